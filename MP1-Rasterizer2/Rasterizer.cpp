@@ -0,0 +1,704 @@
+#include <iostream>
+#include <sstream>
+#include <functional>   
+#include <algorithm>    
+#include <vector>
+#include <float.h>      
+#include <math.h>       
+#include <assert.h>     
+#include "Rasterizer.h"
+#include "../MP7-Raytracer3/Trace.h"
+#include "uselibpng.h"
+using namespace std;
+struct Position2 { int x; int y; };
+struct Color4 { unsigned char r; unsigned char g; unsigned char b; unsigned char a; };
+
+class Vertex {
+public:
+    // Direct member variables with underscore prefix
+    double _x{0}, _y{0}, _z{0}, _w{1.0}; // Position
+    double _r{0}, _g{0}, _b{0}, _a{1.0}; // Color
+    double _s{0}, _t{0};                 // Texture coordinates
+
+    // Accessor methods
+    double x() const { return _x; }
+    double y() const { return _y; }
+    double z() const { return _z; }
+    double w() const { return _w; }
+    double r() const { return _r; }
+    double g() const { return _g; }
+    double b() const { return _b; }
+    double a() const { return _a; }
+    double s() const { return _s; }
+    double t() const { return _t; }
+
+    // Accessor methods using references
+    double& operator[](size_t idx) {
+        switch(idx) {
+            case 0: return _x;
+            case 1: return _y;
+            case 2: return _z;
+            case 3: return _w;
+            case 4: return _r;
+            case 5: return _g;
+            case 6: return _b;
+            case 7: return _a;
+            case 8: return _s;
+            case 9: return _t;
+            default: throw std::out_of_range("Invalid index");
+        }
+    }
+
+    const double& operator[](size_t idx) const {
+        switch(idx) {
+            case 0: return _x;
+            case 1: return _y;
+            case 2: return _z;
+            case 3: return _w;
+            case 4: return _r;
+            case 5: return _g;
+            case 6: return _b;
+            case 7: return _a;
+            case 8: return _s;
+            case 9: return _t;
+            default: throw std::out_of_range("Invalid index");
+        }
+    }
+
+    Vertex operator-(const Vertex &v) const {
+        Vertex ret;
+        ret._x = _x - v._x;
+        ret._y = _y - v._y;
+        ret._z = _z - v._z;
+        ret._w = _w - v._w;
+        ret._r = _r - v._r;
+        ret._g = _g - v._g;
+        ret._b = _b - v._b;
+        ret._a = _a - v._a;
+        ret._s = _s - v._s;
+        ret._t = _t - v._t;
+        return ret;
+    }
+
+    Vertex operator+(const Vertex &v) const {
+        Vertex ret;
+        ret._x = _x + v._x;
+        ret._y = _y + v._y;
+        ret._z = _z + v._z;
+        ret._w = _w + v._w;
+        ret._r = _r + v._r;
+        ret._g = _g + v._g;
+        ret._b = _b + v._b;
+        ret._a = _a + v._a;
+        ret._s = _s + v._s;
+        ret._t = _t + v._t;
+        return ret;
+    }
+
+    Vertex operator/(const double div) const {
+        if (div == 0) return Vertex();
+        Vertex ret;
+        ret._x = _x / div;
+        ret._y = _y / div;
+        ret._z = _z / div;
+        ret._w = _w / div;
+        ret._r = _r / div;
+        ret._g = _g / div;
+        ret._b = _b / div;
+        ret._a = _a / div;
+        ret._s = _s / div;
+        ret._t = _t / div;
+        return ret;
+    }
+
+    Vertex operator*(const double mul) const {
+        Vertex ret;
+        ret._x = _x * mul;
+        ret._y = _y * mul;
+        ret._z = _z * mul;
+        ret._w = _w * mul;
+        ret._r = _r * mul;
+        ret._g = _g * mul;
+        ret._b = _b * mul;
+        ret._a = _a * mul;
+        ret._s = _s * mul;
+        ret._t = _t * mul;
+        return ret;
+    }
+
+    Vertex& operator+=(const Vertex &v) {
+        _x += v._x;
+        _y += v._y;
+        _z += v._z;
+        _w += v._w;
+        _r += v._r;
+        _g += v._g;
+        _b += v._b;
+        _a += v._a;
+        _s += v._s;
+        _t += v._t;
+        return *this;
+    }
+
+    void SetPos(const vector<double> &position) {
+        if (position.size() > 0) _x = position[0];
+        if (position.size() > 1) _y = position[1];
+        if (position.size() > 2) _z = position[2];
+        if (position.size() > 3) _w = position[3];
+    }
+
+    void SetColor(const vector<double> &color) {
+        if (color.size() > 0) _r = color[0];
+        if (color.size() > 1) _g = color[1];
+        if (color.size() > 2) _b = color[2];
+        if (color.size() > 3) _a = color[3];
+    }
+
+    void SetData(const vector<double> &data, int offset) {
+        switch(offset) {
+            case 0: // Position
+                SetPos(data);
+                break;
+            case 4: // Color
+                SetColor(data);
+                break;
+            case 8: // Texture coordinates
+                if (data.size() > 0) _s = data[0];
+                if (data.size() > 1) _t = data[1];
+                break;
+        }
+    }
+
+    Vertex normalize(const int width, const int height, bool enable_hyp) const {
+        Vertex ret;
+        double w_val = this->_w;
+        
+        // Position normalization
+        ret._x = (_x / w_val + 1) * width / 2;
+        ret._y = (_y / w_val + 1) * height / 2;
+        ret._z = _z / w_val;
+        ret._w = 1.0 / w_val;
+        
+        // Color and texture coordinates
+        if (enable_hyp) {
+            ret._r = _r / w_val;
+            ret._g = _g / w_val;
+            ret._b = _b / w_val;
+            ret._a = _a / w_val;
+            ret._s = _s / w_val;
+            ret._t = _t / w_val;
+        } else {
+            ret._r = _r;
+            ret._g = _g;
+            ret._b = _b;
+            ret._a = _a;
+            ret._s = _s;
+            ret._t = _t;
+        }
+        
+        return ret;
+    }
+
+    Vertex undo(bool enable_hyp) const {
+        Vertex ret;
+        double w_val = this->_w;
+        
+        // Position always gets divided
+        ret._x = _x;
+        ret._y = _y;
+        ret._z = _z;
+        ret._w = 1.0 / w_val;
+        
+        // Color and texture coordinates only if enable_hyp is true
+        if (enable_hyp) {
+            ret._r = _r / w_val;
+            ret._g = _g / w_val;
+            ret._b = _b / w_val;
+            ret._a = _a / w_val;
+            ret._s = _s / w_val;
+            ret._t = _t / w_val;
+        } else {
+            ret._r = _r;
+            ret._g = _g;
+            ret._b = _b;
+            ret._a = _a;
+            ret._s = _s;
+            ret._t = _t;
+        }
+        
+        return ret;
+    }
+
+    friend auto operator<<(std::ostream& os, Vertex const& v) -> std::ostream& { 
+        os << "Vertex:\n  pos: " << v._x << ", " << v._y << ", " << v._z << ", " << v._w << '\n';
+        os << "  st: " << v._s << ", " << v._t << '\n';
+        return os;
+    }
+
+private:
+    vector<double> _data;
+};
+
+
+
+
+class Matrix4 {
+public:
+    Matrix4(const vector<double> &vec) {
+        _mat = vec;
+    }
+    vector<double> mul(const Vertex &vertex) const {
+        vector<double> ret(4, 0.0);
+        for (int i = 0; i < 4; i++) {
+            double d = 0;
+            for (int j = 0; j < 4; j++) {
+                d += get(j, i) * vertex[j];
+            }
+            ret[i] = d;
+        }
+        return ret;
+    }
+
+private:
+    double get(int i, int j) const {
+        return _mat[i * 4 + j];
+    }
+    vector<double> _mat;
+};
+
+
+
+
+
+
+class Texture {
+public:
+    Texture(const string &src_file) {
+        _img = load_image(src_file.c_str());
+        if (_img) {
+            wid = _img->width;
+            hei = _img->height;
+        }
+    }
+    
+    ~Texture() {
+        if (_img)
+            free_image(_img);
+    }
+    
+    unsigned GetWidth() const { return wid; }
+    unsigned GetHeight() const { return hei; }
+    
+    void sample(double x, double y,
+            unsigned char &r, unsigned char &g,
+            unsigned char &b, unsigned char &a) const {
+        x = takeDecimal(x), y = takeDecimal(y);
+        double u = x * wid, v = y * hei;
+        int u0 = clamp(static_cast<int>(u + 0.5), wid - 1, 0);
+        int v0 = clamp(static_cast<int>(v + 0.5), hei - 1, 0);
+        // Change this line:
+        pixel_t *pixel = &(_img->rgba[v0 * wid + u0]);
+        r = pixel->r;
+        g = pixel->g;
+        b = pixel->b;
+        a = pixel->a;
+    }
+
+
+    private:
+        image_t *_img = nullptr;
+        unsigned wid = 0, hei = 0;
+
+        double takeDecimal(double num) const {
+            double intpart;
+            num = modf(num, &intpart);
+            return (num < 0) ? num + 1.0 : num;
+        }
+        
+        int clamp(int num, int ub, int lb = 0) const {
+            return max(lb, min(ub, num));
+        }
+    };
+
+// Writes into the caller's pixels, either bytes or linear floats, and keeps the depth buffer
+class Picture {
+public:
+    void setup(unsigned char *bytes, float *floats, const int width, const int height, size_t rowStride) {
+        _bytes = bytes;
+        _floats = floats;
+        _width = width;
+        _height = height;
+        _rowStride = rowStride ? rowStride : 4 * static_cast<size_t>(width);
+        _zbuff.assign(static_cast<size_t>(width) * height, DBL_MAX);
+    }
+
+    void setDepth(bool enable) { _useDepth = enable; }
+    void setsRBG(bool enable) { _usesRGB = enable; }
+
+    bool hasTarget() const { return _bytes || _floats; }
+    int getWidth() const { return _width; }
+    int getHeight() const { return _height; }
+
+    int render(const Vertex &v, const Texture *texture) {
+        int x = v.x(), y = v.y();
+
+        if (x < 0 || x >= _width || y < 0 || y >= _height) {
+            return -1;
+        }
+        int pos_idx = y * _width + x;
+        if (_useDepth && _zbuff[pos_idx] < v.z())
+            return 0;
+
+        double r = v.r(), g = v.g(), b = v.b(), a = v.a();
+        double r_d, g_d, b_d, a_d;
+        
+        // check texture
+        if (texture) {
+            r_d = r, g_d = g, b_d = b, a_d = a;
+            unsigned char rc, gc, bc, ac;
+            texture->sample(v.s(), v.t(), rc, gc, bc, ac);
+            auto convert = (_usesRGB) ? sRGB_2double : linear_2double;
+            r = convert(rc);
+            g = convert(gc);
+            b = convert(bc);
+            a = linear_2double(ac);
+        } else {
+            load(x, y, r_d, g_d, b_d, a_d);
+        }
+
+        // alpha blending
+        if (a < 1) {
+            double alpha = a;
+            a = alpha + (1.0 - alpha) * a_d;
+            r = lerp(r, r_d, alpha / a);
+            g = lerp(g, g_d, alpha / a);
+            b = lerp(b, b_d, alpha / a);
+        }
+
+        store(x, y, r, g, b, a);
+        _zbuff[pos_idx] = v.z();
+        return 0;
+    }
+
+private:
+    int _width = 0, _height = 0;
+    size_t _rowStride = 0;
+    unsigned char *_bytes = nullptr;
+    float *_floats = nullptr;
+    vector<double> _zbuff;
+    bool _useDepth = false, _usesRGB = false;
+
+    void load(int x, int y, double &r, double &g, double &b, double &a) const {
+        size_t offset = y * _rowStride + 4 * static_cast<size_t>(x);
+        if (_floats) {
+            const float *pixel = _floats + offset;
+            r = pixel[0], g = pixel[1], b = pixel[2], a = pixel[3];
+            return;
+        }
+        const unsigned char *pixel = _bytes + offset;
+        auto convert = (_usesRGB) ? sRGB_2double : linear_2double;
+        r = convert(pixel[0]);
+        g = convert(pixel[1]);
+        b = convert(pixel[2]);
+        a = linear_2double(pixel[3]);
+    }
+
+    void store(int x, int y, double r, double g, double b, double a) {
+        size_t offset = y * _rowStride + 4 * static_cast<size_t>(x);
+        if (_floats) {
+            float *pixel = _floats + offset;
+            pixel[0] = r, pixel[1] = g, pixel[2] = b, pixel[3] = a;
+            return;
+        }
+        unsigned char *pixel = _bytes + offset;
+        auto convert = (_usesRGB) ? sRGB_2char : linear_2char;
+        pixel[0] = convert(r);
+        pixel[1] = convert(g);
+        pixel[2] = convert(b);
+        pixel[3] = linear_2char(a);
+    }
+
+    static inline unsigned char linear_2char(double color) {
+        return round(color * 255);
+    }
+    
+    static inline unsigned char sRGB_2char(double color) {
+        if (color <= 0.0031308)
+            color *= 12.92;
+        else
+            color = 1.055 * pow(color, 1.0 / 2.4) - 0.055;
+        return round(color * 255);
+    }
+    
+    static inline double linear_2double(unsigned char color) {
+        return (double)color / 255.0;
+    }
+    
+    static inline double sRGB_2double(unsigned char color) {
+        double c = (double)color / 255.0;
+        if (c <= 0.04045)
+            c /= 12.92;
+        else
+            c = pow((c + 0.055) / 1.055, 2.4);
+        return c;
+    }
+    
+    static inline double lerp(double a, double b, double a_ratio) {
+        return a * a_ratio + b * (1.0 - a_ratio);
+    }
+};
+
+
+
+int DDA(Vertex a, Vertex b, int n, std::function<void(const Vertex &v)> fn) {
+    if (a[n] > b[n]) swap(a, b);
+    else if (a[n] == b[n]) return 0;
+
+    Vertex d = (b - a) / (b[n] - a[n]);
+    Vertex p = a + (d * (ceil(a[n]) - a[n]));;
+
+    while (p[n] < b[n]) {
+        fn(p);
+        p += d;
+    }
+    return 1;
+}
+
+int DDATraverse(const Vertex &p, const Vertex &q, const Vertex &r,
+                std::function<void(const Vertex &v)> fn)
+{
+    Vertex top = p, mid = q, bottom = r;
+    if (top.y() < mid.y()) swap(top, mid);
+    if (top.y() < bottom.y()) {
+        swap(top, bottom);
+        swap(mid, bottom);
+    } else if (mid.y() < bottom.y()) swap(mid, bottom);
+
+    // DDA on edge tm, tb using y axis
+    vector<Vertex> tm_edges, tb_edges, mb_edges;
+    DDA(top, mid, 1, [&tm_edges](const Vertex &v) -> void { tm_edges.push_back(v); });
+    DDA(mid, bottom, 1, [&mb_edges](const Vertex &v) -> void { mb_edges.push_back(v); });
+    DDA(top, bottom, 1, [&tb_edges](const Vertex &v) -> void { tb_edges.push_back(v); });
+
+    std::reverse(tm_edges.begin(), tm_edges.end());
+    std::reverse(mb_edges.begin(), mb_edges.end());
+    std::reverse(tb_edges.begin(), tb_edges.end());
+
+    // Rounding can leave the long edge with fewer rows than the two short ones
+    for (size_t i = 0; i < tm_edges.size() && i < tb_edges.size(); i++) {
+        DDA(tm_edges[i], tb_edges[i], 0, fn);
+    }
+    for (size_t i = 0, j = tm_edges.size(); i < mb_edges.size() && j < tb_edges.size(); i++, j++) {
+        DDA(mb_edges[i], tb_edges[j], 0, fn);
+    }
+    return 0;
+}
+
+
+struct Rasterizer::State {
+    Picture picture;
+    vector<Vertex> vertices;
+    vector<int> elements;
+    unique_ptr<Matrix4> matrix;
+    unique_ptr<Texture> texture;
+    bool enable_hyp = false;
+};
+
+Rasterizer::Rasterizer() : _state(new State()) {}
+
+Rasterizer::~Rasterizer() {}
+
+void Rasterizer::SetTarget(unsigned char *rgba, int width, int height, size_t rowStride) {
+    _state->picture.setup(rgba, nullptr, width, height, rowStride);
+}
+
+void Rasterizer::SetTarget(float *rgba, int width, int height, size_t rowStride) {
+    _state->picture.setup(nullptr, rgba, width, height, rowStride);
+}
+
+static void updateData(const double *values, size_t count, int dimension,
+                       vector<Vertex> &vertices, int offset) {
+    if (vertices.size() < count) vertices.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        vector<double> arr(values + i * dimension, values + (i + 1) * dimension);
+        vertices[i].SetData(arr, offset);
+    }
+}
+
+void Rasterizer::SetPositions(const double *values, size_t count, int dimension) {
+    updateData(values, count, dimension, _state->vertices, 0);
+}
+
+void Rasterizer::SetColors(const double *values, size_t count, int dimension) {
+    updateData(values, count, dimension, _state->vertices, 4);
+}
+
+void Rasterizer::SetTexcoords(const double *values, size_t count) {
+    updateData(values, count, 2, _state->vertices, 8);
+}
+
+void Rasterizer::SetElements(const int *indices, size_t count) {
+    _state->elements.assign(indices, indices + count);
+}
+
+void Rasterizer::SetMatrix(const double *values) {
+    _state->matrix.reset(new Matrix4(vector<double>(values, values + 16)));
+}
+
+void Rasterizer::ClearMatrix() { _state->matrix.reset(); }
+
+bool Rasterizer::SetTexture(const string &filename) {
+    Trace::Scope trace("texture load", "%s", filename.c_str());
+    _state->texture.reset(new Texture(filename));
+    if (_state->texture->GetWidth() == 0) {
+        _state->texture.reset();
+        return false;
+    }
+    return true;
+}
+
+void Rasterizer::ClearTexture() { _state->texture.reset(); }
+
+void Rasterizer::EnableDepth(bool enable) { _state->picture.setDepth(enable); }
+
+void Rasterizer::EnableSRGB(bool enable) { _state->picture.setsRBG(enable); }
+
+void Rasterizer::EnableHyperbolic(bool enable) { _state->enable_hyp = enable; }
+
+bool Rasterizer::DrawTriangle(size_t a, size_t b, size_t c) {
+    const vector<Vertex> &vertices = _state->vertices;
+    Picture &picture = _state->picture;
+    bool enable_hyp = _state->enable_hyp;
+
+    Vertex p = vertices[a], q = vertices[b], r = vertices[c];
+    if (_state->matrix) {
+        p.SetData(_state->matrix->mul(vertices[a]), 0);
+        q.SetData(_state->matrix->mul(vertices[b]), 0);
+        r.SetData(_state->matrix->mul(vertices[c]), 0);
+    }
+    // transform array
+    p = p.normalize(picture.getWidth(), picture.getHeight(), enable_hyp),
+    q = q.normalize(picture.getWidth(), picture.getHeight(), enable_hyp),
+    r = r.normalize(picture.getWidth(), picture.getHeight(), enable_hyp);
+    const Texture *tex = _state->texture.get();
+    DDATraverse(p, q, r, [&picture, enable_hyp, tex](const Vertex &v_n) {
+        Vertex to_render = v_n.undo(enable_hyp);
+        picture.render(to_render, tex);
+    });
+    return true;
+}
+
+// Triangles are taken three at a time from first until count is used up
+static size_t getDrawEnd(int first, int count) {
+    return count > 0 ? static_cast<size_t>(first) + (count - 1) / 3 * 3 + 3 : 0;
+}
+
+bool Rasterizer::DrawArraysTriangles(int first, int count) {
+    if (!_state->picture.hasTarget() || first < 0) return false;
+    if (getDrawEnd(first, count) > _state->vertices.size()) return false;
+    Trace::Scope trace("draw", "%d vertices", count);
+    for (int i = first; i < first + count; i += 3) {
+        DrawTriangle(i, i + 1, i + 2);
+    }
+    return true;
+}
+
+bool Rasterizer::DrawElementsTriangles(int count, int offset) {
+    const vector<int> &elements = _state->elements;
+    if (!_state->picture.hasTarget() || offset < 0) return false;
+    size_t end = getDrawEnd(offset, count);
+    if (end > elements.size()) return false;
+    for (size_t i = offset; i < end; i++) {
+        if (elements[i] < 0 || static_cast<size_t>(elements[i]) >= _state->vertices.size()) return false;
+    }
+    Trace::Scope trace("draw", "%d elements", count);
+    for (int i = offset; i < offset + count; i += 3) {
+        DrawTriangle(elements[i], elements[i + 1], elements[i + 2]);
+    }
+    return true;
+}
+
+// Values after the dimension in a position/color/texcoord command
+static bool parseAttribute(const vector<string> &keyword, vector<double> &values, int &dimension) {
+    if (keyword.size() < 2) return false;
+    dimension = stoi(keyword[1]);
+    for (size_t i = 2; i < keyword.size(); i++) {
+        values.push_back(stod(keyword[i]));
+    }
+    return dimension > 0 && values.size() % dimension == 0;
+}
+
+bool Rasterizer::ExecuteLine(const string &line, const PngHandler &onPng) {
+    vector<string> keyword;
+    istringstream iss(line);
+    string token;
+    while (iss >> token) {
+        keyword.push_back(token);
+    }
+    if (keyword.empty()) return true;
+
+    try {
+        vector<double> values;
+        int dimension;
+        if (keyword[0] == "png") {
+            if (keyword.size() != 4 || !onPng) return false;
+            return onPng(*this, keyword[3], stoi(keyword[1]), stoi(keyword[2]));
+        } else if (keyword[0] == "position") {
+            if (!parseAttribute(keyword, values, dimension)) return false;
+            SetPositions(values.data(), values.size() / dimension, dimension);
+        } else if (keyword[0] == "color") {
+            if (!parseAttribute(keyword, values, dimension)) return false;
+            SetColors(values.data(), values.size() / dimension, dimension);
+        } else if (keyword[0] == "texcoord") {
+            if (!parseAttribute(keyword, values, dimension) || dimension != 2) return false;
+            SetTexcoords(values.data(), values.size() / 2);
+        } else if (keyword[0] == "elements") {
+            vector<int> elements;
+            for (size_t i = 1; i < keyword.size(); i++) {
+                elements.push_back(stoi(keyword[i]));
+            }
+            SetElements(elements.data(), elements.size());
+        } else if (keyword[0] == "uniformMatrix") {
+            if (keyword.size() != 17) return false;
+            for (size_t i = 1; i < keyword.size(); i++) {
+                values.push_back(stod(keyword[i]));
+            }
+            SetMatrix(values.data());
+        } else if (keyword[0] == "drawArraysTriangles") {
+            if (keyword.size() != 3) return false;
+            return DrawArraysTriangles(stoi(keyword[1]), stoi(keyword[2]));
+        } else if (keyword[0] == "drawElementsTriangles") {
+            if (keyword.size() != 3) return false;
+            return DrawElementsTriangles(stoi(keyword[1]), stoi(keyword[2]));
+        } else if (keyword[0] == "texture") {
+            return keyword.size() == 2 && SetTexture(keyword[1]);
+        } else if (keyword[0] == "depth") {
+            EnableDepth();
+        } else if (keyword[0] == "sRGB") {
+            EnableSRGB();
+        } else if (keyword[0] == "hyp") {
+            EnableHyperbolic();
+        } else {
+            return false;
+        }
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool Rasterizer::Execute(istream &commands, const PngHandler &onPng) {
+    // Parsing is the time between the draw spans inside this one
+    Trace::Scope trace("execute");
+    bool succeeded = true;
+    string line;
+    while (getline(commands, line)) {
+        succeeded = ExecuteLine(line, onPng) && succeeded;
+    }
+    return succeeded;
+}
+
+bool Rasterizer::Execute(const string &commands, const PngHandler &onPng) {
+    istringstream stream(commands);
+    return Execute(stream, onPng);
+}
@@ -0,0 +1,68 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+
+// The rasterizer as a library. All state the commands build up (vertex
+// attributes, elements, matrix, texture and the depth/sRGB/hyp switches) lives
+// in the Rasterizer, and pixels go to a caller-owned RGBA buffer, so any number
+// of Rasterizers can draw at once on different threads.
+class Rasterizer {
+public:
+    // Called for a `png <width> <height> <file>` command; it should call
+    // SetTarget with a zeroed buffer of that size and return false on failure
+    typedef std::function<bool(Rasterizer &rasterizer, const std::string &name,
+                               int width, int height)> PngHandler;
+
+    Rasterizer();
+    ~Rasterizer();
+    Rasterizer(const Rasterizer &) = delete;
+    Rasterizer &operator=(const Rasterizer &) = delete;
+
+    // width x height RGBA pixels with rows rowStride values apart (0 for
+    // 4 * width). Bytes hold the same encoding the png command writes; floats
+    // hold linear color. Resets the depth buffer.
+    void SetTarget(unsigned char *rgba, int width, int height, size_t rowStride = 0);
+    void SetTarget(float *rgba, int width, int height, size_t rowStride = 0);
+
+    // count vertices of `dimension` values each, as in the position, color
+    // and texcoord commands; vertices past count keep their other attributes
+    void SetPositions(const double *values, size_t count, int dimension);
+    void SetColors(const double *values, size_t count, int dimension);
+    void SetTexcoords(const double *values, size_t count);
+    void SetElements(const int *indices, size_t count);
+
+    // 16 column-major values applied to positions before the viewport transform
+    void SetMatrix(const double *values);
+    void ClearMatrix();
+
+    // Returns false and clears the texture if the file cannot be loaded
+    bool SetTexture(const std::string &filename);
+    void ClearTexture();
+
+    void EnableDepth(bool enable = true);
+    void EnableSRGB(bool enable = true);
+    void EnableHyperbolic(bool enable = true);
+
+    // Return false without drawing if there is no target or an index is out of range
+    bool DrawArraysTriangles(int first, int count);
+    bool DrawElementsTriangles(int count, int offset);
+
+    // Runs scene-file commands line by line. Malformed or unknown commands
+    // are skipped; returns false if there were any.
+    bool Execute(std::istream &commands, const PngHandler &onPng);
+    bool Execute(const std::string &commands, const PngHandler &onPng);
+
+private:
+    struct State;
+    std::unique_ptr<State> _state;
+
+    bool ExecuteLine(const std::string &line, const PngHandler &onPng);
+    bool DrawTriangle(size_t a, size_t b, size_t c);
+};
+
+#endif // RASTERIZER_H
@@ -4,6 +4,7 @@
 #include <cmath>
 #include <cassert>
 #include <algorithm>
+#include <cstdlib>
 #include <cstring>
 
 #include "uselibpng.h"  // Include the custom PNG library header
@@ -921,32 +922,8 @@ static float expose(float l, float v) {
 
 
 
-void printDebugInfo(const Ray& ray, const Hit& hit, const Vector3f& dir_to_light, 
-                    const Vector3f& light_color, const Vector3f& final_color) {
-    // Ray information
-    std::cout << "Ray origin: " << ray.getOrigin() << std::endl;
-    std::cout << "Ray direction: " << ray.getDirection() << std::endl;
-    
-    // Intersection information
-    std::cout << "Intersection depth: " << hit.t << std::endl;
-    Vector3f intersectionPoint = ray.pointAtParameter(hit.t);
-    std::cout << "Intersection point: " << intersectionPoint << std::endl;
-    std::cout << "Surface normal: " << hit.normal << std::endl;
-    
-    // Light information
-    std::cout << "Sun direction: " << dir_to_light << std::endl;
-    
-    // Shading calculations
-    // Shading calculations - show raw dot product before clamping
-    float lambert = Vector3f::dot(hit.normal, dir_to_light);
-    std::cout << "Lambert dot product: " << lambert << std::endl;
-    
-    
-    // Color calculations
-    // final_color = max(0.0f, min(1.0f, final_color));
-    std::cout << "Linear color: " << final_color << std::endl;
-
-    // Proper sRGB conversion
+// Prints a linear color and the sRGB bytes it is written as
+void printDebugColor(const char* label, const Vector3f& color) {
     auto linear_2_sRGB = [](float linear) {
         float sRGB;
         if (linear <= 0.0031308f) {
@@ -954,88 +931,182 @@ void printDebugInfo(const Ray& ray, const Hit& hit, const Vector3f& dir_to_light
         } else {
             sRGB = 1.055f * pow(linear, 1.0f/2.4f) - 0.055f;
         }
-        // cout << sRGB << endl;
         sRGB = max(0.0f, min(1.0f, sRGB));
-        return sRGB * 255.0f;
+        return round(sRGB * 255.0f);
     };
-    
-    // sRGB conversion (assuming linear to sRGB conversion)
-    int r = linear_2_sRGB(final_color.x);
-    int g = linear_2_sRGB(final_color.y);
-    int b = linear_2_sRGB(final_color.z);
-    std::cout << "sRGB color: (" << r << ", " << g << ", " << b << ")" << std::endl;
+
+    int r = linear_2_sRGB(color.x);
+    int g = linear_2_sRGB(color.y);
+    int b = linear_2_sRGB(color.z);
+    std::cout << label << color << " sRGB (" << r << ", " << g << ", " << b << ")" << std::endl;
+}
+
+
+
+// Traces pixel (i, j) and returns its color; with debug set it also prints
+// the ray tree: the primary hit, then each light with its shadow ray and
+// shading term
+Color4 tracePixel(ConfigParser::Config& config, Camera& camera, int i, int j, bool debug) {
+    Scene& scene = config.scene;
+    float side = max(config.w, config.h);
+    float sx = ((float)i * 2 - config.w) / side;
+    float sy = ((float)config.h - 2 * j) / side;
+
+    Ray ray = camera.generateRay(sx, sy);
+    Hit hit;
+
+    if (debug) {
+        cout << "pixel: " << i << " " << j << " (sx " << sx << ", sy " << sy << ")" << endl;
+        cout << "Ray origin: " << ray.getOrigin() << endl;
+        cout << "Ray direction: " << ray.getDirection() << endl;
+    }
+
+    if (!scene.intersect(ray, hit)) {
+        if (debug) cout << "No hit: transparent background" << endl;
+        return Color4(0, 0, 0, 0);
+    }
+
+    Vector3f p_hit = ray.pointAtParameter(hit.t);
+    if (debug) {
+        cout << "Hit depth: " << hit.t << endl;
+        cout << "Hit point: " << p_hit << endl;
+        cout << "Surface normal: " << hit.normal << endl;
+        cout << "Material color: " << *hit.material << endl;
+    }
+
+    vector<Light*>& lights = scene.getLights();
+    Vector3f rgb;
+    for (size_t l = 0; l < lights.size(); l++) {
+        Vector3f light_color;
+        Vector3f dir_to_light;
+        float d;
+        lights[l]->getIllumination(p_hit,
+            dir_to_light, light_color, d);
+        Ray secondary(p_hit, dir_to_light);
+        float epsilon = 0.0001f; // magic number
+        Hit second_hit;
+        bool shadowed = scene.intersect(secondary, second_hit, epsilon) && (second_hit.t < d);
+        if (debug) {
+            cout << "  Light " << l << ": direction " << dir_to_light << ", distance " << d
+                 << ", color " << light_color << endl;
+            if (shadowed)
+                cout << "    Shadow ray blocked at " << second_hit.t << " by " << *second_hit.material << endl;
+            else
+                cout << "    Shadow ray unblocked" << endl;
+        }
+        if (shadowed) {
+            light_color = Vector3f(0,0,0);
+        }
+        Vector3f term = hit.material->Shade(ray, hit, dir_to_light, light_color);
+        if (debug) {
+            // Shade flips the normal toward the viewer before the dot product
+            Vector3f n = hit.normal;
+            if (Vector3f::dot(n, ray.getDirection()) > 0) n.negate();
+            cout << "    Lambert dot product: " << Vector3f::dot(n, dir_to_light) << endl;
+            cout << "    Shading term: " << term << endl;
+        }
+        rgb += term;
+    }
+
+    if (debug) printDebugColor("Linear color: ", rgb);
+    // do exposure
+    if (config.do_exposure) {
+        rgb[0] = expose(rgb[0], config.exposure);
+        rgb[1] = expose(rgb[1], config.exposure);
+        rgb[2] = expose(rgb[2], config.exposure);
+        if (debug) printDebugColor("Exposed color: ", rgb);
+    }
+
+    return Vector4f(rgb, 1.0f);
 }
 
 
 
+// Reads consecutive integer arguments after a flag
+static bool readIntArgs(int argc, char* argv[], int& pos, int count, int* values) {
+    if (pos + count >= argc) return false;
+    for (int k = 0; k < count; k++) {
+        char* end;
+        long value = strtol(argv[pos + 1 + k], &end, 10);
+        if (*end != '\0' || end == argv[pos + 1 + k]) return false;
+        values[k] = (int)value;
+    }
+    pos += count;
+    return true;
+}
 
 
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <config_file>" << endl;
+    char* config_file = nullptr;
+    bool use_region = false, crop = false, debug_pixel = false;
+    int region[4];   // x0 y0 x1 y1, x1 and y1 exclusive
+    int debug_xy[2];
+    bool valid = true;
+
+    for (int a = 1; a < argc && valid; a++) {
+        if (strcmp(argv[a], "--region") == 0) {
+            valid = readIntArgs(argc, argv, a, 4, region);
+            use_region = true;
+        } else if (strcmp(argv[a], "--crop") == 0) {
+            crop = true;
+        } else if (strcmp(argv[a], "--debug-pixel") == 0) {
+            valid = readIntArgs(argc, argv, a, 2, debug_xy);
+            debug_pixel = true;
+        } else if (!config_file) {
+            config_file = argv[a];
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid || !config_file || (crop && !use_region)) {
+        cerr << "Usage: " << argv[0] << " [--region x0 y0 x1 y1 [--crop]] [--debug-pixel x y] <config_file>" << endl;
         return -1;
     }
 
     ConfigParser::Config config;
     ConfigParser configparser;
-    configparser.readConfigFromFile(argv[1], config);
-
-    Picture image(config.w, config.h);
+    configparser.readConfigFromFile(config_file, config);
     Camera camera = config.getCamera();
-    camera.debugCameraVectors();  // Call debug function on camera instance
-    Scene& scene = config.scene;
 
-    for (int i = 0; i < config.w; i++) {
-        for (int j = 0; j < config.h; j++) {
-            float side = max(config.w, config.h);
-            float sx = ((float)i * 2 - config.w) / side;
-            float sy = ((float)config.h - 2 * j) / side;
-
-            Ray ray = camera.generateRay(sx, sy);
-            Hit hit;
-
-            Color4 pixel_color(0, 0, 0, 0);
-            if (scene.intersect(ray, hit)) {
-
-                // 
-                vector<Light*>& lights = scene.getLights();
-                Vector3f rgb;
-                for (size_t l = 0; l < lights.size(); l++) {
-                    Vector3f light_color;
-                    Vector3f dir_to_light;
-                    float d;
-                    Vector3f p_hit = ray.pointAtParameter(hit.t);
-                    lights[l]->getIllumination(p_hit,
-                        dir_to_light, light_color, d);
-                    Ray secondary(p_hit, dir_to_light);
-                    float epsilon = 0.0001f; // magic number
-                    Hit second_hit;
-                    if (scene.intersect(secondary, second_hit, epsilon) && (second_hit.t < d)) {
-                        light_color = Vector3f(0,0,0);
-                    }
-                    // rgb += hit.material->Shade(ray, hit, dir_to_light, light_color);
-                    rgb += hit.material->Shade(ray, hit, dir_to_light, light_color);
-                    if (i == 82 && j == 70){
-                        cout << "pixel:" << i <<" "<< j<<endl;
-                        printDebugInfo(ray, hit, dir_to_light, light_color, rgb);
-                    }
-                }
-                // do exposure
-                if (config.do_exposure) {
-                    rgb[0] = expose(rgb[0], config.exposure);
-                    rgb[1] = expose(rgb[1], config.exposure);
-                    rgb[2] = expose(rgb[2], config.exposure);
-                }
+    // Only trace the one pixel and print how its color came about
+    if (debug_pixel) {
+        if (debug_xy[0] < 0 || debug_xy[0] >= config.w || debug_xy[1] < 0 || debug_xy[1] >= config.h) {
+            cerr << "Debug pixel " << debug_xy[0] << " " << debug_xy[1] << " is outside the "
+                 << config.w << "x" << config.h << " image" << endl;
+            return -1;
+        }
+        camera.debugCameraVectors();
+        tracePixel(config, camera, debug_xy[0], debug_xy[1], true);
+        return 0;
+    }
 
-                pixel_color = Vector4f(rgb, 1.0f);
-            }
+    int x0 = 0, y0 = 0, x1 = config.w, y1 = config.h;
+    if (use_region) {
+        x0 = max(region[0], 0);
+        y0 = max(region[1], 0);
+        x1 = min(region[2], config.w);
+        y1 = min(region[3], config.h);
+        if (x0 >= x1 || y0 >= y1) {
+            cerr << "Region " << region[0] << " " << region[1] << " " << region[2] << " " << region[3]
+                 << " does not overlap the " << config.w << "x" << config.h << " image" << endl;
+            return -1;
+        }
+    }
 
-            image.setPixel(i, j, pixel_color);
+    // Outside the region a full-size image stays transparent; a cropped one
+    // holds just the region
+    int offset_x = crop ? x0 : 0;
+    int offset_y = crop ? y0 : 0;
+    Picture image(crop ? x1 - x0 : config.w, crop ? y1 - y0 : config.h);
+
+    for (int i = x0; i < x1; i++) {
+        for (int j = y0; j < y1; j++) {
+            image.setPixel(i - offset_x, j - offset_y, tracePixel(config, camera, i, j, false));
         }
     }
     
 
     image.exportPNG(config.name.c_str());
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,227 @@
+#include "Bvh.h"
+#include <algorithm>
+#include <limits>
+
+BoundingBox::BoundingBox()
+    : min(std::numeric_limits<float>::infinity(),
+          std::numeric_limits<float>::infinity(),
+          std::numeric_limits<float>::infinity()),
+      max(-std::numeric_limits<float>::infinity(),
+          -std::numeric_limits<float>::infinity(),
+          -std::numeric_limits<float>::infinity()) {}
+
+BoundingBox::BoundingBox(const Vector3& minCorner, const Vector3& maxCorner)
+    : min(minCorner), max(maxCorner) {}
+
+void BoundingBox::expand(const Vector3& point) {
+    min = Vector3(std::min(min.x, point.x), std::min(min.y, point.y), std::min(min.z, point.z));
+    max = Vector3(std::max(max.x, point.x), std::max(max.y, point.y), std::max(max.z, point.z));
+}
+
+void BoundingBox::expand(const BoundingBox& other) {
+    if (other.isEmpty()) return;
+    expand(other.min);
+    expand(other.max);
+}
+
+float BoundingBox::getSurfaceArea() const {
+    if (isEmpty()) return 0.0f;
+    Vector3 extent = max.minus(min);
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+bool Frustum::overlaps(const BoundingBox& box) const {
+    if (empty || box.isEmpty()) return false;
+    for (int i = 0; i < planeCount; ++i) {
+        // The corner farthest along the normal decides
+        const Vector3& n = normals[i];
+        Vector3 corner(n.x >= 0 ? box.max.x : box.min.x,
+                       n.y >= 0 ? box.max.y : box.min.y,
+                       n.z >= 0 ? box.max.z : box.min.z);
+        if (Vector3::dotProduct(n, corner.minus(apex)) < 0) return false;
+    }
+    return true;
+}
+
+bool Frustum::mayCrossPlane(const Vector3& normal, float d) const {
+    if (empty) return false;
+    if (!hasEdges) return true;
+    // Rays from an apex on one side reach the plane if some edge heads toward it
+    float side = Vector3::dotProduct(normal, apex) + d;
+    for (const Vector3& edge : edges) {
+        float heading = Vector3::dotProduct(normal, edge);
+        if (side == 0 || (side > 0 && heading < 0) || (side < 0 && heading > 0)) return true;
+    }
+    return false;
+}
+
+void Bvh::cull(const Frustum& frustum, std::vector<uint32_t>& nodes) const {
+    nodes.clear();
+    if (nodes_.empty() || !frustum.overlaps(nodes_[0].bounds)) return;
+    nodes.push_back(0);
+
+    // Open nodes a level at a time: one whose children are both in view only
+    // while there is room for both, the others always
+    bool opened = true;
+    while (opened) {
+        opened = false;
+        for (size_t i = 0; i < nodes.size();) {
+            const Node& node = nodes_[nodes[i]];
+            if (node.primitiveCount > 0) {
+                ++i;
+                continue;
+            }
+            uint32_t left = nodes[i] + 1;
+            uint32_t right = node.firstIndex;
+            bool seesLeft = frustum.overlaps(nodes_[left].bounds);
+            bool seesRight = frustum.overlaps(nodes_[right].bounds);
+            if (seesLeft && seesRight) {
+                if (nodes.size() < MAX_START_NODES) {
+                    nodes[i] = left;
+                    nodes.push_back(right);
+                    opened = true;
+                }
+                ++i;
+            } else if (seesLeft || seesRight) {
+                nodes[i++] = seesLeft ? left : right;
+                opened = true;
+            } else {
+                nodes.erase(nodes.begin() + i);
+            }
+        }
+    }
+}
+
+namespace {
+    constexpr int BIN_COUNT = 12;
+
+    float getAxis(const Vector3& v, int axis) {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    struct Bin {
+        BoundingBox bounds;
+        uint32_t count = 0;
+    };
+}
+
+void Bvh::build(const std::vector<BoundingBox>& primitiveBounds) {
+    nodes_.clear();
+    primitiveIndices_.clear();
+    replicas_.clear();
+    if (primitiveBounds.empty()) return;
+    replicas_.resize(Numa::getNodeCount());
+
+    std::vector<Vector3> centers;
+    centers.reserve(primitiveBounds.size());
+    primitiveIndices_.resize(primitiveBounds.size());
+    for (uint32_t i = 0; i < primitiveBounds.size(); ++i) {
+        centers.push_back(primitiveBounds[i].getCenter());
+        primitiveIndices_[i] = i;
+    }
+
+    nodes_.reserve(2 * primitiveBounds.size() / MAX_LEAF_SIZE + 1);
+    buildRecursive(primitiveBounds, centers, 0, static_cast<uint32_t>(primitiveBounds.size()), 0);
+    nodes_.shrink_to_fit();
+}
+
+void Bvh::replicate() {
+    unsigned numaNode = Numa::getCurrentNode();
+    if (numaNode >= replicas_.size() || !replicas_[numaNode].nodes.empty()) return;
+    Replica& replica = replicas_[numaNode];
+    replica.nodes.assign(nodes_.begin(), nodes_.end());
+    replica.primitiveIndices.assign(primitiveIndices_.begin(), primitiveIndices_.end());
+}
+
+void Bvh::dropReplicas() {
+    for (Replica& replica : replicas_) {
+        Numa::Array<Node>().swap(replica.nodes);
+        Numa::Array<uint32_t>().swap(replica.primitiveIndices);
+    }
+}
+
+uint32_t Bvh::buildRecursive(const std::vector<BoundingBox>& primitiveBounds,
+                             const std::vector<Vector3>& centers,
+                             uint32_t begin, uint32_t end, int depth) {
+    uint32_t nodeIndex = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(Node());
+
+    BoundingBox bounds;
+    BoundingBox centerBounds;
+    for (uint32_t i = begin; i < end; ++i) {
+        bounds.expand(primitiveBounds[primitiveIndices_[i]]);
+        centerBounds.expand(centers[primitiveIndices_[i]]);
+    }
+    nodes_[nodeIndex].bounds = bounds;
+
+    uint32_t count = end - begin;
+    auto makeLeaf = [&]() {
+        nodes_[nodeIndex].firstIndex = begin;
+        nodes_[nodeIndex].primitiveCount = count;
+        return nodeIndex;
+    };
+    if (count <= MAX_LEAF_SIZE || depth >= MAX_DEPTH) {
+        return makeLeaf();
+    }
+
+    // Pick the split plane with the lowest surface-area cost over a few bins per axis
+    float bestCost = std::numeric_limits<float>::infinity();
+    int bestAxis = -1;
+    int bestSplit = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo = getAxis(centerBounds.min, axis);
+        float hi = getAxis(centerBounds.max, axis);
+        if (hi - lo < 1e-12f) continue;
+
+        Bin bins[BIN_COUNT];
+        float scale = BIN_COUNT / (hi - lo);
+        for (uint32_t i = begin; i < end; ++i) {
+            uint32_t primitive = primitiveIndices_[i];
+            int bin = std::min(BIN_COUNT - 1, static_cast<int>((getAxis(centers[primitive], axis) - lo) * scale));
+            bins[bin].count++;
+            bins[bin].bounds.expand(primitiveBounds[primitive]);
+        }
+
+        float leftArea[BIN_COUNT - 1];
+        uint32_t leftCount[BIN_COUNT - 1];
+        BoundingBox running;
+        uint32_t runningCount = 0;
+        for (int i = 0; i < BIN_COUNT - 1; ++i) {
+            running.expand(bins[i].bounds);
+            runningCount += bins[i].count;
+            leftArea[i] = running.getSurfaceArea();
+            leftCount[i] = runningCount;
+        }
+        running = BoundingBox();
+        runningCount = 0;
+        for (int i = BIN_COUNT - 1; i > 0; --i) {
+            running.expand(bins[i].bounds);
+            runningCount += bins[i].count;
+            float cost = leftArea[i - 1] * leftCount[i - 1] + running.getSurfaceArea() * runningCount;
+            if (leftCount[i - 1] > 0 && runningCount > 0 && cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    if (bestAxis < 0 || bestCost >= bounds.getSurfaceArea() * count) {
+        return makeLeaf();
+    }
+
+    float lo = getAxis(centerBounds.min, bestAxis);
+    float scale = BIN_COUNT / (getAxis(centerBounds.max, bestAxis) - lo);
+    auto middle = std::partition(primitiveIndices_.begin() + begin, primitiveIndices_.begin() + end,
+        [&](uint32_t primitive) {
+            int bin = std::min(BIN_COUNT - 1, static_cast<int>((getAxis(centers[primitive], bestAxis) - lo) * scale));
+            return bin < bestSplit;
+        });
+    uint32_t mid = static_cast<uint32_t>(middle - primitiveIndices_.begin());
+
+    nodes_[nodeIndex].primitiveCount = 0;
+    buildRecursive(primitiveBounds, centers, begin, mid, depth + 1);
+    uint32_t right = buildRecursive(primitiveBounds, centers, mid, end, depth + 1);
+    nodes_[nodeIndex].firstIndex = right;
+    return nodeIndex;
+}
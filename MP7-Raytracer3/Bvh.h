@@ -0,0 +1,231 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "Math.h"
+#include "Numa.h"
+#include "Stats.h"
+
+struct BoundingBox {
+    Vector3 min;
+    Vector3 max;
+
+    // An empty box; expanding it by any point makes it valid
+    BoundingBox();
+    BoundingBox(const Vector3& minCorner, const Vector3& maxCorner);
+
+    void expand(const Vector3& point);
+    void expand(const BoundingBox& other);
+    bool isEmpty() const { return min.x > max.x; }
+    Vector3 getCenter() const { return min.plus(max).times(0.5f); }
+    float getSurfaceArea() const;
+
+    // Slab test against [tMin, tMax]; tEntry receives the distance where the ray enters.
+    // Running bounds stay the first argument of min/max so a NaN slab (ray origin on
+    // the box plane with a zero direction component) is ignored instead of propagated.
+    bool intersect(const Vector3& origin, const Vector3& inverseDirection,
+                   float tMin, float tMax, float& tEntry) const {
+        float tNear = tMin;
+        float tFar = tMax;
+        float t1 = (min.x - origin.x) * inverseDirection.x;
+        float t2 = (max.x - origin.x) * inverseDirection.x;
+        tNear = std::max(tNear, std::min(t1, t2));
+        tFar = std::min(tFar, std::max(t1, t2));
+        t1 = (min.y - origin.y) * inverseDirection.y;
+        t2 = (max.y - origin.y) * inverseDirection.y;
+        tNear = std::max(tNear, std::min(t1, t2));
+        tFar = std::min(tFar, std::max(t1, t2));
+        t1 = (min.z - origin.z) * inverseDirection.z;
+        t2 = (max.z - origin.z) * inverseDirection.z;
+        tNear = std::max(tNear, std::min(t1, t2));
+        tFar = std::min(tFar, std::max(t1, t2));
+        tEntry = tNear;
+        return tNear <= tFar;
+    }
+};
+
+// Half-spaces bounded by planes through a common apex, enclosing every ray
+// a camera shoots through one screen tile
+struct Frustum {
+    static constexpr int MAX_PLANES = 5;
+
+    Vector3 apex;
+    Vector3 normals[MAX_PLANES];  // Pointing inward
+    int planeCount = 0;
+    // The rays along the frustum's edges when it is a four-sided pyramid, in order
+    // around it; without them unbounded shapes are always taken to be in view
+    Vector3 edges[4];
+    bool hasEdges = false;
+    bool empty = false;  // Holds no rays at all
+
+    // Conservative: a box outside the frustum may still be reported
+    bool overlaps(const BoundingBox& box) const;
+    // Whether some ray in the frustum meets the plane dot(normal, p) + d = 0
+    bool mayCrossPlane(const Vector3& normal, float d) const;
+};
+
+// Bounding volume hierarchy over an arbitrary set of boxed primitives, built
+// with binned SAH and stored as a flat depth-first node array. Threads pinned
+// to a NUMA node traverse that node's replica, if one was made.
+class Bvh {
+public:
+    struct Node {
+        BoundingBox bounds;
+        uint32_t firstIndex;      // Leaf: first entry in primitive indices; interior: right child
+        uint32_t primitiveCount;  // Zero for interior nodes, whose left child is the next node
+    };
+
+    static constexpr uint32_t MAX_LEAF_SIZE = 4;
+    static constexpr int MAX_DEPTH = 48;  // Keeps the fixed traversal stack from overflowing
+    static constexpr uint32_t MAX_START_NODES = 8;
+
+    void build(const std::vector<BoundingBox>& primitiveBounds);
+
+    bool isEmpty() const { return nodes_.empty(); }
+    BoundingBox getBounds() const { return nodes_.empty() ? BoundingBox() : nodes_[0].bounds; }
+    const Numa::Array<Node>& getNodes() const { return nodes_; }
+    const Numa::Array<uint32_t>& getPrimitiveIndices() const { return primitiveIndices_; }
+
+    // Copies the nodes and primitive indices for the NUMA node the calling
+    // thread is pinned to, so its pages land there; nothing if it has one
+    // already. Threads of different nodes may replicate at once. build drops
+    // every replica, as does dropReplicas.
+    void replicate();
+    void dropReplicas();
+
+    // Replaces nodes with the roots of the subtrees the frustum may reach, at
+    // most MAX_START_NODES of them; empty if it reaches none
+    void cull(const Frustum& frustum, std::vector<uint32_t>& nodes) const;
+
+    // Calls visit(primitiveIndex, tMax) for primitives whose leaves the ray reaches
+    // before tMax. The visitor may shrink tMax on a hit, and returns true to stop.
+    template <typename Visitor>
+    void traverse(const Vector3& origin, const Vector3& direction,
+                  float tMin, float& tMax, Visitor&& visit) const {
+        const uint32_t root = 0;
+        traverseFrom(&root, 1, origin, direction, tMin, tMax, visit);
+    }
+
+    // Same walk starting from nodes found by cull instead of the root
+    template <typename Visitor>
+    void traverseFrom(const uint32_t* startNodes, uint32_t startCount, const Vector3& origin,
+                      const Vector3& direction, float tMin, float& tMax, Visitor&& visit) const {
+        traverseLeavesFrom(startNodes, startCount, origin, direction, tMin, tMax,
+            [&](const uint32_t* primitives, uint32_t count, float& leafMax) {
+                for (uint32_t i = 0; i < count; ++i) {
+                    if (visit(primitives[i], leafMax)) return true;
+                }
+                return false;
+            });
+    }
+
+    // Same walk, handing each reached leaf over whole as visit(primitives, count,
+    // tMax) so the visitor can test its primitives together
+    template <typename Visitor>
+    void traverseLeaves(const Vector3& origin, const Vector3& direction,
+                        float tMin, float& tMax, Visitor&& visit) const {
+        const uint32_t root = 0;
+        traverseLeavesFrom(&root, 1, origin, direction, tMin, tMax, visit);
+    }
+
+    template <typename Visitor>
+    void traverseLeavesFrom(const uint32_t* startNodes, uint32_t startCount, const Vector3& origin,
+                            const Vector3& direction, float tMin, float& tMax, Visitor&& visit) const {
+        if (nodes_.empty()) return;
+        unsigned numaNode = Numa::getCurrentNode();
+        if (numaNode < replicas_.size() && !replicas_[numaNode].nodes.empty()) {
+            const Replica& replica = replicas_[numaNode];
+            traverseLeavesIn(replica.nodes.data(), replica.primitiveIndices.data(), startNodes, startCount,
+                             origin, direction, tMin, tMax, visit);
+            return;
+        }
+        traverseLeavesIn(nodes_.data(), primitiveIndices_.data(), startNodes, startCount, origin, direction,
+                         tMin, tMax, visit);
+    }
+
+    // The same walk over nodes and primitive indices stored elsewhere in the
+    // layout build produces, e.g. a mapped file; nodes must not be empty
+    template <typename Visitor>
+    static void traverseLeavesIn(const Node* nodes, const uint32_t* primitiveIndices, const uint32_t* startNodes,
+                                 uint32_t startCount, const Vector3& origin, const Vector3& direction,
+                                 float tMin, float& tMax, Visitor&& visit) {
+        Vector3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        uint32_t stack[MAX_DEPTH + MAX_START_NODES + 1];
+        float stackEntry[MAX_DEPTH + MAX_START_NODES + 1];
+        int stackSize = 0;
+        uint32_t visited = 0;
+        float tEntry;
+
+        // Start nodes go on the stack farthest first, like children below
+        for (uint32_t i = 0; i < startCount; ++i) {
+            if (!nodes[startNodes[i]].bounds.intersect(origin, inverseDirection, tMin, tMax, tEntry)) continue;
+            int position = stackSize++;
+            for (; position > 0 && stackEntry[position - 1] < tEntry; --position) {
+                stack[position] = stack[position - 1];
+                stackEntry[position] = stackEntry[position - 1];
+            }
+            stack[position] = startNodes[i];
+            stackEntry[position] = tEntry;
+        }
+
+        while (stackSize > 0) {
+            --stackSize;
+            // A hit found since this node was pushed may already be closer
+            if (stackEntry[stackSize] > tMax) continue;
+            const Node& node = nodes[stack[stackSize]];
+            ++visited;
+
+            if (node.primitiveCount > 0) {
+                if (visit(&primitiveIndices[node.firstIndex], node.primitiveCount, tMax)) {
+                    RT_STAT_ADD(nodeVisits, visited);
+                    return;
+                }
+                continue;
+            }
+
+            // Push the farther child first so the nearer one is processed next
+            uint32_t left = static_cast<uint32_t>(&node - nodes) + 1;
+            uint32_t right = node.firstIndex;
+            float tLeft, tRight;
+            bool hitLeft = nodes[left].bounds.intersect(origin, inverseDirection, tMin, tMax, tLeft);
+            bool hitRight = nodes[right].bounds.intersect(origin, inverseDirection, tMin, tMax, tRight);
+            if (hitLeft && hitRight) {
+                if (tLeft > tRight) {
+                    std::swap(left, right);
+                    std::swap(tLeft, tRight);
+                }
+                stack[stackSize] = right;
+                stackEntry[stackSize++] = tRight;
+                stack[stackSize] = left;
+                stackEntry[stackSize++] = tLeft;
+            } else if (hitLeft) {
+                stack[stackSize] = left;
+                stackEntry[stackSize++] = tLeft;
+            } else if (hitRight) {
+                stack[stackSize] = right;
+                stackEntry[stackSize++] = tRight;
+            }
+        }
+        (void)visited;
+        RT_STAT_ADD(nodeVisits, visited);
+    }
+
+private:
+    struct Replica {
+        Numa::Array<Node> nodes;
+        Numa::Array<uint32_t> primitiveIndices;
+    };
+
+    Numa::Array<Node> nodes_;
+    Numa::Array<uint32_t> primitiveIndices_;
+    std::vector<Replica> replicas_;  // By NUMA node, sized by build
+
+    uint32_t buildRecursive(const std::vector<BoundingBox>& primitiveBounds,
+                            const std::vector<Vector3>& centers,
+                            uint32_t begin, uint32_t end, int depth);
+};
+
+#endif // BVH_H
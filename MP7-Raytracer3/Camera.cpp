@@ -0,0 +1,132 @@
+#include "Camera.h"
+#include <algorithm>
+#include <cmath>
+
+Camera::Camera(const Vector3& position, const Vector3& lookDirection, const Vector3& upDirection,
+               CameraType type, int width, int height)
+    : position_(position), width_(width), height_(height), type_(type)
+{
+    // Don't normalize forward vector to support zoom through vector length
+    forward_ = lookDirection;
+
+    // Create orthonormal basis
+    right_ = Vector3::crossProduct(forward_, upDirection).getNormalized();
+    up_ = Vector3::crossProduct(right_, forward_).getNormalized();
+
+    // Angle subtended by one pixel; screen coordinates span 2 units on the longer side
+    pixelSpread_ = 2.0f / std::max(width_, height_) / std::max(forward_.getLength(), Math::EPSILON);
+}
+
+Ray Camera::generateRay(float screenX, float screenY) const {
+    switch (type_) {
+        case CameraType::FISHEYE:
+            return generateFisheyeRay(screenX, screenY);
+        case CameraType::PANORAMA:
+            return generatePanoramaRay(screenX, screenY);
+        default:
+            return generateClassicRay(screenX, screenY);
+    }
+}
+
+bool Camera::getTileFrustum(float left, float right, float bottom, float top, Frustum& frustum) const {
+    if (type_ == CameraType::PANORAMA) {
+        return false;
+    }
+    // Leaves room for rounding in generateRay
+    const float margin = 1e-4f;
+    left -= margin;
+    right += margin;
+    bottom -= margin;
+    top += margin;
+
+    // Pixel (x, y) looks along x * right + y * up + z * forward, where z is 1
+    // for the classic camera and sqrt(1 - x^2 - y^2) for the fisheye
+    bool fisheye = type_ == CameraType::FISHEYE;
+    auto getZ = [&](float x, float otherSquared) {
+        return fisheye ? std::sqrt(1.0f - x * x - otherSquared) : 1.0f;
+    };
+    auto minSquare = [](float low, float high) {
+        return low > 0.0f ? low * low : (high < 0.0f ? high * high : 0.0f);
+    };
+    float minX2 = minSquare(left, right), maxX2 = std::max(left * left, right * right);
+    float minY2 = minSquare(bottom, top), maxY2 = std::max(bottom * bottom, top * top);
+
+    frustum = Frustum();
+    frustum.apex = position_;
+    if (fisheye && minX2 + minY2 > 1.0f) {
+        frustum.empty = true;
+        return true;
+    }
+
+    // Each side keeps x / z (or y / z) beyond its value at the tile's extreme
+    // corner. Sides where that corner is off the fisheye circle have no bound.
+    float lengthSquared = Vector3::dotProduct(forward_, forward_);
+    auto addSide = [&](const Vector3& axis, float slope) {
+        if (std::isfinite(slope)) {
+            frustum.normals[frustum.planeCount++] = axis.minus(forward_.times(slope / lengthSquared));
+        }
+    };
+    addSide(right_, left / getZ(left, left >= 0.0f ? minY2 : maxY2));
+    addSide(right_.times(-1.0f), -right / getZ(right, right > 0.0f ? maxY2 : minY2));
+    addSide(up_, bottom / getZ(bottom, bottom >= 0.0f ? minX2 : maxX2));
+    addSide(up_.times(-1.0f), -top / getZ(top, top > 0.0f ? maxX2 : minX2));
+    frustum.normals[frustum.planeCount++] = forward_;
+
+    if (!fisheye) {
+        frustum.hasEdges = true;
+        frustum.edges[0] = forward_.plus(right_.times(left)).plus(up_.times(bottom));
+        frustum.edges[1] = forward_.plus(right_.times(right)).plus(up_.times(bottom));
+        frustum.edges[2] = forward_.plus(right_.times(right)).plus(up_.times(top));
+        frustum.edges[3] = forward_.plus(right_.times(left)).plus(up_.times(top));
+    }
+    return true;
+}
+
+Ray Camera::generateClassicRay(float screenX, float screenY) const {
+    float focalLength = 1.0f;  // Or compute based on desired field of view
+    Vector3 direction = forward_.times(focalLength).plus(
+        right_.times(screenX).plus(
+            up_.times(screenY)
+        )
+    );
+
+    return Ray(position_, direction.getNormalized(), 0, pixelSpread_);
+}
+
+Ray Camera::generateFisheyeRay(float screenX, float screenY) const {
+    float r2 = screenX * screenX + screenY * screenY;
+
+    if (r2 > 1.0f) {
+        return Ray(position_, Vector3::ZERO);
+    }
+
+    // Use 1−sx²−sy² * forward as specified
+    float scale = std::sqrt(1.0f - r2);
+    Vector3 direction = forward_.times(scale).plus(
+        right_.times(screenX).plus(
+            up_.times(screenY)
+        )
+    );
+
+    return Ray(position_, direction.getNormalized(), 0, pixelSpread_);
+}
+
+Ray Camera::generatePanoramaRay(float screenX, float screenY) const {
+    // Map screen coordinates to spherical coordinates
+    float theta = (screenX + 1.0f) * M_PI;  // longitude: [-π, π]
+    float phi = (1.0f - screenY) * M_PI;    // latitude: [0, π]
+
+    // Convert spherical to Cartesian coordinates
+    float sinPhi = std::sin(phi);
+    float cosPhi = std::cos(phi);
+    float sinTheta = std::sin(theta);
+    float cosTheta = std::cos(theta);
+
+    Vector3 direction = forward_.times(cosPhi * cosTheta).plus(
+        right_.times(cosPhi * sinTheta).plus(
+            up_.times(sinPhi)
+        )
+    );
+
+    return Ray(position_, direction.getNormalized(), 0, pixelSpread_);
+}
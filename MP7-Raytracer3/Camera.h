@@ -0,0 +1,36 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "Bvh.h"
+#include "Math.h"
+#include "Renderer.h"
+#include "SceneObjects.h"
+
+class Camera {
+public:
+    Camera(const Vector3& position, const Vector3& lookDirection, const Vector3& upDirection,
+           CameraType type, int width, int height);
+
+    Ray generateRay(float screenX, float screenY) const;
+
+    // Frustum around the rays of every pixel whose screen coordinates lie in
+    // [left, right] x [bottom, top]; false if planes cannot bound them, as for
+    // panoramas. Fisheye pixels outside the unit circle shoot no rays at all.
+    bool getTileFrustum(float left, float right, float bottom, float top, Frustum& frustum) const;
+
+private:
+    Vector3 position_;
+    Vector3 forward_;
+    Vector3 right_;
+    Vector3 up_;
+    int width_;
+    int height_;
+    CameraType type_;
+    float pixelSpread_;
+
+    Ray generateClassicRay(float screenX, float screenY) const;
+    Ray generateFisheyeRay(float screenX, float screenY) const;
+    Ray generatePanoramaRay(float screenX, float screenY) const;
+};
+
+#endif // CAMERA_H
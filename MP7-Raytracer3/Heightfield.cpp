@@ -0,0 +1,367 @@
+#include "Heightfield.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <thread>
+#include "Kernels.h"
+#include "Stats.h"
+
+namespace {
+    // Runs task(firstRow, endRow) on equal row ranges, one per thread, the caller included
+    template <typename Task>
+    void runRows(uint32_t rowCount, unsigned threadCount, Task task) {
+        threadCount = std::max(1u, std::min(threadCount, rowCount));
+        std::vector<std::thread> workers;
+        for (uint32_t i = 1; i < threadCount; ++i) {
+            workers.emplace_back(task, rowCount * i / threadCount, rowCount * (i + 1) / threadCount);
+        }
+        task(0u, rowCount / threadCount);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Uniform in [0, 1) from the top 24 bits, so every standard library agrees
+    float nextUniform(std::mt19937& random) {
+        return static_cast<float>(random() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Slab test like BoundingBox::intersect, also giving where the ray leaves
+    bool intersectBox(const float low[3], const float high[3], const Vector3& origin,
+                      const Vector3& inverseDirection, float tMin, float tMax, float& tNear, float& tFar) {
+        const float origins[3] = {origin.x, origin.y, origin.z};
+        const float inverses[3] = {inverseDirection.x, inverseDirection.y, inverseDirection.z};
+        tNear = tMin;
+        tFar = tMax;
+        for (int axis = 0; axis < 3; ++axis) {
+            float t1 = (low[axis] - origins[axis]) * inverses[axis];
+            float t2 = (high[axis] - origins[axis]) * inverses[axis];
+            tNear = std::max(tNear, std::min(t1, t2));
+            tFar = std::min(tFar, std::max(t1, t2));
+        }
+        return tNear <= tFar;
+    }
+}
+
+std::vector<float> Heightfield::generate(uint32_t size, uint32_t faultCount, uint32_t weathering, uint32_t seed,
+                                        unsigned threadCount) {
+    float step = 2.0f / static_cast<float>(size - 1);
+    std::vector<float> ys(size);
+    for (uint32_t j = 0; j < size; ++j) {
+        ys[j] = -1.0f + step * static_cast<float>(j);
+    }
+
+    // Drawn in terrain.js's order: point x, point y, direction angle
+    std::mt19937 random(seed);
+    std::vector<float> faults(4 * static_cast<size_t>(faultCount));
+    for (uint32_t f = 0; f < faultCount; ++f) {
+        float x = (nextUniform(random) - 0.5f) * 2.0f;
+        float y = (nextUniform(random) - 0.5f) * 2.0f;
+        float theta = 2.0f * Math::PI * nextUniform(random);
+        faults[4 * f + 0] = x;
+        faults[4 * f + 1] = y;
+        faults[4 * f + 2] = std::cos(theta) / FAULT_RADIUS;
+        faults[4 * f + 3] = std::sin(theta) / FAULT_RADIUS;
+    }
+
+    std::vector<float> heights(static_cast<size_t>(size) * size, 0.0f);
+    const Kernels::Table& kernels = Kernels::get();
+    runRows(size, threadCount, [&](uint32_t first, uint32_t end) {
+        for (uint32_t i = first; i < end; ++i) {
+            kernels.applyFaults(faults.data(), faultCount, -1.0f + step * static_cast<float>(i),
+                                ys.data(), &heights[static_cast<size_t>(i) * size], size);
+        }
+    });
+
+    // Each pass averages a height with the mean of its edge neighbors
+    std::vector<float> smoothed(weathering > 0 ? heights.size() : 0);
+    for (uint32_t pass = 0; pass < weathering; ++pass) {
+        runRows(size, threadCount, [&](uint32_t first, uint32_t end) {
+            for (uint32_t i = first; i < end; ++i) {
+                for (uint32_t j = 0; j < size; ++j) {
+                    size_t index = static_cast<size_t>(i) * size + j;
+                    float sum = 0.0f;
+                    int count = 0;
+                    if (i > 0) { sum += heights[index - size]; ++count; }
+                    if (i + 1 < size) { sum += heights[index + size]; ++count; }
+                    if (j > 0) { sum += heights[index - 1]; ++count; }
+                    if (j + 1 < size) { sum += heights[index + 1]; ++count; }
+                    smoothed[index] = (heights[index] + sum / static_cast<float>(count)) / 2.0f;
+                }
+            }
+        });
+        heights.swap(smoothed);
+    }
+
+    auto extremes = std::minmax_element(heights.begin(), heights.end());
+    float low = *extremes.first, high = *extremes.second;
+    if (high != low) {
+        float middle = (high + low) / 2.0f;
+        float range = high - low;
+        runRows(size, threadCount, [&](uint32_t first, uint32_t end) {
+            for (size_t k = static_cast<size_t>(first) * size; k < static_cast<size_t>(end) * size; ++k) {
+                heights[k] = PEAK_HEIGHT * (heights[k] - middle) / range;
+            }
+        });
+    }
+    return heights;
+}
+
+Heightfield::Heightfield(uint32_t size, std::vector<float> heights)
+    : size_(size), cells_(size - 1), step_(2.0f / static_cast<float>(size - 1)),
+      ownedHeights_(std::move(heights)), heights_(ownedHeights_.data()) {}
+
+Heightfield::Heightfield(uint32_t size, const float* heights)
+    : size_(size), cells_(size - 1), step_(2.0f / static_cast<float>(size - 1)), heights_(heights) {}
+
+void Heightfield::build() {
+    ranges_.clear();
+    levelSizes_.clear();
+
+    // Leaves span the vertices on both borders of their cells
+    uint32_t leaves = (cells_ + LEAF_CELLS - 1) / LEAF_CELLS;
+    std::vector<float> leafRanges(2 * static_cast<size_t>(leaves) * leaves);
+    for (uint32_t a = 0; a < leaves; ++a) {
+        uint32_t iEnd = std::min((a + 1) * LEAF_CELLS, cells_);
+        for (uint32_t b = 0; b < leaves; ++b) {
+            uint32_t jEnd = std::min((b + 1) * LEAF_CELLS, cells_);
+            float low = getHeight(a * LEAF_CELLS, b * LEAF_CELLS), high = low;
+            for (uint32_t i = a * LEAF_CELLS; i <= iEnd; ++i) {
+                for (uint32_t j = b * LEAF_CELLS; j <= jEnd; ++j) {
+                    low = std::min(low, getHeight(i, j));
+                    high = std::max(high, getHeight(i, j));
+                }
+            }
+            leafRanges[2 * (static_cast<size_t>(a) * leaves + b)] = low;
+            leafRanges[2 * (static_cast<size_t>(a) * leaves + b) + 1] = high;
+        }
+    }
+    ranges_.push_back(std::move(leafRanges));
+    levelSizes_.push_back(leaves);
+
+    // Each parent covers up to 2x2 children; odd sizes leave the last row short
+    while (levelSizes_.back() > 1) {
+        uint32_t childSize = levelSizes_.back();
+        uint32_t parentSize = (childSize + 1) / 2;
+        const std::vector<float>& children = ranges_.back();
+        std::vector<float> parents(2 * static_cast<size_t>(parentSize) * parentSize);
+        for (uint32_t a = 0; a < parentSize; ++a) {
+            for (uint32_t b = 0; b < parentSize; ++b) {
+                float low = std::numeric_limits<float>::infinity();
+                float high = -std::numeric_limits<float>::infinity();
+                for (uint32_t childA = 2 * a; childA < std::min(2 * a + 2, childSize); ++childA) {
+                    for (uint32_t childB = 2 * b; childB < std::min(2 * b + 2, childSize); ++childB) {
+                        size_t child = 2 * (static_cast<size_t>(childA) * childSize + childB);
+                        low = std::min(low, children[child]);
+                        high = std::max(high, children[child + 1]);
+                    }
+                }
+                parents[2 * (static_cast<size_t>(a) * parentSize + b)] = low;
+                parents[2 * (static_cast<size_t>(a) * parentSize + b) + 1] = high;
+            }
+        }
+        ranges_.push_back(std::move(parents));
+        levelSizes_.push_back(parentSize);
+    }
+}
+
+BoundingBox Heightfield::getBounds() const {
+    if (ranges_.empty()) return BoundingBox();
+    const std::vector<float>& root = ranges_.back();
+    return BoundingBox(Vector3(getCoordinate(0), getCoordinate(0), root[0]),
+                       Vector3(getCoordinate(cells_), getCoordinate(cells_), root[1]));
+}
+
+bool Heightfield::intersect(const Vector3& origin, const Vector3& direction, float tMin, float& tMax,
+                            Hit& hit) const {
+    if (ranges_.empty()) return false;
+
+    struct Entry {
+        uint32_t level, a, b;
+        float tNear, tFar;
+    };
+    Vector3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    auto intersectNode = [&](uint32_t level, uint32_t a, uint32_t b, Entry& entry) {
+        uint32_t span = LEAF_CELLS << level;
+        size_t node = 2 * (static_cast<size_t>(a) * levelSizes_[level] + b);
+        float low[3] = {getCoordinate(a * span), getCoordinate(b * span), ranges_[level][node]};
+        float high[3] = {getCoordinate(std::min((a + 1) * span, cells_)),
+                         getCoordinate(std::min((b + 1) * span, cells_)), ranges_[level][node + 1]};
+        entry = {level, a, b, 0.0f, 0.0f};
+        return intersectBox(low, high, origin, inverseDirection, tMin, tMax, entry.tNear, entry.tFar);
+    };
+    // Cells the ray can reach along one axis of a leaf, with a cell of slack for rounding
+    auto getCellRange = [&](float from, float to, uint32_t first, uint32_t end, uint32_t& low, uint32_t& high) {
+        float last = static_cast<float>(end - 1);
+        float lowCell = std::floor((std::min(from, to) + 1.0f) / step_) - 1.0f;
+        float highCell = std::floor((std::max(from, to) + 1.0f) / step_) + 1.0f;
+        low = static_cast<uint32_t>(std::min(last, std::max(static_cast<float>(first), lowCell)));
+        high = static_cast<uint32_t>(std::min(last, std::max(static_cast<float>(first), highCell)));
+    };
+
+    Entry stack[4 * MAX_LEVELS];
+    int stackSize = 0;
+    uint32_t visited = 0;
+    uint64_t tests = 0;
+    bool found = false;
+
+    uint32_t rootLevel = static_cast<uint32_t>(levelSizes_.size()) - 1;
+    if (!intersectNode(rootLevel, 0, 0, stack[0])) return false;
+    stackSize = 1;
+
+    while (stackSize > 0) {
+        Entry node = stack[--stackSize];
+        // A hit found since this node was pushed may already be closer
+        if (node.tNear > tMax) continue;
+        ++visited;
+
+        if (node.level == 0) {
+            float tExit = std::min(node.tFar, tMax);
+            uint32_t iLow, iHigh, jLow, jHigh;
+            getCellRange(origin.x + direction.x * node.tNear, origin.x + direction.x * tExit,
+                         node.a * LEAF_CELLS, std::min((node.a + 1) * LEAF_CELLS, cells_), iLow, iHigh);
+            getCellRange(origin.y + direction.y * node.tNear, origin.y + direction.y * tExit,
+                         node.b * LEAF_CELLS, std::min((node.b + 1) * LEAF_CELLS, cells_), jLow, jHigh);
+            found = testCells(origin, direction, iLow, iHigh, jLow, jHigh, tMin, tMax, hit) || found;
+            tests += 2 * (iHigh - iLow + 1) * (jHigh - jLow + 1);
+            continue;
+        }
+
+        // Push the children farthest first so the nearest is processed next
+        Entry children[4];
+        int childCount = 0;
+        uint32_t childLevel = node.level - 1;
+        uint32_t childSize = levelSizes_[childLevel];
+        for (uint32_t a = 2 * node.a; a < std::min(2 * node.a + 2, childSize); ++a) {
+            for (uint32_t b = 2 * node.b; b < std::min(2 * node.b + 2, childSize); ++b) {
+                Entry child;
+                if (!intersectNode(childLevel, a, b, child)) continue;
+                int position = childCount++;
+                while (position > 0 && children[position - 1].tNear < child.tNear) {
+                    children[position] = children[position - 1];
+                    --position;
+                }
+                children[position] = child;
+            }
+        }
+        for (int i = 0; i < childCount; ++i) {
+            stack[stackSize++] = children[i];
+        }
+    }
+    RT_STAT_ADD(nodeVisits, visited);
+    RT_STAT_ADD(primitiveTests, tests);
+    return found;
+}
+
+bool Heightfield::intersectTriangle(const Vector3& origin, const Vector3& direction, uint32_t triangle,
+                                    float tMin, float tMax) const {
+    Vector3 corners[3];
+    uint32_t rows[3], columns[3];
+    getCorners(triangle, corners, rows, columns);
+    const float positions[9] = {corners[0].x, corners[0].y, corners[0].z, corners[1].x, corners[1].y,
+                                corners[1].z, corners[2].x, corners[2].y, corners[2].z};
+    const uint32_t indices[3] = {0, 1, 2};
+    const float origin3[3] = {origin.x, origin.y, origin.z};
+    const float direction3[3] = {direction.x, direction.y, direction.z};
+    float u, v;
+    return Kernels::get().intersectTriangles(origin3, direction3, positions, indices, indices, 1,
+                                             tMin, tMax, u, v) >= 0;
+}
+
+Vector3 Heightfield::getNormal(const Hit& hit) const {
+    Vector3 corners[3];
+    uint32_t rows[3], columns[3];
+    getCorners(hit.triangle, corners, rows, columns);
+    return getVertexNormal(rows[0], columns[0]).times(1.0f - hit.u - hit.v)
+        .plus(getVertexNormal(rows[1], columns[1]).times(hit.u))
+        .plus(getVertexNormal(rows[2], columns[2]).times(hit.v))
+        .getNormalized();
+}
+
+void Heightfield::getTextureCoordinates(const Hit& hit, float& u, float& v) const {
+    Vector3 corners[3];
+    uint32_t rows[3], columns[3];
+    getCorners(hit.triangle, corners, rows, columns);
+    float w = 1.0f - hit.u - hit.v;
+    u = (w * columns[0] + hit.u * columns[1] + hit.v * columns[2]) / static_cast<float>(cells_);
+    v = (w * rows[0] + hit.u * rows[1] + hit.v * rows[2]) / static_cast<float>(cells_);
+}
+
+// cross(north - south, west - east) over the neighboring vertices, as terrain.js
+// does, divided by the product of the two spacings. Unscaled, its length falls
+// with the square of the cell size, below what Vector3 will normalize.
+Vector3 Heightfield::getVertexNormal(uint32_t i, uint32_t j) const {
+    Vector3 north = getVertex(i > 0 ? i - 1 : i, j);
+    Vector3 south = getVertex(i < cells_ ? i + 1 : i, j);
+    Vector3 west = getVertex(i, j > 0 ? j - 1 : j);
+    Vector3 east = getVertex(i, j < cells_ ? j + 1 : j);
+    float xSpan = north.x - south.x;
+    float ySpan = west.y - east.y;
+    return Vector3(-(north.z - south.z) / xSpan, -(west.z - east.z) / ySpan, 1.0f);
+}
+
+void Heightfield::getCorners(uint32_t triangle, Vector3 corners[3], uint32_t rows[3], uint32_t columns[3]) const {
+    uint32_t cell = triangle / 2;
+    uint32_t i = cell / cells_;
+    uint32_t j = cell % cells_;
+    if (triangle % 2 == 0) {
+        rows[0] = i;     columns[0] = j;
+        rows[1] = i;     columns[1] = j + 1;
+        rows[2] = i + 1; columns[2] = j;
+    } else {
+        rows[0] = i;     columns[0] = j + 1;
+        rows[1] = i + 1; columns[1] = j;
+        rows[2] = i + 1; columns[2] = j + 1;
+    }
+    for (int corner = 0; corner < 3; ++corner) {
+        corners[corner] = getVertex(rows[corner], columns[corner]);
+    }
+}
+
+// Gathers the cells' corners and hands their triangles, in the order of
+// their numbers, to the triangle kernel the meshes use
+bool Heightfield::testCells(const Vector3& origin, const Vector3& direction, uint32_t iLow, uint32_t iHigh,
+                            uint32_t jLow, uint32_t jHigh, float tMin, float& tMax, Hit& hit) const {
+    constexpr uint32_t MAX_TRIANGLES = 2 * LEAF_CELLS * LEAF_CELLS;
+    static const auto sequence = [] {
+        std::array<uint32_t, MAX_TRIANGLES> result;
+        for (uint32_t k = 0; k < MAX_TRIANGLES; ++k) result[k] = k;
+        return result;
+    }();
+
+    uint32_t rowCount = iHigh - iLow + 1;
+    uint32_t columnCount = jHigh - jLow + 1;
+    uint32_t stride = columnCount + 1;  // Vertices per gathered row
+    float positions[3 * (LEAF_CELLS + 1) * (LEAF_CELLS + 1)];
+    for (uint32_t i = iLow; i <= iHigh + 1; ++i) {
+        for (uint32_t j = jLow; j <= jHigh + 1; ++j) {
+            float* position = &positions[3 * ((i - iLow) * stride + (j - jLow))];
+            position[0] = getCoordinate(i);
+            position[1] = getCoordinate(j);
+            position[2] = getHeight(i, j);
+        }
+    }
+    // The same corners as getCorners
+    uint32_t indices[3 * MAX_TRIANGLES];
+    uint32_t* corner = indices;
+    for (uint32_t a = 0; a < rowCount; ++a) {
+        for (uint32_t b = 0; b < columnCount; ++b, corner += 6) {
+            uint32_t vertex = a * stride + b;
+            corner[0] = vertex;      corner[1] = vertex + 1;      corner[2] = vertex + stride;
+            corner[3] = vertex + 1;  corner[4] = vertex + stride; corner[5] = vertex + stride + 1;
+        }
+    }
+
+    const float origin3[3] = {origin.x, origin.y, origin.z};
+    const float direction3[3] = {direction.x, direction.y, direction.z};
+    int position = Kernels::get().intersectTriangles(origin3, direction3, positions, indices, sequence.data(),
+                                                     2 * rowCount * columnCount, tMin, tMax, hit.u, hit.v);
+    if (position < 0) return false;
+    uint32_t cell = static_cast<uint32_t>(position) / 2;
+    uint32_t i = iLow + cell / columnCount;
+    uint32_t j = jLow + cell % columnCount;
+    hit.triangle = 2 * (i * cells_ + j) + static_cast<uint32_t>(position) % 2;
+    return true;
+}
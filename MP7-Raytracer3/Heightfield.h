@@ -0,0 +1,90 @@
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#include <cstdint>
+#include <vector>
+#include "Bvh.h"
+#include "Math.h"
+
+// Square grid of heights laid out like MP4-Terrain's: vertex (i, j) sits at
+// x = -1 + step * i, y = -1 + step * j with its height as z, and cell (i, j)
+// is split into triangles (i, j) (i, j+1) (i+1, j) and (i, j+1) (i+1, j) (i+1, j+1).
+// Rays descend a quadtree of min-max height ranges, so only the heights are
+// stored per vertex.
+class Heightfield {
+public:
+    static constexpr uint32_t MIN_SIZE = 2;
+    static constexpr uint32_t MAX_SIZE = 32768;  // Keeps triangle numbers within 32 bits
+    static constexpr float FAULT_RADIUS = 1.5f;
+    static constexpr float PEAK_HEIGHT = 0.8f;
+
+    // Cells per side of a quadtree leaf, tested triangle by triangle
+    static constexpr uint32_t LEAF_CELLS = 4;
+    static constexpr int MAX_LEVELS = 16;
+
+    struct Hit {
+        uint32_t triangle;  // 2 * (i * cells + j), plus one for the cell's second triangle
+        float u, v;         // Barycentric weights of the second and third corner
+    };
+
+    // MP4-Terrain's fault formation on size * size heights: each fault through
+    // a random point and direction raises one side and lowers the other within
+    // FAULT_RADIUS, then MP17-Weathering's smoothing runs weathering times and
+    // heights are centered and scaled to PEAK_HEIGHT. Rows are split across
+    // threadCount threads, the caller included, and use the vector fault
+    // kernel; the same seed gives the same terrain whatever the thread count
+    // or instruction set.
+    static std::vector<float> generate(uint32_t size, uint32_t faultCount, uint32_t weathering, uint32_t seed,
+                                       unsigned threadCount);
+
+    // Takes ownership of the heights
+    Heightfield(uint32_t size, std::vector<float> heights);
+    // Uses heights in place; the caller keeps them alive, e.g. a mapped .rtb file
+    Heightfield(uint32_t size, const float* heights);
+
+    Heightfield(Heightfield&&) = default;
+    Heightfield(const Heightfield&) = delete;
+    Heightfield& operator=(const Heightfield&) = delete;
+
+    void build();
+
+    uint32_t getSize() const { return size_; }
+    const float* getHeights() const { return heights_; }
+    BoundingBox getBounds() const;
+
+    // Nearest hit within [tMin, tMax); lowers tMax to its distance
+    bool intersect(const Vector3& origin, const Vector3& direction, float tMin, float& tMax, Hit& hit) const;
+    // Whether one triangle is hit within [tMin, tMax)
+    bool intersectTriangle(const Vector3& origin, const Vector3& direction, uint32_t triangle,
+                           float tMin, float tMax) const;
+
+    // Smooth normal interpolated from MP4-Terrain's vertex normals, pointing up
+    Vector3 getNormal(const Hit& hit) const;
+    // Grid position of the hit scaled to [0, 1]: u follows j, v follows i
+    void getTextureCoordinates(const Hit& hit, float& u, float& v) const;
+
+private:
+    uint32_t size_;
+    uint32_t cells_;  // Per side
+    float step_;
+    std::vector<float> ownedHeights_;
+    const float* heights_;
+
+    // Min, max pairs per node, row-major; level 0 holds the leaves and the last
+    // level the root
+    std::vector<std::vector<float>> ranges_;
+    std::vector<uint32_t> levelSizes_;
+
+    float getCoordinate(uint32_t index) const { return -1.0f + step_ * static_cast<float>(index); }
+    float getHeight(uint32_t i, uint32_t j) const { return heights_[static_cast<size_t>(i) * size_ + j]; }
+    Vector3 getVertex(uint32_t i, uint32_t j) const {
+        return Vector3(getCoordinate(i), getCoordinate(j), getHeight(i, j));
+    }
+    Vector3 getVertexNormal(uint32_t i, uint32_t j) const;
+    void getCorners(uint32_t triangle, Vector3 corners[3], uint32_t rows[3], uint32_t columns[3]) const;
+    // Nearest hit among the triangles of cells [iLow, iHigh] x [jLow, jHigh], at most a leaf's
+    bool testCells(const Vector3& origin, const Vector3& direction, uint32_t iLow, uint32_t iHigh,
+                   uint32_t jLow, uint32_t jHigh, float tMin, float& tMax, Hit& hit) const;
+};
+
+#endif // HEIGHTFIELD_H
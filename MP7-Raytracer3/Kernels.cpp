@@ -0,0 +1,444 @@
+#include "Kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "Math.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RT_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+// Fusing a multiply and add rounds once instead of twice, which would make the
+// FMA-capable levels disagree with the others
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace Kernels {
+namespace {
+    // Shared mesh edges must not leak rays that graze them, so tiny negative
+    // barycentrics are accepted. There is no epsilon on the determinant, since
+    // OBJ models are often authored at scales where edge products fall below one.
+    constexpr float BARYCENTRIC_TOLERANCE = 1e-6f;
+
+    // The encoding looks up a bucket of 65536 consecutive float bit patterns.
+    // Buckets this narrow cross at most one step of the 8-bit output, so each
+    // stores the code at its start and the value where the next code begins.
+    // Everything below the first bucket encodes to 0 (negatives included) and
+    // everything past the last to 255, so indices are clamped to the range.
+    constexpr int SRGB_BUCKET_SHIFT = 16;
+    constexpr int FIRST_SRGB_BUCKET = 0x3900;  // 2^-13
+    constexpr int LAST_SRGB_BUCKET = 0x3f81;   // Just above 1.0, which encodes to 254
+    constexpr int SRGB_BUCKET_COUNT = LAST_SRGB_BUCKET - FIRST_SRGB_BUCKET + 1;
+
+    struct SRGBTable {
+        int32_t codes[SRGB_BUCKET_COUNT];
+        float thresholds[SRGB_BUCKET_COUNT];  // Infinity where the bucket has one code
+    };
+
+    uint8_t encodeSRGBReference(float value) {
+        return static_cast<uint8_t>(Math::clamp(Math::convertLinearToSRGB(value) * 255.0f, 0.0f, 255.0f));
+    }
+
+    float fromBits(uint32_t bits) {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Built from the reference conversion itself, so the kernels reproduce it exactly
+    const SRGBTable& getSRGBTable() {
+        static const SRGBTable table = [] {
+            SRGBTable result;
+            for (int i = 0; i < SRGB_BUCKET_COUNT; ++i) {
+                uint32_t lo = static_cast<uint32_t>(FIRST_SRGB_BUCKET + i) << SRGB_BUCKET_SHIFT;
+                uint32_t hi = lo + (1u << SRGB_BUCKET_SHIFT) - 1;
+                if (i == SRGB_BUCKET_COUNT - 1) {
+                    // Also holds infinity, which must not compare below an infinite threshold
+                    result.codes[i] = 254;
+                    result.thresholds[i] = fromBits(lo);
+                    continue;
+                }
+                uint8_t code = encodeSRGBReference(fromBits(lo));
+                result.codes[i] = code;
+                result.thresholds[i] = std::numeric_limits<float>::infinity();
+                if (encodeSRGBReference(fromBits(hi)) == code) continue;
+
+                // Bisect for the first bit pattern with the next code
+                while (hi - lo > 1) {
+                    uint32_t mid = lo + (hi - lo) / 2;
+                    (encodeSRGBReference(fromBits(mid)) > code ? hi : lo) = mid;
+                }
+                result.thresholds[i] = fromBits(hi);
+            }
+            return result;
+        }();
+        return table;
+    }
+}
+
+// Scalar kernels, used when nothing better is available and for leftovers of
+// the vector loops
+namespace Generic {
+    inline uint8_t encodeChannel(float value, const SRGBTable& table) {
+        // NaN encodes to 255 like it does through pow, whatever its sign bit
+        if (value != value) return 255;
+        int32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        int bucket = std::min(std::max((bits >> SRGB_BUCKET_SHIFT) - FIRST_SRGB_BUCKET, 0), SRGB_BUCKET_COUNT - 1);
+        return static_cast<uint8_t>(table.codes[bucket] + (value < table.thresholds[bucket] ? 0 : 1));
+    }
+
+    inline uint8_t encodeAlpha(float value) {
+        return static_cast<uint8_t>(Math::clamp(value * 255.0f, 0.0f, 255.0f));
+    }
+
+    int intersectSpheres(const float origin[3], const float direction[3],
+                         const void* spheres, size_t stride,
+                         const uint32_t* indices, uint32_t count,
+                         float tMin, float& tMax) {
+        const char* records = static_cast<const char*>(spheres);
+        float a = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+        int best = -1;
+        for (uint32_t i = 0; i < count; ++i) {
+            const float* sphere = reinterpret_cast<const float*>(records + indices[i] * stride);
+            float ocx = origin[0] - sphere[0];
+            float ocy = origin[1] - sphere[1];
+            float ocz = origin[2] - sphere[2];
+            float b = 2.0f * (ocx * direction[0] + ocy * direction[1] + ocz * direction[2]);
+            float c = (ocx * ocx + ocy * ocy + ocz * ocz) - sphere[3] * sphere[3];
+            float discriminant = b * b - 4.0f * a * c;
+            if (discriminant < 0) continue;
+
+            float root = std::sqrt(discriminant);
+            float t = (-b - root) / (2.0f * a);
+            if (t < tMin) {
+                t = (-b + root) / (2.0f * a);
+                if (t < tMin) continue;
+            }
+            if (t < tMax) {
+                tMax = t;
+                best = static_cast<int>(i);
+            }
+        }
+        return best;
+    }
+
+    int intersectTriangles(const float origin[3], const float direction[3],
+                           const float* positions, const uint32_t* positionIndices,
+                           const uint32_t* triangles, uint32_t count,
+                           float tMin, float& tMax, float& u, float& v) {
+        const float* d = direction;
+        int best = -1;
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint32_t* corners = positionIndices + 3 * triangles[i];
+            const float* p0 = positions + 3 * corners[0];
+            const float* p1 = positions + 3 * corners[1];
+            const float* p2 = positions + 3 * corners[2];
+            float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            float s[3] = {origin[0] - p0[0], origin[1] - p0[1], origin[2] - p0[2]};
+
+            float h[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+            float a = e1[0] * h[0] + e1[1] * h[1] + e1[2] * h[2];
+            if (a == 0.0f) continue;
+
+            float f = 1.0f / a;
+            float uu = f * (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]);
+            if (uu < -BARYCENTRIC_TOLERANCE || uu > 1.0f + BARYCENTRIC_TOLERANCE) continue;
+
+            float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+            float vv = f * (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]);
+            if (vv < -BARYCENTRIC_TOLERANCE || uu + vv > 1.0f + BARYCENTRIC_TOLERANCE) continue;
+
+            float t = f * (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]);
+            if (t >= tMin && t < tMax) {
+                tMax = t;
+                u = uu;
+                v = vv;
+                best = static_cast<int>(i);
+            }
+        }
+        return best;
+    }
+
+    void encodeSRGB(const float* rgba, uint8_t* out, size_t pixelCount) {
+        const SRGBTable& table = getSRGBTable();
+        for (size_t i = 0; i < pixelCount; ++i) {
+            out[4 * i + 0] = encodeChannel(rgba[4 * i + 0], table);
+            out[4 * i + 1] = encodeChannel(rgba[4 * i + 1], table);
+            out[4 * i + 2] = encodeChannel(rgba[4 * i + 2], table);
+            out[4 * i + 3] = encodeAlpha(rgba[4 * i + 3]);
+        }
+    }
+
+    // (1 - r^2)^2 on the raised side of the fault line and its negation on the
+    // other, where r is the distance from the line over the radius
+    void applyFaults(const float* faults, uint32_t faultCount, float x,
+                     const float* ys, float* heights, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            float height = heights[i];
+            for (uint32_t f = 0; f < faultCount; ++f) {
+                const float* fault = faults + 4 * f;
+                float ratio = (x - fault[0]) * fault[2] + (ys[i] - fault[1]) * fault[3];
+                float c = 1.0f - ratio * ratio;
+                float falloff = c * c;
+                height += 0.0f < c ? (0.0f < ratio ? falloff : -falloff) : 0.0f;
+            }
+            heights[i] = height;
+        }
+    }
+}
+
+#ifdef RT_KERNELS_X86
+
+// Compiles the functions up to RT_TARGET_POP for the given instruction sets
+#define RT_TARGET_STRING(text) #text
+#define RT_TARGET_PRAGMA(text) _Pragma(RT_TARGET_STRING(text))
+#if defined(__clang__)
+#define RT_TARGET_PUSH(isa) RT_TARGET_PRAGMA(clang attribute push(__attribute__((target(isa))), apply_to = function))
+#define RT_TARGET_POP _Pragma("clang attribute pop")
+#else
+#define RT_TARGET_PUSH(isa) _Pragma("GCC push_options") RT_TARGET_PRAGMA(GCC target(isa))
+#define RT_TARGET_POP _Pragma("GCC pop_options")
+#endif
+
+RT_TARGET_PUSH("sse4.2")
+namespace Sse42 {
+    struct V {
+        static constexpr int WIDTH = 4;
+        using F = __m128;
+        using I = __m128i;
+
+        static F set1(float value) { return _mm_set1_ps(value); }
+        static F load(const float* values) { return _mm_loadu_ps(values); }
+        static void store(float* values, F v) { _mm_storeu_ps(values, v); }
+        static F add(F a, F b) { return _mm_add_ps(a, b); }
+        static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+        static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+        static F div(F a, F b) { return _mm_div_ps(a, b); }
+        static F sqrt(F a) { return _mm_sqrt_ps(a); }
+        static F min(F a, F b) { return _mm_min_ps(a, b); }
+        static F max(F a, F b) { return _mm_max_ps(a, b); }
+        static F lessThan(F a, F b) { return _mm_cmplt_ps(a, b); }
+        static F equal(F a, F b) { return _mm_cmpeq_ps(a, b); }
+        static F select(F mask, F ifTrue, F ifFalse) { return _mm_blendv_ps(ifFalse, ifTrue, mask); }
+        static uint32_t toBits(F mask) { return static_cast<uint32_t>(_mm_movemask_ps(mask)); }
+
+        static I setInt(int value) { return _mm_set1_epi32(value); }
+        static I addInt(I a, I b) { return _mm_add_epi32(a, b); }
+        static I selectInt(F mask, I ifTrue, I ifFalse) {
+            return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(ifFalse), _mm_castsi128_ps(ifTrue), mask));
+        }
+        static I selectIntBits(uint32_t bits, I ifSet, I ifClear) {
+            I mask = _mm_setr_epi32(bits & 1 ? -1 : 0, bits & 2 ? -1 : 0, bits & 4 ? -1 : 0, bits & 8 ? -1 : 0);
+            return _mm_blendv_epi8(ifClear, ifSet, mask);
+        }
+        static I subInt(I a, I b) { return _mm_sub_epi32(a, b); }
+        static I minInt(I a, I b) { return _mm_min_epi32(a, b); }
+        static I maxInt(I a, I b) { return _mm_max_epi32(a, b); }
+        static I shiftRight(I a, int bits) { return _mm_srai_epi32(a, bits); }
+        static I toInt(F a) { return _mm_castps_si128(a); }
+        static F isNaN(F a) { return _mm_cmpunord_ps(a, a); }
+        static I truncate(F a) { return _mm_cvttps_epi32(a); }
+        // No gather instruction before AVX2
+        static F gather(const float* table, I indices) {
+            alignas(16) int32_t lanes[4];
+            _mm_store_si128(reinterpret_cast<I*>(lanes), indices);
+            return _mm_setr_ps(table[lanes[0]], table[lanes[1]], table[lanes[2]], table[lanes[3]]);
+        }
+        static I gatherInt(const int32_t* table, I indices) {
+            alignas(16) int32_t lanes[4];
+            _mm_store_si128(reinterpret_cast<I*>(lanes), indices);
+            return _mm_setr_epi32(table[lanes[0]], table[lanes[1]], table[lanes[2]], table[lanes[3]]);
+        }
+        static void storeBytes(uint8_t* out, I values) {
+            I bytes = _mm_packus_epi16(_mm_packus_epi32(values, values), _mm_setzero_si128());
+            int32_t packed = _mm_cvtsi128_si32(bytes);
+            std::memcpy(out, &packed, 4);
+        }
+    };
+
+#include "KernelsSimd.inl"
+}
+RT_TARGET_POP
+
+RT_TARGET_PUSH("avx2")
+namespace Avx2 {
+    struct V {
+        static constexpr int WIDTH = 8;
+        using F = __m256;
+        using I = __m256i;
+
+        static F set1(float value) { return _mm256_set1_ps(value); }
+        static F load(const float* values) { return _mm256_loadu_ps(values); }
+        static void store(float* values, F v) { _mm256_storeu_ps(values, v); }
+        static F add(F a, F b) { return _mm256_add_ps(a, b); }
+        static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+        static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+        static F div(F a, F b) { return _mm256_div_ps(a, b); }
+        static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+        static F min(F a, F b) { return _mm256_min_ps(a, b); }
+        static F max(F a, F b) { return _mm256_max_ps(a, b); }
+        static F lessThan(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static F equal(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+        static F select(F mask, F ifTrue, F ifFalse) { return _mm256_blendv_ps(ifFalse, ifTrue, mask); }
+        static uint32_t toBits(F mask) { return static_cast<uint32_t>(_mm256_movemask_ps(mask)); }
+
+        static I setInt(int value) { return _mm256_set1_epi32(value); }
+        static I addInt(I a, I b) { return _mm256_add_epi32(a, b); }
+        static I selectInt(F mask, I ifTrue, I ifFalse) {
+            return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(ifFalse), _mm256_castsi256_ps(ifTrue), mask));
+        }
+        static I selectIntBits(uint32_t bits, I ifSet, I ifClear) {
+            I lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+            I mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits)), lanes), lanes);
+            return _mm256_blendv_epi8(ifClear, ifSet, mask);
+        }
+        static I subInt(I a, I b) { return _mm256_sub_epi32(a, b); }
+        static I minInt(I a, I b) { return _mm256_min_epi32(a, b); }
+        static I maxInt(I a, I b) { return _mm256_max_epi32(a, b); }
+        static I shiftRight(I a, int bits) { return _mm256_srai_epi32(a, bits); }
+        static I toInt(F a) { return _mm256_castps_si256(a); }
+        static F isNaN(F a) { return _mm256_cmp_ps(a, a, _CMP_UNORD_Q); }
+        static I truncate(F a) { return _mm256_cvttps_epi32(a); }
+        static F gather(const float* table, I indices) { return _mm256_i32gather_ps(table, indices, 4); }
+        static I gatherInt(const int32_t* table, I indices) {
+            return _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), indices, 4);
+        }
+        static void storeBytes(uint8_t* out, I values) {
+            __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(words, words));
+        }
+    };
+
+#include "KernelsSimd.inl"
+}
+RT_TARGET_POP
+
+RT_TARGET_PUSH("avx512f,avx512bw,avx512vl,avx512dq")
+namespace Avx512 {
+    struct V {
+        static constexpr int WIDTH = 16;
+        using F = __m512;
+        using I = __m512i;
+        using Mask = __mmask16;
+
+        static F set1(float value) { return _mm512_set1_ps(value); }
+        static F load(const float* values) { return _mm512_loadu_ps(values); }
+        static void store(float* values, F v) { _mm512_storeu_ps(values, v); }
+        static F add(F a, F b) { return _mm512_add_ps(a, b); }
+        static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+        static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+        static F div(F a, F b) { return _mm512_div_ps(a, b); }
+        static F sqrt(F a) { return _mm512_sqrt_ps(a); }
+        static F min(F a, F b) { return _mm512_min_ps(a, b); }
+        static F max(F a, F b) { return _mm512_max_ps(a, b); }
+        static Mask lessThan(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+        static Mask equal(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+        static F select(Mask mask, F ifTrue, F ifFalse) { return _mm512_mask_blend_ps(mask, ifFalse, ifTrue); }
+        static uint32_t toBits(Mask mask) { return static_cast<uint32_t>(mask); }
+
+        static I setInt(int value) { return _mm512_set1_epi32(value); }
+        static I addInt(I a, I b) { return _mm512_add_epi32(a, b); }
+        static I selectInt(Mask mask, I ifTrue, I ifFalse) { return _mm512_mask_blend_epi32(mask, ifFalse, ifTrue); }
+        static I selectIntBits(uint32_t bits, I ifSet, I ifClear) {
+            return _mm512_mask_blend_epi32(static_cast<Mask>(bits), ifClear, ifSet);
+        }
+        static I subInt(I a, I b) { return _mm512_sub_epi32(a, b); }
+        static I minInt(I a, I b) { return _mm512_min_epi32(a, b); }
+        static I maxInt(I a, I b) { return _mm512_max_epi32(a, b); }
+        static I shiftRight(I a, int bits) { return _mm512_srai_epi32(a, bits); }
+        static I toInt(F a) { return _mm512_castps_si512(a); }
+        static Mask isNaN(F a) { return _mm512_cmp_ps_mask(a, a, _CMP_UNORD_Q); }
+        static I truncate(F a) { return _mm512_cvttps_epi32(a); }
+        static F gather(const float* table, I indices) { return _mm512_i32gather_ps(indices, table, 4); }
+        static I gatherInt(const int32_t* table, I indices) { return _mm512_i32gather_epi32(indices, table, 4); }
+        static void storeBytes(uint8_t* out, I values) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm512_cvtusepi32_epi8(values));
+        }
+    };
+
+#include "KernelsSimd.inl"
+}
+RT_TARGET_POP
+
+#endif // RT_KERNELS_X86
+
+namespace {
+    const Table GENERIC_TABLE = {Isa::GENERIC, Generic::intersectSpheres, Generic::intersectTriangles,
+                                 Generic::encodeSRGB, Generic::applyFaults};
+#ifdef RT_KERNELS_X86
+    const Table SSE42_TABLE = {Isa::SSE42, Sse42::intersectSpheres, Sse42::intersectTriangles,
+                               Sse42::encodeSRGB, Sse42::applyFaults};
+    const Table AVX2_TABLE = {Isa::AVX2, Avx2::intersectSpheres, Avx2::intersectTriangles,
+                              Avx2::encodeSRGB, Avx2::applyFaults};
+    const Table AVX512_TABLE = {Isa::AVX512, Avx512::intersectSpheres, Avx512::intersectTriangles,
+                                Avx512::encodeSRGB, Avx512::applyFaults};
+#endif
+
+    thread_local const Table* current = nullptr;
+}
+
+const Table& getTable(Isa isa) {
+    switch (isa) {
+#ifdef RT_KERNELS_X86
+        case Isa::SSE42: return SSE42_TABLE;
+        case Isa::AVX2: return AVX2_TABLE;
+        case Isa::AVX512: return AVX512_TABLE;
+#endif
+        default: return GENERIC_TABLE;
+    }
+}
+
+Isa detect() {
+#ifdef RT_KERNELS_X86
+    // Also checks that the OS saves the wider registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq")) {
+        return Isa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) return Isa::AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return Isa::SSE42;
+#endif
+    return Isa::GENERIC;
+}
+
+const Table& get() {
+    if (current) return *current;
+    static const Table& detected = getTable(detect());
+    return detected;
+}
+
+Scope::Scope(const Table& table) : previous_(current) { current = &table; }
+Scope::~Scope() { current = previous_; }
+
+bool find(const std::string& name, Isa& found, std::string& error) {
+    const Isa levels[] = {Isa::GENERIC, Isa::SSE42, Isa::AVX2, Isa::AVX512};
+    for (Isa isa : levels) {
+        if (name != getName(isa)) continue;
+        if (static_cast<int>(isa) > static_cast<int>(detect())) {
+            error = "this CPU does not support " + name;
+            return false;
+        }
+        found = isa;
+        return true;
+    }
+    error = "unknown instruction set " + name + " (expected generic, sse4.2, avx2 or avx512)";
+    return false;
+}
+
+const char* getName(Isa isa) {
+    switch (isa) {
+        case Isa::SSE42: return "sse4.2";
+        case Isa::AVX2: return "avx2";
+        case Isa::AVX512: return "avx512";
+        default: return "generic";
+    }
+}
+}
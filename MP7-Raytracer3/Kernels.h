@@ -0,0 +1,74 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Hot loops built once per instruction set level. A thread uses the table of
+// its innermost Scope, else the best level the CPU reports. Every variant performs the same IEEE operations in the
+// same order (no FMA contraction), so all of them return bit-identical results.
+namespace Kernels {
+    enum class Isa {
+        GENERIC,
+        SSE42,
+        AVX2,
+        AVX512
+    };
+
+    struct Table {
+        Isa isa;
+
+        // Nearest hit among the spheres listed in indices, within [tMin, tMax).
+        // Each sphere is x, y, z, radius at the start of a stride-byte record.
+        // Returns the position in indices of the hit and lowers tMax to its
+        // distance, or returns -1. Ties go to the earlier position.
+        int (*intersectSpheres)(const float origin[3], const float direction[3],
+                                const void* spheres, size_t stride,
+                                const uint32_t* indices, uint32_t count,
+                                float tMin, float& tMax);
+
+        // Same contract for indexed triangles (three position indices each),
+        // also returning the barycentric u, v of the hit
+        int (*intersectTriangles)(const float origin[3], const float direction[3],
+                                  const float* positions, const uint32_t* positionIndices,
+                                  const uint32_t* triangles, uint32_t count,
+                                  float tMin, float& tMax, float& u, float& v);
+
+        // Linear RGBA floats to 8-bit sRGB RGB with linear alpha
+        void (*encodeSRGB)(const float* rgba, uint8_t* out, size_t pixelCount);
+
+        // Raises or lowers a row of terrain heights at x, whose columns sit at
+        // ys, by each fault in turn. A fault is a point px, py and a normal
+        // nx, ny already divided by its radius of influence.
+        void (*applyFaults)(const float* faults, uint32_t faultCount, float x,
+                            const float* ys, float* heights, uint32_t count);
+    };
+
+    // The calling thread's table
+    const Table& get();
+    const Table& getTable(Isa isa);
+
+    // Best level this CPU and OS support
+    Isa detect();
+
+    // Level of a name such as "avx2", e.g. to compare timings; fails for
+    // unknown names and for levels this machine cannot run
+    bool find(const std::string& name, Isa& isa, std::string& error);
+
+    // The calling thread uses table while this lives
+    class Scope {
+    public:
+        explicit Scope(const Table& table);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const Table* previous_;
+    };
+
+    const char* getName(Isa isa);
+}
+
+#endif // KERNELS_H
@@ -0,0 +1,202 @@
+// SIMD kernel bodies shared by every x86 level. Kernels.cpp includes this once
+// per level, inside a namespace that defines the vector wrapper V and under a
+// target pragma, so each copy is compiled for that instruction set.
+//
+// The arithmetic mirrors the scalar versions in Kernels.cpp operation for
+// operation; keep the two in sync.
+
+constexpr int WIDTH = V::WIDTH;
+
+int intersectSpheres(const float origin[3], const float direction[3],
+                     const void* spheres, size_t stride,
+                     const uint32_t* indices, uint32_t count,
+                     float tMin, float& tMax) {
+    // BVH leaves are usually narrower than a vector, and scalar code wins there
+    if (count < WIDTH) {
+        return Generic::intersectSpheres(origin, direction, spheres, stride, indices, count, tMin, tMax);
+    }
+    const char* records = static_cast<const char*>(spheres);
+    float a = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+    V::F dx = V::set1(direction[0]), dy = V::set1(direction[1]), dz = V::set1(direction[2]);
+    V::F vFourA = V::set1(4.0f * a), vTwoA = V::set1(2.0f * a);
+    V::F vTwo = V::set1(2.0f), vMin = V::set1(tMin), vMax = V::set1(tMax);
+
+    int best = -1;
+    float bestT = tMax;
+    for (uint32_t first = 0; first < count; first += WIDTH) {
+        uint32_t lanes = std::min<uint32_t>(WIDTH, count - first);
+        alignas(64) float ocx[WIDTH], ocy[WIDTH], ocz[WIDTH], radius[WIDTH];
+        uint32_t lane = 0;
+        for (; lane < lanes; ++lane) {
+            const float* sphere = reinterpret_cast<const float*>(records + indices[first + lane] * stride);
+            ocx[lane] = origin[0] - sphere[0];
+            ocy[lane] = origin[1] - sphere[1];
+            ocz[lane] = origin[2] - sphere[2];
+            radius[lane] = sphere[3];
+        }
+        // Spare lanes get a harmless point sphere and are masked out below
+        for (; lane < WIDTH; ++lane) {
+            ocx[lane] = ocy[lane] = ocz[lane] = radius[lane] = 0.0f;
+        }
+        V::F x = V::load(ocx), y = V::load(ocy), z = V::load(ocz), r = V::load(radius);
+
+        V::F b = V::mul(vTwo, V::add(V::add(V::mul(x, dx), V::mul(y, dy)), V::mul(z, dz)));
+        V::F c = V::sub(V::add(V::add(V::mul(x, x), V::mul(y, y)), V::mul(z, z)), V::mul(r, r));
+        V::F discriminant = V::sub(V::mul(b, b), V::mul(vFourA, c));
+        V::F root = V::sqrt(discriminant);
+        V::F minusB = V::sub(V::set1(-0.0f), b);  // Exact negation, signed zeros included
+        V::F nearT = V::div(V::sub(minusB, root), vTwoA);
+        V::F farT = V::div(V::add(minusB, root), vTwoA);
+        V::F t = V::select(V::lessThan(nearT, vMin), farT, nearT);
+
+        uint32_t hits = V::toBits(V::lessThan(t, vMax)) &
+                        ~V::toBits(V::lessThan(t, vMin)) &
+                        ~V::toBits(V::lessThan(discriminant, V::set1(0.0f))) &
+                        ((1u << lanes) - 1);
+        if (!hits) continue;
+
+        alignas(64) float distances[WIDTH];
+        V::store(distances, t);
+        for (int lane = 0; lane < WIDTH; ++lane) {
+            if ((hits >> lane & 1) && distances[lane] < bestT) {
+                bestT = distances[lane];
+                best = static_cast<int>(first) + lane;
+            }
+        }
+    }
+    if (best >= 0) tMax = bestT;
+    return best;
+}
+
+int intersectTriangles(const float origin[3], const float direction[3],
+                       const float* positions, const uint32_t* positionIndices,
+                       const uint32_t* triangles, uint32_t count,
+                       float tMin, float& tMax, float& u, float& v) {
+    if (count < WIDTH) {
+        return Generic::intersectTriangles(origin, direction, positions, positionIndices,
+                                           triangles, count, tMin, tMax, u, v);
+    }
+    V::F dx = V::set1(direction[0]), dy = V::set1(direction[1]), dz = V::set1(direction[2]);
+    V::F vZero = V::set1(0.0f), vOne = V::set1(1.0f);
+    V::F vLow = V::set1(-BARYCENTRIC_TOLERANCE), vHigh = V::set1(1.0f + BARYCENTRIC_TOLERANCE);
+    V::F vMin = V::set1(tMin), vMax = V::set1(tMax);
+
+    int best = -1;
+    float bestT = tMax;
+    for (uint32_t first = 0; first < count; first += WIDTH) {
+        uint32_t lanes = std::min<uint32_t>(WIDTH, count - first);
+        alignas(64) float e1[3][WIDTH], e2[3][WIDTH], s[3][WIDTH];
+        uint32_t lane = 0;
+        for (; lane < lanes; ++lane) {
+            const uint32_t* corners = positionIndices + 3 * triangles[first + lane];
+            const float* p0 = positions + 3 * corners[0];
+            const float* p1 = positions + 3 * corners[1];
+            const float* p2 = positions + 3 * corners[2];
+            for (int axis = 0; axis < 3; ++axis) {
+                e1[axis][lane] = p1[axis] - p0[axis];
+                e2[axis][lane] = p2[axis] - p0[axis];
+                s[axis][lane] = origin[axis] - p0[axis];
+            }
+        }
+        // Spare lanes get a degenerate triangle and are masked out below
+        for (; lane < WIDTH; ++lane) {
+            for (int axis = 0; axis < 3; ++axis) {
+                e1[axis][lane] = e2[axis][lane] = s[axis][lane] = 0.0f;
+            }
+        }
+        V::F e1x = V::load(e1[0]), e1y = V::load(e1[1]), e1z = V::load(e1[2]);
+        V::F e2x = V::load(e2[0]), e2y = V::load(e2[1]), e2z = V::load(e2[2]);
+        V::F sx = V::load(s[0]), sy = V::load(s[1]), sz = V::load(s[2]);
+
+        V::F hx = V::sub(V::mul(dy, e2z), V::mul(dz, e2y));
+        V::F hy = V::sub(V::mul(dz, e2x), V::mul(dx, e2z));
+        V::F hz = V::sub(V::mul(dx, e2y), V::mul(dy, e2x));
+        V::F a = V::add(V::add(V::mul(e1x, hx), V::mul(e1y, hy)), V::mul(e1z, hz));
+        V::F f = V::div(vOne, a);
+        V::F uu = V::mul(f, V::add(V::add(V::mul(sx, hx), V::mul(sy, hy)), V::mul(sz, hz)));
+        V::F qx = V::sub(V::mul(sy, e1z), V::mul(sz, e1y));
+        V::F qy = V::sub(V::mul(sz, e1x), V::mul(sx, e1z));
+        V::F qz = V::sub(V::mul(sx, e1y), V::mul(sy, e1x));
+        V::F vv = V::mul(f, V::add(V::add(V::mul(dx, qx), V::mul(dy, qy)), V::mul(dz, qz)));
+        V::F t = V::mul(f, V::add(V::add(V::mul(e2x, qx), V::mul(e2y, qy)), V::mul(e2z, qz)));
+
+        // Written as in the scalar test: each rejection is an ordered comparison
+        uint32_t rejected = V::toBits(V::equal(a, vZero)) |
+                            V::toBits(V::lessThan(uu, vLow)) |
+                            V::toBits(V::lessThan(vHigh, uu)) |
+                            V::toBits(V::lessThan(vv, vLow)) |
+                            V::toBits(V::lessThan(vHigh, V::add(uu, vv)));
+        uint32_t hits = ~rejected &
+                        ~V::toBits(V::lessThan(t, vMin)) &
+                        V::toBits(V::lessThan(t, vMax)) &
+                        ((1u << lanes) - 1);
+        if (!hits) continue;
+
+        alignas(64) float distances[WIDTH], us[WIDTH], vs[WIDTH];
+        V::store(distances, t);
+        V::store(us, uu);
+        V::store(vs, vv);
+        for (int lane = 0; lane < WIDTH; ++lane) {
+            if ((hits >> lane & 1) && distances[lane] < bestT) {
+                bestT = distances[lane];
+                u = us[lane];
+                v = vs[lane];
+                best = static_cast<int>(first) + lane;
+            }
+        }
+    }
+    if (best >= 0) tMax = bestT;
+    return best;
+}
+
+void encodeSRGB(const float* rgba, uint8_t* out, size_t pixelCount) {
+    const SRGBTable& table = getSRGBTable();
+    size_t valueCount = 4 * pixelCount;
+    V::F v255 = V::set1(255.0f), vZero = V::set1(0.0f);
+    V::I firstBucket = V::setInt(FIRST_SRGB_BUCKET), lastIndex = V::setInt(SRGB_BUCKET_COUNT - 1);
+    V::I zero = V::setInt(0), one = V::setInt(1), nanCode = V::setInt(255);
+    // Every fourth value is alpha, which is stored linearly
+    uint32_t alphaLanes = static_cast<uint32_t>(0x8888888888888888ull & ((1ull << WIDTH) - 1));
+
+    size_t i = 0;
+    for (; i + WIDTH <= valueCount; i += WIDTH) {
+        V::F x = V::load(rgba + i);
+
+        V::I bucket = V::subInt(V::shiftRight(V::toInt(x), SRGB_BUCKET_SHIFT), firstBucket);
+        bucket = V::minInt(V::maxInt(bucket, zero), lastIndex);
+        V::I code = V::gatherInt(table.codes, bucket);
+        V::F threshold = V::gather(table.thresholds, bucket);
+        code = V::addInt(code, V::selectInt(V::lessThan(x, threshold), zero, one));
+        code = V::selectInt(V::isNaN(x), nanCode, code);
+
+        V::F alpha = V::max(V::min(V::mul(x, v255), v255), vZero);
+        V::I encoded = V::selectIntBits(alphaLanes, V::truncate(alpha), code);
+        V::storeBytes(out + i, encoded);
+    }
+    for (; i < valueCount; ++i) {
+        out[i] = (i % 4 == 3) ? Generic::encodeAlpha(rgba[i]) : Generic::encodeChannel(rgba[i], table);
+    }
+}
+
+void applyFaults(const float* faults, uint32_t faultCount, float x,
+                 const float* ys, float* heights, uint32_t count) {
+    V::F vZero = V::set1(0.0f), vOne = V::set1(1.0f), vNegativeZero = V::set1(-0.0f);
+
+    // Each group of columns stays in registers while every fault is applied
+    uint32_t i = 0;
+    for (; i + WIDTH <= count; i += WIDTH) {
+        V::F y = V::load(ys + i);
+        V::F height = V::load(heights + i);
+        for (uint32_t f = 0; f < faultCount; ++f) {
+            const float* fault = faults + 4 * f;
+            V::F xTerm = V::set1((x - fault[0]) * fault[2]);
+            V::F ratio = V::add(xTerm, V::mul(V::sub(y, V::set1(fault[1])), V::set1(fault[3])));
+            V::F c = V::sub(vOne, V::mul(ratio, ratio));
+            V::F falloff = V::mul(c, c);
+            V::F signedFalloff = V::select(V::lessThan(vZero, ratio), falloff, V::sub(vNegativeZero, falloff));
+            height = V::add(height, V::select(V::lessThan(vZero, c), signedFalloff, vZero));
+        }
+        V::store(heights + i, height);
+    }
+    Generic::applyFaults(faults, faultCount, x, ys + i, heights + i, count - i);
+}
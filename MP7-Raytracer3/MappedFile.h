@@ -0,0 +1,34 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. The mapping lives as long as the object.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    enum class Access {
+        SEQUENTIAL,  // Streamed front to back once, as parsers do
+        WHOLE_FILE   // Used in place; prefetch all of it
+    };
+
+    bool open(const std::string& filename, Access access = Access::SEQUENTIAL);
+    void close();
+
+    const char* getData() const { return data_; }
+    size_t getSize() const { return size_; }
+    bool isOpen() const { return opened_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool opened_ = false;  // Empty files open successfully but have no mapping
+};
+
+#endif // MAPPED_FILE_H
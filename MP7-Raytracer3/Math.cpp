@@ -13,6 +13,13 @@ namespace Math {
         return 1.055f * std::pow(linearValue, 1.0f/2.4f) - 0.055f;
     }
 
+    float convertSRGBToLinear(float srgbValue) {
+        if (srgbValue <= 0.04045f) {
+            return srgbValue / 12.92f;
+        }
+        return std::pow((srgbValue + 0.055f) / 1.055f, 2.4f);
+    }
+
     float calculateExposure(float value, float exposure) {
         return 1.0f - std::exp(-exposure * value);
     }
@@ -152,4 +159,100 @@ Vector4 Vector4::times(float scalar) const {
 
 Vector3 Vector4::toVector3() const {
     return Vector3(x, y, z);
-}
\ No newline at end of file
+}
+
+// Matrix4 implementation
+Matrix4::Matrix4() {
+    for (int row = 0; row < 4; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            m[row][column] = row == column ? 1.0f : 0.0f;
+        }
+    }
+}
+
+Matrix4 Matrix4::fromColumnMajor(const float values[16]) {
+    Matrix4 result;
+    for (int column = 0; column < 4; ++column) {
+        for (int row = 0; row < 4; ++row) {
+            result.m[row][column] = values[column * 4 + row];
+        }
+    }
+    return result;
+}
+
+Vector3 Matrix4::transformPoint(const Vector3& point) const {
+    return Vector3(
+        m[0][0] * point.x + m[0][1] * point.y + m[0][2] * point.z + m[0][3],
+        m[1][0] * point.x + m[1][1] * point.y + m[1][2] * point.z + m[1][3],
+        m[2][0] * point.x + m[2][1] * point.y + m[2][2] * point.z + m[2][3]
+    );
+}
+
+Vector3 Matrix4::transformDirection(const Vector3& direction) const {
+    return Vector3(
+        m[0][0] * direction.x + m[0][1] * direction.y + m[0][2] * direction.z,
+        m[1][0] * direction.x + m[1][1] * direction.y + m[1][2] * direction.z,
+        m[2][0] * direction.x + m[2][1] * direction.y + m[2][2] * direction.z
+    );
+}
+
+Matrix4 Matrix4::multiply(const Matrix4& other) const {
+    Matrix4 result;
+    for (int row = 0; row < 4; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+                sum += m[row][k] * other.m[k][column];
+            }
+            result.m[row][column] = sum;
+        }
+    }
+    return result;
+}
+
+Matrix4 Matrix4::getTransposed() const {
+    Matrix4 result;
+    for (int row = 0; row < 4; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            result.m[row][column] = m[column][row];
+        }
+    }
+    return result;
+}
+
+bool Matrix4::getInverse(Matrix4& result) const {
+    // Gauss-Jordan elimination with partial pivoting, in double for stability
+    double a[4][8];
+    for (int row = 0; row < 4; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            a[row][column] = m[row][column];
+            a[row][column + 4] = row == column ? 1.0 : 0.0;
+        }
+    }
+
+    for (int column = 0; column < 4; ++column) {
+        int pivot = column;
+        for (int row = column + 1; row < 4; ++row) {
+            if (std::abs(a[row][column]) > std::abs(a[pivot][column])) pivot = row;
+        }
+        if (std::abs(a[pivot][column]) < 1e-12) return false;
+        if (pivot != column) {
+            for (int k = 0; k < 8; ++k) std::swap(a[pivot][k], a[column][k]);
+        }
+
+        double scale = 1.0 / a[column][column];
+        for (int k = 0; k < 8; ++k) a[column][k] *= scale;
+        for (int row = 0; row < 4; ++row) {
+            if (row == column) continue;
+            double factor = a[row][column];
+            for (int k = 0; k < 8; ++k) a[row][k] -= factor * a[column][k];
+        }
+    }
+
+    for (int row = 0; row < 4; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            result.m[row][column] = static_cast<float>(a[row][column + 4]);
+        }
+    }
+    return true;
+}
@@ -9,6 +9,7 @@ namespace Math {
     
     float clamp(float value, float minValue, float maxValue);
     float convertLinearToSRGB(float linearValue);
+    float convertSRGBToLinear(float srgbValue);
     float calculateExposure(float value, float exposure);
 }
 
@@ -67,4 +68,22 @@ public:
     float w;
 };
 
+class Matrix4 {
+public:
+    // Identity
+    Matrix4();
+
+    // 16 values in column-major order, the same layout as uniformMatrix
+    static Matrix4 fromColumnMajor(const float values[16]);
+
+    Vector3 transformPoint(const Vector3& point) const;
+    Vector3 transformDirection(const Vector3& direction) const;
+    Matrix4 multiply(const Matrix4& other) const;
+    Matrix4 getTransposed() const;
+    // Returns false (leaving result untouched) for singular matrices
+    bool getInverse(Matrix4& result) const;
+
+    float m[4][4];  // m[row][column]
+};
+
 #endif // MATH_H
\ No newline at end of file
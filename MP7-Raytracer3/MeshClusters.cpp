@@ -0,0 +1,456 @@
+#include "MeshClusters.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include "Stats.h"
+#include "Trace.h"
+
+namespace MeshClusters {
+    namespace {
+        constexpr uint32_t NO_INDEX = 0xffffffffu;
+
+        uint64_t alignUp(uint64_t value) {
+            return (value + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+        }
+
+        size_t getRecordSize(Section section) {
+            switch (section) {
+                case NODES: return sizeof(Bvh::Node);
+                case POSITIONS: return 3 * sizeof(float);
+                case NORMALS: return 3 * sizeof(float);
+                case TEXCOORDS: return 2 * sizeof(float);
+                default: return sizeof(uint32_t);
+            }
+        }
+
+        struct SectionData {
+            const void* data;
+            size_t size;
+        };
+
+        bool writeCluster(const std::string& filename, const SectionData (&sections)[SECTION_COUNT],
+                          uint64_t& fileSize, std::string& error) {
+            ClusterHeader header = {};
+            std::memcpy(header.magic, CLUSTER_MAGIC, sizeof(CLUSTER_MAGIC));
+            header.version = VERSION;
+            header.byteOrderMark = BYTE_ORDER_MARK;
+            uint64_t offset = alignUp(sizeof(header));
+            for (uint32_t section = 0; section < SECTION_COUNT; ++section) {
+                header.offsets[section] = offset;
+                header.sizes[section] = sections[section].size;
+                offset = alignUp(offset + sections[section].size);
+            }
+            header.fileSize = fileSize = offset;
+
+            std::ofstream out(filename, std::ios::binary);
+            if (!out) {
+                error = "cannot create " + filename;
+                return false;
+            }
+            const char padding[SECTION_ALIGNMENT] = {};
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            uint64_t written = sizeof(header);
+            for (uint32_t section = 0; section < SECTION_COUNT; ++section) {
+                out.write(padding, header.offsets[section] - written);
+                out.write(static_cast<const char*>(sections[section].data), sections[section].size);
+                written = header.offsets[section] + sections[section].size;
+            }
+            out.write(padding, header.fileSize - written);
+            if (!out) {
+                error = "failed writing " + filename;
+                return false;
+            }
+            return true;
+        }
+
+        // Renumbers the entries one cluster uses from 0, in order of first use
+        class Remap {
+        public:
+            explicit Remap(size_t globalCount) : local_(globalCount, NO_INDEX) {}
+
+            uint32_t get(uint32_t global) {
+                if (local_[global] == NO_INDEX) {
+                    local_[global] = static_cast<uint32_t>(used_.size());
+                    used_.push_back(global);
+                }
+                return local_[global];
+            }
+
+            const std::vector<uint32_t>& getUsed() const { return used_; }
+
+            void reset() {
+                for (uint32_t global : used_) local_[global] = NO_INDEX;
+                used_.clear();
+            }
+
+        private:
+            std::vector<uint32_t> local_;
+            std::vector<uint32_t> used_;
+        };
+
+        // First and one past the last primitive index below a node; build lays
+        // every subtree out contiguously
+        void getRange(const Numa::Array<Bvh::Node>& nodes, uint32_t node, uint32_t& begin, uint32_t& end) {
+            uint32_t first = node;
+            while (nodes[first].primitiveCount == 0) first = first + 1;
+            uint32_t last = node;
+            while (nodes[last].primitiveCount == 0) last = nodes[last].firstIndex;
+            begin = nodes[first].firstIndex;
+            end = nodes[last].firstIndex + nodes[last].primitiveCount;
+        }
+    }
+
+    std::string getClusterFilename(const std::string& indexFilename, uint32_t cluster) {
+        return indexFilename + "." + std::to_string(cluster);
+    }
+
+    bool write(const ObjMesh& mesh, const std::string& indexFilename, size_t clusterBytes,
+               uint32_t& clusterCount, std::string& error) {
+        size_t triangleCount = mesh.getTriangleCount();
+        if (triangleCount == 0) {
+            error = "the mesh has no triangles";
+            return false;
+        }
+        bool hasNormals = !mesh.normalIndices.empty();
+        bool hasTexcoords = !mesh.texcoordIndices.empty();
+
+        std::vector<BoundingBox> triangleBounds(triangleCount);
+        for (size_t i = 0; i < triangleCount; ++i) {
+            for (int corner = 0; corner < 3; ++corner) {
+                triangleBounds[i].expand(mesh.positions[mesh.positionIndices[3 * i + corner]]);
+            }
+        }
+        Bvh bvh;
+        bvh.build(triangleBounds);
+
+        // Rough bytes per triangle: indices, about half a vertex of each kind and two BVH nodes per leaf
+        size_t triangleBytes = 4 + 12 + 6 + 16 + (hasNormals ? 18 : 0) + (hasTexcoords ? 16 : 0);
+        uint32_t maxTriangles = static_cast<uint32_t>(std::max<size_t>(Bvh::MAX_LEAF_SIZE,
+                                                                       clusterBytes / triangleBytes));
+        const Numa::Array<Bvh::Node>& nodes = bvh.getNodes();
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;
+        std::vector<uint32_t> pending = {0};
+        while (!pending.empty()) {
+            uint32_t node = pending.back();
+            pending.pop_back();
+            uint32_t begin, end;
+            getRange(nodes, node, begin, end);
+            if (end - begin <= maxTriangles || nodes[node].primitiveCount > 0) {
+                ranges.push_back({begin, end});
+            } else {
+                pending.push_back(nodes[node].firstIndex);
+                pending.push_back(node + 1);
+            }
+        }
+
+        Remap positionRemap(mesh.positions.size());
+        Remap normalRemap(mesh.normals.size());
+        Remap texcoordRemap(mesh.texcoords.size() / 2);
+        std::vector<ClusterRecord> records;
+        uint32_t firstTriangle = 0;
+        for (const auto& range : ranges) {
+            const uint32_t* triangles = &bvh.getPrimitiveIndices()[range.first];
+            uint32_t count = range.second - range.first;
+            std::vector<uint32_t> positionIndices, normalIndices, texcoordIndices;
+            std::vector<BoundingBox> localBounds(count);
+            BoundingBox clusterBounds;
+            for (uint32_t i = 0; i < count; ++i) {
+                for (int corner = 0; corner < 3; ++corner) {
+                    size_t global = 3 * static_cast<size_t>(triangles[i]) + corner;
+                    positionIndices.push_back(positionRemap.get(mesh.positionIndices[global]));
+                    if (hasNormals) normalIndices.push_back(normalRemap.get(mesh.normalIndices[global]));
+                    if (hasTexcoords) texcoordIndices.push_back(texcoordRemap.get(mesh.texcoordIndices[global]));
+                }
+                localBounds[i] = triangleBounds[triangles[i]];
+                clusterBounds.expand(localBounds[i]);
+            }
+
+            std::vector<float> positions, normals, texcoords;
+            for (uint32_t global : positionRemap.getUsed()) {
+                positions.insert(positions.end(), {mesh.positions[global].x, mesh.positions[global].y,
+                                                   mesh.positions[global].z});
+            }
+            for (uint32_t global : normalRemap.getUsed()) {
+                normals.insert(normals.end(), {mesh.normals[global].x, mesh.normals[global].y,
+                                               mesh.normals[global].z});
+            }
+            for (uint32_t global : texcoordRemap.getUsed()) {
+                texcoords.insert(texcoords.end(), {mesh.texcoords[2 * global], mesh.texcoords[2 * global + 1]});
+            }
+            positionRemap.reset();
+            normalRemap.reset();
+            texcoordRemap.reset();
+
+            Bvh clusterBvh;
+            clusterBvh.build(localBounds);
+            const SectionData sections[SECTION_COUNT] = {
+                {clusterBvh.getNodes().data(), clusterBvh.getNodes().size() * sizeof(Bvh::Node)},
+                {clusterBvh.getPrimitiveIndices().data(), clusterBvh.getPrimitiveIndices().size() * sizeof(uint32_t)},
+                {positions.data(), positions.size() * sizeof(float)},
+                {positionIndices.data(), positionIndices.size() * sizeof(uint32_t)},
+                {normals.data(), normals.size() * sizeof(float)},
+                {normalIndices.data(), normalIndices.size() * sizeof(uint32_t)},
+                {texcoords.data(), texcoords.size() * sizeof(float)},
+                {texcoordIndices.data(), texcoordIndices.size() * sizeof(uint32_t)}
+            };
+
+            ClusterRecord record = {
+                {clusterBounds.min.x, clusterBounds.min.y, clusterBounds.min.z},
+                {clusterBounds.max.x, clusterBounds.max.y, clusterBounds.max.z},
+                firstTriangle, count, 0
+            };
+            uint32_t cluster = static_cast<uint32_t>(records.size());
+            if (!writeCluster(getClusterFilename(indexFilename, cluster), sections, record.fileSize, error)) {
+                return false;
+            }
+            records.push_back(record);
+            firstTriangle += count;
+        }
+
+        IndexHeader header = {};
+        std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        header.version = VERSION;
+        header.byteOrderMark = BYTE_ORDER_MARK;
+        header.clusterCount = static_cast<uint32_t>(records.size());
+        header.triangleCount = firstTriangle;
+        std::ofstream out(indexFilename, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()),
+                  static_cast<std::streamsize>(records.size() * sizeof(ClusterRecord)));
+        if (!out) {
+            error = "failed writing " + indexFilename;
+            return false;
+        }
+        clusterCount = header.clusterCount;
+        return true;
+    }
+
+    bool readIndex(const std::string& indexFilename, std::vector<ClusterRecord>& clusters, std::string& error) {
+        std::ifstream in(indexFilename, std::ios::binary);
+        if (!in) {
+            error = "cannot open " + indexFilename;
+            return false;
+        }
+        IndexHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+            error = indexFilename + " is not a cluster index";
+            return false;
+        }
+        if (header.byteOrderMark != BYTE_ORDER_MARK || header.version != VERSION) {
+            error = indexFilename + " was written by a different version or machine; rebuild it with --cluster";
+            return false;
+        }
+        clusters.resize(header.clusterCount);
+        if (!in.read(reinterpret_cast<char*>(clusters.data()),
+                     static_cast<std::streamsize>(clusters.size() * sizeof(ClusterRecord)))) {
+            error = indexFilename + " is truncated";
+            return false;
+        }
+
+        uint64_t nextTriangle = 0;
+        for (uint32_t cluster = 0; cluster < header.clusterCount; ++cluster) {
+            const ClusterRecord& record = clusters[cluster];
+            std::string filename = getClusterFilename(indexFilename, cluster);
+            std::ifstream file(filename, std::ios::binary | std::ios::ate);
+            ClusterHeader clusterHeader;
+            uint64_t size = file ? static_cast<uint64_t>(file.tellg()) : 0;
+            if (!file || !file.seekg(0) ||
+                !file.read(reinterpret_cast<char*>(&clusterHeader), sizeof(clusterHeader)) ||
+                std::memcmp(clusterHeader.magic, CLUSTER_MAGIC, sizeof(CLUSTER_MAGIC)) != 0 ||
+                clusterHeader.version != VERSION || clusterHeader.byteOrderMark != BYTE_ORDER_MARK) {
+                error = "cannot read cluster " + filename;
+                return false;
+            }
+            if (record.firstTriangle != nextTriangle || record.triangleCount == 0 ||
+                clusterHeader.fileSize != size || record.fileSize != size) {
+                error = filename + " does not match " + indexFilename;
+                return false;
+            }
+            nextTriangle += record.triangleCount;
+
+            uint64_t corners = 3ull * record.triangleCount * sizeof(uint32_t);
+            for (uint32_t i = 0; i < SECTION_COUNT; ++i) {
+                Section section = static_cast<Section>(i);
+                uint64_t offset = clusterHeader.offsets[section];
+                uint64_t bytes = clusterHeader.sizes[section];
+                bool sizeMatches = section == NODES ? bytes > 0 :
+                                   section == PRIMITIVES ? bytes == record.triangleCount * sizeof(uint32_t) :
+                                   section == POSITION_INDICES ? bytes == corners :
+                                   section == NORMAL_INDICES || section == TEXCOORD_INDICES ?
+                                       bytes == 0 || bytes == corners : true;
+                if (offset % SECTION_ALIGNMENT != 0 || offset > size || bytes > size - offset ||
+                    bytes % getRecordSize(section) != 0 || !sizeMatches) {
+                    error = filename + " has a corrupt section table";
+                    return false;
+                }
+            }
+        }
+        if (nextTriangle != header.triangleCount) {
+            error = indexFilename + " does not match its clusters";
+            return false;
+        }
+        return true;
+    }
+
+    ClusterView getView(const char* data) {
+        const ClusterHeader& header = *reinterpret_cast<const ClusterHeader*>(data);
+        auto get = [&](Section section) { return data + header.offsets[section]; };
+        auto getOptional = [&](Section section) { return header.sizes[section] ? get(section) : nullptr; };
+        return {
+            reinterpret_cast<const Bvh::Node*>(get(NODES)),
+            reinterpret_cast<const uint32_t*>(get(PRIMITIVES)),
+            reinterpret_cast<const float*>(get(POSITIONS)),
+            reinterpret_cast<const uint32_t*>(get(POSITION_INDICES)),
+            reinterpret_cast<const float*>(get(NORMALS)),
+            reinterpret_cast<const uint32_t*>(getOptional(NORMAL_INDICES)),
+            reinterpret_cast<const float*>(get(TEXCOORDS)),
+            reinterpret_cast<const uint32_t*>(getOptional(TEXCOORD_INDICES))
+        };
+    }
+
+    bool isValid(const char* data, uint32_t triangleCount) {
+        const ClusterHeader& header = *reinterpret_cast<const ClusterHeader*>(data);
+        ClusterView view = getView(data);
+        auto getCount = [&](Section section) { return header.sizes[section] / getRecordSize(section); };
+        auto allBelow = [&](const uint32_t* indices, uint64_t count, uint64_t limit) {
+            return !indices || std::all_of(indices, indices + count, [&](uint32_t index) { return index < limit; });
+        };
+
+        // Interior nodes are followed by their left child and point forward to
+        // the right one, no deeper than the traversal stack allows
+        uint64_t nodeCount = getCount(NODES);
+        std::vector<uint8_t> depths(nodeCount, 0);
+        for (uint64_t i = 0; i < nodeCount; ++i) {
+            const Bvh::Node& node = view.nodes[i];
+            if (node.primitiveCount > 0) {
+                if (node.firstIndex > triangleCount || node.primitiveCount > triangleCount - node.firstIndex) {
+                    return false;
+                }
+                continue;
+            }
+            if (i + 1 >= nodeCount || node.firstIndex <= i + 1 || node.firstIndex >= nodeCount ||
+                depths[i] >= Bvh::MAX_DEPTH) {
+                return false;
+            }
+            depths[i + 1] = std::max<uint8_t>(depths[i + 1], depths[i] + 1);
+            depths[node.firstIndex] = std::max<uint8_t>(depths[node.firstIndex], depths[i] + 1);
+        }
+        uint64_t corners = 3ull * triangleCount;
+        return allBelow(view.primitives, triangleCount, triangleCount) &&
+               allBelow(view.positionIndices, corners, getCount(POSITIONS)) &&
+               allBelow(view.normalIndices, corners, getCount(NORMALS)) &&
+               allBelow(view.texcoordIndices, corners, getCount(TEXCOORDS));
+    }
+}
+
+namespace {
+    thread_local ClusterCache::Deferral* currentDeferral = nullptr;
+}
+
+ClusterCache::Deferral::Deferral() : previous_(currentDeferral) { currentDeferral = this; }
+
+ClusterCache::Deferral::~Deferral() { currentDeferral = previous_; }
+
+void ClusterCache::setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+}
+
+size_t ClusterCache::getBudget() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_;
+}
+
+uint32_t ClusterCache::add(const std::string& filename, const MeshClusters::ClusterRecord& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.emplace_back();
+    Entry& entry = entries_.back();
+    entry.filename = filename;
+    entry.size = record.fileSize;
+    entry.triangleCount = record.triangleCount;
+    return static_cast<uint32_t>(entries_.size() - 1);
+}
+
+const char* ClusterCache::tryPin(uint32_t id) {
+    Entry& entry = entries_[id];
+    entry.pins.fetch_add(1);
+    const char* data = entry.data.load();
+    if (data) {
+        // Read first, so clusters many threads keep using stay shared in their caches
+        if (!entry.used.load(std::memory_order_relaxed)) entry.used.store(true, std::memory_order_relaxed);
+        return data;
+    }
+    entry.pins.fetch_sub(1);
+    return nullptr;
+}
+
+const char* ClusterCache::pin(uint32_t id) {
+    if (const char* data = tryPin(id)) return data;
+    Deferral* deferral = currentDeferral;
+    if (deferral && deferral->active_) {
+        if (!deferral->cache_) {
+            deferral->cache_ = this;
+            deferral->cluster_ = id;
+        }
+        return nullptr;
+    }
+    return load(id);
+}
+
+const char* ClusterCache::load(uint32_t id) {
+    if (const char* data = tryPin(id)) return data;
+
+    Entry& entry = entries_[id];
+    entry.pins.fetch_add(1);
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Another thread may have loaded it meanwhile
+    if (const char* data = entry.data.load()) return data;
+    if (entry.unreadable) {
+        entry.pins.fetch_sub(1);
+        return nullptr;
+    }
+
+    Trace::Scope trace("cluster load", "%s", entry.filename.c_str());
+    makeRoom(entry.size);
+    if (!entry.file.open(entry.filename, MappedFile::Access::WHOLE_FILE) || entry.file.getSize() != entry.size ||
+        !MeshClusters::isValid(entry.file.getData(), entry.triangleCount)) {
+        entry.file.close();
+        entry.unreadable = true;
+        entry.pins.fetch_sub(1);
+        return nullptr;
+    }
+    residentBytes_ += entry.size;
+    RT_STAT_ADD(clusterLoads, 1);
+    RT_STAT_ADD(clusterLoadBytes, entry.size);
+    entry.used.store(false, std::memory_order_relaxed);
+    lru_.push_back(id);
+    entry.data.store(entry.file.getData());
+    return entry.file.getData();
+}
+
+// Takes mapped clusters from the front of lru_, giving any used since it was
+// queued, or pinned, another turn at the back. Two rounds through the queue
+// evict everything unpinned, so one that is all pinned ends the search.
+void ClusterCache::makeRoom(uint64_t size) {
+    size_t turns = 2 * lru_.size();
+    while (residentBytes_ + size > budget_ && !lru_.empty() && turns-- > 0) {
+        uint32_t id = lru_.front();
+        lru_.pop_front();
+        Entry& entry = entries_[id];
+        if (entry.used.exchange(false, std::memory_order_relaxed) || entry.pins.load() > 0) {
+            lru_.push_back(id);
+            continue;
+        }
+
+        entry.data.store(nullptr);
+        if (entry.pins.load() > 0) {
+            entry.data.store(entry.file.getData());
+            lru_.push_back(id);
+            continue;
+        }
+        entry.file.close();
+        residentBytes_ -= entry.size;
+        RT_STAT_ADD(clusterEvictions, 1);
+    }
+}
@@ -0,0 +1,169 @@
+#ifndef MESH_CLUSTERS_H
+#define MESH_CLUSTERS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Bvh.h"
+#include "MappedFile.h"
+#include "ObjLoader.h"
+
+// Triangle meshes kept out of core: an index file (.rtc) holding the bounds of
+// every cluster, and one file per cluster, <index>.<n>, with a few MB of
+// triangles and their own BVH in the layout Bvh::build produces. Like compiled
+// scenes the files are in host byte order with 64-byte aligned sections, so a
+// mapped cluster is used in place.
+namespace MeshClusters {
+    constexpr char INDEX_MAGIC[8] = {'R', 'T', 'C', 'L', 'I', 'D', 'X', '\0'};
+    constexpr char CLUSTER_MAGIC[8] = {'R', 'T', 'C', 'L', 'U', 'S', 'T', '\0'};
+    constexpr uint32_t VERSION = 1;
+    constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+    constexpr size_t SECTION_ALIGNMENT = 64;
+    constexpr size_t DEFAULT_CLUSTER_BYTES = size_t(4) << 20;
+
+    struct IndexHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrderMark;
+        uint32_t clusterCount;
+        uint32_t triangleCount;
+    };
+
+    struct ClusterRecord {
+        float boundsMin[3];
+        float boundsMax[3];
+        uint32_t firstTriangle;  // Triangles are numbered across the whole mesh
+        uint32_t triangleCount;
+        uint64_t fileSize;
+    };
+
+    enum Section : uint32_t {
+        NODES,             // Bvh::Node
+        PRIMITIVES,        // uint32_t, the BVH's primitive indices
+        POSITIONS,         // float[3]
+        POSITION_INDICES,  // uint32_t, 3 per triangle
+        NORMALS,           // float[3]
+        NORMAL_INDICES,    // Empty, or 3 per triangle
+        TEXCOORDS,         // float[2]
+        TEXCOORD_INDICES,  // Empty, or 3 per triangle
+        SECTION_COUNT
+    };
+
+    struct ClusterHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrderMark;
+        uint64_t fileSize;
+        uint64_t offsets[SECTION_COUNT];  // Bytes from the start of the file
+        uint64_t sizes[SECTION_COUNT];    // Bytes
+    };
+
+    // Arrays of a mapped cluster; the index arrays without data are nullptr
+    struct ClusterView {
+        const Bvh::Node* nodes;
+        const uint32_t* primitives;
+        const float* positions;
+        const uint32_t* positionIndices;
+        const float* normals;
+        const uint32_t* normalIndices;
+        const float* texcoords;
+        const uint32_t* texcoordIndices;
+    };
+
+    std::string getClusterFilename(const std::string& indexFilename, uint32_t cluster);
+
+    // Cuts the mesh's BVH into subtrees of about clusterBytes each and writes
+    // them as clusters next to the index; clusterCount receives how many
+    bool write(const ObjMesh& mesh, const std::string& indexFilename, size_t clusterBytes,
+               uint32_t& clusterCount, std::string& error);
+
+    // Reads the index and checks the header and section table of every
+    // cluster file without reading the triangles
+    bool readIndex(const std::string& indexFilename, std::vector<ClusterRecord>& clusters, std::string& error);
+
+    // For a cluster whose header readIndex accepted
+    ClusterView getView(const char* data);
+    // Whether every node and index of a mapped cluster stays in range
+    bool isValid(const char* data, uint32_t triangleCount);
+}
+
+// Mapped cluster files kept within a byte budget. A ray pins the clusters it
+// is using; mapping a new one first unmaps the least recently used unpinned
+// ones until it fits. When everything mapped is pinned the budget is exceeded
+// rather than failing the render.
+class ClusterCache {
+public:
+    static constexpr size_t DEFAULT_BUDGET = size_t(2) << 30;
+
+    // While one is active on a thread, pin there leaves clusters that are not
+    // mapped alone: it fails instead and notes the first it refused, so the
+    // caller can set the ray aside and trace it again once that cluster is in
+    class Deferral {
+    public:
+        Deferral();
+        ~Deferral();
+        Deferral(const Deferral&) = delete;
+        Deferral& operator=(const Deferral&) = delete;
+
+        void setActive(bool active) { active_ = active; }
+        bool hasMissed() const { return cache_ != nullptr; }
+        ClusterCache* getCache() const { return cache_; }
+        uint32_t getCluster() const { return cluster_; }
+        void clear() { cache_ = nullptr; }
+
+    private:
+        friend class ClusterCache;
+
+        Deferral* previous_;
+        bool active_ = true;
+        ClusterCache* cache_ = nullptr;
+        uint32_t cluster_ = 0;
+    };
+
+    void setBudget(size_t bytes);
+    size_t getBudget() const;
+
+    // Registers a cluster file readIndex accepted and returns its id. Not
+    // thread safe against renders in progress.
+    uint32_t add(const std::string& filename, const MeshClusters::ClusterRecord& record);
+
+    // Pins the cluster if it is mapped; nullptr instead of waiting for a load
+    const char* tryPin(uint32_t id);
+    // Pins the cluster, mapping it first if needed; nullptr if its file can no
+    // longer be read or holds out-of-range indices, or if the thread defers
+    const char* pin(uint32_t id);
+    // Same, mapping it even while the thread defers
+    const char* load(uint32_t id);
+    void unpin(uint32_t id) { entries_[id].pins.fetch_sub(1); }
+
+private:
+    // A reader pins before looking at data and an evictor clears data before
+    // looking at the pins, so one of them always sees the other
+    struct Entry {
+        std::string filename;
+        uint64_t size;
+        uint32_t triangleCount;
+        MappedFile file;
+        std::atomic<const char*> data{nullptr};
+        std::atomic<int> pins{0};
+        std::atomic<bool> used{false};  // Since it was last queued in lru_
+        bool unreadable = false;
+    };
+
+    mutable std::mutex mutex_;  // Guards loads, evictions and the fields below
+    std::deque<Entry> entries_;
+    // Ids of the mapped clusters, least recently loaded or passed over first.
+    // Pins only flag an entry as used, so they take no lock; eviction moves
+    // used entries to the back instead of scanning for the oldest.
+    std::deque<uint32_t> lru_;
+    size_t budget_ = DEFAULT_BUDGET;
+    uint64_t residentBytes_ = 0;
+
+    void makeRoom(uint64_t size);
+};
+
+#endif // MESH_CLUSTERS_H
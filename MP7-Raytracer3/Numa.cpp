@@ -0,0 +1,148 @@
+#include "Numa.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+    // Parses a sysfs CPU list such as "0-3,8,10-11"
+    std::vector<int> parseCpuList(const std::string& text) {
+        std::vector<int> cpus;
+        std::stringstream stream(text);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            if (range.empty() || range[0] < '0' || range[0] > '9') continue;
+            size_t dash = range.find('-');
+            int first = std::atoi(range.c_str());
+            int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    std::vector<std::vector<int>> readTopology() {
+        std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool haveAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+        auto isAllowed = [&](int cpu) {
+            return !haveAffinity || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+        };
+
+        std::vector<int> nodeIds;
+        if (DIR* directory = opendir("/sys/devices/system/node")) {
+            while (dirent* entry = readdir(directory)) {
+                std::string name = entry->d_name;
+                if (name.size() > 4 && name.compare(0, 4, "node") == 0 && name[4] >= '0' && name[4] <= '9') {
+                    nodeIds.push_back(std::atoi(name.c_str() + 4));
+                }
+            }
+            closedir(directory);
+        }
+        std::sort(nodeIds.begin(), nodeIds.end());
+        for (int id : nodeIds) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            std::string text;
+            std::getline(file, text);
+            std::vector<int> cpus;
+            for (int cpu : parseCpuList(text)) {
+                if (isAllowed(cpu)) cpus.push_back(cpu);
+            }
+            if (!cpus.empty()) nodes.push_back(std::move(cpus));
+        }
+
+        if (nodes.empty()) {
+            std::vector<int> cpus;
+            for (int cpu = 0; cpu < CPU_SETSIZE && haveAffinity; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+            }
+            nodes.push_back(std::move(cpus));
+        }
+#else
+        nodes.emplace_back();
+#endif
+        return nodes;
+    }
+
+#ifdef __linux__
+    bool setAffinity(const std::vector<int>& cpus) {
+        if (cpus.empty()) return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+#else
+    bool setAffinity(const std::vector<int>&) { return false; }
+#endif
+
+    size_t roundToHugePages(size_t bytes) {
+        return (bytes + Numa::HUGE_PAGE_SIZE - 1) / Numa::HUGE_PAGE_SIZE * Numa::HUGE_PAGE_SIZE;
+    }
+}
+
+namespace Numa {
+    const std::vector<std::vector<int>>& getNodeCpus() {
+        static const std::vector<std::vector<int>> nodes = readTopology();
+        return nodes;
+    }
+
+    unsigned getNodeCount() { return static_cast<unsigned>(getNodeCpus().size()); }
+
+    unsigned getWorkerNode(unsigned worker) { return worker % getNodeCount(); }
+
+    bool pinWorker(unsigned worker) {
+        const std::vector<std::vector<int>>& nodes = getNodeCpus();
+        unsigned node = getWorkerNode(worker);
+        const std::vector<int>& cpus = nodes[node];
+        if (cpus.empty()) return false;
+        if (!setAffinity({cpus[worker / nodes.size() % cpus.size()]})) return false;
+        detail::currentNode = node;
+        return true;
+    }
+
+    void* allocate(size_t bytes, bool hugePages) {
+        if (bytes < HUGE_PAGE_SIZE) {
+            return ::operator new(bytes);
+        }
+        size_t size = roundToHugePages(bytes);
+        hugePages = hugePages && detail::hugePages;
+#ifdef MAP_HUGETLB
+        if (hugePages) {
+            void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (data != MAP_FAILED) return data;
+        }
+#endif
+
+        // Over-map by a huge page and trim, so the block starts on a huge page boundary
+        void* mapping = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        char* start = static_cast<char*>(mapping);
+        char* data = start + (HUGE_PAGE_SIZE - reinterpret_cast<uintptr_t>(start) % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+        if (data > start) munmap(start, data - start);
+        if (data + size < start + size + HUGE_PAGE_SIZE) munmap(data + size, start + HUGE_PAGE_SIZE - data);
+#ifdef MADV_HUGEPAGE
+        if (hugePages) madvise(data, size, MADV_HUGEPAGE);
+#endif
+        return data;
+    }
+
+    void deallocate(void* data, size_t bytes) {
+        if (bytes < HUGE_PAGE_SIZE) {
+            ::operator delete(data);
+            return;
+        }
+        munmap(data, roundToHugePages(bytes));
+    }
+}
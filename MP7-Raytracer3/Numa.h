@@ -0,0 +1,88 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Placement of render threads and large arrays on NUMA machines. The topology
+// comes from Linux's /sys/devices/system/node; elsewhere, or without it, the
+// machine is one node and pinning does nothing.
+namespace Numa {
+    constexpr unsigned NO_NODE = ~0u;
+    constexpr size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+    // CPUs of each node that this process may run on; nodes without any are left out
+    const std::vector<std::vector<int>>& getNodeCpus();
+    unsigned getNodeCount();
+
+    // Worker n runs on node n % getNodeCount(), on its own CPU there while
+    // there are enough; false if the system refused
+    unsigned getWorkerNode(unsigned worker);
+    bool pinWorker(unsigned worker);
+
+    namespace detail {
+        inline thread_local unsigned currentNode = NO_NODE;
+        inline thread_local bool hugePages = false;
+    }
+    // Node the calling thread was pinned to, NO_NODE if it was not
+    inline unsigned getCurrentNode() { return detail::currentNode; }
+
+    // While it lives, arrays that ask for huge pages and that the calling
+    // thread allocates get them if enabled: explicit ones (MAP_HUGETLB) if the
+    // system has any reserved, else transparent ones. Each renderer opens one
+    // around its own builds, so the choice is not the whole process's.
+    class HugePages {
+    public:
+        explicit HugePages(bool enabled) : previous_(detail::hugePages) { detail::hugePages = enabled; }
+        ~HugePages() { detail::hugePages = previous_; }
+        HugePages(const HugePages&) = delete;
+        HugePages& operator=(const HugePages&) = delete;
+
+    private:
+        bool previous_;
+    };
+
+    // At least HUGE_PAGE_SIZE bytes come straight from the kernel, aligned to
+    // it and untouched, so each page lands on the node of the thread that
+    // first writes it; smaller blocks come from operator new
+    void* allocate(size_t bytes, bool hugePages);
+    void deallocate(void* data, size_t bytes);
+
+    // Allocator for std::vector over the above. Default construction leaves
+    // elements uninitialized, so resizing does not touch the pages either.
+    template <typename T, bool hugePages>
+    struct Allocator {
+        typedef T value_type;
+        template <typename U>
+        struct rebind {
+            typedef Allocator<U, hugePages> other;
+        };
+
+        Allocator() = default;
+        template <typename U>
+        Allocator(const Allocator<U, hugePages>&) {}
+
+        T* allocate(size_t count) { return static_cast<T*>(Numa::allocate(count * sizeof(T), hugePages)); }
+        void deallocate(T* data, size_t count) { Numa::deallocate(data, count * sizeof(T)); }
+
+        template <typename U>
+        void construct(U* place) { ::new (static_cast<void*>(place)) U; }
+        template <typename U, typename... Args>
+        void construct(U* place, Args&&... args) { ::new (static_cast<void*>(place)) U(std::forward<Args>(args)...); }
+
+        bool operator==(const Allocator&) const { return true; }
+        bool operator!=(const Allocator&) const { return false; }
+    };
+
+    // Read-mostly arrays, on huge pages when enabled
+    template <typename T>
+    using Array = std::vector<T, Allocator<T, true>>;
+    // Arrays written in parts by different threads, on small pages so that
+    // each part can land on its writer's node
+    template <typename T>
+    using FirstTouchArray = std::vector<T, Allocator<T, false>>;
+}
+
+#endif // NUMA_H
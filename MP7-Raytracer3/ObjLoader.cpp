@@ -0,0 +1,386 @@
+#include "ObjLoader.h"
+#include <algorithm>
+#include <thread>
+#include "MappedFile.h"
+
+namespace {
+    // Files smaller than this are parsed on the calling thread
+    constexpr size_t MIN_CHUNK_SIZE = 1 << 20;
+
+    struct Chunk {
+        const char* begin;
+        const char* end;
+
+        std::vector<Vector3> positions;
+        std::vector<Vector3> normals;
+        std::vector<float> texcoords;
+
+        // Triangle corners as 0-based indices; -1 when a corner omits vt or vn.
+        // Negative OBJ indices resolve against this chunk's own counts, so the
+        // corners listed in the relative* arrays still need the chunk offset added.
+        std::vector<int32_t> positionCorners;
+        std::vector<int32_t> texcoordCorners;
+        std::vector<int32_t> normalCorners;
+        std::vector<size_t> relativePositions;
+        std::vector<size_t> relativeTexcoords;
+        std::vector<size_t> relativeNormals;
+        std::vector<uint32_t> faceSizes;
+        bool allCornersHaveTexcoords = true;
+        bool allCornersHaveNormals = true;
+
+        size_t errorLine = 0;  // Line within the chunk, 1-based; zero when parsing succeeded
+        std::string error;
+
+        size_t positionOffset = 0;
+        size_t texcoordOffset = 0;
+        size_t normalOffset = 0;
+        size_t triangleOffset = 0;
+        size_t faceOffset = 0;
+    };
+
+    inline bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline void skipSpaces(const char*& p, const char* end) {
+        while (p < end && isSpace(*p)) ++p;
+    }
+
+    inline const char* findLineEnd(const char* p, const char* end) {
+        while (p < end && *p != '\n') ++p;
+        return p;
+    }
+
+    bool parseInt(const char*& p, const char* end, long& value) {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            ++p;
+        }
+        if (p >= end || *p < '0' || *p > '9') return false;
+        long result = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            result = result * 10 + (*p - '0');
+            ++p;
+        }
+        value = negative ? -result : result;
+        return true;
+    }
+
+    // Decimal float with optional fraction and exponent; accurate to float precision
+    bool parseFloat(const char*& p, const char* end, float& value) {
+        static const double powersOfTen[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        const char* start = p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            ++p;
+        }
+
+        uint64_t mantissa = 0;
+        int exponent = 0;
+        int digits = 0;
+        bool anyDigits = false;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) ++digits;
+            } else {
+                ++exponent;
+            }
+            anyDigits = true;
+            ++p;
+        }
+        if (p < end && *p == '.') {
+            ++p;
+            while (p < end && *p >= '0' && *p <= '9') {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    if (mantissa) ++digits;
+                    --exponent;
+                }
+                anyDigits = true;
+                ++p;
+            }
+        }
+        if (!anyDigits) {
+            p = start;
+            return false;
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            const char* exponentStart = p;
+            ++p;
+            long explicitExponent;
+            if (parseInt(p, end, explicitExponent)) {
+                exponent += static_cast<int>(explicitExponent);
+            } else {
+                p = exponentStart;
+            }
+        }
+
+        double result = static_cast<double>(mantissa);
+        if (exponent < 0) {
+            while (exponent < -22) {
+                result /= 1e22;
+                exponent += 22;
+            }
+            result /= powersOfTen[-exponent];
+        } else {
+            while (exponent > 22) {
+                result *= 1e22;
+                exponent -= 22;
+            }
+            result *= powersOfTen[exponent];
+        }
+        value = static_cast<float>(negative ? -result : result);
+        return true;
+    }
+
+    bool parseFloats(const char*& p, const char* end, float* values, int count) {
+        for (int i = 0; i < count; ++i) {
+            skipSpaces(p, end);
+            if (!parseFloat(p, end, values[i])) return false;
+        }
+        return true;
+    }
+
+    // Converts a 1-based or negative OBJ index to 0-based, noting relative ones for fix-up
+    bool resolveIndex(long raw, size_t localCount, std::vector<int32_t>& corners,
+                      std::vector<size_t>& relative) {
+        if (raw > 0) {
+            corners.push_back(static_cast<int32_t>(raw - 1));
+        } else if (raw < 0) {
+            relative.push_back(corners.size());
+            corners.push_back(static_cast<int32_t>(static_cast<long>(localCount) + raw));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    struct FaceCorner {
+        long position;
+        long texcoord;  // 0 when absent
+        long normal;    // 0 when absent
+    };
+
+    bool parseFace(const char*& p, const char* end, Chunk& chunk, std::vector<FaceCorner>& corners) {
+        corners.clear();
+        while (true) {
+            skipSpaces(p, end);
+            if (p >= end || *p == '\n' || *p == '#') break;
+
+            FaceCorner corner = {0, 0, 0};
+            if (!parseInt(p, end, corner.position)) return false;
+            if (p < end && *p == '/') {
+                ++p;
+                if (p < end && *p != '/') {
+                    if (!parseInt(p, end, corner.texcoord)) return false;
+                }
+                if (p < end && *p == '/') {
+                    ++p;
+                    if (!parseInt(p, end, corner.normal)) return false;
+                }
+            }
+            corners.push_back(corner);
+        }
+        if (corners.size() < 3) return false;
+        chunk.faceSizes.push_back(static_cast<uint32_t>(corners.size()));
+
+        // Fan triangulation around the first corner, as the WebGL OBJ parser does
+        for (size_t i = 1; i + 1 < corners.size(); ++i) {
+            const FaceCorner* triangle[3] = {&corners[0], &corners[i], &corners[i + 1]};
+            for (const FaceCorner* corner : triangle) {
+                if (!resolveIndex(corner->position, chunk.positions.size(),
+                                  chunk.positionCorners, chunk.relativePositions)) {
+                    return false;
+                }
+                if (corner->texcoord != 0) {
+                    resolveIndex(corner->texcoord, chunk.texcoords.size() / 2,
+                                 chunk.texcoordCorners, chunk.relativeTexcoords);
+                } else {
+                    chunk.texcoordCorners.push_back(-1);
+                    chunk.allCornersHaveTexcoords = false;
+                }
+                if (corner->normal != 0) {
+                    resolveIndex(corner->normal, chunk.normals.size(),
+                                 chunk.normalCorners, chunk.relativeNormals);
+                } else {
+                    chunk.normalCorners.push_back(-1);
+                    chunk.allCornersHaveNormals = false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void parseChunk(Chunk& chunk) {
+        std::vector<FaceCorner> corners;
+        const char* p = chunk.begin;
+        const char* end = chunk.end;
+        size_t line = 0;
+
+        while (p < end) {
+            ++line;
+            const char* lineEnd = findLineEnd(p, end);
+            skipSpaces(p, lineEnd);
+
+            bool ok = true;
+            if (p + 1 < lineEnd && p[0] == 'v' && isSpace(p[1])) {
+                p += 1;
+                float xyz[3];
+                ok = parseFloats(p, lineEnd, xyz, 3);
+                chunk.positions.push_back(Vector3(xyz[0], xyz[1], xyz[2]));
+            } else if (p + 2 < lineEnd && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+                p += 2;
+                float xyz[3];
+                ok = parseFloats(p, lineEnd, xyz, 3);
+                chunk.normals.push_back(Vector3(xyz[0], xyz[1], xyz[2]));
+            } else if (p + 2 < lineEnd && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+                p += 2;
+                float uv[2];
+                ok = parseFloats(p, lineEnd, uv, 2);
+                chunk.texcoords.push_back(uv[0]);
+                chunk.texcoords.push_back(uv[1]);
+            } else if (p + 1 < lineEnd && p[0] == 'f' && isSpace(p[1])) {
+                p += 1;
+                ok = parseFace(p, lineEnd, chunk, corners);
+            }
+            // Other records (comments, g, o, s, usemtl, mtllib) are ignored
+
+            if (!ok) {
+                chunk.errorLine = line;
+                chunk.error = "malformed record";
+                return;
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    // Adds the chunk offsets to relative indices and range-checks every corner,
+    // writing this chunk's triangles into its slice of the final index arrays
+    bool resolveChunk(Chunk& chunk, ObjMesh& mesh, bool useTexcoords, bool useNormals) {
+        for (size_t corner : chunk.relativePositions) {
+            chunk.positionCorners[corner] += static_cast<int32_t>(chunk.positionOffset);
+        }
+        for (size_t corner : chunk.relativeTexcoords) {
+            chunk.texcoordCorners[corner] += static_cast<int32_t>(chunk.texcoordOffset);
+        }
+        for (size_t corner : chunk.relativeNormals) {
+            chunk.normalCorners[corner] += static_cast<int32_t>(chunk.normalOffset);
+        }
+
+        size_t base = chunk.triangleOffset * 3;
+        for (size_t i = 0; i < chunk.positionCorners.size(); ++i) {
+            int32_t position = chunk.positionCorners[i];
+            if (position < 0 || static_cast<size_t>(position) >= mesh.positions.size()) return false;
+            mesh.positionIndices[base + i] = static_cast<uint32_t>(position);
+            if (useTexcoords) {
+                int32_t texcoord = chunk.texcoordCorners[i];
+                if (texcoord < 0 || static_cast<size_t>(texcoord) >= mesh.texcoords.size() / 2) return false;
+                mesh.texcoordIndices[base + i] = static_cast<uint32_t>(texcoord);
+            }
+            if (useNormals) {
+                int32_t normal = chunk.normalCorners[i];
+                if (normal < 0 || static_cast<size_t>(normal) >= mesh.normals.size()) return false;
+                mesh.normalIndices[base + i] = static_cast<uint32_t>(normal);
+            }
+        }
+
+        std::copy(chunk.positions.begin(), chunk.positions.end(),
+                  mesh.positions.begin() + chunk.positionOffset);
+        std::copy(chunk.normals.begin(), chunk.normals.end(),
+                  mesh.normals.begin() + chunk.normalOffset);
+        std::copy(chunk.texcoords.begin(), chunk.texcoords.end(),
+                  mesh.texcoords.begin() + chunk.texcoordOffset * 2);
+        std::copy(chunk.faceSizes.begin(), chunk.faceSizes.end(),
+                  mesh.faceSizes.begin() + chunk.faceOffset);
+        return true;
+    }
+
+    template <typename Task>
+    void runChunks(std::vector<Chunk>& chunks, Task task) {
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < chunks.size(); ++i) {
+            workers.emplace_back(task, std::ref(chunks[i]));
+        }
+        task(chunks[0]);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+}
+
+bool ObjLoader::loadFromFile(const std::string& filename, unsigned threadCount, ObjMesh& mesh,
+                             std::string& error) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        error = "cannot open " + filename;
+        return false;
+    }
+    const char* data = file.getData();
+    const char* dataEnd = data + file.getSize();
+
+    // Split at line boundaries into roughly equal chunks, one per thread
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount, file.getSize() / MIN_CHUNK_SIZE));
+    std::vector<Chunk> chunks(chunkCount);
+    const char* cursor = data;
+    for (size_t i = 0; i < chunkCount; ++i) {
+        const char* chunkEnd = i + 1 == chunkCount ? dataEnd : data + file.getSize() * (i + 1) / chunkCount;
+        chunkEnd = std::max(chunkEnd, cursor);
+        chunkEnd = findLineEnd(chunkEnd, dataEnd);
+        chunks[i].begin = cursor;
+        chunks[i].end = chunkEnd;
+        cursor = std::min(chunkEnd + 1, dataEnd);
+    }
+
+    runChunks(chunks, [](Chunk& chunk) { parseChunk(chunk); });
+
+    // Chunk offsets are prefix sums of the per-chunk counts
+    size_t positionCount = 0, texcoordCount = 0, normalCount = 0, triangleCount = 0, faceCount = 0;
+    bool useTexcoords = true, useNormals = true;
+    for (Chunk& chunk : chunks) {
+        if (chunk.errorLine) {
+            size_t linesBefore = std::count(data, chunk.begin, '\n');
+            error = filename + ":" + std::to_string(linesBefore + chunk.errorLine) + ": " + chunk.error;
+            return false;
+        }
+        chunk.positionOffset = positionCount;
+        chunk.texcoordOffset = texcoordCount;
+        chunk.normalOffset = normalCount;
+        chunk.triangleOffset = triangleCount;
+        chunk.faceOffset = faceCount;
+        positionCount += chunk.positions.size();
+        texcoordCount += chunk.texcoords.size() / 2;
+        normalCount += chunk.normals.size();
+        triangleCount += chunk.positionCorners.size() / 3;
+        faceCount += chunk.faceSizes.size();
+        useTexcoords = useTexcoords && chunk.allCornersHaveTexcoords;
+        useNormals = useNormals && chunk.allCornersHaveNormals;
+    }
+
+    mesh = ObjMesh();
+    mesh.positions.resize(positionCount);
+    mesh.normals.resize(normalCount);
+    mesh.texcoords.resize(texcoordCount * 2);
+    mesh.positionIndices.resize(triangleCount * 3);
+    mesh.faceSizes.resize(faceCount);
+    if (useTexcoords && triangleCount > 0) mesh.texcoordIndices.resize(triangleCount * 3);
+    if (useNormals && triangleCount > 0) mesh.normalIndices.resize(triangleCount * 3);
+    useTexcoords = !mesh.texcoordIndices.empty();
+    useNormals = !mesh.normalIndices.empty();
+
+    std::vector<char> resolved(chunks.size(), 0);
+    runChunks(chunks, [&](Chunk& chunk) {
+        resolved[&chunk - chunks.data()] = resolveChunk(chunk, mesh, useTexcoords, useNormals);
+    });
+    if (std::find(resolved.begin(), resolved.end(), 0) != resolved.end()) {
+        error = filename + ": face index out of range";
+        return false;
+    }
+    return true;
+}
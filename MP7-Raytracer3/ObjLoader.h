@@ -0,0 +1,33 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Math.h"
+
+// Indexed triangle data read from a Wavefront OBJ file. Polygons are fan
+// triangulated; every index array holds three entries per triangle.
+struct ObjMesh {
+    std::vector<Vector3> positions;
+    std::vector<Vector3> normals;
+    std::vector<float> texcoords;           // u, v pairs
+    std::vector<uint32_t> positionIndices;
+    std::vector<uint32_t> normalIndices;    // Empty unless every face corner names a vn
+    std::vector<uint32_t> texcoordIndices;  // Empty unless every face corner names a vt
+    std::vector<uint32_t> faceSizes;        // Corners per OBJ face; face i became the next faceSizes[i] - 2 triangles
+
+    size_t getTriangleCount() const { return positionIndices.size() / 3; }
+};
+
+class ObjLoader {
+public:
+    // Memory-maps the file and parses v/vn/vt/f records, splitting large files
+    // into line-aligned chunks parsed on up to threadCount threads, the caller
+    // included. Negative (relative) indices are supported. Returns false with
+    // a message in error on failure.
+    static bool loadFromFile(const std::string& filename, unsigned threadCount, ObjMesh& mesh,
+                             std::string& error);
+};
+
+#endif // OBJ_LOADER_H
@@ -0,0 +1,90 @@
+#include "PhotonMap.h"
+#include <algorithm>
+
+namespace {
+    // Cells past this from the origin share the outermost ones
+    constexpr float MAX_CELL = 1e9f;
+}
+
+void PhotonMap::build(const std::vector<Photon>& photons, float radius) {
+    radius_ = radius;
+    inverseCellSize_ = 0.5f / radius;
+
+    uint32_t bucketCount = 1;
+    while (bucketCount < photons.size()) bucketCount <<= 1;
+    bucketMask_ = bucketCount - 1;
+
+    // Counting sort by bucket
+    std::vector<uint32_t> buckets(photons.size());
+    bucketStarts_.assign(bucketCount + 1, 0);
+    for (size_t i = 0; i < photons.size(); ++i) {
+        const Vector3& position = photons[i].position;
+        buckets[i] = getBucket(getCell(position.x), getCell(position.y), getCell(position.z));
+        ++bucketStarts_[buckets[i] + 1];
+    }
+    for (uint32_t bucket = 0; bucket < bucketCount; ++bucket) {
+        bucketStarts_[bucket + 1] += bucketStarts_[bucket];
+    }
+
+    std::vector<uint32_t> next(bucketStarts_.begin(), bucketStarts_.end() - 1);
+    photons_.resize(photons.size());
+    for (size_t i = 0; i < photons.size(); ++i) {
+        photons_[next[buckets[i]]++] = photons[i];
+    }
+}
+
+void PhotonMap::clear() {
+    photons_.clear();
+    bucketStarts_.clear();
+    bucketMask_ = 0;
+}
+
+Vector3 PhotonMap::gather(const Vector3& point, const Vector3& normal) const {
+    const float low[3] = {point.x - radius_, point.y - radius_, point.z - radius_};
+    int32_t lowCells[3];
+    int32_t highCells[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        lowCells[axis] = getCell(low[axis]);
+        // The span is one cell wide, so it touches two at most (barring rounding)
+        highCells[axis] = std::min(getCell(low[axis] + 2.0f * radius_), lowCells[axis] + 1);
+    }
+
+    // Cells hash into buckets that may coincide; each bucket is read once
+    uint32_t visited[8];
+    int visitedCount = 0;
+    float radiusSquared = radius_ * radius_;
+    Vector3 flux(0, 0, 0);
+    for (int32_t z = lowCells[2]; z <= highCells[2]; ++z) {
+        for (int32_t y = lowCells[1]; y <= highCells[1]; ++y) {
+            for (int32_t x = lowCells[0]; x <= highCells[0]; ++x) {
+                uint32_t bucket = getBucket(x, y, z);
+                if (std::find(visited, visited + visitedCount, bucket) != visited + visitedCount) continue;
+                visited[visitedCount++] = bucket;
+
+                for (uint32_t i = bucketStarts_[bucket]; i < bucketStarts_[bucket + 1]; ++i) {
+                    const Photon& photon = photons_[i];
+                    float distanceSquared = photon.position.minus(point).getLengthSquared();
+                    if (distanceSquared >= radiusSquared ||
+                        Vector3::dotProduct(photon.direction, normal) >= 0.0f) {
+                        continue;
+                    }
+                    float weight = 1.0f - std::sqrt(distanceSquared) / radius_;
+                    flux = flux.plus(photon.power.times(weight));
+                }
+            }
+        }
+    }
+
+    // The cone filter keeps a third of a uniform disk's weight
+    return flux.times(3.0f / (Math::PI * radiusSquared));
+}
+
+int32_t PhotonMap::getCell(float coordinate) const {
+    return static_cast<int32_t>(std::floor(Math::clamp(coordinate * inverseCellSize_, -MAX_CELL, MAX_CELL)));
+}
+
+uint32_t PhotonMap::getBucket(int32_t x, int32_t y, int32_t z) const {
+    uint32_t hash = static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(y) * 19349663u ^
+                    static_cast<uint32_t>(z) * 83492791u;
+    return hash & bucketMask_;
+}
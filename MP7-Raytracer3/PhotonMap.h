@@ -0,0 +1,40 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include <cstdint>
+#include <vector>
+#include "Math.h"
+
+// Photons in a hashed grid of cells twice the gather radius wide. They are
+// sorted by bucket into one array, so a gather reads at most 8 runs of it.
+class PhotonMap {
+public:
+    struct Photon {
+        Vector3 position;
+        Vector3 direction;  // The way it was travelling
+        Vector3 power;      // Flux it carries
+    };
+
+    bool isEmpty() const { return photons_.empty(); }
+    size_t getSize() const { return photons_.size(); }
+    float getRadius() const { return radius_; }
+
+    void build(const std::vector<Photon>& photons, float radius);
+    void clear();
+
+    // Irradiance at a point from the photons within the radius that arrived on
+    // the side normal faces, cone filtered so nearer photons count more
+    Vector3 gather(const Vector3& point, const Vector3& normal) const;
+
+private:
+    std::vector<Photon> photons_;          // Sorted by bucket
+    std::vector<uint32_t> bucketStarts_;   // Bucket b is [bucketStarts_[b], bucketStarts_[b + 1])
+    uint32_t bucketMask_ = 0;
+    float radius_ = 0.0f;
+    float inverseCellSize_ = 0.0f;
+
+    int32_t getCell(float coordinate) const;
+    uint32_t getBucket(int32_t x, int32_t y, int32_t z) const;
+};
+
+#endif // PHOTON_MAP_H
@@ -0,0 +1,328 @@
+#include "RayTracer.h"
+#include <atomic>
+#include <cmath>
+#include "Stats.h"
+
+RayTracer::TraceResult RayTracer::traceRay(const Ray& ray, const Scene& scene, int maxBounces, ThreadState& state) {
+    Vector3 finalColor(0, 0, 0);
+    bool hitSomething = false;
+    std::vector<PendingRay>& pending = state.pendingRays;
+    pending.clear();
+    pending.push_back({ray, Vector3(1, 1, 1), maxBounces});
+
+    for (bool primary = true; !pending.empty(); primary = false) {
+        PendingRay current = pending.back();
+        pending.pop_back();
+
+        IntersectionInfo intersection;
+        const std::vector<uint32_t>* startNodes = primary && state.tileCulled ? &state.tileNodes : nullptr;
+        if (!scene.findNearestIntersection(current.ray, intersection, MIN_INTERSECTION_DISTANCE, startNodes)) {
+            continue;
+        }
+        if (primary) {
+            hitSomething = true;
+        }
+
+        const Material& material = *intersection.material;
+        Vector3 reflected, refracted, diffuse;
+        material.getShares(reflected, refracted, diffuse);
+
+        if (getLargest(diffuse) > 0.0f) {
+            Vector3 shading = shade(current.ray, intersection, scene, state.shadowCache);
+            finalColor = finalColor.plus(Vector3::componentMultiply(
+                current.throughput, Vector3::componentMultiply(diffuse, shading)));
+        }
+        if (current.bouncesLeft == 0) {
+            continue;
+        }
+
+        const Vector3& direction = current.ray.getDirection();
+        Vector3 point = current.ray.getPointAtDistance(intersection.distance);
+        Vector3 normal = intersection.surfaceNormal;
+        float cosine = -Vector3::dotProduct(normal, direction);
+        bool inside = cosine < 0;
+        if (inside) {
+            normal = normal.times(-1.0f);
+            cosine = -cosine;
+        }
+
+        if (getLargest(refracted) > 0.0f) {
+            // Past the critical angle everything is reflected instead
+            Vector3 refractedDirection;
+            if (!refract(direction, normal, cosine, getRefractiveRatio(material, inside), refractedDirection)) {
+                reflected = reflected.plus(refracted);
+            } else {
+                Ray refractedRay(point, refractedDirection, current.ray.getDepth() + 1,
+                                 current.ray.getConeSpread());
+                queueBounce(pending, current, refractedRay, refracted);
+            }
+        }
+        if (getLargest(reflected) > 0.0f) {
+            Ray reflectedRay(point, reflect(direction, normal, cosine), current.ray.getDepth() + 1,
+                             current.ray.getConeSpread());
+            queueBounce(pending, current, reflectedRay, reflected);
+        }
+    }
+
+    return {finalColor, hitSomething};
+}
+
+bool RayTracer::refract(const Vector3& direction, const Vector3& normal, float cosine, float ratio,
+                        Vector3& refractedDirection) {
+    float k = 1.0f - ratio * ratio * (1.0f - cosine * cosine);
+    if (k < 0.0f) {
+        return false;
+    }
+    refractedDirection = direction.times(ratio).plus(normal.times(ratio * cosine - std::sqrt(k)));
+    return true;
+}
+
+void RayTracer::queueBounce(std::vector<PendingRay>& pending, const PendingRay& parent, const Ray& ray,
+                            const Vector3& share) {
+    Vector3 throughput = Vector3::componentMultiply(parent.throughput, share);
+    if (getLargest(throughput) < MIN_THROUGHPUT) {
+        return;
+    }
+    RT_STAT_ADD(secondaryRays, 1);
+    pending.push_back({ray, throughput, parent.bouncesLeft - 1});
+}
+
+Vector3 RayTracer::shade(const Ray& ray, const IntersectionInfo& intersection, const Scene& scene,
+                         ShadowCache& shadowCache) {
+    Vector3 color(0, 0, 0);
+    const auto& lights = scene.getLights();
+
+    for (size_t i = 0; i < lights.size(); ++i) {
+        auto illumination = lights[i]->calculateIllumination(
+            ray.getPointAtDistance(intersection.distance)
+        );
+
+        // Check for shadows
+        Ray shadowRay(
+            ray.getPointAtDistance(intersection.distance),
+            illumination.direction
+        );
+        RT_STAT_ADD(shadowRays, 1);
+
+        bool inShadow = scene.isOccluded(shadowRay, SHADOW_BIAS, illumination.distance,
+                                         shadowCache.get(i));
+
+        if (!inShadow) {
+            color = color.plus(
+                intersection.material->calculateShading(
+                    ray,
+                    intersection,
+                    illumination.direction,
+                    illumination.color
+                )
+            );
+        }
+    }
+
+    if (scene.hasCaustics()) {
+        Vector3 normal = intersection.surfaceNormal;
+        if (Vector3::dotProduct(normal, ray.getDirection()) > 0) {
+            normal = normal.times(-1.0f);
+        }
+        Vector3 irradiance = scene.gatherCaustics(ray.getPointAtDistance(intersection.distance), normal);
+        color = color.plus(Vector3::componentMultiply(irradiance,
+                                                      intersection.material->getSurfaceColor(intersection)));
+    }
+    return color;
+}
+
+void PhotonTracer::emit(const Scene& scene, int photonCount, int maxBounces, const RenderThreads& threads,
+                        std::vector<PhotonMap::Photon>& photons) {
+    photons.clear();
+    std::vector<BoundingBox> boxes;
+    scene.addCausticTargets(boxes);
+    if (boxes.size() > MAX_TARGETS) {
+        BoundingBox all;
+        for (const BoundingBox& box : boxes) all.expand(box);
+        boxes.assign(1, all);
+    }
+    std::vector<Target> targets;
+    for (const BoundingBox& box : boxes) {
+        targets.push_back({box.getCenter(), box.max.minus(box.min).getLength() * 0.5f});
+    }
+    if (targets.empty()) {
+        return;
+    }
+
+    BoundingBox sceneBox = scene.getBounds();
+    Target sceneBounds = {sceneBox.getCenter(), sceneBox.max.minus(sceneBox.min).getLength() * 0.5f};
+    std::vector<Source> sources;
+    float totalFlux = 0.0f;
+    for (const auto* light : scene.getLights()) {
+        sources.push_back(createSource(light->getEmission(), targets));
+        const Vector3& color = sources.back().emission.color;
+        totalFlux += sources.back().totalMeasure * (std::abs(color.x) + std::abs(color.y) + std::abs(color.z));
+    }
+    if (!(totalFlux > 0.0f)) {
+        return;
+    }
+
+    struct Block {
+        uint32_t source;
+        uint32_t index;
+    };
+    std::vector<Block> blocks;
+    for (uint32_t i = 0; i < sources.size(); ++i) {
+        Source& source = sources[i];
+        const Vector3& color = source.emission.color;
+        float flux = source.totalMeasure * (std::abs(color.x) + std::abs(color.y) + std::abs(color.z));
+        source.photonCount = static_cast<uint32_t>(std::lround(photonCount * (flux / totalFlux)));
+        for (uint32_t block = 0; block * BLOCK_SIZE < source.photonCount; ++block) {
+            blocks.push_back({i, block});
+        }
+    }
+
+    std::vector<std::vector<PhotonMap::Photon>> results(blocks.size());
+    std::atomic<size_t> nextBlock(0);
+    runRenderThreads(threads, blocks.size(), [&](unsigned) {
+        for (size_t i = nextBlock++; i < blocks.size(); i = nextBlock++) {
+            const Source& source = sources[blocks[i].source];
+            uint32_t first = blocks[i].index * BLOCK_SIZE;
+            uint32_t count = std::min(BLOCK_SIZE, source.photonCount - first);
+            std::mt19937 random(blocks[i].source * 0x9E3779B9u + blocks[i].index);
+            for (uint32_t photon = 0; photon < count; ++photon) {
+                Ray ray(Vector3::ZERO, Vector3::FORWARD);
+                Vector3 power;
+                emitPhoton(source, targets, sceneBounds, random, ray, power);
+                trace(scene, ray, power, maxBounces, random, results[i]);
+            }
+            RT_STAT_ADD(storedPhotons, results[i].size());
+        }
+    });
+
+    for (const auto& result : results) {
+        photons.insert(photons.end(), result.begin(), result.end());
+    }
+}
+
+void PhotonTracer::getPerpendiculars(const Vector3& axis, Vector3& first, Vector3& second) {
+    Vector3 helper = std::abs(axis.x) > 0.9f ? Vector3(0, 1, 0) : Vector3(1, 0, 0);
+    first = Vector3::crossProduct(helper, axis).getNormalized();
+    second = Vector3::crossProduct(axis, first);
+}
+
+PhotonTracer::Source PhotonTracer::createSource(const LightSource::Emission& emission,
+                                                const std::vector<Target>& targets) {
+    Source source;
+    source.emission = emission;
+    for (const Target& target : targets) {
+        float measure;
+        if (emission.directional) {
+            measure = Math::PI * target.radius * target.radius;
+        } else {
+            Vector3 toTarget = target.center.minus(emission.vector);
+            float distanceSquared = toTarget.getLengthSquared();
+            float cosine = -1.0f;
+            if (distanceSquared > target.radius * target.radius) {
+                cosine = std::sqrt(1.0f - target.radius * target.radius / distanceSquared);
+            }
+            source.axes.push_back(distanceSquared > 0.0f ? toTarget.getNormalized() : Vector3::UP);
+            source.cosines.push_back(cosine);
+            measure = 2.0f * Math::PI * (1.0f - cosine);
+        }
+        source.measures.push_back(measure);
+        source.totalMeasure += measure;
+    }
+    if (emission.directional) {
+        source.axes.resize(2);
+        getPerpendiculars(emission.vector, source.axes[0], source.axes[1]);
+    }
+    return source;
+}
+
+void PhotonTracer::emitPhoton(const Source& source, const std::vector<Target>& targets, const Target& sceneBounds,
+                              std::mt19937& random, Ray& ray, Vector3& power) {
+    float pick = nextUniform(random) * source.totalMeasure;
+    size_t chosen = 0;
+    while (chosen + 1 < targets.size() && pick >= source.measures[chosen]) {
+        pick -= source.measures[chosen++];
+    }
+    float first = nextUniform(random);
+    float angle = 2.0f * Math::PI * nextUniform(random);
+    int coverage = 1;
+
+    if (source.emission.directional) {
+        const Vector3& direction = source.emission.vector;
+        float radius = targets[chosen].radius * std::sqrt(first);
+        Vector3 point = targets[chosen].center.plus(source.axes[0].times(radius * std::cos(angle)))
+                                              .plus(source.axes[1].times(radius * std::sin(angle)));
+        for (size_t i = 0; i < targets.size(); ++i) {
+            Vector3 offset = point.minus(targets[i].center);
+            float along = Vector3::dotProduct(offset, direction);
+            float acrossSquared = offset.getLengthSquared() - along * along;
+            coverage += i != chosen && acrossSquared <= targets[i].radius * targets[i].radius;
+        }
+        // Start outside the scene so everything in front of the target can block the photon
+        float back = std::max(0.0f, Vector3::dotProduct(sceneBounds.center.minus(point), direction) +
+                                    sceneBounds.radius);
+        ray = Ray(point.plus(direction.times(back)), direction.times(-1.0f));
+    } else {
+        float cosine = 1.0f - first * (1.0f - source.cosines[chosen]);
+        float sine = std::sqrt(std::max(0.0f, 1.0f - cosine * cosine));
+        Vector3 across, up;
+        getPerpendiculars(source.axes[chosen], across, up);
+        Vector3 direction = across.times(sine * std::cos(angle)).plus(up.times(sine * std::sin(angle)))
+                                  .plus(source.axes[chosen].times(cosine));
+        for (size_t i = 0; i < targets.size(); ++i) {
+            coverage += i != chosen && Vector3::dotProduct(direction, source.axes[i]) >= source.cosines[i];
+        }
+        ray = Ray(source.emission.vector, direction);
+    }
+    power = source.emission.color.times(source.totalMeasure / (source.photonCount * coverage));
+}
+
+void PhotonTracer::trace(const Scene& scene, Ray ray, Vector3 power, int maxBounces, std::mt19937& random,
+                         std::vector<PhotonMap::Photon>& stored) {
+    for (int bounce = 0; ; ++bounce) {
+        RT_STAT_ADD(photonRays, 1);
+        IntersectionInfo intersection;
+        if (!scene.findNearestIntersection(ray, intersection, MIN_INTERSECTION_DISTANCE)) {
+            return;
+        }
+
+        const Material& material = *intersection.material;
+        Vector3 reflected, refracted, diffuse;
+        material.getShares(reflected, refracted, diffuse);
+        const Vector3& direction = ray.getDirection();
+        Vector3 point = ray.getPointAtDistance(intersection.distance);
+        if (bounce > 0 && RayTracer::getLargest(diffuse) > 0.0f) {
+            stored.push_back({point, direction, power});
+        }
+        if (bounce == maxBounces) {
+            return;
+        }
+
+        Vector3 normal = intersection.surfaceNormal;
+        float cosine = -Vector3::dotProduct(normal, direction);
+        bool inside = cosine < 0;
+        if (inside) {
+            normal = normal.times(-1.0f);
+            cosine = -cosine;
+        }
+        Vector3 refractedDirection;
+        if (RayTracer::getLargest(refracted) > 0.0f &&
+            !RayTracer::refract(direction, normal, cosine, RayTracer::getRefractiveRatio(material, inside),
+                                refractedDirection)) {
+            reflected = reflected.plus(refracted);
+            refracted = Vector3(0, 0, 0);
+        }
+
+        float reflectChance = (reflected.x + reflected.y + reflected.z) / 3.0f;
+        float refractChance = (refracted.x + refracted.y + refracted.z) / 3.0f;
+        float choice = nextUniform(random);
+        if (choice < reflectChance) {
+            power = Vector3::componentMultiply(power, reflected.dividedBy(reflectChance));
+            ray = Ray(point, RayTracer::reflect(direction, normal, cosine));
+        } else if (choice < reflectChance + refractChance) {
+            power = Vector3::componentMultiply(power, refracted.dividedBy(refractChance));
+            ray = Ray(point, refractedDirection);
+        } else {
+            return;
+        }
+    }
+}
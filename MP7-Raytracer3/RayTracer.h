@@ -0,0 +1,136 @@
+#ifndef RAY_TRACER_H
+#define RAY_TRACER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "PhotonMap.h"
+#include "RenderThreads.h"
+#include "Scene.h"
+#include "SceneObjects.h"
+
+class RayTracer {
+public:
+    struct TraceResult {
+        Vector3 color;
+        bool hitSomething;
+    };
+
+    // Remembers, per light, what blocked the last shadow ray toward it, since
+    // neighboring pixels are usually shadowed by the same primitive. Each
+    // rendering thread keeps its own.
+    class ShadowCache {
+    public:
+        explicit ShadowCache(size_t lightCount) : occluders_(lightCount) {}
+        Occluder& get(size_t light) { return occluders_[light]; }
+
+    private:
+        std::vector<Occluder> occluders_;
+    };
+
+    // A reflected or refracted ray waiting to be traced
+    struct PendingRay {
+        Ray ray;
+        Vector3 throughput;  // Share of its color that reaches the pixel
+        int bouncesLeft;
+    };
+
+    // Scratch state of one rendering thread
+    struct ThreadState {
+        explicit ThreadState(size_t lightCount) : shadowCache(lightCount) {}
+
+        ShadowCache shadowCache;
+        std::vector<PendingRay> pendingRays;  // Explicit stack in place of recursion
+        // Top-level BVH nodes the current tile's primary rays start from, when culled
+        std::vector<uint32_t> tileNodes;
+        bool tileCulled = false;
+    };
+
+    static TraceResult traceRay(const Ray& ray, const Scene& scene, int maxBounces, ThreadState& state);
+
+    static float getLargest(const Vector3& value) {
+        return std::max(value.x, std::max(value.y, value.z));
+    }
+
+    // normal faces against direction, at the given cosine to it
+    static Vector3 reflect(const Vector3& direction, const Vector3& normal, float cosine) {
+        return direction.plus(normal.times(2.0f * cosine));
+    }
+
+    // Snell's law; false past the critical angle
+    static bool refract(const Vector3& direction, const Vector3& normal, float cosine, float ratio,
+                        Vector3& refractedDirection);
+
+    // Index of refraction on the side a ray leaves over the side it enters
+    static float getRefractiveRatio(const Material& material, bool inside) {
+        return inside ? material.getRefractiveIndex() : 1.0f / material.getRefractiveIndex();
+    }
+
+private:
+    // Queues a bounce unless too little of its color would reach the pixel
+    static void queueBounce(std::vector<PendingRay>& pending, const PendingRay& parent, const Ray& ray,
+                            const Vector3& share);
+
+    // Diffuse lighting from every light that the surface point can see, plus
+    // any caustic photons landing near it
+    static Vector3 shade(const Ray& ray, const IntersectionInfo& intersection, const Scene& scene,
+                         ShadowCache& shadowCache);
+};
+
+// Caustic photons: paths from a light through at least one mirror or
+// refraction to a surface with a diffuse share, where they are stored. Photons
+// are only aimed at the bounding spheres of objects with specular materials,
+// and each light emits a share of the count in proportion to the flux it sends
+// toward them.
+class PhotonTracer {
+public:
+    // Each block of photons has its own random sequence, so the map is the
+    // same whatever the thread count
+    static constexpr uint32_t BLOCK_SIZE = 4096;
+    // Past this many targets photons are aimed at one box around them all
+    static constexpr size_t MAX_TARGETS = 64;
+
+    static void emit(const Scene& scene, int photonCount, int maxBounces, const RenderThreads& threads,
+                     std::vector<PhotonMap::Photon>& photons);
+
+private:
+    struct Target {
+        Vector3 center;
+        float radius;
+    };
+
+    // What a light sends toward the targets. measures are the area (suns) or
+    // solid angle (bulbs) each target covers as seen from the light.
+    struct Source {
+        LightSource::Emission emission;
+        std::vector<Vector3> axes;     // Bulbs: toward each target. Suns: only axes[0], across the direction
+        std::vector<float> cosines;    // Bulbs: of each target's cone, -1 when the bulb is inside it
+        std::vector<float> measures;
+        float totalMeasure = 0.0f;
+        uint32_t photonCount = 0;
+    };
+
+    // Uniform in [0, 1) from the top 24 bits, so every standard library agrees
+    static float nextUniform(std::mt19937& random) {
+        return static_cast<float>(random() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Two unit vectors perpendicular to axis and each other
+    static void getPerpendiculars(const Vector3& axis, Vector3& first, Vector3& second);
+
+    static Source createSource(const LightSource::Emission& emission, const std::vector<Target>& targets);
+
+    // Picks a target in proportion to its measure and a point on its disk (suns)
+    // or a direction in its cone (bulbs). Targets may overlap, so the photon's
+    // power is divided among every target that could have produced it.
+    static void emitPhoton(const Source& source, const std::vector<Target>& targets, const Target& sceneBounds,
+                           std::mt19937& random, Ray& ray, Vector3& power);
+
+    // Follows the photon's specular bounces, choosing one of them by its share
+    // and ending it with the rest, storing it wherever there is a diffuse share
+    static void trace(const Scene& scene, Ray ray, Vector3 power, int maxBounces, std::mt19937& random,
+                      std::vector<PhotonMap::Photon>& stored);
+};
+
+#endif // RAY_TRACER_H
@@ -0,0 +1,446 @@
+#include "RenderLoop.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include "Camera.h"
+#include "Kernels.h"
+#include "MeshClusters.h"
+#include "RayTracer.h"
+#include "Stats.h"
+#include "Trace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+constexpr int TILE_SIZE = 32;
+
+void ImageRenderer::saveToFile(const char* filename) {
+    if (width_ > 0 && height_ > 0) {
+        Trace::Scope trace("tone map");
+        Kernels::get().encodeSRGB(pixels_.data(), image_[0]->p,
+                                  static_cast<size_t>(width_) * height_);
+    }
+    Trace::Scope trace("png encode", "%s", filename);
+    image_.save(filename);
+}
+
+// Running total of a cost metric on the calling thread; a pixel costs the
+// difference across its trace
+static uint64_t readCost(CostMetric metric) {
+    if (metric == CostMetric::CYCLES) {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+#if RT_STATS_ENABLED
+    const RenderStats* stats = Stats::local();
+    if (!stats) return 0;
+    switch (metric) {
+        case CostMetric::RAYS: return stats->getTotalRays();
+        case CostMetric::PRIMITIVE_TESTS: return stats->primitiveTests;
+        case CostMetric::NODE_VISITS: return stats->nodeVisits;
+        case CostMetric::CYCLES: break;
+    }
+#endif
+    return 0;
+}
+
+bool writeCostMap(const std::vector<float>& cost, int width, int height, const std::string& prefix,
+                  std::string& error) {
+    Trace::Scope trace("cost map", "%s", prefix.c_str());
+    static const float stops[][3] = {{0, 0, 0}, {0, 0, 1}, {1, 0, 0}, {1, 1, 0}, {1, 1, 1}};
+    constexpr int lastStop = 4;
+    float largest = cost.empty() ? 0.0f : *std::max_element(cost.begin(), cost.end());
+
+    Image image(width, height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float position = largest > 0.0f ? cost[static_cast<size_t>(y) * width + x] / largest * lastStop : 0.0f;
+            int stop = std::min(static_cast<int>(position), lastStop - 1);
+            float blend = position - stop;
+            pixel_t& pixel = image[y][x];
+            for (int channel = 0; channel < 3; ++channel) {
+                float value = stops[stop][channel] + (stops[stop + 1][channel] - stops[stop][channel]) * blend;
+                pixel.p[channel] = static_cast<uint8_t>(std::lround(255.0f * value));
+            }
+            pixel.p[3] = 255;
+        }
+    }
+    image.save((prefix + ".png").c_str());
+
+    // PFM keeps rows bottom to top; a negative scale marks little-endian floats
+    std::ofstream pfm(prefix + ".pfm", std::ios::binary);
+    uint16_t probe = 1;
+    bool littleEndian = *reinterpret_cast<uint8_t*>(&probe) == 1;
+    pfm << "Pf\n" << width << ' ' << height << '\n' << (littleEndian ? "-1.0" : "1.0") << '\n';
+    for (int y = height - 1; y >= 0; --y) {
+        pfm.write(reinterpret_cast<const char*>(&cost[static_cast<size_t>(y) * width]),
+                  static_cast<std::streamsize>(sizeof(float) * width));
+    }
+    if (!pfm) {
+        error = "Failed to write " + prefix + ".pfm";
+        return false;
+    }
+    return true;
+}
+
+static void writePixel(const SceneConfiguration::Config& config, float* pixel, Vector3 pixelColor,
+                       bool hitSomething) {
+    if (config.useExposure) {
+        pixelColor = Vector3(
+            Math::calculateExposure(pixelColor.x, config.exposureValue),
+            Math::calculateExposure(pixelColor.y, config.exposureValue),
+            Math::calculateExposure(pixelColor.z, config.exposureValue)
+        );
+    }
+
+    // Set alpha to 0 for background (no hit), 1 for objects
+    pixel[0] = pixelColor.x;
+    pixel[1] = pixelColor.y;
+    pixel[2] = pixelColor.z;
+    pixel[3] = hitSomething ? 1.0f : 0.0f;
+}
+
+// Where pixel coordinate x (or y, negated) of an image size pixels wide (or
+// high) lies on the screen, which spans 2 units along the longer side
+static float getScreenCoordinate(float x, int size, const SceneConfiguration::Config& config) {
+    float aspectRatio = std::max(config.imageWidth, config.imageHeight);
+    return (2.0f * x - size) / aspectRatio;
+}
+
+// A pixel whose trace needed an out-of-core cluster that was not mapped
+struct DeferredPixel {
+    ClusterCache* cache;
+    uint32_t cluster;
+    int x;
+    int y;
+};
+
+// Rounds of regrouping a deferred pixel gets before it may load clusters itself
+constexpr int MAX_DEFERRED_ROUNDS = 2;
+
+// Traces pixels set aside under deferral again, grouped by the cluster they
+// missed: that cluster stays pinned while its group is traced, so it is
+// mapped once for all of them rather than once per ray. Pixels missing
+// another cluster are regrouped, and after MAX_DEFERRED_ROUNDS traced with
+// loads allowed. tracePixel(x, y) returns false if the pixel was deferred.
+template <typename TracePixel>
+static void traceDeferred(ClusterCache::Deferral& deferral, std::vector<DeferredPixel>& pixels,
+                          TracePixel tracePixel) {
+    auto isBefore = [](const DeferredPixel& a, const DeferredPixel& b) {
+        if (a.cache != b.cache) return std::less<ClusterCache*>()(a.cache, b.cache);
+        return a.cluster < b.cluster;
+    };
+    std::vector<DeferredPixel> missed;
+    for (int round = 0; !pixels.empty(); ++round) {
+        RT_STAT_ADD(deferredPixels, pixels.size());
+        deferral.setActive(round < MAX_DEFERRED_ROUNDS);
+        std::stable_sort(pixels.begin(), pixels.end(), isBefore);
+        missed.clear();
+        for (size_t begin = 0, end; begin < pixels.size(); begin = end) {
+            for (end = begin + 1; end < pixels.size() && !isBefore(pixels[begin], pixels[end]); ++end) {}
+            ClusterCache* cache = pixels[begin].cache;
+            uint32_t cluster = pixels[begin].cluster;
+            // Unreadable clusters leave their pixels to the last round
+            const char* data = cache->load(cluster);
+            if (!data) deferral.setActive(false);
+            for (size_t i = begin; i < end; ++i) {
+                if (!tracePixel(pixels[i].x, pixels[i].y)) {
+                    missed.push_back({deferral.getCache(), deferral.getCluster(), pixels[i].x, pixels[i].y});
+                    deferral.clear();
+                }
+            }
+            if (data) {
+                cache->unpin(cluster);
+            } else {
+                deferral.setActive(round < MAX_DEFERRED_ROUNDS);
+            }
+        }
+        pixels.swap(missed);
+    }
+    deferral.setActive(true);
+}
+
+// Renders the TILE_SIZE square at x0, y0 (clipped to the image) into linear
+// RGBA rows, rowStride floats apart. A tile whose frustum reaches nothing is
+// filled with background; otherwise its primary rays skip the parts of the
+// scene's BVH outside the frustum.
+// With step > 1 only pixels on every step-th row and column are traced, each
+// filling the step x step block it is the top left corner of. Pixels on the
+// grid of an earlier, coarser pass (previousStep) already hold their sample.
+// A cost map, if given, receives the cost of every traced pixel. Returns how
+// many pixels of the pass it finished, background ones of a culled tile included.
+// Pixels whose rays reach unmapped clusters wait for the rest of the tile and
+// are traced together per cluster (traceDeferred).
+static int renderTile(const SceneConfiguration::Config& config, const Camera& camera, int x0, int y0,
+                       int step, int previousStep, float* pixels, size_t rowStride,
+                       RayTracer::ThreadState& threadState, const CostMap* costMap) {
+    const Scene& scene = config.scene;
+    int xEnd = std::min(x0 + TILE_SIZE, config.imageWidth);
+    int yEnd = std::min(y0 + TILE_SIZE, config.imageHeight);
+    auto getScreenX = [&](int x) { return getScreenCoordinate(x, config.imageWidth, config); };
+    auto getScreenY = [&](int y) { return -getScreenCoordinate(y, config.imageHeight, config); };
+
+    Frustum frustum;
+    threadState.tileCulled = camera.getTileFrustum(getScreenX(x0), getScreenX(xEnd - 1),
+                                                   getScreenY(yEnd - 1), getScreenY(y0), frustum);
+    int finished = 0;
+    if (threadState.tileCulled && !scene.cull(frustum, threadState.tileNodes)) {
+        RT_STAT_ADD(culledTiles, 1);
+        for (int y = y0; y < yEnd; ++y) {
+            for (int x = x0; x < xEnd; ++x) {
+                writePixel(config, pixels + y * rowStride + 4 * static_cast<size_t>(x), Vector3(0, 0, 0), false);
+                if (costMap) costMap->values[y * costMap->stride + x] = 0.0f;
+                bool inPass = x % step == 0 && y % step == 0 &&
+                              !(previousStep && x % previousStep == 0 && y % previousStep == 0);
+                finished += inPass;
+            }
+        }
+        return finished;
+    }
+
+    ClusterCache::Deferral deferral;
+    // A deferred trace is redone, so only the counts of the trace that finishes are kept
+    auto tracePixel = [&](int x, int y) {
+        Stats::Attempt attempt;
+        uint64_t costBefore = costMap ? readCost(costMap->metric) : 0;
+        Ray ray = camera.generateRay(getScreenX(x), getScreenY(y));
+        RT_STAT_ADD(primaryRays, 1);
+        auto traceResult = RayTracer::traceRay(ray, scene, config.maxBounces, threadState);
+        if (deferral.hasMissed()) return false;
+        attempt.keep();
+        if (costMap) {
+            costMap->values[y * costMap->stride + x] = static_cast<float>(readCost(costMap->metric) - costBefore);
+        }
+        float* pixel = pixels + y * rowStride + 4 * static_cast<size_t>(x);
+        writePixel(config, pixel, traceResult.color, traceResult.hitSomething);
+
+        for (int blockY = y; blockY < std::min(y + step, yEnd); ++blockY) {
+            for (int blockX = x; blockX < std::min(x + step, xEnd); ++blockX) {
+                std::copy(pixel, pixel + 4, pixels + blockY * rowStride + 4 * static_cast<size_t>(blockX));
+            }
+        }
+        return true;
+    };
+
+    std::vector<DeferredPixel> deferred;
+    for (int x = x0; x < xEnd; x += step) {
+        for (int y = y0; y < yEnd; y += step) {
+            if (previousStep && x % previousStep == 0 && y % previousStep == 0) {
+                continue;
+            }
+            ++finished;
+            if (!tracePixel(x, y)) {
+                deferred.push_back({deferral.getCache(), deferral.getCluster(), x, y});
+                deferral.clear();
+            }
+        }
+    }
+    traceDeferred(deferral, deferred, tracePixel);
+    return finished;
+}
+
+// Threads take tiles in turn from a shared counter, so expensive tiles do not
+// hold up the rest. Pinned threads split the tiles into a band of rows per
+// NUMA node and take from their own node's band until it runs out, so a
+// band's framebuffer pages are first written, and so placed, on its node.
+uint64_t renderImage(const SceneConfiguration::Config& config, float* pixels, size_t rowStride,
+                     const RenderThreads& threads, int step, int previousStep, const CostMap* costMap,
+                     const std::chrono::steady_clock::time_point* deadline) {
+    Camera camera = config.createCamera();
+    int tilesX = (config.imageWidth + TILE_SIZE - 1) / TILE_SIZE;
+    int tileCount = tilesX * ((config.imageHeight + TILE_SIZE - 1) / TILE_SIZE);
+    unsigned bandCount = threads.pinned ? Numa::getNodeCount() : 1;
+    std::unique_ptr<std::atomic<int>[]> nextTiles(new std::atomic<int>[bandCount]);
+    for (unsigned band = 0; band < bandCount; ++band) nextTiles[band] = 0;
+    std::atomic<uint64_t> finished(0);
+
+    runRenderThreads(threads, tileCount, [&](unsigned worker) {
+        RayTracer::ThreadState threadState(config.scene.getLights().size());
+        unsigned firstBand = threads.pinned ? Numa::getWorkerNode(worker) : 0;
+        for (unsigned k = 0; k < bandCount; ++k) {
+            unsigned band = (firstBand + k) % bandCount;
+            int bandStart = static_cast<int>(static_cast<int64_t>(tileCount) * band / bandCount);
+            int bandEnd = static_cast<int>(static_cast<int64_t>(tileCount) * (band + 1) / bandCount);
+            for (int tile = bandStart + nextTiles[band]++; tile < bandEnd; tile = bandStart + nextTiles[band]++) {
+                if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+                    return;
+                }
+                int x0 = tile % tilesX * TILE_SIZE;
+                int y0 = tile / tilesX * TILE_SIZE;
+                Trace::Scope trace("tile", "%d,%d", x0, y0);
+                finished += renderTile(config, camera, x0, y0, step, previousStep, pixels, rowStride, threadState,
+                                       costMap);
+            }
+        }
+    });
+    return finished;
+}
+
+// Pixels a refining thread traces between looks at the clock
+constexpr size_t REFINE_CHUNK = 64;
+// Share of the image given one more sample per refining round
+constexpr size_t REFINE_FRACTION = 16;
+// Error estimates are binned by their bits from this one up, which order
+// positive floats: the exponent and three bits of mantissa, so each bin spans
+// an eighth of an octave. Bin 0 holds errors of zero.
+constexpr int ERROR_BIN_SHIFT = 20;
+constexpr uint32_t ERROR_BINS = 1u << (31 - ERROR_BIN_SHIFT);
+
+static uint32_t getErrorBin(float error) {
+    uint32_t bits;
+    std::memcpy(&bits, &error, sizeof(bits));
+    return bits >> ERROR_BIN_SHIFT;
+}
+
+// Where sample n of a pixel lies within it, from the R2 sequence; sample 0 is
+// the pixel's own position, where the first pass traced it
+static void getSampleOffset(uint32_t sample, float& dx, float& dy) {
+    dx = static_cast<float>(std::fmod(0.5 + sample * 0.7548776662466927, 1.0)) - 0.5f;
+    dy = static_cast<float>(std::fmod(0.5 + sample * 0.5698402909980532, 1.0)) - 0.5f;
+}
+
+// What the error estimate follows in a sample: displayed brightness plus
+// coverage, so silhouettes against the background count as edges
+static float getSampleValue(const float* rgba) {
+    return Math::clamp(0.2126f * rgba[0] + 0.7152f * rgba[1] + 0.0722f * rgba[2], 0.0f, 1.0f) + rgba[3];
+}
+
+// Threads estimate the errors of whole tiles and count them into histograms
+// of their own; the bin where the merged counts reach the round's share of
+// the image is the threshold the threads then trace the tiles against.
+uint64_t refineImage(const SceneConfiguration::Config& config, float* pixels, size_t rowStride,
+                     const RenderThreads& threads, std::chrono::steady_clock::time_point deadline,
+                     uint32_t& maxSamples) {
+    int width = config.imageWidth;
+    int height = config.imageHeight;
+    size_t pixelCount = static_cast<size_t>(width) * height;
+    std::vector<float> sums(4 * pixelCount);
+    std::vector<float> valueSums(pixelCount);
+    std::vector<float> valueSquares(pixelCount);
+    std::vector<uint32_t> counts(pixelCount, 1);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t i = static_cast<size_t>(y) * width + x;
+            const float* pixel = pixels + y * rowStride + 4 * static_cast<size_t>(x);
+            std::copy(pixel, pixel + 4, &sums[4 * i]);
+            valueSums[i] = getSampleValue(pixel);
+            valueSquares[i] = valueSums[i] * valueSums[i];
+        }
+    }
+
+    Camera camera = config.createCamera();
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tileCount = tilesX * ((height + TILE_SIZE - 1) / TILE_SIZE);
+    size_t workerCount = std::max<size_t>(1, std::min<size_t>(threads.count, tileCount));
+    std::vector<uint32_t> bins(pixelCount);
+    std::vector<uint32_t> histograms(workerCount * ERROR_BINS);
+    std::atomic<uint64_t> added(0);
+    size_t batchSize = std::min(pixelCount, std::max<size_t>(pixelCount / REFINE_FRACTION,
+                                                             REFINE_CHUNK * threads.count));
+
+    // Calls visit(x, y, i) for the pixels of a tile until it returns false;
+    // returns whether it never did
+    auto forTile = [&](int tile, auto&& visit) {
+        int x0 = tile % tilesX * TILE_SIZE;
+        int y0 = tile / tilesX * TILE_SIZE;
+        for (int y = y0; y < std::min(y0 + TILE_SIZE, height); ++y) {
+            for (int x = x0; x < std::min(x0 + TILE_SIZE, width); ++x) {
+                if (!visit(x, y, static_cast<size_t>(y) * width + x)) return false;
+            }
+        }
+        return true;
+    };
+
+    while (std::chrono::steady_clock::now() < deadline) {
+        std::fill(histograms.begin(), histograms.end(), 0);
+        std::atomic<int> nextTile(0);
+        runRenderThreads(threads, tileCount, [&](unsigned worker) {
+            uint32_t* histogram = &histograms[worker * ERROR_BINS];
+            for (int tile = nextTile++; tile < tileCount; tile = nextTile++) {
+                forTile(tile, [&](int x, int y, size_t i) {
+                    float mean = valueSums[i] / counts[i];
+                    float error = 0.0f;
+                    if (counts[i] > 1) {
+                        float variance = std::max(0.0f, valueSquares[i] / counts[i] - mean * mean);
+                        error = std::sqrt(variance / counts[i]);
+                    } else {
+                        auto compare = [&](size_t neighbor) {
+                            error = std::max(error, std::abs(mean - valueSums[neighbor] / counts[neighbor]));
+                        };
+                        if (x > 0) compare(i - 1);
+                        if (x + 1 < width) compare(i + 1);
+                        if (y > 0) compare(i - width);
+                        if (y + 1 < height) compare(i + width);
+                    }
+                    bins[i] = getErrorBin(error);
+                    ++histogram[bins[i]];
+                    return true;
+                });
+            }
+        });
+
+        // The round takes the largest bins until they hold its share of the image
+        uint32_t threshold = ERROR_BINS;
+        size_t selected = 0;
+        while (threshold > 1 && selected < batchSize) {
+            --threshold;
+            for (size_t worker = 0; worker < workerCount; ++worker) {
+                selected += histograms[worker * ERROR_BINS + threshold];
+            }
+        }
+        if (selected == 0) {
+            break;
+        }
+
+        Trace::Scope trace("refine", "%zu pixels", selected);
+        nextTile = 0;
+        runRenderThreads(threads, tileCount, [&](unsigned) {
+            RayTracer::ThreadState threadState(config.scene.getLights().size());
+            uint64_t traced = 0;
+            for (int tile = nextTile++; tile < tileCount; tile = nextTile++) {
+                bool inTime = forTile(tile, [&](int x, int y, size_t i) {
+                    if (bins[i] < threshold) return true;
+                    float dx, dy;
+                    getSampleOffset(counts[i], dx, dy);
+                    Ray ray = camera.generateRay(getScreenCoordinate(x + dx, width, config),
+                                                 -getScreenCoordinate(y + dy, height, config));
+                    RT_STAT_ADD(primaryRays, 1);
+                    auto traceResult = RayTracer::traceRay(ray, config.scene, config.maxBounces, threadState);
+
+                    float sample[4];
+                    writePixel(config, sample, traceResult.color, traceResult.hitSomething);
+                    for (int channel = 0; channel < 4; ++channel) sums[4 * i + channel] += sample[channel];
+                    float value = getSampleValue(sample);
+                    valueSums[i] += value;
+                    valueSquares[i] += value * value;
+                    ++counts[i];
+                    return ++traced % REFINE_CHUNK != 0 || std::chrono::steady_clock::now() < deadline;
+                });
+                if (!inTime || std::chrono::steady_clock::now() >= deadline) {
+                    break;
+                }
+            }
+            added += traced;
+        });
+    }
+
+    maxSamples = 1;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t i = static_cast<size_t>(y) * width + x;
+            if (counts[i] == 1) continue;
+            maxSamples = std::max(maxSamples, counts[i]);
+            float* pixel = pixels + y * rowStride + 4 * static_cast<size_t>(x);
+            for (int channel = 0; channel < 4; ++channel) pixel[channel] = sums[4 * i + channel] / counts[i];
+        }
+    }
+    return added;
+}
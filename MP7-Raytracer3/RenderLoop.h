@@ -0,0 +1,75 @@
+#ifndef RENDER_LOOP_H
+#define RENDER_LOOP_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Numa.h"
+#include "Renderer.h"
+#include "RenderThreads.h"
+#include "SceneConfiguration.h"
+#include "uselibpng.h"
+
+// Step of the pass a render to a deadline starts with, traced whatever the
+// deadline so that tiles the later passes never reach still get a color
+constexpr int BUDGET_FLOOR_STEP = 16;
+// What writing a PNG is expected to take, fixed and per pixel; renderToFile
+// stops tracing this long before its deadline to leave time for the encode
+constexpr double ENCODE_SECONDS = 0.001;
+constexpr double ENCODE_SECONDS_PER_PIXEL = 400e-9;
+
+class ImageRenderer {
+public:
+    ImageRenderer(int width, int height)
+        : width_(width), height_(height), pixels_(4 * static_cast<size_t>(width) * height),
+          image_(width, height) {}
+
+    // Linear RGBA rows; conversion to 8-bit sRGB happens for the whole image on save
+    float* getPixels() { return pixels_.data(); }
+
+    void saveToFile(const char* filename);
+
+private:
+    int width_;
+    int height_;
+    Numa::FirstTouchArray<float> pixels_;  // Linear RGBA, left for the render threads to place
+    Image image_;
+};
+
+// Where renderImage records what each pixel cost, values[y * stride + x]
+struct CostMap {
+    CostMetric metric;
+    float* values;
+    size_t stride;
+};
+
+// Writes <prefix>.png in false color, from black through blue, red and yellow
+// to white at the costliest pixel, and <prefix>.pfm with the raw values
+bool writeCostMap(const std::vector<float>& cost, int width, int height, const std::string& prefix,
+                  std::string& error);
+
+// Traces the image in square tiles into linear RGBA rows, rowStride floats
+// apart. step and previousStep select a pass of a progressive render: only
+// pixels on every step-th row and column are traced, each filling the step x
+// step block it is the top left corner of, and pixels on the grid of the
+// earlier, coarser pass already hold their sample. A cost map, if given,
+// receives the cost of every traced pixel. Past the deadline, if given,
+// threads stop taking tiles. Returns how many pixels of the pass were finished.
+uint64_t renderImage(const SceneConfiguration::Config& config, float* pixels, size_t rowStride,
+                     const RenderThreads& threads, int step = 1, int previousStep = 0,
+                     const CostMap* costMap = nullptr,
+                     const std::chrono::steady_clock::time_point* deadline = nullptr);
+
+// Adds samples to a fully traced image until the deadline, in rounds: each
+// round gives one more to the pixels whose error estimate is largest, judged
+// by the standard error of their samples or, with only one, by the contrast
+// with their neighbors. Stops early if every pixel has settled. Pixels end up
+// as the mean of their samples; returns how many were added and the most any
+// pixel got.
+uint64_t refineImage(const SceneConfiguration::Config& config, float* pixels, size_t rowStride,
+                     const RenderThreads& threads, std::chrono::steady_clock::time_point deadline,
+                     uint32_t& maxSamples);
+
+#endif // RENDER_LOOP_H
@@ -0,0 +1,26 @@
+#include "RenderThreads.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "Numa.h"
+#include "Trace.h"
+
+void runRenderThreads(const RenderThreads& threads, size_t limit, const std::function<void(unsigned)>& work) {
+    unsigned count = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads.count, limit)));
+    std::vector<std::thread> workers;
+    for (unsigned i = threads.pinned ? 0 : 1; i < count; ++i) {
+        workers.emplace_back([&work, &threads, i]() {
+            Trace::setThreadName("render worker");
+            if (threads.pinned) Numa::pinWorker(i);
+            ThreadScope scope(threads);
+            work(i);
+        });
+    }
+    if (!threads.pinned) {
+        ThreadScope scope(threads);
+        work(0);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef RENDER_THREADS_H
+#define RENDER_THREADS_H
+
+#include <cstddef>
+#include <functional>
+#include "Kernels.h"
+#include "Stats.h"
+
+// The threads of a render; pinned ones each run on a CPU of their own NUMA
+// node (Numa::pinWorker). They count into stats, if not nullptr, and compute
+// with kernels.
+struct RenderThreads {
+    unsigned count;
+    bool pinned;
+    Stats::Totals* stats;
+    const Kernels::Table* kernels;
+};
+
+// Makes the calling thread count and compute like the threads while it lives
+struct ThreadScope {
+    explicit ThreadScope(const RenderThreads& threads) : stats(threads.stats), kernels(*threads.kernels) {}
+
+    Stats::Scope stats;
+    Kernels::Scope kernels;
+};
+
+// Runs work(worker) on up to limit threads. The calling thread is one of them
+// unless they are pinned, since its pinning would outlast the render.
+void runRenderThreads(const RenderThreads& threads, size_t limit, const std::function<void(unsigned)>& work);
+
+#endif // RENDER_THREADS_H
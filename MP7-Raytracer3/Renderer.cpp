@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Kernels.h"
+#include "MeshClusters.h"
+#include "Numa.h"
+#include "Renderer.h"
+#include "RenderLoop.h"
+#include "RenderThreads.h"
+#include "SceneConfiguration.h"
+#include "Stats.h"
+#include "Trace.h"
+
+static bool isCompiledScene(const std::string& filename) {
+    const std::string extension = ".rtb";
+    return filename.size() > extension.size() &&
+           filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+struct Renderer::State {
+    SceneConfiguration::Config config;
+    SceneConfiguration loader;
+    std::string error;
+    unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+    bool pinThreads = false;
+    bool replicateAcceleration = false;
+    bool replicated = false;  // The scene's BVHs hold copies per node
+    bool statsEnabled = false;
+    Stats::Totals stats;
+    const Kernels::Table* kernels = &Kernels::getTable(Kernels::detect());
+
+    // From the first load after a build to the end of the next build
+    bool startingUp = false;
+    std::chrono::steady_clock::time_point startupStart;
+
+    State() { loader.setThreadCount(threadCount); }
+
+    // What the renderer's threads count into, nullptr while statistics are off
+    Stats::Totals* getStats() { return statsEnabled ? &stats : nullptr; }
+    RenderThreads getThreads() { return {threadCount, pinThreads, getStats(), kernels}; }
+
+    void beginStartup() {
+        if (startingUp) return;
+        startingUp = true;
+        startupStart = std::chrono::steady_clock::now();
+        loader.resetCriticalPath();
+    }
+
+    bool fail(const std::string& message) {
+        error = message;
+        return false;
+    }
+
+    bool canRender() {
+        if (config.imageWidth <= 0 || config.imageHeight <= 0) {
+            return fail("No image size; use setImage or a png command");
+        }
+        if (config.currentDefinition) {
+            return fail("Missing end for object " + config.currentDefinitionName);
+        }
+        return true;
+    }
+
+    // Config operations leave their reason in config.error
+    bool check(bool succeeded) {
+        if (!succeeded) error = config.error;
+        config.error.clear();
+        return succeeded;
+    }
+};
+
+Renderer::Renderer() : state_(std::make_unique<State>()) {}
+Renderer::Renderer(const Options& options) : Renderer() { setOptions(options); }
+Renderer::~Renderer() = default;
+Renderer::Renderer(Renderer&&) noexcept = default;
+Renderer& Renderer::operator=(Renderer&&) noexcept = default;
+
+const std::string& Renderer::getError() const { return state_->error; }
+
+bool Renderer::loadFile(const std::string& filename) {
+    ThreadScope scope(state_->getThreads());
+    RT_STAT_TIMER(parseSeconds);
+    Trace::Scope trace("parse", "%s", filename.c_str());
+    state_->beginStartup();
+    SceneConfiguration::Config& config = state_->config;
+    return isCompiledScene(filename) ? state_->loader.loadFromBinaryFile(filename, config, state_->error)
+                                     : state_->loader.loadFromFile(filename, config, state_->error);
+}
+
+bool Renderer::execute(std::string_view commands, const std::string& sourceName) {
+    ThreadScope scope(state_->getThreads());
+    RT_STAT_TIMER(parseSeconds);
+    Trace::Scope trace("parse", "%s", sourceName.c_str());
+    state_->beginStartup();
+    return state_->loader.loadFromText(commands, sourceName, state_->config, state_->error);
+}
+
+bool Renderer::compileToFile(const std::string& filename) const {
+    Trace::Scope trace("compile", "%s", filename.c_str());
+    return state_->loader.compileToFile(state_->config, filename, state_->error);
+}
+
+void Renderer::setImage(int width, int height, const std::string& outputFilename) {
+    state_->config.imageWidth = width;
+    state_->config.imageHeight = height;
+    state_->config.outputFilename = outputFilename;
+}
+
+void Renderer::setEye(const Vector3& position) { state_->config.cameraPosition = position; }
+void Renderer::setForward(const Vector3& forward) { state_->config.cameraForward = forward.getNormalized(); }
+void Renderer::setUp(const Vector3& up) { state_->config.cameraUp = up.getNormalized(); }
+void Renderer::setCameraType(CameraType type) { state_->config.cameraType = type; }
+
+void Renderer::setExposure(float exposure) {
+    state_->config.useExposure = true;
+    state_->config.exposureValue = exposure;
+}
+
+bool Renderer::setBounces(int bounces) { return state_->check(state_->config.setBounces(bounces)); }
+bool Renderer::setCaustics(int photons, float radius) {
+    return state_->check(state_->config.setCaustics(photons, radius));
+}
+
+void Renderer::setColor(const Vector3& color) { state_->config.pushMaterial().setDiffuseColor(color); }
+bool Renderer::setTexture(const std::string& filename) { return state_->check(state_->config.setTexture(filename)); }
+void Renderer::setShininess(const Vector3& reflectivity) { state_->config.pushMaterial().setReflectivity(reflectivity); }
+void Renderer::setTransparency(const Vector3& transparency) { state_->config.pushMaterial().setTransparency(transparency); }
+void Renderer::setRefractiveIndex(float refractiveIndex) { state_->config.pushMaterial().setRefractiveIndex(refractiveIndex); }
+
+void Renderer::addSun(const Vector3& direction) { state_->config.addDirectionalLight(direction); }
+void Renderer::addBulb(const Vector3& position) { state_->config.addPointLight(position); }
+void Renderer::addSphere(const Vector3& center, float radius) { state_->config.addSphere(center, radius); }
+void Renderer::addPlane(float a, float b, float c, float d) { state_->config.addPlane(a, b, c, d); }
+void Renderer::addVertex(const Vector3& position) { state_->config.vertices.push_back(position); }
+
+bool Renderer::addTriangle(int first, int second, int third) {
+    return state_->check(state_->config.addTriangle(first, second, third));
+}
+
+bool Renderer::addObj(const std::string& filename, int subdivisionLevels) {
+    ThreadScope scope(state_->getThreads());
+    return state_->check(state_->config.addObj(filename, subdivisionLevels, state_->threadCount));
+}
+
+bool Renderer::addHeightfield(int size, int faults, int weatheringPasses, int seed) {
+    ThreadScope scope(state_->getThreads());
+    return state_->check(state_->config.addHeightfield(size, faults, weatheringPasses, seed, state_->threadCount));
+}
+
+bool Renderer::addClusters(const std::string& indexFilename) {
+    return state_->check(state_->config.addClusters(indexFilename));
+}
+
+bool Renderer::beginObject(const std::string& name) { return state_->check(state_->config.beginObject(name)); }
+bool Renderer::endObject() { return state_->check(state_->config.endObject()); }
+
+bool Renderer::addInstance(const std::string& name, const float objectToWorld[16], bool overrideMaterial) {
+    return state_->check(state_->config.addInstance(name, objectToWorld, overrideMaterial));
+}
+
+void Renderer::setOptions(const Options& options) {
+    setThreadCount(options.threadCount);
+    setNumaPlacement(options.pinThreads, options.replicateAcceleration);
+    setHugePages(options.hugePages);
+    setGeometryBudget(options.geometryBudget ? options.geometryBudget : ClusterCache::DEFAULT_BUDGET);
+}
+
+void Renderer::setThreadCount(unsigned threadCount) {
+    state_->threadCount = threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+    state_->loader.setThreadCount(state_->threadCount);
+}
+
+unsigned Renderer::getThreadCount() const { return state_->threadCount; }
+
+void Renderer::setHugePages(bool enabled) { state_->config.hugePages = enabled; }
+
+void Renderer::setNumaPlacement(bool pinThreads, bool replicateAcceleration) {
+    state_->pinThreads = pinThreads;
+    state_->replicateAcceleration = pinThreads && replicateAcceleration;
+}
+
+void Renderer::setGeometryBudget(size_t bytes) { state_->config.clusterCache->setBudget(bytes); }
+
+void Renderer::setStatsEnabled(bool enabled) {
+    state_->statsEnabled = enabled;
+    state_->loader.setStats(state_->getStats());
+}
+
+RenderStats Renderer::getStats() const { return state_->stats.get(); }
+
+bool Renderer::setIsa(const std::string& name) {
+    Kernels::Isa isa;
+    std::string error;
+    if (!Kernels::find(name, isa, error)) return state_->fail(error);
+    state_->kernels = &Kernels::getTable(isa);
+    return true;
+}
+
+int Renderer::getWidth() const { return state_->config.imageWidth; }
+int Renderer::getHeight() const { return state_->config.imageHeight; }
+const std::string& Renderer::getOutputFilename() const { return state_->config.outputFilename; }
+
+void Renderer::build() {
+    SceneConfiguration::Config& config = state_->config;
+    ThreadScope scope(state_->getThreads());
+    Numa::HugePages hugePages(config.hugePages);
+    {
+        RT_STAT_TIMER(buildSeconds);
+        Trace::Scope trace("build");
+        config.scene.build();
+    }
+    config.scene.buildCaustics(config.causticPhotons, config.causticRadius, config.maxBounces, state_->getThreads());
+
+    // Pinned render worker n copies the BVHs for node n, so the copy's pages
+    // land there; copies a later build no longer wants are dropped
+    if (state_->replicateAcceleration && Numa::getNodeCount() > 1) {
+        Trace::Scope trace("replicate");
+        runRenderThreads(state_->getThreads(), Numa::getNodeCount(), [&config](unsigned) {
+            Numa::HugePages hugePages(config.hugePages);
+            config.scene.replicate();
+        });
+        state_->replicated = true;
+    } else if (state_->replicated) {
+        config.scene.dropReplicas();
+        state_->replicated = false;
+    }
+
+    // Tracing can start now
+    if (state_->startingUp) {
+        state_->startingUp = false;
+        std::chrono::duration<double> startup = std::chrono::steady_clock::now() - state_->startupStart;
+        RT_STAT_ADD(startupSeconds, startup.count());
+        RT_STAT_ADD(criticalPathSeconds, state_->loader.getCriticalPath());
+    }
+}
+
+bool Renderer::render(float* rgba, size_t rowStride) {
+    const SceneConfiguration::Config& config = state_->config;
+    if (!state_->canRender()) return false;
+    build();
+
+    ThreadScope scope(state_->getThreads());
+    RT_STAT_TIMER(traceSeconds);
+    renderImage(config, rgba, rowStride ? rowStride : 4 * static_cast<size_t>(config.imageWidth),
+                state_->getThreads());
+    return true;
+}
+
+bool Renderer::render(float* rgba, size_t rowStride, CostMetric metric, float* cost, size_t costStride) {
+    const SceneConfiguration::Config& config = state_->config;
+    if (!RT_STATS_ENABLED && metric != CostMetric::CYCLES) {
+        return state_->fail("Only the cycles cost map works with statistics compiled out (RT_DISABLE_STATS)");
+    }
+    if (!state_->canRender()) return false;
+    build();
+
+    CostMap costMap{metric, cost, costStride ? costStride : static_cast<size_t>(config.imageWidth)};
+    // The counter metrics read the counters, kept apart while statistics are off
+    Stats::Totals costStats;
+    RenderThreads threads = state_->getThreads();
+    if (!threads.stats) threads.stats = &costStats;
+    ThreadScope scope(threads);
+    RT_STAT_TIMER(traceSeconds);
+    renderImage(config, rgba, rowStride ? rowStride : 4 * static_cast<size_t>(config.imageWidth), threads, 1, 0,
+                &costMap);
+    return true;
+}
+
+bool Renderer::renderProgressive(float* rgba, size_t rowStride, const PassCallback& onPass) {
+    const SceneConfiguration::Config& config = state_->config;
+    if (!state_->canRender()) return false;
+    build();
+
+    ThreadScope scope(state_->getThreads());
+    rowStride = rowStride ? rowStride : 4 * static_cast<size_t>(config.imageWidth);
+    int previousStep = 0;
+    for (int pass = 0; pass < PREVIEW_PASSES; ++pass) {
+        int step = 1 << (PREVIEW_PASSES - 1 - pass);
+        {
+            RT_STAT_TIMER(traceSeconds);
+            Trace::Scope trace("preview pass", "1/%d", step * step);
+            renderImage(config, rgba, rowStride, state_->getThreads(), step, previousStep);
+        }
+        previousStep = step;
+        if (onPass) onPass(pass);
+    }
+    return true;
+}
+
+bool Renderer::render(float* rgba, size_t rowStride, std::chrono::steady_clock::time_point deadline,
+                      BudgetReport& report) {
+    const SceneConfiguration::Config& config = state_->config;
+    if (!state_->canRender()) return false;
+    build();
+
+    ThreadScope scope(state_->getThreads());
+    RT_STAT_TIMER(traceSeconds);
+    rowStride = rowStride ? rowStride : 4 * static_cast<size_t>(config.imageWidth);
+    uint64_t pixelCount = static_cast<uint64_t>(config.imageWidth) * config.imageHeight;
+    report = BudgetReport();
+    {
+        Trace::Scope trace("budget pass", "1/%d", BUDGET_FLOOR_STEP * BUDGET_FLOOR_STEP);
+        report.samples += renderImage(config, rgba, rowStride, state_->getThreads(), BUDGET_FLOOR_STEP);
+    }
+    int previousStep = BUDGET_FLOOR_STEP;
+    for (int pass = 0; pass < PREVIEW_PASSES; ++pass) {
+        int step = 1 << (PREVIEW_PASSES - 1 - pass);
+        Trace::Scope trace("budget pass", "1/%d", step * step);
+        report.samples += renderImage(config, rgba, rowStride, state_->getThreads(), step, previousStep, nullptr,
+                                      &deadline);
+        previousStep = step;
+    }
+    report.complete = report.samples == pixelCount;
+    report.maxSamples = 1;
+    if (report.complete) {
+        report.samples += refineImage(config, rgba, rowStride, state_->getThreads(), deadline, report.maxSamples);
+    }
+    report.samplesPerPixel = static_cast<double>(report.samples) / pixelCount;
+    return true;
+}
+
+bool Renderer::render(uint8_t* rgba, size_t rowStride) {
+    size_t width = static_cast<size_t>(std::max(getWidth(), 0));
+    size_t height = static_cast<size_t>(std::max(getHeight(), 0));
+    Numa::FirstTouchArray<float> pixels(4 * width * height);
+    if (!render(pixels.data())) return false;
+
+    ThreadScope scope(state_->getThreads());
+    RT_STAT_TIMER(encodeSeconds);
+    Trace::Scope trace("tone map");
+    rowStride = rowStride ? rowStride : 4 * width;
+    for (size_t y = 0; y < height; ++y) {
+        Kernels::get().encodeSRGB(&pixels[4 * width * y], rgba + y * rowStride, width);
+    }
+    return true;
+}
+
+bool Renderer::renderToFile() {
+    if (getOutputFilename().empty()) return state_->fail("No output file; use setImage or a png command");
+    if (!state_->canRender()) return false;
+    ImageRenderer image(getWidth(), getHeight());
+    if (!render(image.getPixels())) return false;
+
+    ThreadScope scope(state_->getThreads());
+    RT_STAT_TIMER(encodeSeconds);
+    image.saveToFile(getOutputFilename().c_str());
+    return true;
+}
+
+bool Renderer::renderToFile(CostMetric metric, const std::string& costPrefix) {
+    if (getOutputFilename().empty()) return state_->fail("No output file; use setImage or a png command");
+    if (!state_->canRender()) return false;
+    ImageRenderer image(getWidth(), getHeight());
+    std::vector<float> cost(static_cast<size_t>(getWidth()) * getHeight());
+    if (!render(image.getPixels(), 0, metric, cost.data())) return false;
+
+    ThreadScope scope(state_->getThreads());
+    RT_STAT_TIMER(encodeSeconds);
+    image.saveToFile(getOutputFilename().c_str());
+    std::string error;
+    if (!writeCostMap(cost, getWidth(), getHeight(), costPrefix, error)) return state_->fail(error);
+    return true;
+}
+
+bool Renderer::renderToFile(std::chrono::steady_clock::time_point deadline, BudgetReport& report) {
+    if (getOutputFilename().empty()) return state_->fail("No output file; use setImage or a png command");
+    if (!state_->canRender()) return false;
+    ImageRenderer image(getWidth(), getHeight());
+    double pixelCount = static_cast<double>(getWidth()) * getHeight();
+    std::chrono::duration<double> encode(ENCODE_SECONDS + ENCODE_SECONDS_PER_PIXEL * pixelCount);
+    auto traceDeadline = deadline - std::chrono::duration_cast<std::chrono::steady_clock::duration>(encode);
+    if (!render(image.getPixels(), 0, traceDeadline, report)) return false;
+
+    ThreadScope scope(state_->getThreads());
+    RT_STAT_TIMER(encodeSeconds);
+    image.saveToFile(getOutputFilename().c_str());
+    return true;
+}
+
+bool Renderer::renderToFile(const PassCallback& onPass) {
+    if (getOutputFilename().empty()) return state_->fail("No output file; use setImage or a png command");
+    if (!state_->canRender()) return false;
+    ImageRenderer image(getWidth(), getHeight());
+    return renderProgressive(image.getPixels(), 0, [&](int pass) {
+        {
+            ThreadScope scope(state_->getThreads());
+            RT_STAT_TIMER(encodeSeconds);
+            image.saveToFile(getOutputFilename().c_str());
+        }
+        if (onPass) onPass(pass);
+    });
+}
@@ -0,0 +1,181 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "Math.h"
+#include "Stats.h"
+
+enum class CameraType {
+    CLASSIC,
+    FISHEYE,
+    PANORAMA
+};
+
+// What a cost map records for each pixel: the rays it cast (primary, shadow and
+// bounces), primitive intersection tests, acceleration-node visits, or CPU
+// cycles (the time-stamp counter on x86, nanoseconds elsewhere)
+enum class CostMetric {
+    RAYS,
+    PRIMITIVE_TESTS,
+    NODE_VISITS,
+    CYCLES
+};
+
+// The ray tracer as a library. A scene is built from a scene file, from
+// command text in memory or from the typed calls below (which mirror the
+// scene-file commands one for one), and renders into a caller-owned buffer.
+// Renderers share nothing but process-wide read-only data, the textures of
+// TextureCache; each keeps its own statistics and kernel choice. Several can
+// therefore load and render on different threads at once.
+class Renderer {
+public:
+    // Threads and memory of a renderer, set together; the setters further
+    // down change them one at a time
+    struct Options {
+        unsigned threadCount = 0;  // 0 for one per hardware thread
+        bool pinThreads = false;   // setNumaPlacement
+        bool replicateAcceleration = false;
+        bool hugePages = false;
+        size_t geometryBudget = 0;  // Bytes, 0 for the default of setGeometryBudget
+    };
+
+    Renderer();
+    explicit Renderer(const Options& options);
+    ~Renderer();
+    Renderer(Renderer&&) noexcept;
+    Renderer& operator=(Renderer&&) noexcept;
+
+    // Anything that fails returns false and leaves a message in getError()
+    const std::string& getError() const;
+
+    // Scene files (.rtb for compiled ones) and command text add to the
+    // current scene; sourceName prefixes error locations
+    bool loadFile(const std::string& filename);
+    bool execute(std::string_view commands, const std::string& sourceName = "<commands>");
+    bool compileToFile(const std::string& filename) const;
+
+    // png, eye, forward, up, fisheye/panorama, expose, bounces and caustics
+    void setImage(int width, int height, const std::string& outputFilename = "");
+    void setEye(const Vector3& position);
+    void setForward(const Vector3& forward);
+    void setUp(const Vector3& up);
+    void setCameraType(CameraType type);
+    void setExposure(float exposure);
+    bool setBounces(int bounces);
+    // Photons emitted toward specular objects, gathered within radius; 0 turns caustics off
+    bool setCaustics(int photons, float radius);
+
+    // Material state picked up by later objects: color, texture, shininess,
+    // transparency and ior
+    void setColor(const Vector3& color);
+    bool setTexture(const std::string& filename);  // Empty for none
+    void setShininess(const Vector3& reflectivity);
+    void setTransparency(const Vector3& transparency);
+    void setRefractiveIndex(float refractiveIndex);
+
+    void addSun(const Vector3& direction);
+    void addBulb(const Vector3& position);
+    void addSphere(const Vector3& center, float radius);
+    void addPlane(float a, float b, float c, float d);
+    void addVertex(const Vector3& position);
+    // 1-based vertex indices, negative ones counting back from the last vertex
+    bool addTriangle(int first, int second, int third);
+    bool addObj(const std::string& filename, int subdivisionLevels = 0);
+    bool addHeightfield(int size, int faults, int weatheringPasses = 0, int seed = 1);
+    // Out-of-core mesh written by MeshClusters::write (--cluster); its
+    // clusters are mapped during rendering as rays reach them
+    bool addClusters(const std::string& indexFilename);
+    bool beginObject(const std::string& name);
+    bool endObject();
+    // objectToWorld is column-major; overrideMaterial uses the current material
+    bool addInstance(const std::string& name, const float objectToWorld[16], bool overrideMaterial = false);
+
+    void setOptions(const Options& options);
+    // Threads rendering tiles; 0 for one per hardware thread, the default
+    void setThreadCount(unsigned threadCount);
+    unsigned getThreadCount() const;
+    // Pins the render threads round-robin to the NUMA nodes and gives each
+    // node a band of tile rows to take first; replicateAcceleration also
+    // copies every BVH to each node at build. Images are unchanged.
+    void setNumaPlacement(bool pinThreads, bool replicateAcceleration = false);
+    // Puts BVH arrays of 2 MB or more on huge pages, for this renderer's
+    // scene only; off by default. Takes effect for what is built next.
+    void setHugePages(bool enabled);
+
+    // Bytes of out-of-core clusters kept mapped at once, 2 GB by default. The
+    // least recently used are unmapped to load more.
+    void setGeometryBudget(size_t bytes);
+
+    // Counts rays, tests and phase times from here on, off by default; off,
+    // the counters cost one test of a thread-local pointer each
+    void setStatsEnabled(bool enabled);
+    // Everything counted while enabled by calls that have returned
+    RenderStats getStats() const;
+
+    // Runs the hot loops at an instruction set level (Kernels::find) instead
+    // of the best one the CPU supports
+    bool setIsa(const std::string& name);
+
+    int getWidth() const;
+    int getHeight() const;
+    const std::string& getOutputFilename() const;
+
+    // Builds the acceleration structures; render does this itself when the
+    // scene changed, so calling it only separates the time it takes
+    void build();
+    // width x height RGBA rows, rowStride values apart (0 for 4 * width).
+    // Bytes get sRGB-encoded color, floats linear color, both after exposure.
+    bool render(uint8_t* rgba, size_t rowStride = 0);
+    bool render(float* rgba, size_t rowStride = 0);
+    // Renders to the png command's file
+    bool renderToFile();
+
+    // Also fills width x height floats, costStride apart (0 for width), with
+    // what each pixel cost. Pixels of culled tiles cost 0. Only CYCLES works
+    // when the Stats counters are compiled out.
+    bool render(float* rgba, size_t rowStride, CostMetric metric, float* cost, size_t costStride = 0);
+    // Renders to the png command's file and writes the cost map next to it as
+    // <costPrefix>.png, in false color scaled to the costliest pixel, and as
+    // <costPrefix>.pfm, the raw values as a little-endian float map
+    bool renderToFile(CostMetric metric, const std::string& costPrefix);
+
+    // Progressive rendering for a quick first look: passes at 1/16, 1/4 and
+    // full resolution. A pass traces only the pixels on every 4th, 2nd or
+    // every row and column that no earlier pass traced, and fills the block
+    // each one starts with its color, so the last pass leaves the same image
+    // render would. onPass(pass), pass counting from 0, is called after each.
+    static constexpr int PREVIEW_PASSES = 3;
+    typedef std::function<void(int pass)> PassCallback;
+    bool renderProgressive(float* rgba, size_t rowStride, const PassCallback& onPass);
+    // Rewrites the png command's file after every pass, before calling onPass
+    bool renderToFile(const PassCallback& onPass);
+
+    // Rendering to a deadline: a 1/256 pass traced regardless, then the preview
+    // passes, which stop taking tiles at the deadline and leave the tiles they
+    // miss to the coarser passes, then, while time remains, more samples
+    // spread within the pixels whose error estimate is largest. Tracing stops
+    // at the deadline give or take a tile per thread; building the scene
+    // counts against it. renderToFile stops early by an estimate of the time
+    // the PNG takes to encode, so the file is written by the deadline.
+    struct BudgetReport {
+        uint64_t samples = 0;
+        double samplesPerPixel = 0.0;
+        uint32_t maxSamples = 0;  // In any one pixel
+        bool complete = false;    // Whether every pixel was traced rather than filled by a coarser pass
+    };
+    bool render(float* rgba, size_t rowStride, std::chrono::steady_clock::time_point deadline,
+                BudgetReport& report);
+    bool renderToFile(std::chrono::steady_clock::time_point deadline, BudgetReport& report);
+
+private:
+    struct State;
+    std::unique_ptr<State> state_;
+};
+
+#endif // RENDERER_H
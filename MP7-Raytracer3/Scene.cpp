@@ -0,0 +1,64 @@
+#include "Scene.h"
+#include "RayTracer.h"
+#include "Stats.h"
+#include "Trace.h"
+
+void Scene::buildCaustics(int photonCount, float radius, int maxBounces, const RenderThreads& threads) {
+    if (!causticsStale_ && photonCount == causticPhotonCount_ && radius == causticRadius_ &&
+        maxBounces == causticBounces_) {
+        return;
+    }
+    causticsStale_ = false;
+    causticPhotonCount_ = photonCount;
+    causticRadius_ = radius;
+    causticBounces_ = maxBounces;
+    causticMap_.clear();
+    if (photonCount <= 0) {
+        return;
+    }
+
+    RT_STAT_TIMER(photonSeconds);
+    Trace::Scope trace("photons", "%d", photonCount);
+    std::vector<PhotonMap::Photon> photons;
+    PhotonTracer::emit(*this, photonCount, maxBounces, threads, photons);
+    causticMap_.build(photons, radius);
+}
+
+void Scene::compile(SceneCompiler& compiler) const {
+    for (const auto* light : lights_) {
+        light->compile(compiler.getWriter());
+    }
+    objects_.compile(compiler);
+}
+
+bool Scene::findNearestIntersection(const Ray& ray, IntersectionInfo& intersection, float minDistance,
+                                    const std::vector<uint32_t>* startNodes) const {
+    Hit hit;
+    bool foundIntersection = objects_.intersect(ray, minDistance, hit, startNodes);
+    RT_STAT_ADD(rayHits, foundIntersection ? 1 : 0);
+    RT_STAT_ADD(rayMisses, foundIntersection ? 0 : 1);
+    if (foundIntersection) {
+        hit.object->getSurface(ray, hit.distance, hit, intersection);
+        intersection.object = hit.object;
+        intersection.primitive = hit.primitive;
+    }
+    return foundIntersection;
+}
+
+bool Scene::isOccluded(const Ray& ray, float minDistance, float maxDistance, Occluder& lastOccluder) const {
+    if (lastOccluder.object &&
+        lastOccluder.object->occludes(ray, lastOccluder.primitive, minDistance, maxDistance)) {
+        RT_STAT_ADD(shadowCacheHits, 1);
+        RT_STAT_ADD(rayHits, 1);
+        return true;
+    }
+
+    // Anything past maxDistance is culled during traversal, and no surface is needed
+    Hit hit;
+    hit.distance = maxDistance;
+    bool occluded = objects_.intersect(ray, minDistance, hit);
+    RT_STAT_ADD(rayHits, occluded ? 1 : 0);
+    RT_STAT_ADD(rayMisses, occluded ? 0 : 1);
+    lastOccluder = occluded ? Occluder{hit.object, hit.primitive} : Occluder{};
+    return occluded;
+}
@@ -0,0 +1,69 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cstdint>
+#include <vector>
+#include "PhotonMap.h"
+#include "RenderThreads.h"
+#include "SceneObjects.h"
+
+class Scene {
+public:
+    Scene() = default;
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+    ~Scene() {
+        for (auto* light : lights_) delete light;
+    }
+
+    // Both take ownership
+    void addObject(SceneObject* object) {
+        objects_.addObject(object);
+        causticsStale_ = true;
+    }
+    void addLight(LightSource* light) {
+        lights_.push_back(light);
+        causticsStale_ = true;
+    }
+
+    void build() { objects_.build(); }
+    void replicate() { objects_.replicate(); }
+    void dropReplicas() { objects_.dropReplicas(); }
+
+    // Emits caustic photons again if the scene or the settings changed since
+    // the last time; no photons leaves the map empty. After build().
+    void buildCaustics(int photonCount, float radius, int maxBounces, const RenderThreads& threads);
+    bool hasCaustics() const { return !causticMap_.isEmpty(); }
+    Vector3 gatherCaustics(const Vector3& point, const Vector3& normal) const {
+        return causticMap_.gather(point, normal);
+    }
+
+    void compile(SceneCompiler& compiler) const;
+
+    const std::vector<LightSource*>& getLights() const { return lights_; }
+    BoundingBox getBounds() const { return objects_.getBounds(); }
+    void addCausticTargets(std::vector<BoundingBox>& targets) const { objects_.addCausticTargets(targets); }
+
+    bool cull(const Frustum& frustum, std::vector<uint32_t>& startNodes) const {
+        return objects_.cull(frustum, startNodes);
+    }
+
+    // Traverses first, then works out the surface only at the nearest hit
+    bool findNearestIntersection(const Ray& ray, IntersectionInfo& intersection, float minDistance,
+                                 const std::vector<uint32_t>* startNodes = nullptr) const;
+
+    // Whether anything lies along the ray within [minDistance, maxDistance).
+    // lastOccluder is tried first and then replaced by whatever blocked the ray.
+    bool isOccluded(const Ray& ray, float minDistance, float maxDistance, Occluder& lastOccluder) const;
+
+private:
+    ObjectGroup objects_;
+    std::vector<LightSource*> lights_;
+    PhotonMap causticMap_;
+    bool causticsStale_ = true;
+    int causticPhotonCount_ = 0;
+    float causticRadius_ = 0.0f;
+    int causticBounces_ = 0;
+};
+
+#endif // SCENE_H
@@ -0,0 +1,136 @@
+#include "SceneBinary.h"
+#include <fstream>
+
+namespace SceneBinary {
+    namespace {
+        size_t getRecordSize(Section section) {
+            switch (section) {
+                case SETTINGS: return sizeof(Settings);
+                case STRINGS: return 1;
+                case MATERIALS: return sizeof(Material);
+                case LIGHTS: return sizeof(Light);
+                case SPHERES: return sizeof(Sphere);
+                case PLANES: return sizeof(Plane);
+                case TRIANGLES: return sizeof(Triangle);
+                case MESHES: return sizeof(Mesh);
+                case MESH_POSITIONS: return 3 * sizeof(float);
+                case MESH_NORMALS: return 3 * sizeof(float);
+                case MESH_TEXCOORDS: return 2 * sizeof(float);
+                case MESH_INDICES: return sizeof(uint32_t);
+                case INSTANCES: return sizeof(Instance);
+                case HEIGHTFIELDS: return sizeof(Heightfield);
+                case HEIGHTFIELD_HEIGHTS: return sizeof(float);
+                case CLUSTERED_MESHES: return sizeof(ClusteredMesh);
+                default: return 1;
+            }
+        }
+
+        uint64_t alignUp(uint64_t value) {
+            return (value + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+        }
+    }
+
+    uint32_t Writer::addString(const std::string& value) {
+        std::vector<char>& bytes = sections_[STRINGS];
+        uint32_t offset = static_cast<uint32_t>(bytes.size());
+        bytes.insert(bytes.end(), value.begin(), value.end());
+        bytes.push_back('\0');
+        return offset;
+    }
+
+    bool Writer::writeToFile(const std::string& filename, std::string& error) const {
+        Header header = {};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.byteOrderMark = BYTE_ORDER_MARK;
+
+        uint64_t offset = alignUp(sizeof(Header));
+        for (uint32_t section = 0; section < SECTION_COUNT; ++section) {
+            header.sections[section].offset = offset;
+            header.sections[section].size = sections_[section].size();
+            offset = alignUp(offset + sections_[section].size());
+        }
+        header.fileSize = offset;
+
+        std::ofstream out(filename, std::ios::binary);
+        if (!out) {
+            error = "cannot create " + filename;
+            return false;
+        }
+
+        const char padding[SECTION_ALIGNMENT] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        uint64_t written = sizeof(header);
+        for (uint32_t section = 0; section < SECTION_COUNT; ++section) {
+            out.write(padding, header.sections[section].offset - written);
+            out.write(sections_[section].data(), sections_[section].size());
+            written = header.sections[section].offset + sections_[section].size();
+        }
+        out.write(padding, header.fileSize - written);
+
+        if (!out) {
+            error = "failed writing " + filename;
+            return false;
+        }
+        return true;
+    }
+
+    bool Reader::open(const std::string& filename, std::string& error) {
+        if (!file_.open(filename, MappedFile::Access::WHOLE_FILE)) {
+            error = "cannot open " + filename;
+            return false;
+        }
+        if (file_.getSize() < sizeof(Header)) {
+            error = filename + " is too small to be a compiled scene";
+            return false;
+        }
+
+        std::memcpy(&header_, file_.getData(), sizeof(Header));
+        if (std::memcmp(header_.magic, MAGIC, sizeof(MAGIC)) != 0) {
+            error = filename + " is not a compiled scene";
+            return false;
+        }
+        if (header_.byteOrderMark != BYTE_ORDER_MARK) {
+            error = filename + " was compiled on a machine with a different byte order";
+            return false;
+        }
+        if (header_.version != VERSION) {
+            error = filename + " has format version " + std::to_string(header_.version) +
+                    ", expected " + std::to_string(VERSION) + "; recompile it";
+            return false;
+        }
+        if (header_.fileSize != file_.getSize()) {
+            error = filename + " is truncated";
+            return false;
+        }
+
+        for (uint32_t i = 0; i < SECTION_COUNT; ++i) {
+            Section section = static_cast<Section>(i);
+            const SectionEntry& entry = header_.sections[section];
+            if (entry.offset % SECTION_ALIGNMENT != 0 || entry.offset > header_.fileSize ||
+                entry.size > header_.fileSize - entry.offset ||
+                entry.size % getRecordSize(section) != 0) {
+                error = filename + " has a corrupt section table";
+                return false;
+            }
+        }
+        if (getCount<Settings>(SETTINGS) != 1) {
+            error = filename + " has no scene settings";
+            return false;
+        }
+        return true;
+    }
+
+    const char* Reader::getString(uint32_t offset) const {
+        const SectionEntry& entry = header_.sections[STRINGS];
+        if (offset >= entry.size) {
+            return nullptr;
+        }
+        const char* begin = file_.getData() + entry.offset;
+        // The string must be terminated inside the section
+        if (std::memchr(begin + offset, '\0', entry.size - offset) == nullptr) {
+            return nullptr;
+        }
+        return begin + offset;
+    }
+}
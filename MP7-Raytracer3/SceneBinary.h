@@ -0,0 +1,203 @@
+#ifndef SCENE_BINARY_H
+#define SCENE_BINARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+// On-disk layout of compiled .rtb scenes. Records are plain structs of 4-byte
+// fields in host byte order, and every section starts on a 64-byte boundary,
+// so a mapped file is used in place without any per-element parsing.
+namespace SceneBinary {
+    constexpr char MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+    constexpr uint32_t VERSION = 5;
+    constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+    constexpr size_t SECTION_ALIGNMENT = 64;
+    constexpr uint32_t NO_INDEX = 0xffffffffu;
+
+    enum Section : uint32_t {
+        SETTINGS,
+        STRINGS,         // NUL-terminated strings referenced by byte offset
+        MATERIALS,
+        LIGHTS,
+        SPHERES,
+        PLANES,
+        TRIANGLES,
+        MESHES,
+        MESH_POSITIONS,  // float[3] per vertex
+        MESH_NORMALS,    // float[3] per normal
+        MESH_TEXCOORDS,  // float[2] per texture coordinate
+        MESH_INDICES,    // uint32_t
+        INSTANCES,
+        HEIGHTFIELDS,
+        HEIGHTFIELD_HEIGHTS,  // float, size * size per heightfield
+        CLUSTERED_MESHES,
+        SECTION_COUNT
+    };
+
+    struct SectionEntry {
+        uint64_t offset;  // Bytes from the start of the file
+        uint64_t size;    // Bytes
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrderMark;
+        uint64_t fileSize;
+        SectionEntry sections[SECTION_COUNT];
+    };
+
+    // Group 0 is the scene itself; groups 1..definitionCount are `object`
+    // definitions, which only instances refer to.
+    struct Settings {
+        uint32_t imageWidth;
+        uint32_t imageHeight;
+        uint32_t outputFilename;  // String offset
+        uint32_t cameraType;
+        float cameraPosition[3];
+        float cameraForward[3];
+        float cameraUp[3];
+        uint32_t useExposure;
+        float exposureValue;
+        uint32_t definitionCount;
+        uint32_t maxBounces;
+        uint32_t causticPhotons;
+        float causticRadius;
+    };
+
+    struct Material {
+        float diffuseColor[3];
+        uint32_t textureFilename;  // String offset, or NO_INDEX when untextured
+        float reflectivity[3];
+        float transparency[3];
+        float refractiveIndex;
+    };
+
+    enum LightType : uint32_t { DIRECTIONAL_LIGHT, POINT_LIGHT };
+
+    struct Light {
+        uint32_t type;
+        float vector[3];  // Direction for directional lights, position for point lights
+        float color[3];
+    };
+
+    // Primitives of one group are stored contiguously, in the order they were added
+    struct Sphere {
+        float center[3];
+        float radius;
+        uint32_t material;
+        uint32_t group;
+    };
+
+    struct Plane {
+        float coefficients[4];  // A, B, C, D of Ax + By + Cz + D = 0
+        uint32_t material;
+        uint32_t group;
+    };
+
+    struct Triangle {
+        float vertices[3][3];
+        uint32_t material;
+        uint32_t group;
+    };
+
+    // Normal and texcoord indices follow the position indices in MESH_INDICES
+    // when present, each 3 * triangleCount long.
+    struct Mesh {
+        uint32_t material;
+        uint32_t group;
+        uint32_t firstPosition;
+        uint32_t positionCount;
+        uint32_t firstNormal;
+        uint32_t normalCount;
+        uint32_t firstTexcoord;
+        uint32_t texcoordCount;
+        uint32_t firstIndex;
+        uint32_t triangleCount;
+        uint32_t hasNormalIndices;
+        uint32_t hasTexcoordIndices;
+    };
+
+    struct Heightfield {
+        uint32_t material;
+        uint32_t group;
+        uint32_t size;         // Vertices per side
+        uint32_t firstHeight;  // Row-major in HEIGHTFIELD_HEIGHTS
+    };
+
+    // Out-of-core mesh; its clusters stay in their own files
+    struct ClusteredMesh {
+        uint32_t material;
+        uint32_t group;
+        uint32_t indexFilename;  // String offset
+    };
+
+    struct Instance {
+        float objectToWorld[4][4];  // [row][column]
+        float worldToObject[4][4];
+        uint32_t definition;        // Group index, never 0
+        uint32_t material;          // Override material, or NO_INDEX to keep the definition's
+        uint32_t group;
+    };
+
+    // Collects sections in memory and writes them out as one file
+    class Writer {
+    public:
+        uint32_t addString(const std::string& value);
+
+        // Appends count records to a section and returns the index of the first
+        template <typename T>
+        uint32_t add(Section section, const T* records, size_t count) {
+            std::vector<char>& bytes = sections_[section];
+            uint32_t first = static_cast<uint32_t>(bytes.size() / sizeof(T));
+            bytes.resize(bytes.size() + count * sizeof(T));
+            if (count > 0) {
+                std::memcpy(bytes.data() + first * sizeof(T), records, count * sizeof(T));
+            }
+            return first;
+        }
+
+        template <typename T>
+        uint32_t add(Section section, const T& record) { return add(section, &record, 1); }
+
+        template <typename T>
+        uint32_t getCount(Section section) const {
+            return static_cast<uint32_t>(sections_[section].size() / sizeof(T));
+        }
+
+        bool writeToFile(const std::string& filename, std::string& error) const;
+
+    private:
+        std::vector<char> sections_[SECTION_COUNT];
+    };
+
+    // Maps a compiled scene and checks that every section lies inside the file.
+    // Record contents (indices, string offsets) are validated by the caller.
+    class Reader {
+    public:
+        bool open(const std::string& filename, std::string& error);
+
+        template <typename T>
+        const T* getRecords(Section section) const {
+            return reinterpret_cast<const T*>(file_.getData() + header_.sections[section].offset);
+        }
+
+        template <typename T>
+        size_t getCount(Section section) const {
+            return header_.sections[section].size / sizeof(T);
+        }
+
+        // nullptr unless offset starts a string inside the STRINGS section
+        const char* getString(uint32_t offset) const;
+
+    private:
+        MappedFile file_;
+        Header header_;
+    };
+}
+
+#endif // SCENE_BINARY_H
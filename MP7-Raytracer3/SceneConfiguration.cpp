@@ -0,0 +1,925 @@
+#include "SceneConfiguration.h"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include "Numa.h"
+#include "Subdivision.h"
+#include "Trace.h"
+
+bool SceneConfiguration::Config::setBounces(int bounces) {
+    if (bounces < 0) {
+        error = "Bounces must not be negative";
+        return false;
+    }
+    maxBounces = bounces;
+    return true;
+}
+
+bool SceneConfiguration::Config::setCaustics(int photons, float radius) {
+    if (photons < 0) {
+        error = "Photon count must not be negative";
+        return false;
+    }
+    if (!(radius > 0.0f)) {
+        error = "Caustic gather radius must be positive";
+        return false;
+    }
+    causticPhotons = photons;
+    causticRadius = radius;
+    return true;
+}
+
+bool SceneConfiguration::Config::setTexture(const std::string& filename) {
+    std::shared_ptr<const Texture> texture;
+    if (!filename.empty()) {
+        texture = TextureCache::getInstance().acquire(filename);
+        if (!texture) {
+            error = "Failed to load texture: " + filename;
+            return false;
+        }
+    }
+    useTexture(std::move(texture));
+    return true;
+}
+
+void SceneConfiguration::Config::addDirectionalLight(const Vector3& direction) {
+    auto light = std::make_unique<DirectionalLight>(
+        direction,
+        materials.back()->getDiffuseColor()
+    );
+    scene.addLight(light.release());
+}
+
+void SceneConfiguration::Config::addPointLight(const Vector3& position) {
+    auto light = std::make_unique<PointLight>(
+        position,
+        materials.back()->getDiffuseColor()
+    );
+    scene.addLight(light.release());
+}
+
+void SceneConfiguration::Config::addSphere(const Vector3& center, float radius) {
+    auto sphere = std::make_unique<Sphere>(
+        radius,
+        center,
+        materials.back().get()
+    );
+    addObject(sphere.release());
+}
+
+void SceneConfiguration::Config::addPlane(float a, float b, float c, float d) {
+    auto plane = std::make_unique<Plane>(a, b, c, d, materials.back().get());
+    addObject(plane.release());
+}
+
+bool SceneConfiguration::Config::addTriangle(int first, int second, int third) {
+    int size = static_cast<int>(vertices.size());
+    int indices[3] = {first, second, third};
+    for (int& index : indices) {
+        index = index < 0 ? size + index : index - 1;
+        if (index < 0 || index >= size) {
+            error = "Triangle vertex is out of range";
+            return false;
+        }
+    }
+
+    auto triangle = std::make_unique<Triangle>(
+        vertices[indices[0]],
+        vertices[indices[1]],
+        vertices[indices[2]],
+        materials.back().get()
+    );
+    addObject(triangle.release());
+    return true;
+}
+
+bool SceneConfiguration::Config::addObj(const std::string& filename, int levels, unsigned threadCount) {
+    Trace::Scope trace("obj load", "%s", filename.c_str());
+    ObjMesh mesh;
+    if (levels < 0) {
+        error = "Subdivision levels must not be negative";
+        return false;
+    }
+    if (!readObj(filename, levels, threadCount, mesh, error)) return false;
+
+    auto triangleMesh = std::make_unique<TriangleMesh>(
+        std::move(mesh),
+        materials.back().get()
+    );
+    addObject(triangleMesh.release());
+    return true;
+}
+
+bool SceneConfiguration::Config::addObj(const std::string& filename, int levels, TaskGraph& graph,
+                                        std::shared_ptr<TaskGraph::Task>& task) {
+    if (levels < 0) {
+        error = "Subdivision levels must not be negative";
+        return false;
+    }
+    auto* triangleMesh = new TriangleMesh(ObjMesh(), materials.back().get());
+    addObject(triangleMesh);
+    TaskGraph* tasks = &graph;
+    bool hugePages = this->hugePages;
+    task = graph.add("obj load", filename, [triangleMesh, filename, levels, tasks, hugePages](std::string& error) {
+        ObjMesh mesh;
+        {
+            TaskGraph::Lease threads(*tasks);
+            if (!readObj(filename, levels, threads.getThreadCount(), mesh, error)) return false;
+        }
+        triangleMesh->setMesh(std::move(mesh));
+        Trace::Scope trace("mesh build");
+        Numa::HugePages pages(hugePages);
+        triangleMesh->build();
+        return true;
+    });
+    return true;
+}
+
+bool SceneConfiguration::Config::readObj(const std::string& filename, int levels, unsigned threadCount,
+                                         ObjMesh& mesh, std::string& error) {
+    if (!ObjLoader::loadFromFile(filename, threadCount, mesh, error)) {
+        error = "Failed to load OBJ: " + error;
+        return false;
+    }
+    if (levels > 0) {
+        PolygonMesh polygons = PolygonMesh::fromObj(mesh);
+        if (!Subdivision::subdivide(polygons, levels, threadCount, error)) {
+            error = "Failed to subdivide " + filename + ": " + error;
+            return false;
+        }
+        mesh = polygons.toTriangles(threadCount);
+    }
+    return true;
+}
+
+bool SceneConfiguration::Config::addClusters(const std::string& indexFilename) {
+    std::vector<MeshClusters::ClusterRecord> clusters;
+    if (!MeshClusters::readIndex(indexFilename, clusters, error)) {
+        error = "Failed to load clusters: " + error;
+        return false;
+    }
+    addObject(new OutOfCoreMesh(indexFilename, clusters, clusterCache, materials.back().get()));
+    return true;
+}
+
+bool SceneConfiguration::Config::addHeightfield(int size, int faults, int weathering, int seed, unsigned threadCount) {
+    if (size < static_cast<int>(Heightfield::MIN_SIZE) || size > static_cast<int>(Heightfield::MAX_SIZE)) {
+        error = "Heightfield size must be between " + std::to_string(Heightfield::MIN_SIZE) + " and " +
+                std::to_string(Heightfield::MAX_SIZE);
+        return false;
+    }
+    if (faults < 0 || weathering < 0 || seed < 0) {
+        error = "Heightfield values must not be negative";
+        return false;
+    }
+
+    std::vector<float> heights = Heightfield::generate(static_cast<uint32_t>(size),
+        static_cast<uint32_t>(faults), static_cast<uint32_t>(weathering), static_cast<uint32_t>(seed),
+        threadCount);
+    auto terrain = std::make_unique<Terrain>(
+        Heightfield(static_cast<uint32_t>(size), std::move(heights)),
+        materials.back().get()
+    );
+    addObject(terrain.release());
+    return true;
+}
+
+bool SceneConfiguration::Config::beginObject(const std::string& name) {
+    if (currentDefinition) {
+        error = "Object " + name + " starts inside object " + currentDefinitionName;
+        return false;
+    }
+    if (objectDefinitions.count(name)) {
+        error = "Object " + name + " is already defined";
+        return false;
+    }
+    currentDefinitionName = name;
+    currentDefinition = std::make_shared<ObjectGroup>();
+    return true;
+}
+
+bool SceneConfiguration::Config::endObject() {
+    if (!currentDefinition) {
+        error = "end without object";
+        return false;
+    }
+    // Registered only now, so a definition cannot instance itself
+    objectDefinitions[currentDefinitionName] = currentDefinition;
+    currentDefinition = nullptr;
+    return true;
+}
+
+bool SceneConfiguration::Config::addInstance(const std::string& name, const float values[16],
+                                             bool overrideMaterial) {
+    auto definition = objectDefinitions.find(name);
+    if (definition == objectDefinitions.end()) {
+        error = "Unknown object " + name;
+        return false;
+    }
+    if (definition->second->isEmpty()) return true;
+
+    if (definition->second->getInstanceDepth() >= Hit::MAX_INSTANCE_DEPTH) {
+        error = "Object " + name + " nests instances more than " +
+                std::to_string(Hit::MAX_INSTANCE_DEPTH) + " deep";
+        return false;
+    }
+
+    Matrix4 objectToWorld = Matrix4::fromColumnMajor(values);
+    Matrix4 worldToObject;
+    if (!objectToWorld.getInverse(worldToObject)) {
+        error = "Instance transform is not invertible";
+        return false;
+    }
+
+    auto instance = std::make_unique<Instance>(
+        definition->second,
+        objectToWorld,
+        worldToObject,
+        overrideMaterial ? materials.back().get() : nullptr
+    );
+    addObject(instance.release());
+    return true;
+}
+
+bool SceneConfiguration::loadFromFile(const std::string& filename, Config& config, std::string& error) {
+    SceneTokenizer tokenizer;
+    if (!tokenizer.open(filename, error)) return false;
+    if (!load(tokenizer, filename, config, error)) return false;
+
+    if (config.currentDefinition) {
+        error = "Missing end for object " + config.currentDefinitionName;
+        return false;
+    }
+    return true;
+}
+
+bool SceneConfiguration::loadFromText(std::string_view text, const std::string& sourceName, Config& config,
+                                      std::string& error) {
+    SceneTokenizer tokenizer;
+    tokenizer.open(text);
+    return load(tokenizer, sourceName, config, error);
+}
+
+bool SceneConfiguration::loadFromBinaryFile(const std::string& filename, Config& config, std::string& error) {
+    auto file = std::make_shared<SceneBinary::Reader>();
+    if (!file->open(filename, error)) {
+        error = "Failed to load compiled scene: " + error;
+        return false;
+    }
+    config.error.clear();
+    bool loaded = loadBinarySettings(*file, config) && loadBinaryContents(file, config);
+    // Textures come first in the file, so their failures come first too
+    PendingLoad failed;
+    if (!finishLoads(failed)) {
+        config.error = failed.task->getError();
+        loaded = false;
+    }
+    if (!loaded) {
+        error = config.error.empty() ? "Compiled scene " + filename + " is corrupt" : config.error;
+        return false;
+    }
+    return true;
+}
+
+bool SceneConfiguration::compileToFile(const Config& config, const std::string& filename, std::string& error) {
+    SceneBinary::Writer writer;
+    SceneCompiler compiler(writer);
+
+    config.scene.compile(compiler);
+    while (const ObjectGroup* definition = compiler.beginNextDefinition()) {
+        definition->compile(compiler);
+    }
+
+    SceneBinary::Settings settings = {
+        static_cast<uint32_t>(config.imageWidth),
+        static_cast<uint32_t>(config.imageHeight),
+        writer.addString(config.outputFilename),
+        static_cast<uint32_t>(config.cameraType),
+        {config.cameraPosition.x, config.cameraPosition.y, config.cameraPosition.z},
+        {config.cameraForward.x, config.cameraForward.y, config.cameraForward.z},
+        {config.cameraUp.x, config.cameraUp.y, config.cameraUp.z},
+        config.useExposure ? 1u : 0u,
+        config.exposureValue,
+        compiler.getDefinitionCount(),
+        static_cast<uint32_t>(config.maxBounces),
+        static_cast<uint32_t>(config.causticPhotons),
+        config.causticRadius
+    };
+    writer.add(SceneBinary::SETTINGS, settings);
+
+    if (!writer.writeToFile(filename, error)) {
+        error = "Failed to write compiled scene: " + error;
+        return false;
+    }
+    return true;
+}
+
+std::string SceneConfiguration::formatError(const std::string& sourceName, size_t line, size_t column,
+                                            const std::string& message) {
+    return sourceName + ":" + std::to_string(line) + ":" + std::to_string(column) + ": " + message;
+}
+
+bool SceneConfiguration::load(SceneTokenizer& tokenizer, const std::string& sourceName, Config& config,
+                              std::string& error) {
+    std::string failure;
+    if (tasks_.getThreadCount() > 1) {
+        loadChunks(tokenizer, sourceName, config, failure);
+    } else {
+        SceneCommand command;
+        while (tokenizer.next(command) && apply(command, 0, sourceName, config, failure)) {}
+    }
+
+    // Files read for earlier commands fail first
+    PendingLoad failed;
+    if (!finishLoads(failed)) {
+        failure = formatError(sourceName, failed.line, failed.column, failed.task->getError());
+    }
+    if (!failure.empty()) {
+        error = failure;
+        return false;
+    }
+    return true;
+}
+
+void SceneConfiguration::loadChunks(SceneTokenizer& tokenizer, const std::string& sourceName, Config& config,
+                                    std::string& failure) {
+    struct Chunk {
+        std::shared_ptr<ParsedChunk> parsed;
+        std::shared_ptr<TaskGraph::Task> task;
+    };
+    std::deque<Chunk> chunks;
+    size_t chunkLimit = PARSE_CHUNKS_PER_THREAD * std::max(1u, tasks_.getThreadCount());
+    auto queueChunks = [&]() {
+        std::string_view text;
+        while (chunks.size() < chunkLimit && tokenizer.nextChunk(PARSE_CHUNK_BYTES, text)) {
+            auto parsed = std::make_shared<ParsedChunk>();
+            auto task = tasks_.add("parse chunk", sourceName, [parsed, text](std::string&) {
+                SceneTokenizer chunkTokenizer;
+                chunkTokenizer.open(text);
+                SceneCommand command;
+                while (chunkTokenizer.next(command)) {
+                    command.parseNumbers();
+                    parsed->commands.push_back(command);
+                }
+                parsed->lineCount = chunkTokenizer.getLine();
+                return true;
+            });
+            chunks.push_back({parsed, task});
+        }
+    };
+
+    size_t firstLine = 0;  // Lines before the chunk
+    queueChunks();
+    while (!chunks.empty()) {
+        Chunk chunk = std::move(chunks.front());
+        chunks.pop_front();
+        tasks_.wait(chunk.task);
+        queueChunks();
+        for (const SceneCommand& command : chunk.parsed->commands) {
+            if (!apply(command, firstLine, sourceName, config, failure)) return;
+        }
+        firstLine += chunk.parsed->lineCount;
+    }
+}
+
+bool SceneConfiguration::apply(const SceneCommand& command, size_t firstLine, const std::string& sourceName,
+                               Config& config, std::string& failure) {
+    config.error.clear();
+    size_t loadCount = pendingLoads_.size();
+    bool succeeded = command.getError().empty() && processCommand(command, config);
+    for (size_t i = loadCount; i < pendingLoads_.size(); ++i) {
+        pendingLoads_[i].line = firstLine + command.getLine();
+        pendingLoads_[i].column = command.getColumn(0);
+    }
+    if (succeeded) return true;
+
+    // Number errors point at the offending value, anything else at the keyword
+    size_t token = command.getError().empty() ? 0 : command.getErrorToken();
+    failure = formatError(sourceName, firstLine + command.getLine(), command.getColumn(token),
+                          !command.getError().empty() ? command.getError()
+                          : !config.error.empty() ? config.error
+                          : "error processing command: " + command.getString(0));
+    return false;
+}
+
+bool SceneConfiguration::finishLoads(PendingLoad& failed) {
+    bool succeeded = true;
+    for (const PendingLoad& load : pendingLoads_) {
+        tasks_.wait(load.task);
+        if (succeeded && !load.task->hasSucceeded()) {
+            failed = load;
+            succeeded = false;
+        }
+    }
+    pendingLoads_.clear();
+    tasks_.finish();
+    return succeeded;
+}
+
+bool SceneConfiguration::loadBinarySettings(const SceneBinary::Reader& file, Config& config) {
+    const auto& settings = file.getRecords<SceneBinary::Settings>(SceneBinary::SETTINGS)[0];
+    const char* outputFilename = file.getString(settings.outputFilename);
+    if (!outputFilename || settings.cameraType > static_cast<uint32_t>(CameraType::PANORAMA)) {
+        return false;
+    }
+
+    config.imageWidth = static_cast<int>(settings.imageWidth);
+    config.imageHeight = static_cast<int>(settings.imageHeight);
+    config.outputFilename = outputFilename;
+    config.cameraType = static_cast<CameraType>(settings.cameraType);
+    config.cameraPosition = toVector3(settings.cameraPosition);
+    config.cameraForward = toVector3(settings.cameraForward);
+    config.cameraUp = toVector3(settings.cameraUp);
+    config.useExposure = settings.useExposure != 0;
+    config.exposureValue = settings.exposureValue;
+    config.maxBounces = static_cast<int>(settings.maxBounces);
+    config.causticPhotons = static_cast<int>(settings.causticPhotons);
+    config.causticRadius = settings.causticRadius;
+    return true;
+}
+
+bool SceneConfiguration::loadBinaryContents(const std::shared_ptr<const SceneBinary::Reader>& file, Config& config) {
+    using namespace SceneBinary;
+    const Reader& reader = *file;
+    uint32_t groupCount = reader.getRecords<Settings>(SETTINGS)[0].definitionCount + 1;
+
+    std::vector<::Material*> materials;
+    const auto* materialRecords = reader.getRecords<SceneBinary::Material>(MATERIALS);
+    for (size_t i = 0; i < reader.getCount<SceneBinary::Material>(MATERIALS); ++i) {
+        std::shared_ptr<const Texture> texture;
+        if (materialRecords[i].textureFilename != NO_INDEX) {
+            const char* textureFilename = reader.getString(materialRecords[i].textureFilename);
+            if (!textureFilename) return false;
+            // Decoded on the loader threads while the rest is read
+            TextureCache::Request request = TextureCache::getInstance().request(textureFilename, tasks_);
+            texture = request.texture;
+            pendingLoads_.push_back({request.task, 0, 0});
+        }
+        config.materials.push_back(std::make_unique<::Material>(
+            toVector3(materialRecords[i].diffuseColor), texture));
+        config.materials.back()->setReflectivity(toVector3(materialRecords[i].reflectivity));
+        config.materials.back()->setTransparency(toVector3(materialRecords[i].transparency));
+        config.materials.back()->setRefractiveIndex(materialRecords[i].refractiveIndex);
+        materials.push_back(config.materials.back().get());
+    }
+    auto isValid = [&](uint32_t material, uint32_t group) {
+        return material < materials.size() && group < groupCount;
+    };
+
+    // Every group exists up front, so instances may refer to any definition
+    std::vector<std::shared_ptr<ObjectGroup>> definitions(groupCount);
+    for (uint32_t group = 1; group < groupCount; ++group) {
+        definitions[group] = std::make_shared<ObjectGroup>();
+    }
+    auto addToGroup = [&](uint32_t group, SceneObject* object) {
+        if (group == 0) {
+            config.scene.addObject(object);
+        } else {
+            definitions[group]->addObject(object);
+        }
+    };
+
+    const auto* lights = reader.getRecords<Light>(LIGHTS);
+    for (size_t i = 0; i < reader.getCount<Light>(LIGHTS); ++i) {
+        Vector3 vector = toVector3(lights[i].vector);
+        Vector3 color = toVector3(lights[i].color);
+        if (lights[i].type == DIRECTIONAL_LIGHT) {
+            config.scene.addLight(new DirectionalLight(vector, color));
+        } else if (lights[i].type == POINT_LIGHT) {
+            config.scene.addLight(new PointLight(vector, color));
+        } else {
+            return false;
+        }
+    }
+
+    // One SphereSet per run of spheres sharing a group
+    const auto* spheres = reader.getRecords<SceneBinary::Sphere>(SPHERES);
+    size_t sphereCount = reader.getCount<SceneBinary::Sphere>(SPHERES);
+    for (size_t first = 0; first < sphereCount;) {
+        size_t end = first;
+        while (end < sphereCount && spheres[end].group == spheres[first].group) {
+            if (!isValid(spheres[end].material, spheres[end].group)) return false;
+            ++end;
+        }
+        addToGroup(spheres[first].group,
+                   new SphereSet(file, spheres + first, end - first, materials));
+        first = end;
+    }
+
+    const auto* planes = reader.getRecords<SceneBinary::Plane>(PLANES);
+    for (size_t i = 0; i < reader.getCount<SceneBinary::Plane>(PLANES); ++i) {
+        const auto& plane = planes[i];
+        if (!isValid(plane.material, plane.group)) return false;
+        addToGroup(plane.group, new ::Plane(plane.coefficients[0], plane.coefficients[1],
+            plane.coefficients[2], plane.coefficients[3], materials[plane.material]));
+    }
+
+    const auto* triangles = reader.getRecords<SceneBinary::Triangle>(TRIANGLES);
+    for (size_t i = 0; i < reader.getCount<SceneBinary::Triangle>(TRIANGLES); ++i) {
+        const auto& triangle = triangles[i];
+        if (!isValid(triangle.material, triangle.group)) return false;
+        addToGroup(triangle.group, new ::Triangle(toVector3(triangle.vertices[0]),
+            toVector3(triangle.vertices[1]), toVector3(triangle.vertices[2]),
+            materials[triangle.material]));
+    }
+
+    const auto* meshes = reader.getRecords<SceneBinary::Mesh>(MESHES);
+    for (size_t i = 0; i < reader.getCount<SceneBinary::Mesh>(MESHES); ++i) {
+        ObjMesh mesh;
+        if (!isValid(meshes[i].material, meshes[i].group) ||
+            !loadBinaryMesh(reader, meshes[i], mesh)) {
+            return false;
+        }
+        addToGroup(meshes[i].group, new TriangleMesh(std::move(mesh), materials[meshes[i].material]));
+    }
+
+    // Heights are used in place from the mapping
+    const auto* heightfields = reader.getRecords<SceneBinary::Heightfield>(HEIGHTFIELDS);
+    size_t heightCount = reader.getCount<float>(HEIGHTFIELD_HEIGHTS);
+    for (size_t i = 0; i < reader.getCount<SceneBinary::Heightfield>(HEIGHTFIELDS); ++i) {
+        const auto& heightfield = heightfields[i];
+        uint64_t count = static_cast<uint64_t>(heightfield.size) * heightfield.size;
+        if (!isValid(heightfield.material, heightfield.group) ||
+            heightfield.size < ::Heightfield::MIN_SIZE || heightfield.size > ::Heightfield::MAX_SIZE ||
+            heightfield.firstHeight > heightCount || count > heightCount - heightfield.firstHeight) {
+            return false;
+        }
+        const float* heights = reader.getRecords<float>(HEIGHTFIELD_HEIGHTS) + heightfield.firstHeight;
+        addToGroup(heightfield.group, new Terrain(::Heightfield(heightfield.size, heights),
+                                                  materials[heightfield.material], file));
+    }
+
+    const auto* clusteredMeshes = reader.getRecords<SceneBinary::ClusteredMesh>(CLUSTERED_MESHES);
+    for (size_t i = 0; i < reader.getCount<SceneBinary::ClusteredMesh>(CLUSTERED_MESHES); ++i) {
+        const auto& record = clusteredMeshes[i];
+        const char* indexFilename = reader.getString(record.indexFilename);
+        std::vector<MeshClusters::ClusterRecord> clusters;
+        if (!isValid(record.material, record.group) || !indexFilename) return false;
+        if (!MeshClusters::readIndex(indexFilename, clusters, config.error)) {
+            config.error = "Failed to load clusters: " + config.error;
+            return false;
+        }
+        addToGroup(record.group, new OutOfCoreMesh(indexFilename, clusters, config.clusterCache,
+                                                   materials[record.material]));
+    }
+
+    const auto* instances = reader.getRecords<SceneBinary::Instance>(INSTANCES);
+    size_t instanceCount = reader.getCount<SceneBinary::Instance>(INSTANCES);
+    for (size_t i = 0; i < instanceCount; ++i) {
+        const auto& instance = instances[i];
+        bool overrideMaterial = instance.material != NO_INDEX;
+        if (!isValid(overrideMaterial ? instance.material : 0, instance.group) ||
+            instance.definition == 0 || instance.definition >= groupCount) {
+            return false;
+        }
+        Matrix4 objectToWorld, worldToObject;
+        std::memcpy(objectToWorld.m, instance.objectToWorld, sizeof(objectToWorld.m));
+        std::memcpy(worldToObject.m, instance.worldToObject, sizeof(worldToObject.m));
+        addToGroup(instance.group, new ::Instance(definitions[instance.definition],
+            objectToWorld, worldToObject, overrideMaterial ? materials[instance.material] : nullptr));
+    }
+    return !hasInvalidDefinitions(instances, instanceCount, groupCount);
+}
+
+bool SceneConfiguration::loadBinaryMesh(const SceneBinary::Reader& reader, const SceneBinary::Mesh& record,
+                                        ObjMesh& mesh) {
+    using namespace SceneBinary;
+    auto inRange = [](uint32_t first, uint64_t count, size_t available) {
+        return first <= available && count <= available - first;
+    };
+    uint64_t cornerCount = 3ull * record.triangleCount;
+    uint64_t indexCount = cornerCount * (1 + (record.hasNormalIndices ? 1 : 0) +
+                                        (record.hasTexcoordIndices ? 1 : 0));
+    if (!inRange(record.firstPosition, record.positionCount, reader.getCount<float[3]>(MESH_POSITIONS)) ||
+        !inRange(record.firstNormal, record.normalCount, reader.getCount<float[3]>(MESH_NORMALS)) ||
+        !inRange(record.firstTexcoord, record.texcoordCount, reader.getCount<float[2]>(MESH_TEXCOORDS)) ||
+        !inRange(record.firstIndex, indexCount, reader.getCount<uint32_t>(MESH_INDICES))) {
+        return false;
+    }
+
+    const float (*positions)[3] = reader.getRecords<float[3]>(MESH_POSITIONS) + record.firstPosition;
+    mesh.positions.reserve(record.positionCount);
+    for (uint32_t i = 0; i < record.positionCount; ++i) {
+        mesh.positions.push_back(toVector3(positions[i]));
+    }
+    const float (*normals)[3] = reader.getRecords<float[3]>(MESH_NORMALS) + record.firstNormal;
+    mesh.normals.reserve(record.normalCount);
+    for (uint32_t i = 0; i < record.normalCount; ++i) {
+        mesh.normals.push_back(toVector3(normals[i]));
+    }
+    const float* texcoords = reader.getRecords<float[2]>(MESH_TEXCOORDS)[record.firstTexcoord];
+    mesh.texcoords.assign(texcoords, texcoords + 2 * record.texcoordCount);
+
+    const uint32_t* indices = reader.getRecords<uint32_t>(MESH_INDICES) + record.firstIndex;
+    auto copyIndices = [&](std::vector<uint32_t>& target, uint32_t limit) {
+        target.assign(indices, indices + cornerCount);
+        indices += cornerCount;
+        return std::all_of(target.begin(), target.end(), [&](uint32_t index) { return index < limit; });
+    };
+    return copyIndices(mesh.positionIndices, record.positionCount) &&
+           (!record.hasNormalIndices || copyIndices(mesh.normalIndices, record.normalCount)) &&
+           (!record.hasTexcoordIndices || copyIndices(mesh.texcoordIndices, record.texcoordCount));
+}
+
+bool SceneConfiguration::hasInvalidDefinitions(const SceneBinary::Instance* instances, size_t instanceCount,
+                                               uint32_t groupCount) {
+    std::vector<std::vector<uint32_t>> references(groupCount);
+    for (size_t i = 0; i < instanceCount; ++i) {
+        references[instances[i].group].push_back(instances[i].definition);
+    }
+
+    enum { UNVISITED, VISITING, DONE };
+    std::vector<int> state(groupCount, UNVISITED);
+    std::vector<int> depth(groupCount, 0);
+    std::function<bool(uint32_t)> visit = [&](uint32_t group) {
+        if (state[group] == VISITING) return true;
+        if (state[group] == DONE) return false;
+        state[group] = VISITING;
+        for (uint32_t definition : references[group]) {
+            if (visit(definition)) return true;
+            depth[group] = std::max(depth[group], depth[definition] + 1);
+        }
+        state[group] = DONE;
+        return depth[group] > Hit::MAX_INSTANCE_DEPTH;
+    };
+    for (uint32_t group = 0; group < groupCount; ++group) {
+        if (visit(group)) return true;
+    }
+    return false;
+}
+
+bool SceneConfiguration::getVector3(const SceneCommand& command, size_t first, Vector3& value) {
+    float values[3];
+    if (!command.getFloats(first, values, 3)) return false;
+    value = Vector3(values[0], values[1], values[2]);
+    return true;
+}
+
+bool SceneConfiguration::processCommand(const SceneCommand& command, Config& config) {
+    std::string_view cmd = command[0];
+
+    switch (cmd[0]) {
+        case 'b':
+            if (cmd == "bulb") return processPointLight(command, config);
+            if (cmd == "bounces") return processBounces(command, config);
+            break;
+        case 'c':
+            if (cmd == "color") return processMaterial(command, config);
+            if (cmd == "clusters") return processClusters(command, config);
+            if (cmd == "caustics") return processCaustics(command, config);
+            break;
+        case 'e':
+            if (cmd == "eye") return processCameraPosition(command, config);
+            if (cmd == "expose") return processExposure(command, config);
+            if (cmd == "end") return processObjectEnd(command, config);
+            break;
+        case 'f':
+            if (cmd == "forward") return processCameraForward(command, config);
+            if (cmd == "fisheye") {
+                config.cameraType = CameraType::FISHEYE;
+                return true;
+            }
+            break;
+        case 'h':
+            if (cmd == "heightfield") return processHeightfield(command, config);
+            break;
+        case 'i':
+            if (cmd == "instance") return processInstance(command, config);
+            if (cmd == "ior") return processRefractiveIndex(command, config);
+            break;
+        case 'o':
+            if (cmd == "obj") return processObj(command, config);
+            if (cmd == "object") return processObjectBegin(command, config);
+            break;
+        case 'p':
+            if (cmd == "png") return processImageSettings(command, config);
+            if (cmd == "plane") return processPlane(command, config);
+            if (cmd == "panorama") {
+                config.cameraType = CameraType::PANORAMA;
+                return true;
+            }
+            break;
+        case 's':
+            if (cmd == "sphere") return processSphere(command, config);
+            if (cmd == "sun") return processDirectionalLight(command, config);
+            if (cmd == "shininess") return processReflectivity(command, config);
+            break;
+        case 't':
+            if (cmd == "tri") return processTriangle(command, config);
+            if (cmd == "texture") return processTexture(command, config);
+            if (cmd == "transparency") return processTransparency(command, config);
+            break;
+        case 'u':
+            if (cmd == "up") return processCameraUp(command, config);
+            break;
+        case 'x':
+            if (cmd == "xyz") return processVertex(command, config);
+            break;
+    }
+
+    return false;
+}
+
+bool SceneConfiguration::processImageSettings(const SceneCommand& command, Config& config) {
+    if (command.size() != 4) return false;
+    if (!command.getInt(1, config.imageWidth) || !command.getInt(2, config.imageHeight)) return false;
+    config.outputFilename = command.getString(3);
+    return true;
+}
+
+bool SceneConfiguration::processSphere(const SceneCommand& command, Config& config) {
+    if (command.size() != 5) return false;
+    
+    Vector3 center;
+    float radius;
+    if (!getVector3(command, 1, center) || !command.getFloat(4, radius)) return false;
+    config.addSphere(center, radius);
+    return true;
+}
+
+bool SceneConfiguration::processDirectionalLight(const SceneCommand& command, Config& config) {
+    if (command.size() != 4) return false;
+    
+    Vector3 direction;
+    if (!getVector3(command, 1, direction)) return false;
+    config.addDirectionalLight(direction);
+    return true;
+}
+
+bool SceneConfiguration::processPointLight(const SceneCommand& command, Config& config) {
+    if (command.size() != 4) return false;
+    
+    Vector3 position;
+    if (!getVector3(command, 1, position)) return false;
+    config.addPointLight(position);
+    return true;
+}
+
+bool SceneConfiguration::processMaterial(const SceneCommand& command, Config& config) {
+    if (command.size() != 4) return false;
+    
+    Vector3 color;
+    if (!getVector3(command, 1, color)) return false;
+    
+    config.pushMaterial().setDiffuseColor(color);
+    return true;
+}
+
+bool SceneConfiguration::processTexture(const SceneCommand& command, Config& config) {
+    if (command.size() != 2) return false;
+    if (command[1] == "none") {
+        config.useTexture(nullptr);
+        return true;
+    }
+    TextureCache::Request request = TextureCache::getInstance().request(command.getString(1), tasks_);
+    pendingLoads_.push_back({request.task, 0, 0});
+    config.useTexture(request.texture);
+    return true;
+}
+
+bool SceneConfiguration::getChannels(const SceneCommand& command, Vector3& value) {
+    if (command.size() == 2) {
+        float channel;
+        if (!command.getFloat(1, channel)) return false;
+        value = Vector3(channel, channel, channel);
+        return true;
+    }
+    return command.size() == 4 && getVector3(command, 1, value);
+}
+
+bool SceneConfiguration::processReflectivity(const SceneCommand& command, Config& config) {
+    Vector3 reflectivity;
+    if (!getChannels(command, reflectivity)) return false;
+    config.pushMaterial().setReflectivity(reflectivity);
+    return true;
+}
+
+bool SceneConfiguration::processTransparency(const SceneCommand& command, Config& config) {
+    Vector3 transparency;
+    if (!getChannels(command, transparency)) return false;
+    config.pushMaterial().setTransparency(transparency);
+    return true;
+}
+
+bool SceneConfiguration::processRefractiveIndex(const SceneCommand& command, Config& config) {
+    float refractiveIndex;
+    if (command.size() != 2 || !command.getFloat(1, refractiveIndex)) return false;
+    config.pushMaterial().setRefractiveIndex(refractiveIndex);
+    return true;
+}
+
+bool SceneConfiguration::processBounces(const SceneCommand& command, Config& config) {
+    int bounces;
+    if (command.size() != 2 || !command.getInt(1, bounces)) return false;
+    return config.setBounces(bounces);
+}
+
+bool SceneConfiguration::processCaustics(const SceneCommand& command, Config& config) {
+    int photons;
+    float radius;
+    if (command.size() != 3 || !command.getInt(1, photons) || !command.getFloat(2, radius)) return false;
+    return config.setCaustics(photons, radius);
+}
+
+bool SceneConfiguration::processExposure(const SceneCommand& command, Config& config) {
+    if (command.size() != 2) return false;
+    if (!command.getFloat(1, config.exposureValue)) return false;
+    config.useExposure = true;
+    return true;
+}
+
+bool SceneConfiguration::processCameraPosition(const SceneCommand& command, Config& config) {
+    if (command.size() != 4) return false;
+    return getVector3(command, 1, config.cameraPosition);
+}
+
+bool SceneConfiguration::processCameraForward(const SceneCommand& command, Config& config) {
+    if (command.size() != 4) return false;
+    Vector3 forward;
+    if (!getVector3(command, 1, forward)) return false;
+    config.cameraForward = forward.getNormalized();
+    return true;
+}
+
+bool SceneConfiguration::processCameraUp(const SceneCommand& command, Config& config) {
+    if (command.size() != 4) return false;
+    Vector3 up;
+    if (!getVector3(command, 1, up)) return false;
+    config.cameraUp = up.getNormalized();
+    return true;
+}
+
+bool SceneConfiguration::processPlane(const SceneCommand& command, Config& config) {
+    if (command.size() != 5) return false;  // Expect: plane A B C D
+    
+    float coefficients[4];
+    if (!command.getFloats(1, coefficients, 4)) return false;
+    config.addPlane(coefficients[0], coefficients[1], coefficients[2], coefficients[3]);
+    return true;
+}
+
+bool SceneConfiguration::processVertex(const SceneCommand& command, Config& config) {
+    if (command.size() != 4) return false;
+
+    Vector3 vertex;
+    if (!getVector3(command, 1, vertex)) return false;
+    config.vertices.push_back(vertex);
+    return true;
+}
+
+bool SceneConfiguration::processTriangle(const SceneCommand& command, Config& config) {
+    if (command.size() != 4) return false;
+    int indices[3];
+    if (!command.getInt(1, indices[0]) || !command.getInt(2, indices[1]) ||
+        !command.getInt(3, indices[2])) {
+        return false;
+    }
+    return config.addTriangle(indices[0], indices[1], indices[2]);
+}
+
+bool SceneConfiguration::processObj(const SceneCommand& command, Config& config) {
+    if (command.size() != 2 && command.size() != 3) return false;
+    int levels = 0;
+    if (command.size() == 3 && !command.getInt(2, levels)) return false;
+    std::shared_ptr<TaskGraph::Task> task;
+    if (!config.addObj(command.getString(1), levels, tasks_, task)) return false;
+    pendingLoads_.push_back({task, 0, 0});
+    return true;
+}
+
+bool SceneConfiguration::processClusters(const SceneCommand& command, Config& config) {
+    if (command.size() != 2) return false;
+    return config.addClusters(command.getString(1));
+}
+
+bool SceneConfiguration::processHeightfield(const SceneCommand& command, Config& config) {
+    if (command.size() < 3 || command.size() > 5) return false;
+    int values[4] = {0, 0, 0, 1};  // Size, faults, weathering, seed
+    for (size_t i = 1; i < command.size(); ++i) {
+        if (!command.getInt(i, values[i - 1])) return false;
+    }
+    TaskGraph::Lease threads(tasks_);
+    return config.addHeightfield(values[0], values[1], values[2], values[3], threads.getThreadCount());
+}
+
+bool SceneConfiguration::processObjectBegin(const SceneCommand& command, Config& config) {
+    if (command.size() != 2) return false;
+    return config.beginObject(command.getString(1));
+}
+
+bool SceneConfiguration::processObjectEnd(const SceneCommand& command, Config& config) {
+    if (command.size() != 1) return false;
+    return config.endObject();
+}
+
+bool SceneConfiguration::processInstance(const SceneCommand& command, Config& config) {
+    if (command.size() != 18 && command.size() != 19) return false;
+    bool overrideMaterial = command.size() == 19;
+    if (overrideMaterial && command[18] != "override") return false;
+
+    float values[16];
+    if (!command.getFloats(2, values, 16)) return false;
+    return config.addInstance(command.getString(1), values, overrideMaterial);
+}
+
@@ -0,0 +1,227 @@
+#ifndef SCENE_CONFIGURATION_H
+#define SCENE_CONFIGURATION_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Camera.h"
+#include "MeshClusters.h"
+#include "ObjLoader.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "SceneBinary.h"
+#include "SceneObjects.h"
+#include "SceneTokenizer.h"
+#include "Stats.h"
+#include "TaskGraph.h"
+#include "Texture.h"
+
+// Reads scene files, text or compiled, and command text into a Config, and
+// compiles a Config back into a .rtb file
+class SceneConfiguration {
+public:
+    // The scene being built plus the current state of the commands. Each
+    // operation returns false on failure and, when there is more to say than
+    // that the command was malformed, leaves the reason in error.
+    struct Config {
+        std::string outputFilename;
+        int imageWidth = 0;
+        int imageHeight = 0;
+        Scene scene;
+        Vector3 cameraPosition = Vector3::ZERO;
+        Vector3 cameraForward = Vector3::FORWARD;
+        Vector3 cameraUp = Vector3::UP;
+        std::vector<std::unique_ptr<Material>> materials;
+        bool useExposure = false;
+        float exposureValue = 1.0f;
+        int maxBounces = DEFAULT_BOUNCES;
+        int causticPhotons = 0;  // None: caustics are left out
+        float causticRadius = 0.0f;
+        std::vector<Vector3> vertices;
+        std::shared_ptr<const Texture> currentTexture;
+        CameraType cameraType = CameraType::CLASSIC;  // Updated to use the new enum
+        std::map<std::string, std::shared_ptr<ObjectGroup>> objectDefinitions;
+        std::string currentDefinitionName;
+        std::shared_ptr<ObjectGroup> currentDefinition;  // Set between `object` and `end`
+        std::shared_ptr<ClusterCache> clusterCache = std::make_shared<ClusterCache>();
+        bool hugePages = false;  // For BVH arrays, wherever they are built
+        std::string error;
+
+        Config() {
+            materials.push_back(std::make_unique<Material>(Vector3(1, 1, 1)));
+        }
+
+        // Geometry goes into the open object definition, if any, otherwise the scene
+        void addObject(SceneObject* object) {
+            if (currentDefinition) {
+                currentDefinition->addObject(object);
+            } else {
+                scene.addObject(object);
+            }
+        }
+
+        Camera createCamera() const {
+            return Camera(cameraPosition, cameraForward, cameraUp,
+                        cameraType, imageWidth, imageHeight);
+        }
+
+        // Material properties are current state: each change starts a copy of the
+        // current material, so objects already added keep theirs
+        Material& pushMaterial() {
+            materials.push_back(std::make_unique<Material>(*materials.back()));
+            return *materials.back();
+        }
+
+        bool setBounces(int bounces);
+        bool setCaustics(int photons, float radius);
+
+        // An empty filename removes the texture
+        bool setTexture(const std::string& filename);
+
+        // Texture is current state like color: later objects pick it up
+        void useTexture(std::shared_ptr<const Texture> texture) {
+            currentTexture = std::move(texture);
+            pushMaterial().setTexture(currentTexture);
+        }
+
+        void addDirectionalLight(const Vector3& direction);
+        void addPointLight(const Vector3& position);
+        void addSphere(const Vector3& center, float radius);
+        void addPlane(float a, float b, float c, float d);
+
+        // 1-based indices; negative ones count back from the last vertex
+        bool addTriangle(int first, int second, int third);
+
+        bool addObj(const std::string& filename, int levels, unsigned threadCount);
+
+        // Adds the mesh now but reads and builds it on graph's threads; task
+        // reports any failure, and the mesh must not be used before it is done
+        bool addObj(const std::string& filename, int levels, TaskGraph& graph,
+                    std::shared_ptr<TaskGraph::Task>& task);
+
+        static bool readObj(const std::string& filename, int levels, unsigned threadCount, ObjMesh& mesh,
+                            std::string& error);
+
+        bool addClusters(const std::string& indexFilename);
+        bool addHeightfield(int size, int faults, int weathering, int seed, unsigned threadCount);
+
+        // object <name> ... end: records geometry once without adding it to the scene
+        bool beginObject(const std::string& name);
+        bool endObject();
+
+        bool addInstance(const std::string& name, const float values[16], bool overrideMaterial);
+    };
+
+    bool loadFromFile(const std::string& filename, Config& config, std::string& error);
+
+    // Commands already in memory; an object definition may stay open for later ones
+    bool loadFromText(std::string_view text, const std::string& sourceName, Config& config,
+                      std::string& error);
+
+    // Loads a scene written by compileToFile. Spheres are used in place from the
+    // mapping; everything else is copied out of the packed records.
+    bool loadFromBinaryFile(const std::string& filename, Config& config, std::string& error);
+
+    bool compileToFile(const Config& config, const std::string& filename, std::string& error);
+
+    // Threads loading a scene, the caller included
+    void setThreadCount(unsigned threadCount) { tasks_.setThreadCount(threadCount); }
+    // Where the loading threads count; see TaskGraph
+    void setStats(Stats::Totals* stats) { tasks_.setStats(stats); }
+    // Of the loading thread since the reset; see TaskGraph
+    double getCriticalPath() const { return tasks_.getCriticalPath(); }
+    void resetCriticalPath() { tasks_.resetCriticalPath(); }
+
+private:
+    // Scene file text per parse task, and how many may be queued per thread
+    static constexpr size_t PARSE_CHUNK_BYTES = 64 << 10;
+    static constexpr unsigned PARSE_CHUNKS_PER_THREAD = 2;
+
+    // A file that the command at line, column started reading
+    struct PendingLoad {
+        std::shared_ptr<TaskGraph::Task> task;
+        size_t line = 0;
+        size_t column = 0;
+    };
+
+    // Commands of a run of lines, tokenized with their numbers parsed ahead of use
+    struct ParsedChunk {
+        std::vector<SceneCommand> commands;
+        size_t lineCount = 0;
+    };
+
+    TaskGraph tasks_;
+    std::vector<PendingLoad> pendingLoads_;
+
+    static std::string formatError(const std::string& sourceName, size_t line, size_t column,
+                                   const std::string& message);
+
+    // With loader threads, runs of lines are tokenized on them a few ahead of
+    // the commands being applied here, in order. Textures and OBJ files load
+    // on those threads too, and are waited for at the end.
+    bool load(SceneTokenizer& tokenizer, const std::string& sourceName, Config& config, std::string& error);
+    void loadChunks(SceneTokenizer& tokenizer, const std::string& sourceName, Config& config,
+                    std::string& failure);
+
+    // Processes a command firstLine lines into the source; false, with the
+    // message in failure, if it failed
+    bool apply(const SceneCommand& command, size_t firstLine, const std::string& sourceName, Config& config,
+               std::string& failure);
+
+    // Waits for every pending load and the threads; false, with the first
+    // that failed, if any did
+    bool finishLoads(PendingLoad& failed);
+
+    bool loadBinarySettings(const SceneBinary::Reader& file, Config& config);
+    bool loadBinaryContents(const std::shared_ptr<const SceneBinary::Reader>& file, Config& config);
+    bool loadBinaryMesh(const SceneBinary::Reader& reader, const SceneBinary::Mesh& record, ObjMesh& mesh);
+
+    // A definition that instances itself, directly or not, would recurse
+    // forever, and hits nested too deep could not be traced back
+    bool hasInvalidDefinitions(const SceneBinary::Instance* instances, size_t instanceCount, uint32_t groupCount);
+
+    static Vector3 toVector3(const float values[3]) {
+        return Vector3(values[0], values[1], values[2]);
+    }
+
+    static bool getVector3(const SceneCommand& command, size_t first, Vector3& value);
+
+    // Keywords are picked out by first letter, then compared whole within it
+    bool processCommand(const SceneCommand& command, Config& config);
+
+    bool processImageSettings(const SceneCommand& command, Config& config);
+    bool processSphere(const SceneCommand& command, Config& config);
+    bool processDirectionalLight(const SceneCommand& command, Config& config);
+    bool processPointLight(const SceneCommand& command, Config& config);
+    bool processMaterial(const SceneCommand& command, Config& config);
+    // Objects take the texture at once; it is decoded on the loader threads
+    bool processTexture(const SceneCommand& command, Config& config);
+    // One value applies to every channel, or r g b
+    bool getChannels(const SceneCommand& command, Vector3& value);
+    bool processReflectivity(const SceneCommand& command, Config& config);
+    bool processTransparency(const SceneCommand& command, Config& config);
+    bool processRefractiveIndex(const SceneCommand& command, Config& config);
+    bool processBounces(const SceneCommand& command, Config& config);
+    bool processCaustics(const SceneCommand& command, Config& config);
+    bool processExposure(const SceneCommand& command, Config& config);
+    bool processCameraPosition(const SceneCommand& command, Config& config);
+    bool processCameraForward(const SceneCommand& command, Config& config);
+    bool processCameraUp(const SceneCommand& command, Config& config);
+    bool processPlane(const SceneCommand& command, Config& config);
+    bool processVertex(const SceneCommand& command, Config& config);
+    bool processTriangle(const SceneCommand& command, Config& config);
+    // obj <file.obj> [<subdivision levels>]
+    bool processObj(const SceneCommand& command, Config& config);
+    // clusters <index.rtc>
+    bool processClusters(const SceneCommand& command, Config& config);
+    // heightfield <size> <faults> [<weathering passes> [<seed>]]
+    bool processHeightfield(const SceneCommand& command, Config& config);
+    bool processObjectBegin(const SceneCommand& command, Config& config);
+    bool processObjectEnd(const SceneCommand& command, Config& config);
+    // instance <name> <16 column-major matrix values> [override]
+    bool processInstance(const SceneCommand& command, Config& config);
+};
+
+#endif // SCENE_CONFIGURATION_H
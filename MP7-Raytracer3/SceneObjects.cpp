@@ -0,0 +1,831 @@
+#include "SceneObjects.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "Kernels.h"
+#include "Stats.h"
+
+// Sets the footprint of the ray's cone on a surface from how fast u and v change
+// across it in world units. The cone's width stretches by the grazing angle along
+// the ray's heading over the surface and keeps its width across it.
+static void setTextureFootprint(const Ray& ray, const Vector3& normal, const Vector3& gradientU,
+                                const Vector3& gradientV, IntersectionInfo& intersection) {
+    float width = ray.getConeWidthAtDistance(intersection.distance);
+    float cosine = Vector3::dotProduct(normal, ray.getDirection());
+    Vector3 along = ray.getDirection().minus(normal.times(cosine));
+    float alongLength = along.getLength();
+    if (alongLength < 1e-6f) {
+        intersection.textureFootprintU = width * gradientU.getLength();
+        intersection.textureFootprintV = width * gradientV.getLength();
+        return;
+    }
+    along = along.times(1.0f / alongLength);
+    Vector3 across = Vector3::crossProduct(normal, along);
+    float stretched = width / std::max(std::abs(cosine), 0.05f);
+    auto extent = [&](const Vector3& gradient) {
+        return std::hypot(stretched * Vector3::dotProduct(gradient, along),
+                          width * Vector3::dotProduct(gradient, across));
+    };
+    intersection.textureFootprintU = extent(gradientU);
+    intersection.textureFootprintV = extent(gradientV);
+}
+
+void DirectionalLight::compile(SceneBinary::Writer& writer) const {
+    SceneBinary::Light record = {
+        SceneBinary::DIRECTIONAL_LIGHT,
+        {direction_.x, direction_.y, direction_.z},
+        {color_.x, color_.y, color_.z}
+    };
+    writer.add(SceneBinary::LIGHTS, record);
+}
+
+LightSource::IlluminationInfo PointLight::calculateIllumination(const Vector3& point) const {
+    Vector3 direction = position_.minus(point);
+    float distance = direction.getLength();
+    return {
+        direction.getNormalized(),
+        color_.times(1.0f / (distance * distance)),
+        distance
+    };
+}
+
+void PointLight::compile(SceneBinary::Writer& writer) const {
+    SceneBinary::Light record = {
+        SceneBinary::POINT_LIGHT,
+        {position_.x, position_.y, position_.z},
+        {color_.x, color_.y, color_.z}
+    };
+    writer.add(SceneBinary::LIGHTS, record);
+}
+
+Vector3 Material::calculateShading(const Ray& ray, const IntersectionInfo& intersection,
+                                   const Vector3& lightDir, const Vector3& lightColor) const {
+    Vector3 normal = intersection.surfaceNormal;
+    if (Vector3::dotProduct(normal, ray.getDirection()) > 0) {
+        normal = normal.times(-1.0f);
+    }
+    float diffuseFactor = std::max(0.0f, Vector3::dotProduct(normal, lightDir));
+    return Vector3::componentMultiply(lightColor, getSurfaceColor(intersection)).times(diffuseFactor);
+}
+
+Vector3 Material::getSurfaceColor(const IntersectionInfo& intersection) const {
+    if (texture_ && intersection.hasTextureCoordinates) {
+        return texture_->sample(intersection.u, intersection.v, intersection.textureFootprintU,
+                                intersection.textureFootprintV).toVector3();
+    }
+    return diffuseColor_;
+}
+
+uint32_t SceneCompiler::getMaterialIndex(const Material* material) {
+    auto found = materials_.find(material);
+    if (found != materials_.end()) return found->second;
+
+    const Vector3& color = material->getDiffuseColor();
+    const Vector3& reflectivity = material->getReflectivity();
+    const Vector3& transparency = material->getTransparency();
+    SceneBinary::Material record = {
+        {color.x, color.y, color.z},
+        material->hasTexture() ? writer_.addString(material->getTexture()->getFilename())
+                               : SceneBinary::NO_INDEX,
+        {reflectivity.x, reflectivity.y, reflectivity.z},
+        {transparency.x, transparency.y, transparency.z},
+        material->getRefractiveIndex()
+    };
+    uint32_t index = writer_.add(SceneBinary::MATERIALS, record);
+    materials_[material] = index;
+    return index;
+}
+
+uint32_t SceneCompiler::getDefinitionIndex(const ObjectGroup* definition) {
+    auto found = definitions_.find(definition);
+    if (found != definitions_.end()) return found->second;
+
+    pendingDefinitions_.push_back(definition);
+    uint32_t index = static_cast<uint32_t>(pendingDefinitions_.size());
+    definitions_[definition] = index;
+    return index;
+}
+
+void SceneObject::addCausticTargets(std::vector<BoundingBox>& targets) const {
+    if (isBounded() && material_ && material_->isSpecular()) {
+        targets.push_back(getBounds());
+    }
+}
+
+bool SceneObject::occludes(const Ray& ray, uint32_t primitive, float minDistance, float maxDistance) const {
+    (void)primitive;
+    Hit hit;
+    hit.distance = maxDistance;
+    return intersect(ray, minDistance, hit);
+}
+
+bool Sphere::intersect(const Ray& ray, float minDistance, Hit& hit) const {
+    const float sphere[4] = {center_.x, center_.y, center_.z, radius_};
+    const uint32_t index = 0;
+    const float origin[3] = {ray.getOrigin().x, ray.getOrigin().y, ray.getOrigin().z};
+    const float direction[3] = {ray.getDirection().x, ray.getDirection().y, ray.getDirection().z};
+    if (Kernels::get().intersectSpheres(origin, direction, sphere, sizeof(sphere), &index, 1,
+                                        minDistance, hit.distance) < 0) {
+        return false;
+    }
+    hit.primitive = 0;
+    return true;
+}
+
+void Sphere::getSurface(const Ray& ray, float distance, const Hit& hit, IntersectionInfo& intersection) const {
+    (void)hit;
+    getSurface(center_, radius_, material_, ray, distance, intersection);
+}
+
+void Sphere::compile(SceneCompiler& compiler) const {
+    SceneBinary::Sphere record = {
+        {center_.x, center_.y, center_.z},
+        radius_,
+        compiler.getMaterialIndex(material_),
+        compiler.getCurrentGroup()
+    };
+    compiler.getWriter().add(SceneBinary::SPHERES, record);
+}
+
+void Sphere::getSurface(const Vector3& center, float radius, Material* material, const Ray& ray,
+                        float distance, IntersectionInfo& intersection) {
+    intersection.distance = distance;
+    intersection.material = material;
+    intersection.surfaceNormal = ray.getPointAtDistance(distance).minus(center).times(1.0f / radius);
+
+    if (material->hasTexture()) {
+        calculateTextureCoordinates(radius, ray, intersection);
+    }
+}
+
+void Sphere::calculateTextureCoordinates(float radius, const Ray& ray, IntersectionInfo& intersection) {
+    const Vector3& n = intersection.surfaceNormal;
+    intersection.hasTextureCoordinates = true;
+    intersection.u = (Math::PI - std::atan2(n.z, n.x)) / (2.0f * Math::PI);
+    intersection.v = std::acos(Math::clamp(n.y, -1.0f, 1.0f)) / Math::PI;
+
+    // u runs east around circles of latitude 2*pi*r*sin(theta) long, v south
+    // along meridians pi*r long; near the poles u packs into ever less space
+    float sine = std::max(std::sqrt(std::max(1.0f - n.y * n.y, 0.0f)), 0.01f);
+    Vector3 east = Vector3(n.z, 0.0f, -n.x).times(1.0f / sine);
+    Vector3 south = Vector3::crossProduct(east, n);
+    setTextureFootprint(ray, n, east.times(1.0f / (2.0f * Math::PI * radius * sine)),
+                        south.times(1.0f / (Math::PI * radius)), intersection);
+}
+
+void SphereSet::build() {
+    std::vector<BoundingBox> sphereBounds(count_);
+    for (size_t i = 0; i < count_; ++i) {
+        sphereBounds[i] = Sphere::getBounds(getCenter(i), spheres_[i].radius);
+    }
+    bvh_.build(sphereBounds);
+}
+
+bool SphereSet::intersect(const Ray& ray, float minDistance, Hit& hit) const {
+    float nearest = hit.distance;
+    uint32_t hitSphere = 0;
+    bool found = false;
+    uint64_t tests = 0;
+
+    const Kernels::Table& kernels = Kernels::get();
+    const float origin[3] = {ray.getOrigin().x, ray.getOrigin().y, ray.getOrigin().z};
+    const float direction[3] = {ray.getDirection().x, ray.getDirection().y, ray.getDirection().z};
+    bvh_.traverseLeaves(ray.getOrigin(), ray.getDirection(), minDistance, nearest,
+        [&](const uint32_t* indices, uint32_t count, float& tMax) {
+            tests += count;
+            int winner = kernels.intersectSpheres(origin, direction, spheres_, sizeof(SceneBinary::Sphere),
+                                                  indices, count, minDistance, tMax);
+            if (winner >= 0) {
+                hitSphere = indices[winner];
+                found = true;
+            }
+            return false;
+        });
+    RT_STAT_ADD(primitiveTests, tests);
+
+    if (!found) {
+        return false;
+    }
+    hit.distance = nearest;
+    hit.primitive = hitSphere;
+    return true;
+}
+
+void SphereSet::getSurface(const Ray& ray, float distance, const Hit& hit, IntersectionInfo& intersection) const {
+    const SceneBinary::Sphere& sphere = spheres_[hit.primitive];
+    Sphere::getSurface(getCenter(hit.primitive), sphere.radius, materials_[sphere.material],
+                       ray, distance, intersection);
+}
+
+void SphereSet::addCausticTargets(std::vector<BoundingBox>& targets) const {
+    for (size_t i = 0; i < count_; ++i) {
+        if (materials_[spheres_[i].material]->isSpecular()) {
+            targets.push_back(Sphere::getBounds(getCenter(i), spheres_[i].radius));
+        }
+    }
+}
+
+bool SphereSet::occludes(const Ray& ray, uint32_t primitive, float minDistance, float maxDistance) const {
+    const float origin[3] = {ray.getOrigin().x, ray.getOrigin().y, ray.getOrigin().z};
+    const float direction[3] = {ray.getDirection().x, ray.getDirection().y, ray.getDirection().z};
+    return Kernels::get().intersectSpheres(origin, direction, spheres_, sizeof(SceneBinary::Sphere),
+                                           &primitive, 1, minDistance, maxDistance) >= 0;
+}
+
+void SphereSet::compile(SceneCompiler& compiler) const {
+    for (size_t i = 0; i < count_; ++i) {
+        SceneBinary::Sphere record = spheres_[i];
+        record.material = compiler.getMaterialIndex(materials_[record.material]);
+        record.group = compiler.getCurrentGroup();
+        compiler.getWriter().add(SceneBinary::SPHERES, record);
+    }
+}
+
+void ObjectGroup::build() {
+    if (builtCount_ == objects_.size()) return;
+    for (size_t i = builtCount_; i < objects_.size(); ++i) {
+        objects_[i]->build();
+    }
+    builtCount_ = objects_.size();
+
+    boundedObjects_.clear();
+    unboundedObjects_.clear();
+    std::vector<BoundingBox> bounds;
+    for (auto* object : objects_) {
+        // Compiled scenes may add instances before their definitions are complete
+        instanceDepth_ = std::max(instanceDepth_, object->getInstanceDepth());
+        if (object->isBounded()) {
+            boundedObjects_.push_back(object);
+            bounds.push_back(object->getBounds());
+        } else {
+            unboundedObjects_.push_back(object);
+        }
+    }
+    bvh_.build(bounds);
+}
+
+void ObjectGroup::replicate() {
+    bvh_.replicate();
+    for (auto* object : objects_) {
+        object->replicate();
+    }
+}
+
+void ObjectGroup::dropReplicas() {
+    bvh_.dropReplicas();
+    for (auto* object : objects_) {
+        object->dropReplicas();
+    }
+}
+
+void ObjectGroup::addCausticTargets(std::vector<BoundingBox>& targets) const {
+    for (const auto* object : boundedObjects_) {
+        object->addCausticTargets(targets);
+    }
+}
+
+void ObjectGroup::compile(SceneCompiler& compiler) const {
+    for (const auto* object : objects_) {
+        object->compile(compiler);
+    }
+}
+
+bool ObjectGroup::cull(const Frustum& frustum, std::vector<uint32_t>& startNodes) const {
+    bvh_.cull(frustum, startNodes);
+    bool visible = !startNodes.empty();
+    for (const auto* object : unboundedObjects_) {
+        visible = visible || object->mayIntersect(frustum);
+    }
+    return visible;
+}
+
+bool ObjectGroup::intersect(const Ray& ray, float minDistance, Hit& hit,
+                            const std::vector<uint32_t>* startNodes) const {
+    bool found = false;
+    uint64_t tests = 0;
+
+    auto testObject = [&](const SceneObject* object) {
+        ++tests;
+        if (object->intersect(ray, minDistance, hit)) {
+            hit.object = object;
+            found = true;
+        }
+    };
+
+    for (const auto* object : unboundedObjects_) {
+        testObject(object);
+    }
+    auto visit = [&](uint32_t index, float&) {
+        testObject(boundedObjects_[index]);
+        return false;
+    };
+    if (startNodes) {
+        bvh_.traverseFrom(startNodes->data(), static_cast<uint32_t>(startNodes->size()),
+                          ray.getOrigin(), ray.getDirection(), minDistance, hit.distance, visit);
+    } else {
+        bvh_.traverse(ray.getOrigin(), ray.getDirection(), minDistance, hit.distance, visit);
+    }
+
+    RT_STAT_ADD(primitiveTests, tests);
+    return found;
+}
+
+Plane::Plane(float A, float B, float C, float D, Material* material)
+    : SceneObject(material), A_(A), B_(B), C_(C), D_(D) {
+    // Calculate normalized normal vector from A, B, C coefficients
+    float length = std::sqrt(A*A + B*B + C*C);
+    if (length > MIN_INTERSECTION_DISTANCE) {
+        normal_ = Vector3(A/length, B/length, C/length);
+    } else {
+        normal_ = Vector3(0, 1, 0);  // Default to up vector if degenerate
+    }
+}
+
+bool Plane::intersect(const Ray& ray, float minDistance, Hit& hit) const {
+    float denominator = getDenominator(ray);
+
+    // Ray is parallel to plane
+    if (std::abs(denominator) < MIN_INTERSECTION_DISTANCE) {
+        return false;
+    }
+
+    // Calculate intersection using plane equation
+    float t = -(A_ * ray.getOrigin().x +
+               B_ * ray.getOrigin().y +
+               C_ * ray.getOrigin().z + D_) / denominator;
+
+    if (t < minDistance || !(t < hit.distance)) {
+        return false;
+    }
+
+    hit.distance = t;
+    hit.primitive = 0;
+    return true;
+}
+
+void Plane::getSurface(const Ray& ray, float distance, const Hit& hit, IntersectionInfo& intersection) const {
+    (void)hit;
+    intersection.distance = distance;
+    intersection.material = material_;
+    intersection.surfaceNormal = getDenominator(ray) < 0 ? normal_ : normal_.times(-1.0f);
+}
+
+void Plane::compile(SceneCompiler& compiler) const {
+    SceneBinary::Plane record = {
+        {A_, B_, C_, D_},
+        compiler.getMaterialIndex(material_),
+        compiler.getCurrentGroup()
+    };
+    compiler.getWriter().add(SceneBinary::PLANES, record);
+}
+
+Triangle::Triangle(const Vector3& v1, const Vector3& v2, const Vector3& v3, Material* material)
+    : SceneObject(material), v1_(v1), v2_(v2), v3_(v3) {
+    // Calculate normal using cross product
+    Vector3 edge1 = v2_.minus(v1_);
+    Vector3 edge2 = v3_.minus(v1_);
+    normal_ = Vector3::crossProduct(edge1, edge2).getNormalized();
+}
+
+bool Triangle::intersect(const Ray& ray, float minDistance, Hit& hit) const {
+    const float positions[9] = {v1_.x, v1_.y, v1_.z, v2_.x, v2_.y, v2_.z, v3_.x, v3_.y, v3_.z};
+    const uint32_t indices[3] = {0, 1, 2};
+    const float origin[3] = {ray.getOrigin().x, ray.getOrigin().y, ray.getOrigin().z};
+    const float direction[3] = {ray.getDirection().x, ray.getDirection().y, ray.getDirection().z};
+    if (Kernels::get().intersectTriangles(origin, direction, positions, indices, indices, 1,
+                                          minDistance, hit.distance, hit.u, hit.v) < 0) {
+        return false;
+    }
+    hit.primitive = 0;
+    return true;
+}
+
+void Triangle::getSurface(const Ray& ray, float distance, const Hit& hit, IntersectionInfo& intersection) const {
+    (void)hit;
+    intersection.distance = distance;
+    intersection.material = material_;
+    intersection.surfaceNormal = Vector3::dotProduct(normal_, ray.getDirection()) < 0
+                               ? normal_
+                               : normal_.times(-1.0f);
+}
+
+BoundingBox Triangle::getBounds() const {
+    BoundingBox bounds;
+    bounds.expand(v1_);
+    bounds.expand(v2_);
+    bounds.expand(v3_);
+    return bounds;
+}
+
+void Triangle::compile(SceneCompiler& compiler) const {
+    SceneBinary::Triangle record = {
+        {{v1_.x, v1_.y, v1_.z}, {v2_.x, v2_.y, v2_.z}, {v3_.x, v3_.y, v3_.z}},
+        compiler.getMaterialIndex(material_),
+        compiler.getCurrentGroup()
+    };
+    compiler.getWriter().add(SceneBinary::TRIANGLES, record);
+}
+
+void TriangleMesh::build() {
+    if (!bvh_.isEmpty()) return;  // Built by the loader thread that read it
+    std::vector<BoundingBox> triangleBounds(mesh_.getTriangleCount());
+    for (size_t i = 0; i < triangleBounds.size(); ++i) {
+        triangleBounds[i].expand(getVertex(i, 0));
+        triangleBounds[i].expand(getVertex(i, 1));
+        triangleBounds[i].expand(getVertex(i, 2));
+    }
+    bvh_.build(triangleBounds);
+}
+
+bool TriangleMesh::intersect(const Ray& ray, float minDistance, Hit& hit) const {
+    float nearest = hit.distance;
+    uint32_t hitTriangle = 0;
+    float hitU = 0.0f, hitV = 0.0f;
+    bool found = false;
+    uint64_t tests = 0;
+
+    const Kernels::Table& kernels = Kernels::get();
+    const float origin[3] = {ray.getOrigin().x, ray.getOrigin().y, ray.getOrigin().z};
+    const float direction[3] = {ray.getDirection().x, ray.getDirection().y, ray.getDirection().z};
+    bvh_.traverseLeaves(ray.getOrigin(), ray.getDirection(), minDistance, nearest,
+        [&](const uint32_t* triangles, uint32_t count, float& tMax) {
+            tests += count;
+            float u, v;
+            int winner = kernels.intersectTriangles(origin, direction, &mesh_.positions[0].x,
+                                                    mesh_.positionIndices.data(), triangles, count,
+                                                    minDistance, tMax, u, v);
+            if (winner >= 0) {
+                hitTriangle = triangles[winner];
+                hitU = u;
+                hitV = v;
+                found = true;
+            }
+            return false;
+        });
+    RT_STAT_ADD(primitiveTests, tests);
+
+    if (!found) {
+        return false;
+    }
+    hit.distance = nearest;
+    hit.primitive = hitTriangle;
+    hit.u = hitU;
+    hit.v = hitV;
+    return true;
+}
+
+void TriangleMesh::getSurface(const Arrays& arrays, Material* material, const Ray& ray, float distance,
+                              uint32_t triangle, float u, float v, IntersectionInfo& intersection) {
+    intersection.distance = distance;
+    intersection.material = material;
+    Vector3 normal;
+    if (arrays.normalIndices) {
+        const uint32_t* corners = &arrays.normalIndices[3 * triangle];
+        normal = getVector(arrays.normals, corners[0]).times(1.0f - u - v)
+            .plus(getVector(arrays.normals, corners[1]).times(u))
+            .plus(getVector(arrays.normals, corners[2]).times(v))
+            .getNormalized();
+    } else {
+        Vector3 edge1 = getVertex(arrays, triangle, 1).minus(getVertex(arrays, triangle, 0));
+        Vector3 edge2 = getVertex(arrays, triangle, 2).minus(getVertex(arrays, triangle, 0));
+        normal = Vector3::crossProduct(edge1, edge2).getNormalized();
+    }
+    intersection.surfaceNormal = Vector3::dotProduct(normal, ray.getDirection()) < 0
+                               ? normal
+                               : normal.times(-1.0f);
+
+    if (material->hasTexture() && arrays.texcoordIndices) {
+        calculateTextureCoordinates(arrays, ray, triangle, u, v, intersection);
+    }
+}
+
+bool TriangleMesh::occludes(const Ray& ray, uint32_t primitive, float minDistance, float maxDistance) const {
+    const float origin[3] = {ray.getOrigin().x, ray.getOrigin().y, ray.getOrigin().z};
+    const float direction[3] = {ray.getDirection().x, ray.getDirection().y, ray.getDirection().z};
+    float u, v;
+    return Kernels::get().intersectTriangles(origin, direction, &mesh_.positions[0].x,
+                                             mesh_.positionIndices.data(), &primitive, 1,
+                                             minDistance, maxDistance, u, v) >= 0;
+}
+
+void TriangleMesh::compile(SceneCompiler& compiler) const {
+    SceneBinary::Writer& writer = compiler.getWriter();
+    SceneBinary::Mesh record = {};
+    record.material = compiler.getMaterialIndex(material_);
+    record.group = compiler.getCurrentGroup();
+
+    record.firstPosition = writer.getCount<float[3]>(SceneBinary::MESH_POSITIONS);
+    record.positionCount = static_cast<uint32_t>(mesh_.positions.size());
+    for (const auto& position : mesh_.positions) {
+        float values[3] = {position.x, position.y, position.z};
+        writer.add(SceneBinary::MESH_POSITIONS, values);
+    }
+    record.firstNormal = writer.getCount<float[3]>(SceneBinary::MESH_NORMALS);
+    record.normalCount = static_cast<uint32_t>(mesh_.normals.size());
+    for (const auto& normal : mesh_.normals) {
+        float values[3] = {normal.x, normal.y, normal.z};
+        writer.add(SceneBinary::MESH_NORMALS, values);
+    }
+    record.texcoordCount = static_cast<uint32_t>(mesh_.texcoords.size() / 2);
+    record.firstTexcoord = writer.add(SceneBinary::MESH_TEXCOORDS,
+        reinterpret_cast<const float (*)[2]>(mesh_.texcoords.data()), record.texcoordCount);
+
+    record.triangleCount = static_cast<uint32_t>(mesh_.getTriangleCount());
+    record.hasNormalIndices = !mesh_.normalIndices.empty();
+    record.hasTexcoordIndices = !mesh_.texcoordIndices.empty();
+    record.firstIndex = writer.add(SceneBinary::MESH_INDICES,
+        mesh_.positionIndices.data(), mesh_.positionIndices.size());
+    writer.add(SceneBinary::MESH_INDICES, mesh_.normalIndices.data(), mesh_.normalIndices.size());
+    writer.add(SceneBinary::MESH_INDICES, mesh_.texcoordIndices.data(), mesh_.texcoordIndices.size());
+
+    writer.add(SceneBinary::MESHES, record);
+}
+
+TriangleMesh::Arrays TriangleMesh::getArrays() const {
+    auto indicesOrNull = [](const std::vector<uint32_t>& indices) {
+        return indices.empty() ? nullptr : indices.data();
+    };
+    return {
+        reinterpret_cast<const float*>(mesh_.positions.data()), mesh_.positionIndices.data(),
+        reinterpret_cast<const float*>(mesh_.normals.data()), indicesOrNull(mesh_.normalIndices),
+        mesh_.texcoords.data(), indicesOrNull(mesh_.texcoordIndices)
+    };
+}
+
+void TriangleMesh::calculateTextureCoordinates(const Arrays& arrays, const Ray& ray, uint32_t triangle,
+                                               float u, float v, IntersectionInfo& intersection) {
+    const uint32_t* corners = &arrays.texcoordIndices[3 * triangle];
+    const float* uv0 = &arrays.texcoords[2 * corners[0]];
+    const float* uv1 = &arrays.texcoords[2 * corners[1]];
+    const float* uv2 = &arrays.texcoords[2 * corners[2]];
+    float w = 1.0f - u - v;
+    intersection.hasTextureCoordinates = true;
+    intersection.u = w * uv0[0] + u * uv1[0] + v * uv2[0];
+    // OBJ texture coordinates have v pointing up; image rows go down
+    intersection.v = 1.0f - (w * uv0[1] + u * uv1[1] + v * uv2[1]);
+
+    // The gradients of u and v in the triangle's plane, from how they change along its edges
+    Vector3 edge1 = getVertex(arrays, triangle, 1).minus(getVertex(arrays, triangle, 0));
+    Vector3 edge2 = getVertex(arrays, triangle, 2).minus(getVertex(arrays, triangle, 0));
+    Vector3 normal = Vector3::crossProduct(edge1, edge2);
+    float area2 = Vector3::dotProduct(normal, normal);
+    if (area2 <= 0.0f) return;
+    Vector3 toEdge1 = Vector3::crossProduct(edge2, normal).times(1.0f / area2);
+    Vector3 toEdge2 = Vector3::crossProduct(normal, edge1).times(1.0f / area2);
+    Vector3 gradientU = toEdge1.times(uv1[0] - uv0[0]).plus(toEdge2.times(uv2[0] - uv0[0]));
+    Vector3 gradientV = toEdge1.times(uv1[1] - uv0[1]).plus(toEdge2.times(uv2[1] - uv0[1]));
+    setTextureFootprint(ray, intersection.surfaceNormal, gradientU, gradientV, intersection);
+}
+
+OutOfCoreMesh::OutOfCoreMesh(std::string filename, const std::vector<MeshClusters::ClusterRecord>& clusters,
+                             std::shared_ptr<ClusterCache> cache, Material* material)
+    : SceneObject(material), filename_(std::move(filename)), cache_(std::move(cache)) {
+    for (uint32_t i = 0; i < clusters.size(); ++i) {
+        uint32_t id = cache_->add(MeshClusters::getClusterFilename(filename_, i), clusters[i]);
+        if (i == 0) firstId_ = id;
+        clusterBounds_.emplace_back(toVector3(clusters[i].boundsMin), toVector3(clusters[i].boundsMax));
+        firstTriangles_.push_back(clusters[i].firstTriangle);
+    }
+}
+
+bool OutOfCoreMesh::intersect(const Ray& ray, float minDistance, Hit& hit) const {
+    const Vector3& origin = ray.getOrigin();
+    const Vector3& direction = ray.getDirection();
+    Vector3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    float nearest = hit.distance;
+    bool found = false;
+    uint32_t deferred[MAX_DEFERRED];
+    float deferredEntry[MAX_DEFERRED];
+    int deferredCount = 0;
+
+    bvh_.traverse(origin, direction, minDistance, nearest, [&](uint32_t cluster, float& tMax) {
+        const char* data = cache_->tryPin(firstId_ + cluster);
+        if (!data) {
+            float entry;
+            if (!clusterBounds_[cluster].intersect(origin, inverseDirection, minDistance, tMax, entry)) {
+                return false;
+            }
+            if (deferredCount < MAX_DEFERRED) {
+                // Sorted nearest first
+                int position = deferredCount++;
+                for (; position > 0 && deferredEntry[position - 1] > entry; --position) {
+                    deferred[position] = deferred[position - 1];
+                    deferredEntry[position] = deferredEntry[position - 1];
+                }
+                deferred[position] = cluster;
+                deferredEntry[position] = entry;
+                return false;
+            }
+            data = cache_->pin(firstId_ + cluster);
+        }
+        if (data) {
+            found |= intersectCluster(ray, minDistance, cluster, data, tMax, hit);
+            cache_->unpin(firstId_ + cluster);
+        }
+        return false;
+    });
+
+    for (int i = 0; i < deferredCount && deferredEntry[i] <= nearest; ++i) {
+        if (const char* data = cache_->pin(firstId_ + deferred[i])) {
+            found |= intersectCluster(ray, minDistance, deferred[i], data, nearest, hit);
+            cache_->unpin(firstId_ + deferred[i]);
+        }
+    }
+    return found;
+}
+
+void OutOfCoreMesh::getSurface(const Ray& ray, float distance, const Hit& hit,
+                               IntersectionInfo& intersection) const {
+    uint32_t cluster = getCluster(hit.primitive);
+    const char* data = cache_->pin(firstId_ + cluster);
+    if (!data) {
+        // Its file went away since the hit; shade flat facing the ray
+        intersection.distance = distance;
+        intersection.material = material_;
+        intersection.surfaceNormal = ray.getDirection().times(-1.0f);
+        return;
+    }
+    TriangleMesh::getSurface(getArrays(MeshClusters::getView(data)), material_, ray, distance,
+                             hit.primitive - firstTriangles_[cluster], hit.u, hit.v, intersection);
+    cache_->unpin(firstId_ + cluster);
+}
+
+bool OutOfCoreMesh::occludes(const Ray& ray, uint32_t primitive, float minDistance, float maxDistance) const {
+    uint32_t cluster = getCluster(primitive);
+    const char* data = cache_->pin(firstId_ + cluster);
+    if (!data) return false;
+    MeshClusters::ClusterView view = MeshClusters::getView(data);
+    const float origin[3] = {ray.getOrigin().x, ray.getOrigin().y, ray.getOrigin().z};
+    const float direction[3] = {ray.getDirection().x, ray.getDirection().y, ray.getDirection().z};
+    uint32_t triangle = primitive - firstTriangles_[cluster];
+    float u, v;
+    bool occluded = Kernels::get().intersectTriangles(origin, direction, view.positions, view.positionIndices,
+                                                      &triangle, 1, minDistance, maxDistance, u, v) >= 0;
+    cache_->unpin(firstId_ + cluster);
+    return occluded;
+}
+
+void OutOfCoreMesh::compile(SceneCompiler& compiler) const {
+    SceneBinary::ClusteredMesh record = {
+        compiler.getMaterialIndex(material_),
+        compiler.getCurrentGroup(),
+        compiler.getWriter().addString(filename_)
+    };
+    compiler.getWriter().add(SceneBinary::CLUSTERED_MESHES, record);
+}
+
+uint32_t OutOfCoreMesh::getCluster(uint32_t triangle) const {
+    return static_cast<uint32_t>(
+        std::upper_bound(firstTriangles_.begin(), firstTriangles_.end(), triangle) - firstTriangles_.begin() - 1);
+}
+
+bool OutOfCoreMesh::intersectCluster(const Ray& ray, float minDistance, uint32_t cluster, const char* data,
+                                     float& nearest, Hit& hit) const {
+    MeshClusters::ClusterView view = MeshClusters::getView(data);
+    const Kernels::Table& kernels = Kernels::get();
+    const float origin[3] = {ray.getOrigin().x, ray.getOrigin().y, ray.getOrigin().z};
+    const float direction[3] = {ray.getDirection().x, ray.getDirection().y, ray.getDirection().z};
+    const uint32_t root = 0;
+    bool found = false;
+    uint64_t tests = 0;
+    Bvh::traverseLeavesIn(view.nodes, view.primitives, &root, 1, ray.getOrigin(), ray.getDirection(),
+                          minDistance, nearest,
+        [&](const uint32_t* triangles, uint32_t count, float& tMax) {
+            tests += count;
+            float u, v;
+            int winner = kernels.intersectTriangles(origin, direction, view.positions, view.positionIndices,
+                                                    triangles, count, minDistance, tMax, u, v);
+            if (winner >= 0) {
+                hit.distance = tMax;
+                hit.primitive = firstTriangles_[cluster] + triangles[winner];
+                hit.u = u;
+                hit.v = v;
+                found = true;
+            }
+            return false;
+        });
+    RT_STAT_ADD(primitiveTests, tests);
+    return found;
+}
+
+bool Terrain::intersect(const Ray& ray, float minDistance, Hit& hit) const {
+    float nearest = hit.distance;
+    Heightfield::Hit cell;
+    if (!heightfield_.intersect(ray.getOrigin(), ray.getDirection(), minDistance, nearest, cell)) {
+        return false;
+    }
+    hit.distance = nearest;
+    hit.primitive = cell.triangle;
+    hit.u = cell.u;
+    hit.v = cell.v;
+    return true;
+}
+
+void Terrain::getSurface(const Ray& ray, float distance, const Hit& hit, IntersectionInfo& intersection) const {
+    Heightfield::Hit cell = {hit.primitive, hit.u, hit.v};
+    intersection.distance = distance;
+    intersection.material = material_;
+    Vector3 normal = heightfield_.getNormal(cell);
+    float cosine = Vector3::dotProduct(normal, ray.getDirection());
+    intersection.surfaceNormal = cosine < 0 ? normal : normal.times(-1.0f);
+
+    if (material_->hasTexture()) {
+        intersection.hasTextureCoordinates = true;
+        heightfield_.getTextureCoordinates(cell, intersection.u, intersection.v);
+        // One texture repeat covers the grid's two units of width: v runs
+        // down the rows along x, u across the columns along y
+        Vector3 gradientU = Vector3(0.0f, 0.5f, 0.0f);
+        Vector3 gradientV = Vector3(0.5f, 0.0f, 0.0f);
+        float alongU = Vector3::dotProduct(gradientU, normal);
+        float alongV = Vector3::dotProduct(gradientV, normal);
+        setTextureFootprint(ray, normal, gradientU.minus(normal.times(alongU)),
+                            gradientV.minus(normal.times(alongV)), intersection);
+    }
+}
+
+void Terrain::compile(SceneCompiler& compiler) const {
+    SceneBinary::Writer& writer = compiler.getWriter();
+    uint32_t size = heightfield_.getSize();
+    SceneBinary::Heightfield record = {
+        compiler.getMaterialIndex(material_),
+        compiler.getCurrentGroup(),
+        size,
+        writer.add(SceneBinary::HEIGHTFIELD_HEIGHTS, heightfield_.getHeights(),
+                   static_cast<size_t>(size) * size)
+    };
+    writer.add(SceneBinary::HEIGHTFIELDS, record);
+}
+
+void Instance::addCausticTargets(std::vector<BoundingBox>& targets) const {
+    if (material_) {
+        SceneObject::addCausticTargets(targets);
+        return;
+    }
+    std::vector<BoundingBox> local;
+    geometry_->addCausticTargets(local);
+    for (const BoundingBox& bounds : local) {
+        targets.push_back(toWorld(bounds));
+    }
+}
+
+bool Instance::intersect(const Ray& ray, float minDistance, Hit& hit) const {
+    float scale;
+    Ray localRay = getLocalRay(ray, scale);
+    if (scale < Math::EPSILON) {
+        return false;
+    }
+
+    float maxDistance = hit.distance;
+    hit.distance = maxDistance * scale;
+    if (!geometry_->intersect(localRay, minDistance * scale, hit)) {
+        hit.distance = maxDistance;
+        return false;
+    }
+
+    hit.levels[geometry_->getInstanceDepth()] = {hit.object, hit.distance};
+    hit.distance /= scale;
+    return true;
+}
+
+void Instance::getSurface(const Ray& ray, float distance, const Hit& hit, IntersectionInfo& intersection) const {
+    float scale;
+    Ray localRay = getLocalRay(ray, scale);
+    const Hit::Level& level = hit.levels[geometry_->getInstanceDepth()];
+    level.object->getSurface(localRay, level.distance, hit, intersection);
+
+    intersection.distance = distance;
+    intersection.surfaceNormal = normalToWorld_.transformDirection(intersection.surfaceNormal).getNormalized();
+    if (material_) {
+        intersection.material = material_;
+    }
+}
+
+void Instance::compile(SceneCompiler& compiler) const {
+    SceneBinary::Instance record;
+    std::memcpy(record.objectToWorld, objectToWorld_.m, sizeof(record.objectToWorld));
+    std::memcpy(record.worldToObject, worldToObject_.m, sizeof(record.worldToObject));
+    record.definition = compiler.getDefinitionIndex(geometry_.get());
+    record.material = material_ ? compiler.getMaterialIndex(material_) : SceneBinary::NO_INDEX;
+    record.group = compiler.getCurrentGroup();
+    compiler.getWriter().add(SceneBinary::INSTANCES, record);
+}
+
+BoundingBox Instance::toWorld(const BoundingBox& local) const {
+    BoundingBox bounds;
+    if (local.isEmpty()) return bounds;
+    for (int corner = 0; corner < 8; ++corner) {
+        bounds.expand(objectToWorld_.transformPoint(Vector3(
+            corner & 1 ? local.max.x : local.min.x,
+            corner & 2 ? local.max.y : local.min.y,
+            corner & 4 ? local.max.z : local.min.z
+        )));
+    }
+    return bounds;
+}
+
+Ray Instance::getLocalRay(const Ray& ray, float& scale) const {
+    Vector3 localDirection = worldToObject_.transformDirection(ray.getDirection());
+    scale = localDirection.getLength();
+    return Ray(worldToObject_.transformPoint(ray.getOrigin()), localDirection,
+               ray.getDepth(), ray.getConeSpread());
+}
@@ -0,0 +1,600 @@
+#ifndef SCENE_OBJECTS_H
+#define SCENE_OBJECTS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Bvh.h"
+#include "Heightfield.h"
+#include "Math.h"
+#include "MeshClusters.h"
+#include "ObjLoader.h"
+#include "SceneBinary.h"
+#include "Texture.h"
+
+class Material;
+class ObjectGroup;
+class SceneObject;
+
+// Constants
+constexpr float MIN_INTERSECTION_DISTANCE = 0.0001f;
+constexpr float SHADOW_BIAS = 0.0001f;
+constexpr int DEFAULT_BOUNCES = 4;
+constexpr float DEFAULT_REFRACTIVE_INDEX = 1.458f;
+// Reflected and refracted paths carrying less than this share of a pixel's color are dropped
+constexpr float MIN_THROUGHPUT = 1.0f / 1024.0f;
+
+struct IntersectionInfo {
+    float distance;
+    Material* material;
+    Vector3 surfaceNormal;
+    bool hasTextureCoordinates = false;
+    float u = 0.0f;
+    float v = 0.0f;
+    // Extents of the ray cone's footprint along u and v, in texture-coordinate units
+    float textureFootprintU = 0.0f;
+    float textureFootprintV = 0.0f;
+    // Top-level object hit and, for objects made of many primitives, which one
+    const SceneObject* object = nullptr;
+    uint32_t primitive = 0;
+};
+
+// What traversal keeps of the nearest hit so far. Only the hit that ends up
+// nearest gets its normal, material and texture coordinates, from getSurface.
+struct Hit {
+    // Instances a hit can lie inside, counting nested ones
+    static constexpr int MAX_INSTANCE_DEPTH = 8;
+
+    float distance = std::numeric_limits<float>::infinity();  // Hits must come closer than this
+    const SceneObject* object = nullptr;  // Set by the group holding the object
+    uint32_t primitive = 0;
+    float u = 0.0f, v = 0.0f;             // Barycentrics, for triangles
+    // For a hit inside instances, the object hit within each definition and
+    // its distance in that definition's space. An instance uses the entry
+    // indexed by how deeply instances nest inside its definition, so the
+    // instances along one path never share an entry.
+    struct Level {
+        const SceneObject* object;
+        float distance;
+    };
+    Level levels[MAX_INSTANCE_DEPTH];
+};
+
+
+class Ray {
+public:
+    // coneSpread is the growth of the ray's footprint width per unit of distance,
+    // used to pick texture mip levels
+    Ray(const Vector3& origin, const Vector3& direction, int depth = 0, float coneSpread = 0.0f)
+        : origin_(origin), direction_(direction.getNormalized()), depth_(depth), coneSpread_(coneSpread) {}
+
+    const Vector3& getOrigin() const { return origin_; }
+    const Vector3& getDirection() const { return direction_; }
+    Vector3 getPointAtDistance(float distance) const { return origin_.plus(direction_.times(distance)); }
+    float getConeWidthAtDistance(float distance) const { return coneSpread_ * distance; }
+    float getConeSpread() const { return coneSpread_; }
+    int getDepth() const { return depth_; }
+
+private:
+    Vector3 origin_;
+    Vector3 direction_;
+    int depth_;
+    float coneSpread_;
+};
+
+class LightSource {
+public:
+    struct IlluminationInfo {
+        Vector3 direction;
+        Vector3 color;
+        float distance;
+    };
+
+    // What photons start from: a sun sends them along -vector with color as
+    // irradiance, a bulb from vector with color as intensity
+    struct Emission {
+        bool directional;
+        Vector3 vector;
+        Vector3 color;
+    };
+
+    virtual ~LightSource() = default;
+    virtual IlluminationInfo calculateIllumination(const Vector3& point) const = 0;
+    virtual Emission getEmission() const = 0;
+    virtual void compile(SceneBinary::Writer& writer) const = 0;
+};
+
+class DirectionalLight : public LightSource {
+public:
+    DirectionalLight(const Vector3& direction, const Vector3& color)
+        : direction_(direction.getNormalized()), color_(color) {}
+
+    IlluminationInfo calculateIllumination(const Vector3& point) const override {
+        (void)point;  // A sun lies the same way from everywhere
+        return {direction_, color_, std::numeric_limits<float>::infinity()};
+    }
+
+    Emission getEmission() const override { return {true, direction_, color_}; }
+    void compile(SceneBinary::Writer& writer) const override;
+
+private:
+    Vector3 direction_;
+    Vector3 color_;
+};
+
+class PointLight : public LightSource {
+public:
+    PointLight(const Vector3& position, const Vector3& color)
+        : position_(position), color_(color) {}
+
+    IlluminationInfo calculateIllumination(const Vector3& point) const override;
+    Emission getEmission() const override { return {false, position_, color_}; }
+    void compile(SceneBinary::Writer& writer) const override;
+
+private:
+    Vector3 position_;
+    Vector3 color_;
+};
+
+class Material {
+public:
+    Material(const Vector3& diffuseColor = Vector3(1, 1, 1),
+             std::shared_ptr<const Texture> texture = nullptr)
+        : diffuseColor_(diffuseColor), texture_(std::move(texture)) {}
+
+    Vector3 calculateShading(const Ray& ray, const IntersectionInfo& intersection,
+                             const Vector3& lightDir, const Vector3& lightColor) const;
+    Vector3 getSurfaceColor(const IntersectionInfo& intersection) const;
+
+    const Vector3& getDiffuseColor() const { return diffuseColor_; }
+    const std::shared_ptr<const Texture>& getTexture() const { return texture_; }
+    bool hasTexture() const { return texture_ != nullptr; }
+
+    // Per channel, the share of light mirrored and, of what is left, the share refracted
+    const Vector3& getReflectivity() const { return reflectivity_; }
+    const Vector3& getTransparency() const { return transparency_; }
+    float getRefractiveIndex() const { return refractiveIndex_; }
+    // Per channel, the shares of light mirrored, refracted and diffusely reflected
+    void getShares(Vector3& reflected, Vector3& refracted, Vector3& diffuse) const {
+        Vector3 one(1, 1, 1);
+        reflected = reflectivity_;
+        Vector3 remainder = one.minus(reflected);
+        refracted = Vector3::componentMultiply(remainder, transparency_);
+        diffuse = Vector3::componentMultiply(remainder, one.minus(transparency_));
+    }
+    // Whether it mirrors or refracts any light, and so may focus caustics
+    bool isSpecular() const {
+        return reflectivity_.x > 0 || reflectivity_.y > 0 || reflectivity_.z > 0 ||
+               transparency_.x > 0 || transparency_.y > 0 || transparency_.z > 0;
+    }
+
+    void setDiffuseColor(const Vector3& color) { diffuseColor_ = color; }
+    void setTexture(std::shared_ptr<const Texture> texture) { texture_ = std::move(texture); }
+    void setReflectivity(const Vector3& reflectivity) { reflectivity_ = reflectivity; }
+    void setTransparency(const Vector3& transparency) { transparency_ = transparency; }
+    void setRefractiveIndex(float refractiveIndex) { refractiveIndex_ = refractiveIndex; }
+
+private:
+    Vector3 diffuseColor_;
+    std::shared_ptr<const Texture> texture_;
+    Vector3 reflectivity_ = Vector3(0, 0, 0);
+    Vector3 transparency_ = Vector3(0, 0, 0);
+    float refractiveIndex_ = DEFAULT_REFRACTIVE_INDEX;
+};
+
+// Flattens a loaded scene into the records of a compiled .rtb file. Materials
+// and object definitions are numbered the first time an object refers to them.
+class SceneCompiler {
+public:
+    explicit SceneCompiler(SceneBinary::Writer& writer) : writer_(writer) {}
+
+    SceneBinary::Writer& getWriter() { return writer_; }
+    uint32_t getCurrentGroup() const { return currentGroup_; }
+
+    uint32_t getMaterialIndex(const Material* material);
+    // Definitions are compiled after the scene, in the order they were first instanced
+    uint32_t getDefinitionIndex(const ObjectGroup* definition);
+
+    // Moves on to the next definition waiting to be compiled; nullptr when done
+    const ObjectGroup* beginNextDefinition() {
+        if (currentGroup_ >= pendingDefinitions_.size()) return nullptr;
+        return pendingDefinitions_[currentGroup_++];
+    }
+
+    uint32_t getDefinitionCount() const { return static_cast<uint32_t>(pendingDefinitions_.size()); }
+
+private:
+    SceneBinary::Writer& writer_;
+    std::map<const Material*, uint32_t> materials_;
+    std::map<const ObjectGroup*, uint32_t> definitions_;
+    std::vector<const ObjectGroup*> pendingDefinitions_;
+    uint32_t currentGroup_ = 0;  // 0 is the scene; definition n is group n
+};
+
+class SceneObject {
+public:
+    explicit SceneObject(Material* material) : material_(material) {}
+    virtual ~SceneObject() = default;
+    // Records a hit nearer than hit.distance, keeping only what getSurface
+    // needs later: distance, primitive and barycentrics. Distances have to
+    // compare less, so the NaNs of degenerate rays never count as hits.
+    virtual bool intersect(const Ray& ray, float minDistance, Hit& hit) const = 0;
+    // Fills in the surface at the nearest hit, distance along this ray
+    virtual void getSurface(const Ray& ray, float distance, const Hit& hit,
+                            IntersectionInfo& intersection) const = 0;
+    // Builds any acceleration structure once the scene is fully loaded
+    virtual void build() {}
+    // Copies it for the NUMA node of the calling thread (Bvh::replicate), or
+    // drops every copy
+    virtual void replicate() {}
+    virtual void dropReplicas() {}
+    // Unbounded objects (planes) are tested for every ray instead of living in a BVH
+    virtual bool isBounded() const { return true; }
+    virtual BoundingBox getBounds() const = 0;
+    virtual void compile(SceneCompiler& compiler) const = 0;
+    // Instances nested between this object and its primitives
+    virtual int getInstanceDepth() const { return 0; }
+    // Whether an unbounded object may be seen by rays within the frustum
+    virtual bool mayIntersect(const Frustum& frustum) const { return !frustum.empty; }
+    // Bounds of the parts with specular materials, which photons are aimed at
+    virtual void addCausticTargets(std::vector<BoundingBox>& targets) const;
+
+    // Whether the primitive reported by an earlier hit blocks the ray within
+    // [minDistance, maxDistance). Objects without primitives test themselves whole.
+    virtual bool occludes(const Ray& ray, uint32_t primitive, float minDistance, float maxDistance) const;
+
+protected:
+    Material* material_;
+};
+
+class Sphere : public SceneObject {
+public:
+    Sphere(float radius, const Vector3& center, Material* material)
+        : SceneObject(material), radius_(radius), center_(center) {}
+
+    // Through the kernel table like SphereSet, as a set of one
+    bool intersect(const Ray& ray, float minDistance, Hit& hit) const override;
+    void getSurface(const Ray& ray, float distance, const Hit& hit,
+                    IntersectionInfo& intersection) const override;
+    BoundingBox getBounds() const override { return getBounds(center_, radius_); }
+    void compile(SceneCompiler& compiler) const override;
+
+    // Shared with SphereSet, which stores spheres as packed records instead of objects
+    static void getSurface(const Vector3& center, float radius, Material* material, const Ray& ray,
+                           float distance, IntersectionInfo& intersection);
+    static BoundingBox getBounds(const Vector3& center, float radius) {
+        Vector3 extent(radius, radius, radius);
+        return BoundingBox(center.minus(extent), center.plus(extent));
+    }
+
+private:
+    // Longitude/latitude mapping with the north pole along +y
+    static void calculateTextureCoordinates(float radius, const Ray& ray, IntersectionInfo& intersection);
+
+    float radius_;
+    Vector3 center_;
+};
+
+// The spheres of one group in a compiled scene, intersected straight from the
+// mapped file so loading never creates an object per sphere.
+class SphereSet : public SceneObject {
+public:
+    SphereSet(std::shared_ptr<const SceneBinary::Reader> file, const SceneBinary::Sphere* spheres,
+              size_t count, std::vector<Material*> materials)
+        : SceneObject(nullptr), file_(std::move(file)), spheres_(spheres), count_(count),
+          materials_(std::move(materials)) {}
+
+    void build() override;
+    void replicate() override { bvh_.replicate(); }
+    void dropReplicas() override { bvh_.dropReplicas(); }
+
+    bool intersect(const Ray& ray, float minDistance, Hit& hit) const override;
+    void getSurface(const Ray& ray, float distance, const Hit& hit,
+                    IntersectionInfo& intersection) const override;
+    BoundingBox getBounds() const override { return bvh_.getBounds(); }
+    void addCausticTargets(std::vector<BoundingBox>& targets) const override;
+    bool occludes(const Ray& ray, uint32_t primitive, float minDistance, float maxDistance) const override;
+    void compile(SceneCompiler& compiler) const override;
+
+private:
+    std::shared_ptr<const SceneBinary::Reader> file_;  // Keeps the mapping alive
+    const SceneBinary::Sphere* spheres_;
+    size_t count_;
+    std::vector<Material*> materials_;  // Indexed by the records' material field
+    Bvh bvh_;
+
+    Vector3 getCenter(size_t index) const {
+        const float* center = spheres_[index].center;
+        return Vector3(center[0], center[1], center[2]);
+    }
+};
+
+// A set of objects with a BVH over the bounded ones. The scene uses one as its
+// top level; each `object` definition owns one that all its instances share.
+class ObjectGroup {
+public:
+    ObjectGroup() = default;
+    ObjectGroup(const ObjectGroup&) = delete;
+    ObjectGroup& operator=(const ObjectGroup&) = delete;
+    ~ObjectGroup() {
+        for (auto* object : objects_) delete object;
+    }
+
+    // Takes ownership
+    void addObject(SceneObject* object) {
+        objects_.push_back(object);
+        instanceDepth_ = std::max(instanceDepth_, object->getInstanceDepth());
+    }
+    bool isEmpty() const { return objects_.empty(); }
+    int getInstanceDepth() const { return instanceDepth_; }
+
+    // Only objects added since the last build are built again; the group's
+    // own BVH is rebuilt over all of them
+    void build();
+
+    // Definitions shared by several instances are visited once per instance,
+    // but only copied once
+    void replicate();
+    void dropReplicas();
+
+    bool isBounded() const { return unboundedObjects_.empty(); }
+    BoundingBox getBounds() const { return bvh_.getBounds(); }
+
+    void addCausticTargets(std::vector<BoundingBox>& targets) const;
+    void compile(SceneCompiler& compiler) const;
+
+    // Finds the BVH nodes rays within the frustum may reach; false if those
+    // rays cannot hit anything at all
+    bool cull(const Frustum& frustum, std::vector<uint32_t>& startNodes) const;
+
+    // Objects shrink hit.distance as they report hits, which also narrows the
+    // BVH walk, so whichever object reported last holds the nearest hit.
+    // startNodes from cull limit the walk to those nodes.
+    bool intersect(const Ray& ray, float minDistance, Hit& hit,
+                   const std::vector<uint32_t>* startNodes = nullptr) const;
+
+private:
+    std::vector<SceneObject*> objects_;
+    std::vector<SceneObject*> boundedObjects_;    // Indexed by the BVH
+    std::vector<SceneObject*> unboundedObjects_;
+    Bvh bvh_;
+    size_t builtCount_ = 0;
+    int instanceDepth_ = 0;
+};
+
+// A primitive that blocked a shadow ray
+struct Occluder {
+    const SceneObject* object = nullptr;
+    uint32_t primitive = 0;
+};
+
+class Plane : public SceneObject {
+public:
+    // Constructor takes A, B, C, D coefficients of the plane equation Ax + By + Cz + D = 0
+    Plane(float A, float B, float C, float D, Material* material);
+
+    bool intersect(const Ray& ray, float minDistance, Hit& hit) const override;
+    void getSurface(const Ray& ray, float distance, const Hit& hit,
+                    IntersectionInfo& intersection) const override;
+
+    bool isBounded() const override { return false; }
+    BoundingBox getBounds() const override { return BoundingBox(); }
+
+    bool mayIntersect(const Frustum& frustum) const override {
+        return frustum.mayCrossPlane(Vector3(A_, B_, C_), D_);
+    }
+
+    void compile(SceneCompiler& compiler) const override;
+
+private:
+    float getDenominator(const Ray& ray) const {
+        return A_ * ray.getDirection().x +
+               B_ * ray.getDirection().y +
+               C_ * ray.getDirection().z;
+    }
+
+    float A_, B_, C_, D_;  // Plane equation coefficients
+    Vector3 normal_;       // Normalized normal vector (A,B,C)/sqrt(A²+B²+C²)
+};
+
+class Triangle : public SceneObject {
+public:
+    Triangle(const Vector3& v1, const Vector3& v2, const Vector3& v3, Material* material);
+
+    // Through the kernel table like TriangleMesh, as a mesh of one
+    bool intersect(const Ray& ray, float minDistance, Hit& hit) const override;
+    void getSurface(const Ray& ray, float distance, const Hit& hit,
+                    IntersectionInfo& intersection) const override;
+    BoundingBox getBounds() const override;
+    void compile(SceneCompiler& compiler) const override;
+
+private:
+    Vector3 v1_, v2_, v3_;
+    Vector3 normal_;
+};
+
+// Indexed triangle mesh with its own BVH, loaded from an OBJ file. Normals are
+// interpolated from the file's vn data when every corner has one.
+class TriangleMesh : public SceneObject {
+public:
+    TriangleMesh(ObjMesh mesh, Material* material)
+        : SceneObject(material), mesh_(std::move(mesh)) {}
+
+    // For a mesh added before it is read; a loader thread sets it and builds
+    void setMesh(ObjMesh mesh) { mesh_ = std::move(mesh); }
+
+    void build() override;
+    void replicate() override { bvh_.replicate(); }
+    void dropReplicas() override { bvh_.dropReplicas(); }
+
+    bool intersect(const Ray& ray, float minDistance, Hit& hit) const override;
+    void getSurface(const Ray& ray, float distance, const Hit& hit,
+                    IntersectionInfo& intersection) const override {
+        getSurface(getArrays(), material_, ray, distance, hit.primitive, hit.u, hit.v, intersection);
+    }
+
+    // Index arrays the mesh lacks are nullptr
+    struct Arrays {
+        const float* positions;  // x, y, z per vertex
+        const uint32_t* positionIndices;
+        const float* normals;
+        const uint32_t* normalIndices;
+        const float* texcoords;  // u, v per texture coordinate
+        const uint32_t* texcoordIndices;
+    };
+
+    // Shared with OutOfCoreMesh, whose clusters hold the same arrays
+    static void getSurface(const Arrays& arrays, Material* material, const Ray& ray, float distance,
+                           uint32_t triangle, float u, float v, IntersectionInfo& intersection);
+
+    BoundingBox getBounds() const override { return bvh_.getBounds(); }
+    size_t getTriangleCount() const { return mesh_.getTriangleCount(); }
+
+    bool occludes(const Ray& ray, uint32_t primitive, float minDistance, float maxDistance) const override;
+    void compile(SceneCompiler& compiler) const override;
+
+private:
+    ObjMesh mesh_;
+    Bvh bvh_;
+
+    static_assert(sizeof(Vector3) == 3 * sizeof(float), "kernels read positions as packed floats");
+
+    const Vector3& getVertex(size_t triangle, int corner) const {
+        return mesh_.positions[mesh_.positionIndices[3 * triangle + corner]];
+    }
+
+    Arrays getArrays() const;
+
+    static Vector3 getVector(const float* values, uint32_t index) {
+        return Vector3(values[3 * index], values[3 * index + 1], values[3 * index + 2]);
+    }
+
+    static Vector3 getVertex(const Arrays& arrays, uint32_t triangle, int corner) {
+        return getVector(arrays.positions, arrays.positionIndices[3 * triangle + corner]);
+    }
+
+    static void calculateTextureCoordinates(const Arrays& arrays, const Ray& ray, uint32_t triangle,
+                                            float u, float v, IntersectionInfo& intersection);
+};
+
+// Triangle mesh split into cluster files by --cluster and mapped a cluster at
+// a time through the renderer's ClusterCache. Only the cluster bounds and a
+// BVH over them stay resident. A ray first tests the clusters that are already
+// mapped, then loads the others it reaches nearest first, skipping any that
+// lie beyond the hits found so far.
+class OutOfCoreMesh : public SceneObject {
+public:
+    static constexpr int MAX_DEFERRED = 64;  // Clusters a ray sets aside before it loads them at once
+
+    OutOfCoreMesh(std::string filename, const std::vector<MeshClusters::ClusterRecord>& clusters,
+                  std::shared_ptr<ClusterCache> cache, Material* material);
+
+    void build() override { bvh_.build(clusterBounds_); }
+    void replicate() override { bvh_.replicate(); }
+    void dropReplicas() override { bvh_.dropReplicas(); }
+    BoundingBox getBounds() const override { return bvh_.getBounds(); }
+
+    bool intersect(const Ray& ray, float minDistance, Hit& hit) const override;
+    void getSurface(const Ray& ray, float distance, const Hit& hit,
+                    IntersectionInfo& intersection) const override;
+    bool occludes(const Ray& ray, uint32_t primitive, float minDistance, float maxDistance) const override;
+    void compile(SceneCompiler& compiler) const override;
+
+private:
+    std::string filename_;  // The index
+    std::shared_ptr<ClusterCache> cache_;
+    uint32_t firstId_ = 0;  // Cache ids are consecutive
+    std::vector<BoundingBox> clusterBounds_;
+    std::vector<uint32_t> firstTriangles_;
+    Bvh bvh_;
+
+    static Vector3 toVector3(const float values[3]) {
+        return Vector3(values[0], values[1], values[2]);
+    }
+
+    uint32_t getCluster(uint32_t triangle) const;
+
+    static TriangleMesh::Arrays getArrays(const MeshClusters::ClusterView& view) {
+        return {view.positions, view.positionIndices, view.normals, view.normalIndices,
+                view.texcoords, view.texcoordIndices};
+    }
+
+    // Like TriangleMesh::intersect over one mapped cluster, numbering its
+    // triangles across the whole mesh
+    bool intersectCluster(const Ray& ray, float minDistance, uint32_t cluster, const char* data,
+                          float& nearest, Hit& hit) const;
+};
+
+// Fault-formation terrain, or a heightfield from a compiled scene, in
+// MP4-Terrain's frame: x and y span [-1, 1] and heights run along z
+class Terrain : public SceneObject {
+public:
+    Terrain(Heightfield heightfield, Material* material,
+            std::shared_ptr<const SceneBinary::Reader> file = nullptr)
+        : SceneObject(material), file_(std::move(file)), heightfield_(std::move(heightfield)) {}
+
+    void build() override { heightfield_.build(); }
+    BoundingBox getBounds() const override { return heightfield_.getBounds(); }
+
+    bool intersect(const Ray& ray, float minDistance, Hit& hit) const override;
+    void getSurface(const Ray& ray, float distance, const Hit& hit,
+                    IntersectionInfo& intersection) const override;
+
+    bool occludes(const Ray& ray, uint32_t primitive, float minDistance, float maxDistance) const override {
+        return heightfield_.intersectTriangle(ray.getOrigin(), ray.getDirection(), primitive,
+                                              minDistance, maxDistance);
+    }
+
+    void compile(SceneCompiler& compiler) const override;
+
+private:
+    std::shared_ptr<const SceneBinary::Reader> file_;  // Keeps mapped heights alive
+    Heightfield heightfield_;
+};
+
+// A placement of an `object` definition. Rays are moved into the definition's
+// space, so every instance shares one copy of the geometry and its BVH.
+class Instance : public SceneObject {
+public:
+    Instance(std::shared_ptr<ObjectGroup> geometry, const Matrix4& objectToWorld,
+             const Matrix4& worldToObject, Material* materialOverride)
+        : SceneObject(materialOverride), geometry_(std::move(geometry)),
+          objectToWorld_(objectToWorld), worldToObject_(worldToObject),
+          normalToWorld_(worldToObject.getTransposed()) {}
+
+    void build() override { geometry_->build(); }
+    void replicate() override { geometry_->replicate(); }
+    void dropReplicas() override { geometry_->dropReplicas(); }
+    bool isBounded() const override { return geometry_->isBounded(); }
+
+    BoundingBox getBounds() const override { return toWorld(geometry_->getBounds()); }
+
+    // An override material decides for the whole copy
+    void addCausticTargets(std::vector<BoundingBox>& targets) const override;
+
+    int getInstanceDepth() const override { return 1 + geometry_->getInstanceDepth(); }
+
+    // Records which of the definition's objects was hit, so getSurface can
+    // follow the same path back down
+    bool intersect(const Ray& ray, float minDistance, Hit& hit) const override;
+    void getSurface(const Ray& ray, float distance, const Hit& hit,
+                    IntersectionInfo& intersection) const override;
+    void compile(SceneCompiler& compiler) const override;
+
+private:
+    BoundingBox toWorld(const BoundingBox& local) const;
+
+    // Ray normalizes its direction, so distances scale by the direction's stretch
+    Ray getLocalRay(const Ray& ray, float& scale) const;
+
+    std::shared_ptr<ObjectGroup> geometry_;
+    Matrix4 objectToWorld_;
+    Matrix4 worldToObject_;
+    Matrix4 normalToWorld_;  // Inverse transpose of objectToWorld
+};
+
+#endif // SCENE_OBJECTS_H
@@ -0,0 +1,196 @@
+#include "SceneTokenizer.h"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+    // Space and every control character separate tokens; newlines end lines first
+    inline bool isSpace(char c) {
+        return static_cast<unsigned char>(c) <= ' ';
+    }
+
+    // Finds the first separator eight bytes at a time. A byte below 0x21 sets its
+    // high bit in the mask; borrows can only mark bytes after the first real match.
+    inline const char* findTokenEnd(const char* p, const char* end) {
+        const uint64_t ones = 0x0101010101010101ull;
+        while (end - p >= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            uint64_t mask = (word - ones * 0x21) & ~word & (ones * 0x80);
+            if (mask) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                return p + __builtin_ctzll(mask) / 8;
+#else
+                break;
+#endif
+            }
+            p += 8;
+        }
+        while (p < end && !isSpace(*p)) ++p;
+        return p;
+    }
+
+    // from_chars rejects the leading '+' that std::stof used to accept
+    inline const char* skipPlus(const char* begin, const char* end) {
+        return (begin < end && *begin == '+') ? begin + 1 : begin;
+    }
+
+    // Plain decimals of up to 9 digits whose value fits in 24 bits. Both
+    // operands of the division are then exact floats, so its correctly rounded
+    // result is the one from_chars would produce, at a fraction of the cost.
+    bool parseShortDecimal(const char* p, const char* end, float& value) {
+        static const float powersOfTen[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f};
+
+        bool negative = p < end && *p == '-';
+        if (negative) ++p;
+        // At most 9 digits and the point, so the mantissa cannot overflow
+        // before the range check
+        if (end - p > 10) return false;
+
+        uint32_t mantissa = 0;
+        const char* digitsStart = p;
+        while (p < end && static_cast<unsigned>(*p - '0') < 10) {
+            mantissa = mantissa * 10 + static_cast<uint32_t>(*p++ - '0');
+        }
+        long integerDigits = p - digitsStart;
+        long fractionDigits = 0;
+        if (p < end && *p == '.') {
+            const char* fractionStart = ++p;
+            while (p < end && static_cast<unsigned>(*p - '0') < 10) {
+                mantissa = mantissa * 10 + static_cast<uint32_t>(*p++ - '0');
+            }
+            fractionDigits = p - fractionStart;
+        }
+        long digits = integerDigits + fractionDigits;
+        if (p != end || digits == 0 || digits > 9 || mantissa > (1u << 24)) return false;
+
+        value = static_cast<float>(mantissa) / powersOfTen[fractionDigits];
+        if (negative) value = -value;
+        return true;
+    }
+
+    bool parseFloat(std::string_view token, float& value) {
+        const char* end = token.data() + token.size();
+        const char* begin = skipPlus(token.data(), end);
+        if (parseShortDecimal(begin, end, value)) return true;
+        auto result = std::from_chars(begin, end, value);
+        return result.ec == std::errc() && result.ptr == end;
+    }
+}
+
+bool SceneCommand::fail(size_t index, const char* message) const {
+    error_ = message;
+    errorToken_ = index;
+    return false;
+}
+
+bool SceneCommand::getFloat(size_t index, float& value) const {
+    if (index >= tokenCount_) return fail(index, "missing number");
+    if (numberMask_ >> index & 1) {
+        value = numbers_[index];
+        return true;
+    }
+    if (!parseFloat(tokens_[index], value)) return fail(index, "expected a number");
+    return true;
+}
+
+bool SceneCommand::getFloats(size_t first, float* values, size_t count) const {
+    for (size_t i = 0; i < count; ++i) {
+        if (!getFloat(first + i, values[i])) return false;
+    }
+    return true;
+}
+
+bool SceneCommand::getInt(size_t index, int& value) const {
+    if (index >= tokenCount_) return fail(index, "missing integer");
+    const char* end = tokens_[index].data() + tokens_[index].size();
+    auto result = std::from_chars(skipPlus(tokens_[index].data(), end), end, value);
+    if (result.ec != std::errc() || result.ptr != end) {
+        return fail(index, "expected an integer");
+    }
+    return true;
+}
+
+void SceneCommand::parseNumbers() {
+    numberMask_ = 0;
+    for (size_t i = 0; i < tokenCount_; ++i) {
+        if (parseFloat(tokens_[i], numbers_[i])) numberMask_ |= 1u << i;
+    }
+}
+
+size_t SceneCommand::getColumn(size_t index) const {
+    if (tokenCount_ == 0) return 1;
+    if (index >= tokenCount_) {
+        const std::string_view& last = tokens_[tokenCount_ - 1];
+        return static_cast<size_t>(last.data() + last.size() - lineStart_) + 1;
+    }
+    return static_cast<size_t>(tokens_[index].data() - lineStart_) + 1;
+}
+
+bool SceneTokenizer::open(const std::string& filename, std::string& error) {
+    if (!file_.open(filename)) {
+        error = "cannot open " + filename;
+        return false;
+    }
+    position_ = file_.getData();
+    end_ = position_ + file_.getSize();
+    line_ = 0;
+    return true;
+}
+
+void SceneTokenizer::open(std::string_view text) {
+    file_.close();
+    position_ = text.data();
+    end_ = position_ + text.size();
+    line_ = 0;
+}
+
+bool SceneTokenizer::next(SceneCommand& command) {
+    const char* p = position_;
+    while (p < end_) {
+        ++line_;
+        command.tokenCount_ = 0;
+        command.line_ = line_;
+        command.lineStart_ = p;
+        command.numberMask_ = 0;
+        command.error_.clear();
+
+        // Tokens and the line end are found in the same pass
+        while (p < end_ && *p != '\n') {
+            if (isSpace(*p)) {
+                ++p;
+                continue;
+            }
+            const char* tokenStart = p;
+            p = findTokenEnd(p, end_);
+            if (command.tokenCount_ == SceneCommand::MAX_TOKENS) {
+                if (command.error_.empty()) {
+                    command.fail(command.tokenCount_, "too many values on one line");
+                }
+                continue;
+            }
+            command.tokens_[command.tokenCount_++] = std::string_view(tokenStart, p - tokenStart);
+        }
+        if (p < end_) ++p;  // Newline
+
+        if (command.tokenCount_ > 0) {
+            position_ = p;
+            return true;
+        }
+    }
+    position_ = p;
+    return false;
+}
+
+bool SceneTokenizer::nextChunk(size_t bytes, std::string_view& text) {
+    if (position_ >= end_) return false;
+    const char* chunkEnd = end_;
+    if (static_cast<size_t>(end_ - position_) > bytes) {
+        const char* newline = static_cast<const char*>(std::memchr(position_ + bytes, '\n',
+                                                                   end_ - position_ - bytes));
+        if (newline) chunkEnd = newline + 1;
+    }
+    text = std::string_view(position_, chunkEnd - position_);
+    position_ = chunkEnd;
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef SCENE_TOKENIZER_H
+#define SCENE_TOKENIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "MappedFile.h"
+
+// One line of a scene file. Tokens are views into the tokenizer's mapped
+// buffer, so they stay valid only until the next line is read.
+class SceneCommand {
+public:
+    static constexpr size_t MAX_TOKENS = 24;
+
+    size_t size() const { return tokenCount_; }
+    bool empty() const { return tokenCount_ == 0; }
+    std::string_view operator[](size_t index) const { return tokens_[index]; }
+    std::string getString(size_t index) const { return std::string(tokens_[index]); }
+
+    // Each token must be a complete number; on failure the error names its column
+    bool getFloat(size_t index, float& value) const;
+    bool getFloats(size_t first, float* values, size_t count) const;
+    bool getInt(size_t index, int& value) const;
+    // Parses every token that is a number now, so getFloat only looks it up;
+    // for commands tokenized ahead of use on another thread
+    void parseNumbers();
+
+    size_t getLine() const { return line_; }
+    // 1-based column of a token; past the last token, the column just after it
+    size_t getColumn(size_t index) const;
+
+    // Set by a failed getFloat/getInt; empty when the command was merely malformed
+    const std::string& getError() const { return error_; }
+    size_t getErrorToken() const { return errorToken_; }
+
+private:
+    friend class SceneTokenizer;
+
+    std::string_view tokens_[MAX_TOKENS];
+    size_t tokenCount_ = 0;
+    float numbers_[MAX_TOKENS];
+    uint32_t numberMask_ = 0;  // Bit i: numbers_[i] holds token i's value
+    size_t line_ = 0;
+    const char* lineStart_ = nullptr;
+    mutable std::string error_;
+    mutable size_t errorToken_ = 0;
+
+    bool fail(size_t index, const char* message) const;
+};
+
+// Splits a memory-mapped scene file, or commands already in memory, into
+// commands in a single pass, without allocating per line.
+class SceneTokenizer {
+public:
+    bool open(const std::string& filename, std::string& error);
+    // Reads the caller's text in place; it must outlive the commands read
+    void open(std::string_view text);
+
+    // Reads the next line that has any tokens; false at end of file. Lines with
+    // more than MAX_TOKENS tokens come back with an error already set.
+    bool next(SceneCommand& command);
+    // Lines read so far, empty ones included
+    size_t getLine() const { return line_; }
+    // Splits the rest off in runs of whole lines of at least bytes, for
+    // tokenizing in parallel; false once nothing is left. Lines of each run
+    // count from 1 again.
+    bool nextChunk(size_t bytes, std::string_view& text);
+
+private:
+    MappedFile file_;
+    const char* position_ = nullptr;
+    const char* end_ = nullptr;
+    size_t line_ = 0;
+};
+
+#endif // SCENE_TOKENIZER_H
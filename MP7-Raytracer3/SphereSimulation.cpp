@@ -0,0 +1,322 @@
+#include "SphereSimulation.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+
+namespace {
+    // Uniform in [0, 1) from the top 24 bits, so every standard library agrees
+    float nextUniform(std::mt19937& random) {
+        return static_cast<float>(random() >> 8) * (1.0f / 16777216.0f);
+    }
+}
+
+// Threads kept for the simulation's lifetime, since a step runs several short
+// parallel passes and starting threads for each would cost more than the work.
+// run() hands every worker, and the calling thread, the same task.
+class SphereSimulation::WorkerPool {
+public:
+    explicit WorkerPool(uint32_t threadCount) {
+        for (uint32_t i = 1; i < threadCount; ++i) {
+            workers_.emplace_back([this, i]() { work(i); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            ++generation_;
+        }
+        wake_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(workers_.size()) + 1; }
+
+    void run(const std::function<void(uint32_t)>& task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            pending_ = workers_.size();
+            ++generation_;
+        }
+        wake_.notify_all();
+        task(0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return pending_ == 0; });
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(uint32_t)>* task_ = nullptr;
+    size_t pending_ = 0;
+    uint64_t generation_ = 0;
+    bool stopping_ = false;
+
+    void work(uint32_t index) {
+        uint64_t seen = 0;
+        for (;;) {
+            const std::function<void(uint32_t)>* task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&]() { return generation_ != seen; });
+                seen = generation_;
+                if (stopping_) return;
+                task = task_;
+            }
+            (*task)(index);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0) done_.notify_one();
+        }
+    }
+};
+
+void SphereSimulation::Spheres::resize(size_t count) {
+    for (std::vector<float>* component : {&x, &y, &z, &vx, &vy, &vz, &radius, &mass}) {
+        component->resize(count);
+    }
+    color.resize(count);
+    cell.resize(count);
+}
+
+SphereSimulation::SphereSimulation(uint32_t sphereCount, uint32_t seed, uint32_t threadCount)
+    : sphereCount_(sphereCount) {
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    pool_ = std::make_unique<WorkerPool>(threadCount);
+    blockSums_.resize(threadCount);
+
+    spheres_.resize(sphereCount);
+    scratch_.resize(sphereCount);
+    order_.resize(sphereCount);
+
+    // Drawn in manysphere.js's order: every sphere's radius and color, then
+    // every sphere's position and velocity
+    std::mt19937 random(seed);
+    palette_.resize(3 * PALETTE_SIZE);
+    for (float& channel : palette_) {
+        channel = nextUniform(random);
+    }
+    float radiusScale = 0.75f / std::cbrt(static_cast<float>(std::max(1u, sphereCount)));
+    for (uint32_t i = 0; i < sphereCount; ++i) {
+        float radius = (nextUniform(random) + 0.25f) * radiusScale;
+        spheres_.radius[i] = radius;
+        spheres_.mass[i] = radius * radius * radius;
+        spheres_.color[i] = std::min(PALETTE_SIZE - 1, static_cast<uint32_t>(nextUniform(random) * PALETTE_SIZE));
+    }
+    for (uint32_t i = 0; i < sphereCount; ++i) {
+        spheres_.x[i] = CUBE_WIDTH * nextUniform(random) - 1.0f;
+        spheres_.y[i] = CUBE_WIDTH * nextUniform(random) - 1.0f;
+        spheres_.z[i] = CUBE_WIDTH * nextUniform(random) - 1.0f;
+        spheres_.vx[i] = (nextUniform(random) - 1.0f) * MAX_VELOCITY;
+        spheres_.vy[i] = (nextUniform(random) - 1.0f) * MAX_VELOCITY;
+        spheres_.vz[i] = (nextUniform(random) - 1.0f) * MAX_VELOCITY;
+    }
+
+    float largestDiameter = 2.0f * 1.25f * radiusScale;
+    cellsPerSide_ = static_cast<uint32_t>(std::clamp(std::floor(CUBE_WIDTH / largestDiameter),
+                                                     1.0f, static_cast<float>(MAX_CELLS_PER_SIDE)));
+    cellLength_ = CUBE_WIDTH / static_cast<float>(cellsPerSide_);
+    size_t cellCount = static_cast<size_t>(cellsPerSide_) * cellsPerSide_ * cellsPerSide_;
+    cellStart_.resize(cellCount + 1);
+    cellCursor_ = std::make_unique<std::atomic<uint32_t>[]>(cellCount);
+}
+
+SphereSimulation::~SphereSimulation() = default;
+
+uint32_t SphereSimulation::getThreadCount() const {
+    return pool_->getThreadCount();
+}
+
+// Runs task(begin, end, thread) on equal ranges of [0, count), one per thread
+template <typename Task>
+void SphereSimulation::forEachRange(size_t count, Task task) {
+    uint32_t threadCount = pool_->getThreadCount();
+    pool_->run([&](uint32_t thread) {
+        task(count * thread / threadCount, count * (thread + 1) / threadCount, thread);
+    });
+}
+
+void SphereSimulation::step(float deltaSeconds) {
+    integrate(deltaSeconds);
+    sortByCell();
+    collide(deltaSeconds);
+}
+
+// Moves every sphere, bounces it off the walls and counts it into its cell
+void SphereSimulation::integrate(float deltaSeconds) {
+    size_t cellCount = cellStart_.size() - 1;
+    forEachRange(cellCount, [&](size_t begin, size_t end, uint32_t) {
+        for (size_t c = begin; c < end; ++c) {
+            cellCursor_[c].store(0, std::memory_order_relaxed);
+        }
+    });
+
+    float inverseCellLength = 1.0f / cellLength_;
+    float lastCell = static_cast<float>(cellsPerSide_ - 1);
+    forEachRange(sphereCount_, [&](size_t begin, size_t end, uint32_t) {
+        float* positions[3] = {spheres_.x.data(), spheres_.y.data(), spheres_.z.data()};
+        float* velocities[3] = {spheres_.vx.data(), spheres_.vy.data(), spheres_.vz.data()};
+        for (size_t i = begin; i < end; ++i) {
+            float radius = spheres_.radius[i];
+            uint32_t cell = 0;
+            for (int axis = 2; axis >= 0; --axis) {
+                float& position = positions[axis][i];
+                float& velocity = velocities[axis][i];
+                position += velocity * deltaSeconds;
+                if (position - radius < -CUBE_WALL && velocity < 0) {
+                    velocity *= -ELASTICITY;
+                    position = -CUBE_WALL + radius;
+                } else if (position + radius > CUBE_WALL && velocity > 0) {
+                    velocity *= -ELASTICITY;
+                    position = CUBE_WALL - radius;
+                }
+                float index = std::clamp(std::floor((position + CUBE_WALL) * inverseCellLength), 0.0f, lastCell);
+                cell = cell * cellsPerSide_ + static_cast<uint32_t>(index);
+            }
+            spheres_.cell[i] = cell;
+            cellCursor_[cell].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+}
+
+// Counting sort of the spheres by cell, keeping their previous order within a
+// cell so the result does not depend on which thread placed them first
+void SphereSimulation::sortByCell() {
+    size_t cellCount = cellStart_.size() - 1;
+    forEachRange(cellCount, [&](size_t begin, size_t end, uint32_t thread) {
+        uint32_t sum = 0;
+        for (size_t c = begin; c < end; ++c) {
+            sum += cellCursor_[c].load(std::memory_order_relaxed);
+        }
+        blockSums_[thread] = sum;
+    });
+    uint32_t offset = 0;
+    for (uint32_t& sum : blockSums_) {
+        uint32_t count = sum;
+        sum = offset;
+        offset += count;
+    }
+    forEachRange(cellCount, [&](size_t begin, size_t end, uint32_t thread) {
+        uint32_t start = blockSums_[thread];
+        for (size_t c = begin; c < end; ++c) {
+            uint32_t count = cellCursor_[c].load(std::memory_order_relaxed);
+            cellStart_[c] = start;
+            cellCursor_[c].store(start, std::memory_order_relaxed);
+            start += count;
+        }
+    });
+    cellStart_[cellCount] = sphereCount_;
+
+    forEachRange(sphereCount_, [&](size_t begin, size_t end, uint32_t) {
+        for (size_t i = begin; i < end; ++i) {
+            order_[cellCursor_[spheres_.cell[i]].fetch_add(1, std::memory_order_relaxed)] = static_cast<uint32_t>(i);
+        }
+    });
+
+    forEachRange(cellCount, [&](size_t begin, size_t end, uint32_t) {
+        for (size_t c = begin; c < end; ++c) {
+            std::sort(order_.begin() + cellStart_[c], order_.begin() + cellStart_[c + 1]);
+        }
+    });
+
+    forEachRange(sphereCount_, [&](size_t begin, size_t end, uint32_t) {
+        for (size_t s = begin; s < end; ++s) {
+            uint32_t i = order_[s];
+            scratch_.x[s] = spheres_.x[i];
+            scratch_.y[s] = spheres_.y[i];
+            scratch_.z[s] = spheres_.z[i];
+            scratch_.vx[s] = spheres_.vx[i];
+            scratch_.vy[s] = spheres_.vy[i];
+            scratch_.vz[s] = spheres_.vz[i];
+            scratch_.radius[s] = spheres_.radius[i];
+            scratch_.mass[s] = spheres_.mass[i];
+            scratch_.color[s] = spheres_.color[i];
+            scratch_.cell[s] = spheres_.cell[i];
+        }
+    });
+    std::swap(spheres_, scratch_);
+}
+
+// Resolves each sphere's contacts against the sorted state, then applies
+// gravity and the speed limit, writing the next positions and velocities
+void SphereSimulation::collide(float deltaSeconds) {
+    const Spheres& current = spheres_;
+    uint32_t side = cellsPerSide_;
+    forEachRange(sphereCount_, [&](size_t begin, size_t end, uint32_t) {
+        for (size_t s = begin; s < end; ++s) {
+            float x = current.x[s], y = current.y[s], z = current.z[s];
+            float vx = current.vx[s], vy = current.vy[s], vz = current.vz[s];
+            float radius = current.radius[s];
+            float mass = current.mass[s];
+            float dx = 0, dy = 0, dz = 0;     // Separation
+            float dvx = 0, dvy = 0, dvz = 0;  // Impulse per unit mass
+
+            uint32_t cell = current.cell[s];
+            int cellX = static_cast<int>(cell % side);
+            int cellY = static_cast<int>(cell / side % side);
+            int cellZ = static_cast<int>(cell / side / side);
+            for (int nz = std::max(cellZ - 1, 0); nz <= std::min(cellZ + 1, static_cast<int>(side) - 1); ++nz) {
+                for (int ny = std::max(cellY - 1, 0); ny <= std::min(cellY + 1, static_cast<int>(side) - 1); ++ny) {
+                    // Neighbors along x are adjacent in sorted order
+                    size_t row = (static_cast<size_t>(nz) * side + ny) * side;
+                    uint32_t first = cellStart_[row + std::max(cellX - 1, 0)];
+                    uint32_t last = cellStart_[row + std::min(cellX + 1, static_cast<int>(side) - 1) + 1];
+                    for (uint32_t t = first; t < last; ++t) {
+                        float ox = current.x[t] - x, oy = current.y[t] - y, oz = current.z[t] - z;
+                        float minDistance = radius + current.radius[t];
+                        float squared = ox * ox + oy * oy + oz * oz;
+                        if (squared >= minDistance * minDistance || t == s || squared == 0.0f) continue;
+
+                        float distance = std::sqrt(squared);
+                        float normalX = ox / distance, normalY = oy / distance, normalZ = oz / distance;
+                        float velocityAlongNormal = (current.vx[t] - vx) * normalX + (current.vy[t] - vy) * normalY +
+                                                    (current.vz[t] - vz) * normalZ;
+                        if (velocityAlongNormal > 0) continue;
+
+                        float otherMass = current.mass[t];
+                        float impulse = -(1 + ELASTICITY) * velocityAlongNormal / (mass + otherMass) * otherMass;
+                        dvx -= normalX * impulse;
+                        dvy -= normalY * impulse;
+                        dvz -= normalZ * impulse;
+                        float correction = (minDistance - distance) * 0.5f;
+                        dx -= normalX * correction;
+                        dy -= normalY * correction;
+                        dz -= normalZ * correction;
+                    }
+                }
+            }
+
+            vx += dvx;
+            vy += dvy;
+            vz += dvz - GRAVITY * deltaSeconds;
+            float speed = std::sqrt(vx * vx + vy * vy + vz * vz);
+            if (speed > MAX_VELOCITY) {
+                float scale = MAX_VELOCITY / speed;
+                vx *= scale;
+                vy *= scale;
+                vz *= scale;
+            }
+            scratch_.x[s] = x + dx;
+            scratch_.y[s] = y + dy;
+            scratch_.z[s] = z + dz;
+            scratch_.vx[s] = vx;
+            scratch_.vy[s] = vy;
+            scratch_.vz[s] = vz;
+        }
+    });
+    std::swap(spheres_.x, scratch_.x);
+    std::swap(spheres_.y, scratch_.y);
+    std::swap(spheres_.z, scratch_.z);
+    std::swap(spheres_.vx, scratch_.vx);
+    std::swap(spheres_.vy, scratch_.vy);
+    std::swap(spheres_.vz, scratch_.vz);
+}
@@ -0,0 +1,81 @@
+#ifndef SPHERE_SIMULATION_H
+#define SPHERE_SIMULATION_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// MP20-Many-Spheres' simulation: spheres of mass r^3 fall along -z inside a
+// cube of width CUBE_WIDTH, bounce off its walls and off each other with
+// restitution ELASTICITY, and have their speed capped at MAX_VELOCITY.
+//
+// State is kept as one array per component, reordered every step so spheres
+// sharing a grid cell are adjacent. Each sphere sums the impulses and
+// separations from all its contacts, reading only the previous state, so
+// threads never write the same sphere and results do not depend on the
+// thread count.
+class SphereSimulation {
+public:
+    static constexpr float CUBE_WIDTH = 2.0f;
+    static constexpr float CUBE_WALL = CUBE_WIDTH / 2;
+    static constexpr float ELASTICITY = 0.9f;
+    static constexpr float GRAVITY = 3.0f;
+    static constexpr float MAX_VELOCITY = 3.0f;
+    // Sphere colors are drawn from this many random colors, so a frame needs
+    // one material per palette entry rather than per sphere
+    static constexpr uint32_t PALETTE_SIZE = 256;
+    static constexpr uint32_t MAX_CELLS_PER_SIDE = 1024;
+
+    struct Spheres {
+        std::vector<float> x, y, z;
+        std::vector<float> vx, vy, vz;
+        std::vector<float> radius;
+        std::vector<float> mass;
+        std::vector<uint32_t> color;  // Palette entry
+        std::vector<uint32_t> cell;   // Grid cell, as of the last step
+
+        void resize(size_t count);
+    };
+
+    // Radii, colors, positions and velocities are drawn like manysphere.js's;
+    // threadCount 0 uses every hardware thread
+    SphereSimulation(uint32_t sphereCount, uint32_t seed, uint32_t threadCount = 0);
+    ~SphereSimulation();
+
+    // Moves, bounces off walls, collides and applies gravity, in that order
+    void step(float deltaSeconds);
+
+    uint32_t getSphereCount() const { return sphereCount_; }
+    uint32_t getThreadCount() const;
+    // Spheres are reordered by step(); colors and radii travel with them
+    const Spheres& getSpheres() const { return spheres_; }
+    const std::vector<float>& getPalette() const { return palette_; }  // r, g, b per entry
+
+private:
+    class WorkerPool;
+
+    uint32_t sphereCount_;
+    Spheres spheres_;
+    Spheres scratch_;  // Reordered copy being built, then the next positions and velocities
+    std::vector<float> palette_;
+
+    // Uniform grid over the cube, with cells at least one sphere diameter wide
+    // so contacts only reach the 26 neighboring cells
+    uint32_t cellsPerSide_;
+    float cellLength_;
+    std::vector<uint32_t> cellStart_;  // Per cell plus one: first sphere in sorted order
+    std::vector<uint32_t> order_;      // Previous index of each sorted sphere
+    std::unique_ptr<std::atomic<uint32_t>[]> cellCursor_;  // Per cell: count, then next free slot
+    std::vector<uint32_t> blockSums_;  // Per thread, for the parallel prefix sum
+    std::unique_ptr<WorkerPool> pool_;
+
+    template <typename Task>
+    void forEachRange(size_t count, Task task);
+
+    void integrate(float deltaSeconds);
+    void sortByCell();
+    void collide(float deltaSeconds);
+};
+
+#endif // SPHERE_SIMULATION_H
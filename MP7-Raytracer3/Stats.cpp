@@ -0,0 +1,80 @@
+#include "Stats.h"
+
+RenderStats& RenderStats::merge(const RenderStats& other) {
+    primaryRays += other.primaryRays;
+    shadowRays += other.shadowRays;
+    shadowCacheHits += other.shadowCacheHits;
+    secondaryRays += other.secondaryRays;
+    primitiveTests += other.primitiveTests;
+    nodeVisits += other.nodeVisits;
+    rayHits += other.rayHits;
+    rayMisses += other.rayMisses;
+    culledTiles += other.culledTiles;
+    clusterLoads += other.clusterLoads;
+    clusterLoadBytes += other.clusterLoadBytes;
+    clusterEvictions += other.clusterEvictions;
+    deferredPixels += other.deferredPixels;
+    photonRays += other.photonRays;
+    storedPhotons += other.storedPhotons;
+    parseSeconds += other.parseSeconds;
+    buildSeconds += other.buildSeconds;
+    photonSeconds += other.photonSeconds;
+    traceSeconds += other.traceSeconds;
+    encodeSeconds += other.encodeSeconds;
+    loadTaskSeconds += other.loadTaskSeconds;
+    startupSeconds += other.startupSeconds;
+    criticalPathSeconds += other.criticalPathSeconds;
+    return *this;
+}
+
+void RenderStats::writeJson(std::ostream& out) const {
+    out << "{\n"
+        << "  \"rays\": {\n"
+        << "    \"primary\": " << primaryRays << ",\n"
+        << "    \"shadow\": " << shadowRays << ",\n"
+        << "    \"secondary\": " << secondaryRays << ",\n"
+        << "    \"total\": " << getTotalRays() << ",\n"
+        << "    \"hits\": " << rayHits << ",\n"
+        << "    \"misses\": " << rayMisses << "\n"
+        << "  },\n"
+        << "  \"shadowCache\": {\n"
+        << "    \"hits\": " << shadowCacheHits << ",\n"
+        << "    \"hitRate\": " << (shadowRays ? static_cast<double>(shadowCacheHits) / shadowRays : 0.0) << "\n"
+        << "  },\n"
+        << "  \"primitiveTests\": " << primitiveTests << ",\n"
+        << "  \"nodeVisits\": " << nodeVisits << ",\n"
+        << "  \"culledTiles\": " << culledTiles << ",\n"
+        << "  \"clusters\": {\n"
+        << "    \"loads\": " << clusterLoads << ",\n"
+        << "    \"loadBytes\": " << clusterLoadBytes << ",\n"
+        << "    \"evictions\": " << clusterEvictions << ",\n"
+        << "    \"deferredPixels\": " << deferredPixels << "\n"
+        << "  },\n"
+        << "  \"photons\": {\n"
+        << "    \"rays\": " << photonRays << ",\n"
+        << "    \"stored\": " << storedPhotons << "\n"
+        << "  },\n"
+        << "  \"seconds\": {\n"
+        << "    \"parse\": " << parseSeconds << ",\n"
+        << "    \"build\": " << buildSeconds << ",\n"
+        << "    \"photons\": " << photonSeconds << ",\n"
+        << "    \"trace\": " << traceSeconds << ",\n"
+        << "    \"encode\": " << encodeSeconds << ",\n"
+        << "    \"loadTasks\": " << loadTaskSeconds << ",\n"
+        << "    \"startup\": " << startupSeconds << ",\n"
+        << "    \"criticalPath\": " << criticalPathSeconds << "\n"
+        << "  }\n"
+        << "}\n";
+}
+
+namespace Stats {
+    void Totals::add(const RenderStats& stats) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.merge(stats);
+    }
+
+    RenderStats Totals::get() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+}
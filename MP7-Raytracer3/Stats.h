@@ -0,0 +1,134 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+// Counters gathered while rendering. Each thread working for a renderer owns
+// one instance, added to the renderer's Stats::Totals when it is done.
+struct RenderStats {
+    uint64_t primaryRays = 0;
+    uint64_t shadowRays = 0;
+    uint64_t shadowCacheHits = 0;  // Shadow rays answered by the light's last occluder
+    uint64_t secondaryRays = 0;
+    uint64_t primitiveTests = 0;
+    uint64_t nodeVisits = 0;
+    uint64_t rayHits = 0;
+    uint64_t rayMisses = 0;
+    uint64_t culledTiles = 0;  // Tiles whose frustum reached nothing, left as background
+    uint64_t clusterLoads = 0;  // Out-of-core mesh clusters mapped on demand
+    uint64_t clusterLoadBytes = 0;
+    uint64_t clusterEvictions = 0;
+    uint64_t deferredPixels = 0;  // Traced again once a cluster their rays missed was mapped
+    uint64_t photonRays = 0;  // Segments of caustic photon paths, not counted in the ray total
+    uint64_t storedPhotons = 0;
+
+    double parseSeconds = 0.0;
+    double buildSeconds = 0.0;
+    double photonSeconds = 0.0;
+    double traceSeconds = 0.0;
+    double encodeSeconds = 0.0;
+    double loadTaskSeconds = 0.0;      // File reads, decodes and builds on loader threads
+    double startupSeconds = 0.0;       // First load until tracing could start
+    double criticalPathSeconds = 0.0;  // Of startup, were every load task on a thread of its own
+
+    RenderStats& merge(const RenderStats& other);
+    uint64_t getTotalRays() const { return primaryRays + shadowRays + secondaryRays; }
+    void writeJson(std::ostream& out) const;
+};
+
+namespace Stats {
+    // What one renderer's threads counted, from the Scopes that have ended
+    class Totals {
+    public:
+        void add(const RenderStats& stats);
+        RenderStats get() const;
+
+    private:
+        mutable std::mutex mutex_;
+        RenderStats stats_;
+    };
+
+    namespace detail {
+        // Plain pointer, so a counter only costs a load and a test when nothing counts
+        inline thread_local RenderStats* current = nullptr;
+    }
+    // Counters of the calling thread, nullptr if it counts nothing
+    inline RenderStats* local() { return detail::current; }
+
+    // The calling thread counts into counters of its own while this lives and
+    // adds them to totals at the end; with totals nullptr it counts nothing.
+    // Scopes nest, the innermost counting.
+    class Scope {
+    public:
+        explicit Scope(Totals* totals) : totals_(totals), previous_(detail::current) {
+            detail::current = totals ? &counters_ : nullptr;
+        }
+        ~Scope() {
+            detail::current = previous_;
+            if (totals_) totals_->add(counters_);
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Totals* totals_;
+        RenderStats* previous_;
+        RenderStats counters_;
+    };
+
+    // Work that may be thrown away and redone: while this lives the calling
+    // thread counts apart, and keep() adds those counts to what it counted
+    // before. Dropped otherwise, so redone work is counted once.
+    class Attempt {
+    public:
+        Attempt() : previous_(detail::current) {
+            if (previous_) detail::current = &counters_;
+        }
+        ~Attempt() {
+            if (previous_) detail::current = previous_;
+        }
+        Attempt(const Attempt&) = delete;
+        Attempt& operator=(const Attempt&) = delete;
+
+        void keep() {
+            if (previous_) previous_->merge(counters_);
+        }
+
+    private:
+        RenderStats* previous_;
+        RenderStats counters_;
+    };
+
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(double RenderStats::*phase)
+            : phase_(phase), start_(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() {
+            if (RenderStats* stats = local()) {
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+                stats->*phase_ += elapsed.count();
+            }
+        }
+
+    private:
+        double RenderStats::*phase_;
+        std::chrono::steady_clock::time_point start_;
+    };
+}
+
+// Build with -DRT_DISABLE_STATS to remove every counter from the hot path
+#ifdef RT_DISABLE_STATS
+#define RT_STATS_ENABLED 0
+#define RT_STAT_ADD(counter, amount) ((void)0)
+#define RT_STAT_TIMER(phase) ((void)0)
+#else
+#define RT_STATS_ENABLED 1
+#define RT_STAT_ADD(counter, amount) \
+    (Stats::local() ? static_cast<void>(Stats::local()->counter += (amount)) : static_cast<void>(0))
+#define RT_STAT_TIMER(phase) Stats::ScopedTimer phase##Timer(&RenderStats::phase)
+#endif
+
+#endif // STATS_H
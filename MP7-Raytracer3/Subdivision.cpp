@@ -0,0 +1,373 @@
+#include "Subdivision.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace {
+    constexpr uint32_t NONE = 0xffffffffu;
+    // Ranges smaller than this are not worth a thread
+    constexpr size_t MIN_RANGE_SIZE = 1 << 14;
+
+    // Splits work into equal ranges over up to threadCount threads, the caller included
+    struct Ranges {
+        size_t threadCount;
+
+        size_t getCount(size_t count) const {
+            return std::max<size_t>(1, std::min(threadCount, count / MIN_RANGE_SIZE));
+        }
+
+        // Runs task(begin, end, range) on getCount(count) equal ranges of [0, count)
+        template <typename Task>
+        void run(size_t count, Task task) const {
+            size_t rangeCount = getCount(count);
+            std::vector<std::thread> workers;
+            for (size_t i = 1; i < rangeCount; ++i) {
+                workers.emplace_back(task, count * i / rangeCount, count * (i + 1) / rangeCount, i);
+            }
+            task(size_t(0), count / rangeCount, size_t(0));
+            for (std::thread& worker : workers) {
+                worker.join();
+            }
+        }
+    };
+
+    // Connectivity of one level's half-edges
+    struct Adjacency {
+        std::vector<uint32_t> faces;      // Face of each half-edge
+        std::vector<uint32_t> outStarts;  // Per vertex plus one, into outgoing
+        std::vector<uint32_t> outgoing;   // Half-edges grouped by start vertex, ascending within a vertex
+        std::vector<uint32_t> twins;      // Opposite half-edge, or NONE on a boundary
+        std::vector<uint32_t> edges;      // Undirected edge, numbered in order of its lower half-edge
+        uint32_t edgeCount = 0;
+
+        uint32_t getNext(const PolygonMesh& mesh, uint32_t h) const {
+            uint32_t face = faces[h];
+            return h + 1 == mesh.faceStarts[face + 1] ? mesh.faceStarts[face] : h + 1;
+        }
+
+        uint32_t getPrevious(const PolygonMesh& mesh, uint32_t h) const {
+            uint32_t face = faces[h];
+            return h == mesh.faceStarts[face] ? mesh.faceStarts[face + 1] - 1 : h - 1;
+        }
+
+        // Faces of every half-edge and the half-edges leaving every vertex
+        void buildOutgoing(const PolygonMesh& mesh, const Ranges& ranges) {
+            size_t halfEdgeCount = mesh.corners.size();
+            size_t vertexCount = mesh.positions.size();
+            faces.resize(halfEdgeCount);
+            ranges.run(mesh.getFaceCount(), [&](size_t begin, size_t end, size_t) {
+                for (size_t f = begin; f < end; ++f) {
+                    std::fill(faces.begin() + mesh.faceStarts[f], faces.begin() + mesh.faceStarts[f + 1],
+                              static_cast<uint32_t>(f));
+                }
+            });
+
+            std::vector<std::atomic<uint32_t>> cursors(vertexCount);
+            ranges.run(halfEdgeCount, [&](size_t begin, size_t end, size_t) {
+                for (size_t h = begin; h < end; ++h) {
+                    cursors[mesh.corners[h]].fetch_add(1, std::memory_order_relaxed);
+                }
+            });
+            outStarts.resize(vertexCount + 1);
+            uint32_t start = 0;
+            for (size_t v = 0; v < vertexCount; ++v) {
+                uint32_t count = cursors[v].load(std::memory_order_relaxed);
+                outStarts[v] = start;
+                cursors[v].store(start, std::memory_order_relaxed);
+                start += count;
+            }
+            outStarts[vertexCount] = start;
+
+            outgoing.resize(halfEdgeCount);
+            ranges.run(halfEdgeCount, [&](size_t begin, size_t end, size_t) {
+                for (size_t h = begin; h < end; ++h) {
+                    outgoing[cursors[mesh.corners[h]].fetch_add(1, std::memory_order_relaxed)] =
+                        static_cast<uint32_t>(h);
+                }
+            });
+            // Threads fill a vertex's slots in any order
+            ranges.run(vertexCount, [&](size_t begin, size_t end, size_t) {
+                for (size_t v = begin; v < end; ++v) {
+                    std::sort(outgoing.begin() + outStarts[v], outgoing.begin() + outStarts[v + 1]);
+                }
+            });
+        }
+
+        void build(const PolygonMesh& mesh, const Ranges& ranges) {
+            buildOutgoing(mesh, ranges);
+            size_t halfEdgeCount = mesh.corners.size();
+
+            // A half-edge's twin leaves its end vertex for its start vertex; pairs
+            // that do not agree (non-manifold edges) are treated as boundaries
+            std::vector<uint32_t> candidates(halfEdgeCount);
+            ranges.run(halfEdgeCount, [&](size_t begin, size_t end, size_t) {
+                for (size_t h = begin; h < end; ++h) {
+                    uint32_t from = mesh.corners[h];
+                    uint32_t to = mesh.corners[getNext(mesh, static_cast<uint32_t>(h))];
+                    candidates[h] = NONE;
+                    for (uint32_t i = outStarts[to]; i < outStarts[to + 1]; ++i) {
+                        if (mesh.corners[getNext(mesh, outgoing[i])] == from) {
+                            candidates[h] = outgoing[i];
+                            break;
+                        }
+                    }
+                }
+            });
+            twins.resize(halfEdgeCount);
+            ranges.run(halfEdgeCount, [&](size_t begin, size_t end, size_t) {
+                for (size_t h = begin; h < end; ++h) {
+                    uint32_t twin = candidates[h];
+                    twins[h] = twin != NONE && candidates[twin] == h ? twin : NONE;
+                }
+            });
+
+            // Each edge is numbered by its lower half-edge: count per range, then offset
+            auto isLower = [&](size_t h) { return twins[h] == NONE || h < twins[h]; };
+            std::vector<uint32_t> rangeOffsets(ranges.getCount(halfEdgeCount));
+            ranges.run(halfEdgeCount, [&](size_t begin, size_t end, size_t range) {
+                uint32_t count = 0;
+                for (size_t h = begin; h < end; ++h) {
+                    count += isLower(h);
+                }
+                rangeOffsets[range] = count;
+            });
+            edgeCount = 0;
+            for (uint32_t& offset : rangeOffsets) {
+                uint32_t count = offset;
+                offset = edgeCount;
+                edgeCount += count;
+            }
+            edges.resize(halfEdgeCount);
+            ranges.run(halfEdgeCount, [&](size_t begin, size_t end, size_t range) {
+                uint32_t edge = rangeOffsets[range];
+                for (size_t h = begin; h < end; ++h) {
+                    if (isLower(h)) edges[h] = edge++;
+                }
+            });
+            ranges.run(halfEdgeCount, [&](size_t begin, size_t end, size_t) {
+                for (size_t h = begin; h < end; ++h) {
+                    if (!isLower(h)) edges[h] = edges[twins[h]];
+                }
+            });
+        }
+    };
+
+    void accumulate(float sum[3], const Vector3& point, float weight = 1.0f) {
+        sum[0] += point.x * weight;
+        sum[1] += point.y * weight;
+        sum[2] += point.z * weight;
+    }
+
+    void subdivideOnce(const PolygonMesh& mesh, const Adjacency& adjacency, const Ranges& ranges,
+                       PolygonMesh& result) {
+        size_t faceCount = mesh.getFaceCount();
+        size_t halfEdgeCount = mesh.corners.size();
+        size_t vertexCount = mesh.positions.size();
+        uint32_t firstEdgePoint = static_cast<uint32_t>(faceCount);
+        uint32_t firstVertexPoint = firstEdgePoint + adjacency.edgeCount;
+        result.positions.resize(firstVertexPoint + vertexCount);
+        const std::vector<Vector3>& positions = mesh.positions;
+        std::vector<Vector3>& points = result.positions;
+
+        // Face points: the average of the face's corners
+        ranges.run(faceCount, [&](size_t begin, size_t end, size_t) {
+            for (size_t f = begin; f < end; ++f) {
+                float sum[3] = {0, 0, 0};
+                for (uint32_t h = mesh.faceStarts[f]; h < mesh.faceStarts[f + 1]; ++h) {
+                    accumulate(sum, positions[mesh.corners[h]]);
+                }
+                float scale = 1.0f / static_cast<float>(mesh.faceStarts[f + 1] - mesh.faceStarts[f]);
+                points[f] = Vector3(sum[0] * scale, sum[1] * scale, sum[2] * scale);
+            }
+        });
+
+        // Edge points: the average of both ends and both face points
+        ranges.run(halfEdgeCount, [&](size_t begin, size_t end, size_t) {
+            for (size_t h = begin; h < end; ++h) {
+                uint32_t twin = adjacency.twins[h];
+                if (twin != NONE && twin < h) continue;
+                float sum[3] = {0, 0, 0};
+                accumulate(sum, positions[mesh.corners[h]]);
+                accumulate(sum, positions[mesh.corners[adjacency.getNext(mesh, static_cast<uint32_t>(h))]]);
+                float scale = 0.5f;
+                if (twin != NONE) {
+                    accumulate(sum, points[adjacency.faces[h]]);
+                    accumulate(sum, points[adjacency.faces[twin]]);
+                    scale = 0.25f;
+                }
+                points[firstEdgePoint + adjacency.edges[h]] = Vector3(sum[0] * scale, sum[1] * scale, sum[2] * scale);
+            }
+        });
+
+        // Vertex points: (F + 2R + (n - 3) P) / n from the n surrounding face
+        // points' average F and edge midpoints' average R
+        ranges.run(vertexCount, [&](size_t begin, size_t end, size_t) {
+            for (size_t v = begin; v < end; ++v) {
+                const Vector3& position = positions[v];
+                uint32_t first = adjacency.outStarts[v];
+                uint32_t last = adjacency.outStarts[v + 1];
+                float faceSum[3] = {0, 0, 0};
+                float midpointSum[3] = {0, 0, 0};
+                float boundarySum[3] = {0, 0, 0};
+                int boundaryEdges = 0;
+                for (uint32_t i = first; i < last; ++i) {
+                    uint32_t h = adjacency.outgoing[i];
+                    const Vector3& next = positions[mesh.corners[adjacency.getNext(mesh, h)]];
+                    accumulate(faceSum, points[adjacency.faces[h]]);
+                    accumulate(midpointSum, position, 0.5f);
+                    accumulate(midpointSum, next, 0.5f);
+                    if (adjacency.twins[h] == NONE) {
+                        accumulate(boundarySum, next);
+                        ++boundaryEdges;
+                    }
+                    uint32_t previous = adjacency.getPrevious(mesh, h);
+                    if (adjacency.twins[previous] == NONE) {
+                        accumulate(boundarySum, positions[mesh.corners[previous]]);
+                        ++boundaryEdges;
+                    }
+                }
+
+                Vector3& point = points[firstVertexPoint + v];
+                float n = static_cast<float>(last - first);
+                if (first == last || boundaryEdges > 2 || boundaryEdges == 1) {
+                    point = position;  // Isolated or non-manifold corner
+                } else if (boundaryEdges == 2) {
+                    point = Vector3((boundarySum[0] + 6.0f * position.x) * 0.125f,
+                                    (boundarySum[1] + 6.0f * position.y) * 0.125f,
+                                    (boundarySum[2] + 6.0f * position.z) * 0.125f);
+                } else {
+                    float inverse = 1.0f / n;
+                    point = Vector3((faceSum[0] * inverse + 2.0f * midpointSum[0] * inverse + (n - 3.0f) * position.x) * inverse,
+                                    (faceSum[1] * inverse + 2.0f * midpointSum[1] * inverse + (n - 3.0f) * position.y) * inverse,
+                                    (faceSum[2] * inverse + 2.0f * midpointSum[2] * inverse + (n - 3.0f) * position.z) * inverse);
+                }
+            }
+        });
+
+        // Half-edge h becomes quad (vertex point, edge point, face point, previous edge point)
+        result.faceStarts.resize(halfEdgeCount + 1);
+        result.corners.resize(4 * halfEdgeCount);
+        ranges.run(halfEdgeCount, [&](size_t begin, size_t end, size_t) {
+            for (size_t h = begin; h < end; ++h) {
+                uint32_t* quad = &result.corners[4 * h];
+                quad[0] = firstVertexPoint + mesh.corners[h];
+                quad[1] = firstEdgePoint + adjacency.edges[h];
+                quad[2] = adjacency.faces[h];
+                quad[3] = firstEdgePoint + adjacency.edges[adjacency.getPrevious(mesh, static_cast<uint32_t>(h))];
+                result.faceStarts[h] = static_cast<uint32_t>(4 * h);
+            }
+        });
+        result.faceStarts[halfEdgeCount] = static_cast<uint32_t>(4 * halfEdgeCount);
+    }
+}
+
+PolygonMesh PolygonMesh::fromObj(const ObjMesh& mesh) {
+    PolygonMesh result;
+    result.positions = mesh.positions;
+    size_t triangleCount = mesh.getTriangleCount();
+    size_t fannedCount = 0;
+    for (uint32_t size : mesh.faceSizes) {
+        fannedCount += size - 2;
+    }
+
+    result.faceStarts.push_back(0);
+    if (fannedCount != triangleCount) {
+        result.corners = mesh.positionIndices;
+        for (size_t t = 0; t < triangleCount; ++t) {
+            result.faceStarts.push_back(static_cast<uint32_t>(3 * (t + 1)));
+        }
+        return result;
+    }
+
+    // A fan around corner 0 lists corners 0, 1, 2, then each later triangle adds its third corner
+    const uint32_t* triangle = mesh.positionIndices.data();
+    for (uint32_t size : mesh.faceSizes) {
+        result.corners.insert(result.corners.end(), triangle, triangle + 3);
+        triangle += 3;
+        for (uint32_t i = 3; i < size; ++i, triangle += 3) {
+            result.corners.push_back(triangle[2]);
+        }
+        result.faceStarts.push_back(static_cast<uint32_t>(result.corners.size()));
+    }
+    return result;
+}
+
+ObjMesh PolygonMesh::toTriangles(unsigned threadCount) const {
+    Ranges ranges{threadCount};
+    ObjMesh result;
+    result.positions = positions;
+    size_t faceCount = getFaceCount();
+    result.faceSizes.resize(faceCount);
+    std::vector<uint32_t> firstTriangles(faceCount + 1, 0);
+    for (size_t f = 0; f < faceCount; ++f) {
+        result.faceSizes[f] = faceStarts[f + 1] - faceStarts[f];
+        firstTriangles[f + 1] = firstTriangles[f] + result.faceSizes[f] - 2;
+    }
+
+    // Face normals are summed over the fan, so their length is twice the face area
+    std::vector<Vector3> faceNormals(faceCount);
+    result.positionIndices.resize(3 * static_cast<size_t>(firstTriangles[faceCount]));
+    ranges.run(faceCount, [&](size_t begin, size_t end, size_t) {
+        for (size_t f = begin; f < end; ++f) {
+            uint32_t* triangle = &result.positionIndices[3 * static_cast<size_t>(firstTriangles[f])];
+            const Vector3& origin = positions[corners[faceStarts[f]]];
+            float normal[3] = {0, 0, 0};
+            for (uint32_t h = faceStarts[f] + 1; h + 1 < faceStarts[f + 1]; ++h, triangle += 3) {
+                triangle[0] = corners[faceStarts[f]];
+                triangle[1] = corners[h];
+                triangle[2] = corners[h + 1];
+                accumulate(normal, Vector3::crossProduct(positions[corners[h]].minus(origin),
+                                                         positions[corners[h + 1]].minus(origin)));
+            }
+            faceNormals[f] = Vector3(normal[0], normal[1], normal[2]);
+        }
+    });
+
+    Adjacency adjacency;
+    adjacency.buildOutgoing(*this, ranges);
+    result.normals.resize(positions.size());
+    ranges.run(positions.size(), [&](size_t begin, size_t end, size_t) {
+        for (size_t v = begin; v < end; ++v) {
+            float normal[3] = {0, 0, 0};
+            for (uint32_t i = adjacency.outStarts[v]; i < adjacency.outStarts[v + 1]; ++i) {
+                accumulate(normal, faceNormals[adjacency.faces[adjacency.outgoing[i]]]);
+            }
+            // Not getNormalized(): finely subdivided faces have sums below its epsilon
+            float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            float scale = length > 0.0f ? 1.0f / length : 0.0f;
+            result.normals[v] = Vector3(normal[0] * scale, normal[1] * scale, normal[2] * scale);
+        }
+    });
+    result.normalIndices = result.positionIndices;
+    return result;
+}
+
+bool Subdivision::subdivide(PolygonMesh& mesh, int levels, unsigned threadCount, std::string& error,
+                            std::vector<double>* levelSeconds) {
+    // Every level turns each corner into a quad
+    uint64_t cornerCount = mesh.corners.size();
+    for (int level = 0; level < levels; ++level) {
+        cornerCount *= 4;
+        if (cornerCount > NONE) {
+            error = std::to_string(levels) + " subdivision levels exceed 32-bit indices";
+            return false;
+        }
+    }
+
+    // The two meshes trade places every level, so their arrays are reused
+    Ranges ranges{threadCount};
+    PolygonMesh next;
+    Adjacency adjacency;
+    for (int level = 0; level < levels; ++level) {
+        auto start = std::chrono::steady_clock::now();
+        adjacency.build(mesh, ranges);
+        subdivideOnce(mesh, adjacency, ranges, next);
+        std::swap(mesh, next);
+        if (levelSeconds) {
+            levelSeconds->push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef SUBDIVISION_H
+#define SUBDIVISION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Math.h"
+#include "ObjLoader.h"
+
+// Polygon mesh kept as an index-based edge table: face f's corners are
+// corners[faceStarts[f]] .. corners[faceStarts[f + 1] - 1] in winding order,
+// and corner h doubles as the half-edge from its vertex to the next corner's.
+struct PolygonMesh {
+    std::vector<Vector3> positions;
+    std::vector<uint32_t> faceStarts;  // Per face plus one
+    std::vector<uint32_t> corners;     // Position index per corner
+
+    size_t getFaceCount() const { return faceStarts.empty() ? 0 : faceStarts.size() - 1; }
+
+    // Rebuilds the OBJ polygons from ObjMesh::faceSizes; meshes without them
+    // (e.g. from compiled scenes) take every triangle as a face
+    static PolygonMesh fromObj(const ObjMesh& mesh);
+    // Fan triangulates every face and adds area-weighted vertex normals, on up
+    // to threadCount threads
+    ObjMesh toTriangles(unsigned threadCount) const;
+};
+
+class Subdivision {
+public:
+    // MP15-Subdivision's Catmull-Clark scheme, applied levels times. New
+    // vertices are numbered like subdivision.js's: face points, then edge
+    // points, then the moved original vertices, and half-edge h of the old
+    // mesh becomes quad h. Boundary edges use their midpoint and boundary
+    // vertices (previous + 6 * vertex + next) / 8. Face, edge and vertex points
+    // are computed on up to threadCount threads, the caller included, and the
+    // result does not depend on the thread count. levelSeconds, when given,
+    // receives each level's time. Returns false with a message in error if the
+    // result would not fit 32-bit indices.
+    static bool subdivide(PolygonMesh& mesh, int levels, unsigned threadCount, std::string& error,
+                          std::vector<double>* levelSeconds = nullptr);
+};
+
+#endif // SUBDIVISION_H
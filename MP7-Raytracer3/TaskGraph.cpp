@@ -0,0 +1,162 @@
+#include "TaskGraph.h"
+#include <algorithm>
+#include "Stats.h"
+#include "Trace.h"
+
+TaskGraph::Lease::Lease(TaskGraph& graph) : graph_(graph) {
+    std::lock_guard<std::mutex> lock(graph_.mutex_);
+    unsigned busy = graph_.getBusyThreads();
+    spare_ = graph_.threadCount_ > busy ? graph_.threadCount_ - busy : 0;
+    graph_.lentThreads_ += spare_;
+}
+
+TaskGraph::Lease::~Lease() {
+    {
+        std::lock_guard<std::mutex> lock(graph_.mutex_);
+        graph_.lentThreads_ -= spare_;
+    }
+    // Workers hold back queued tasks while the threads are lent
+    graph_.queued_.notify_all();
+}
+
+void TaskGraph::setThreadCount(unsigned threadCount) {
+    finish();
+    threadCount_ = threadCount;
+}
+
+void TaskGraph::setStats(Stats::Totals* stats) {
+    finish();
+    stats_ = stats;
+}
+
+std::shared_ptr<TaskGraph::Task> TaskGraph::add(const char* name, const std::string& detail, Work work) {
+    auto task = std::make_shared<Task>();
+    task->graph_ = this;
+    task->name_ = name;
+    task->detail_ = detail;
+    task->work_ = std::move(work);
+    task->pathStart_ = getCriticalPath();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(task);
+    unfinished_.push_back(task);
+    // Threads start as tasks come, up to one fewer than the count beside the caller
+    if (queue_.size() > idleWorkers_ && workers_.size() + 1 < threadCount_) {
+        workers_.emplace_back(&TaskGraph::work, this);
+    }
+    queued_.notify_one();
+    return task;
+}
+
+void TaskGraph::wait(const std::shared_ptr<Task>& task) {
+    double path = getCriticalPath();
+    complete(task);
+    if (task->graph_ == this) path = std::max(path, task->pathEnd_);
+    path_ = path;
+    pathMark_ = std::chrono::steady_clock::now();
+}
+
+void TaskGraph::finish() {
+    double path = getCriticalPath();
+    std::vector<std::shared_ptr<Task>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks.swap(unfinished_);
+    }
+    for (const auto& task : tasks) {
+        complete(task);
+        path = std::max(path, task->pathEnd_);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    queued_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+    stopping_ = false;
+
+    path_ = path;
+    pathMark_ = std::chrono::steady_clock::now();
+}
+
+double TaskGraph::getCriticalPath() const {
+    std::chrono::duration<double> sinceMark = std::chrono::steady_clock::now() - pathMark_;
+    return path_ + sinceMark.count();
+}
+
+void TaskGraph::resetCriticalPath() {
+    path_ = 0.0;
+    pathMark_ = std::chrono::steady_clock::now();
+}
+
+void TaskGraph::work() {
+    Trace::setThreadName("loader");
+    // Added to the totals as the thread exits, before finish() joins it
+    Stats::Scope stats(stats_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        if (!queue_.empty() && getBusyThreads() < threadCount_) {
+            std::shared_ptr<Task> task = std::move(queue_.front());
+            queue_.pop_front();
+            ++runningWorkers_;
+            lock.unlock();
+            run(*task);
+            lock.lock();
+            --runningWorkers_;
+        } else if (stopping_ && queue_.empty()) {
+            return;
+        } else {
+            ++idleWorkers_;
+            queued_.wait(lock);
+            --idleWorkers_;
+        }
+    }
+}
+
+void TaskGraph::run(Task& task) {
+    auto start = std::chrono::steady_clock::now();
+    {
+        Trace::Scope trace(task.name_, "%s", task.detail_.c_str());
+        task.succeeded_ = task.work_(task.error_);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    RT_STAT_ADD(loadTaskSeconds, elapsed.count());
+    task.work_ = nullptr;  // Drops what it captured
+    task.pathEnd_ = task.pathStart_ + elapsed.count();
+
+    std::lock_guard<std::mutex> lock(task.mutex_);
+    task.done_ = true;
+    task.finished_.notify_all();
+}
+
+void TaskGraph::complete(const std::shared_ptr<Task>& task) {
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto position = std::find(queue_.begin(), queue_.end(), task);
+        if (position != queue_.end()) {
+            queue_.erase(position);
+            queued = true;
+        }
+    }
+    if (queued) {
+        run(*task);
+        return;
+    }
+    // The caller's thread is free for leases and queued tasks meanwhile
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callerWaiting_ = true;
+    }
+    queued_.notify_one();
+    {
+        std::unique_lock<std::mutex> lock(task->mutex_);
+        task->finished_.wait(lock, [&task]() { return task->done_; });
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    callerWaiting_ = false;
+}
@@ -0,0 +1,121 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Stats { class Totals; }
+
+// Work of loading a scene that can run beside the parse (file reads, decodes,
+// builds), handed to a few threads as the commands needing it come up. Tasks
+// never wait for each other; the thread adding them waits for their results,
+// running the one it waits for itself if no thread has taken it yet.
+//
+// Tasks that split their own work over threads take them from the same count
+// through a Lease, so loads running side by side share the cores instead of
+// each starting a full set.
+//
+// The graph also keeps that thread's critical path: how long its work would
+// take if every task ran on a thread of its own from the moment it was added.
+class TaskGraph {
+public:
+    // Returns false with a message on failure
+    typedef std::function<bool(std::string& error)> Work;
+
+    class Task {
+    public:
+        // Valid once waited for
+        bool hasSucceeded() const { return succeeded_; }
+        const std::string& getError() const { return error_; }
+
+    private:
+        friend class TaskGraph;
+
+        const TaskGraph* graph_ = nullptr;
+        const char* name_ = nullptr;
+        std::string detail_;
+        Work work_;
+        double pathStart_ = 0.0;
+        double pathEnd_ = 0.0;
+        bool succeeded_ = false;
+        std::string error_;
+
+        std::mutex mutex_;
+        std::condition_variable finished_;
+        bool done_ = false;
+    };
+
+    // Threads for one piece of work, its own included: whichever of the
+    // graph's are not busy when it is taken, given back when destroyed
+    class Lease {
+    public:
+        explicit Lease(TaskGraph& graph);
+        ~Lease();
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        unsigned getThreadCount() const { return 1 + spare_; }
+
+    private:
+        TaskGraph& graph_;
+        unsigned spare_;
+    };
+
+    // threadCount counts the caller; with 1, tasks run when waited for
+    explicit TaskGraph(unsigned threadCount = 1) : threadCount_(threadCount) {}
+    ~TaskGraph() { finish(); }
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    // Waits for every task first
+    void setThreadCount(unsigned threadCount);
+    unsigned getThreadCount() const { return threadCount_; }
+    // Where the graph's threads count, nullptr for nowhere; waits for every task first
+    void setStats(Stats::Totals* stats);
+
+    // name is a literal naming the kind of task in traces, detail the instance
+    std::shared_ptr<Task> add(const char* name, const std::string& detail, Work work);
+    // Also accepts tasks of other graphs, which run on their own threads
+    void wait(const std::shared_ptr<Task>& task);
+    // Waits for every task added so far and lets the threads go
+    void finish();
+
+    // Seconds of critical path since the last reset
+    double getCriticalPath() const;
+    void resetCriticalPath();
+
+private:
+    unsigned threadCount_;
+    Stats::Totals* stats_ = nullptr;
+    std::mutex mutex_;
+    std::condition_variable queued_;
+    std::deque<std::shared_ptr<Task>> queue_;
+    std::vector<std::shared_ptr<Task>> unfinished_;  // Added since the last finish
+    std::vector<std::thread> workers_;
+    size_t idleWorkers_ = 0;
+    // What the caller, running workers and leases hold of threadCount_
+    unsigned runningWorkers_ = 0;
+    unsigned lentThreads_ = 0;
+    bool callerWaiting_ = false;
+    bool stopping_ = false;
+
+    double path_ = 0.0;
+    std::chrono::steady_clock::time_point pathMark_ = std::chrono::steady_clock::now();
+
+    // Under mutex_
+    unsigned getBusyThreads() const { return (callerWaiting_ ? 0 : 1) + runningWorkers_ + lentThreads_; }
+
+    void work();
+    void run(Task& task);
+    // Runs the task here if it is still queued, else blocks until it is done
+    void complete(const std::shared_ptr<Task>& task);
+};
+
+#endif // TASK_GRAPH_H
@@ -0,0 +1,158 @@
+#include "Texture.h"
+#include <algorithm>
+#include <cmath>
+#include "uselibpng.h"
+
+// Levels this many powers of two below the footprint's size in texels are
+// read: a footprint up to 16 texels across takes the nearest texel of the full
+// image, as the reference renders do, and only distant or grazing surfaces,
+// where that aliases badly, move down the chain.
+constexpr float LOD_BIAS = 4.0f;
+
+std::shared_ptr<const Texture> Texture::loadFromFile(const std::string& filename) {
+    auto texture = std::make_shared<Texture>();
+    return texture->load(filename) ? texture : nullptr;
+}
+
+bool Texture::load(const std::string& filename) {
+    image_t* image = load_image(filename.c_str());
+    if (image == nullptr) {
+        return false;
+    }
+
+    // Decode every possible 8-bit value once instead of calling pow per texel
+    float srgbToLinear[256];
+    for (int i = 0; i < 256; ++i) {
+        srgbToLinear[i] = Math::convertSRGBToLinear(i / 255.0f);
+    }
+
+    filename_ = filename;
+    MipLevel base;
+    base.width = static_cast<int>(image->width);
+    base.height = static_cast<int>(image->height);
+    base.texels.resize(static_cast<size_t>(base.width) * base.height);
+    for (size_t i = 0; i < base.texels.size(); ++i) {
+        const pixel_t& pixel = image->rgba[i];
+        base.texels[i] = Vector4(
+            srgbToLinear[pixel.r],
+            srgbToLinear[pixel.g],
+            srgbToLinear[pixel.b],
+            pixel.a / 255.0f
+        );
+    }
+    free_image(image);
+
+    levels_.push_back(std::move(base));
+    buildMipChain();
+    return true;
+}
+
+void Texture::buildMipChain() {
+    while (levels_.back().width > 1 || levels_.back().height > 1) {
+        const MipLevel& src = levels_.back();
+        MipLevel dst;
+        dst.width = std::max(1, src.width / 2);
+        dst.height = std::max(1, src.height / 2);
+        dst.texels.resize(static_cast<size_t>(dst.width) * dst.height);
+
+        // 2x2 box filter; odd trailing rows/columns fold into the last texel
+        for (int y = 0; y < dst.height; ++y) {
+            int y0 = std::min(2 * y, src.height - 1);
+            int y1 = std::min(2 * y + 1, src.height - 1);
+            for (int x = 0; x < dst.width; ++x) {
+                int x0 = std::min(2 * x, src.width - 1);
+                int x1 = std::min(2 * x + 1, src.width - 1);
+                Vector4 sum = src.texels[y0 * src.width + x0]
+                    .plus(src.texels[y0 * src.width + x1])
+                    .plus(src.texels[y1 * src.width + x0])
+                    .plus(src.texels[y1 * src.width + x1]);
+                dst.texels[y * dst.width + x] = sum.times(0.25f);
+            }
+        }
+        levels_.push_back(std::move(dst));
+    }
+}
+
+Vector4 Texture::sampleBilinear(const MipLevel& level, float u, float v) const {
+    float x = (u - std::floor(u)) * level.width;
+    float y = Math::clamp(v, 0.0f, 1.0f) * level.height;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    // Wrap horizontally (longitude seam), clamp vertically (poles)
+    int x0 = static_cast<int>(fx);
+    int x1 = x0 + 1;
+    x0 = (x0 % level.width + level.width) % level.width;
+    x1 = (x1 % level.width + level.width) % level.width;
+    int y0 = std::max(static_cast<int>(fy), 0);
+    int y1 = std::min(static_cast<int>(fy) + 1, level.height - 1);
+
+    const Vector4& c00 = level.texels[y0 * level.width + x0];
+    const Vector4& c10 = level.texels[y0 * level.width + x1];
+    const Vector4& c01 = level.texels[y1 * level.width + x0];
+    const Vector4& c11 = level.texels[y1 * level.width + x1];
+    Vector4 top = c00.times(1.0f - tx).plus(c10.times(tx));
+    Vector4 bottom = c01.times(1.0f - tx).plus(c11.times(tx));
+    return top.times(1.0f - ty).plus(bottom.times(ty));
+}
+
+Vector4 Texture::sampleNearest(const MipLevel& level, float u, float v) const {
+    int x = static_cast<int>(std::floor((u - std::floor(u)) * level.width + 0.5f)) % level.width;
+    int y = static_cast<int>(std::floor(Math::clamp(v, 0.0f, 1.0f) * level.height + 0.5f));
+    return level.texels[std::min(y, level.height - 1) * level.width + x];
+}
+
+Vector4 Texture::sample(float u, float v, float footprintU, float footprintV) const {
+    const MipLevel& base = levels_[0];
+    float texels = std::max(footprintU * base.width, footprintV * base.height);
+    float lod = texels > 0.0f ? std::log2(texels) - LOD_BIAS : 0.0f;
+    if (!(lod > 0.0f)) {
+        return sampleNearest(base, u, v);
+    }
+    float maxLevel = static_cast<float>(levels_.size() - 1);
+    lod = std::min(lod, maxLevel);
+
+    int level = static_cast<int>(lod);
+    float blend = lod - level;
+    Vector4 color = sampleBilinear(levels_[level], u, v);
+    if (blend > 0.0f && level + 1 < static_cast<int>(levels_.size())) {
+        Vector4 coarser = sampleBilinear(levels_[level + 1], u, v);
+        color = color.times(1.0f - blend).plus(coarser.times(blend));
+    }
+    return color;
+}
+
+TextureCache& TextureCache::getInstance() {
+    static TextureCache instance;
+    return instance;
+}
+
+std::shared_ptr<const Texture> TextureCache::acquire(const std::string& filename) {
+    TaskGraph graph;
+    Request request = this->request(filename, graph);
+    graph.wait(request.task);
+    return request.task->hasSucceeded() ? request.texture : nullptr;
+}
+
+TextureCache::Request TextureCache::request(const std::string& filename, TaskGraph& graph) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = textures_.find(filename);
+    if (it != textures_.end()) {
+        return it->second;
+    }
+
+    auto texture = std::make_shared<Texture>();
+    Request request{texture, nullptr};
+    request.task = graph.add("texture load", filename, [this, texture, filename](std::string& error) {
+        if (texture->load(filename)) return true;
+        error = "Failed to load texture: " + filename;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = textures_.find(filename);
+        if (it != textures_.end() && it->second.texture == texture) textures_.erase(it);
+        return false;
+    });
+    textures_[filename] = request;
+    return request;
+}
@@ -0,0 +1,71 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Math.h"
+#include "TaskGraph.h"
+
+// Linear-light RGBA texture with a precomputed mip chain.
+// Level 0 is the full-resolution image; each level halves both dimensions.
+class Texture {
+public:
+    struct MipLevel {
+        int width;
+        int height;
+        std::vector<Vector4> texels;
+    };
+
+    // Decodes a PNG through load_image; returns nullptr if the file cannot be read.
+    static std::shared_ptr<const Texture> loadFromFile(const std::string& filename);
+
+    // u wraps, v clamps; texel i lies centered on i / width. The footprint's
+    // extents along u and v, in texture-coordinate units, select the mip level
+    // by the longer one in texels: small footprints read the nearest texel of
+    // the full image, larger ones blend levels trilinearly.
+    Vector4 sample(float u, float v, float footprintU, float footprintV) const;
+
+    int getWidth() const { return levels_[0].width; }
+    int getHeight() const { return levels_[0].height; }
+    int getLevelCount() const { return static_cast<int>(levels_.size()); }
+    const std::string& getFilename() const { return filename_; }
+
+private:
+    friend class TextureCache;
+
+    std::vector<MipLevel> levels_;
+    std::string filename_;
+
+    bool load(const std::string& filename);
+    void buildMipChain();
+    Vector4 sampleNearest(const MipLevel& level, float u, float v) const;
+    Vector4 sampleBilinear(const MipLevel& level, float u, float v) const;
+};
+
+// Process-wide cache so a texture shared by many objects is decoded once.
+class TextureCache {
+public:
+    static TextureCache& getInstance();
+
+    std::shared_ptr<const Texture> acquire(const std::string& filename);
+
+    // A texture to use before it is decoded: until task has finished, and
+    // only if it succeeded. A texture neither cached nor being decoded is
+    // decoded on graph; failures are dropped from the cache.
+    struct Request {
+        std::shared_ptr<const Texture> texture;
+        std::shared_ptr<TaskGraph::Task> task;
+    };
+    Request request(const std::string& filename, TaskGraph& graph);
+
+private:
+    TextureCache() = default;
+
+    std::mutex mutex_;
+    std::map<std::string, Request> textures_;
+};
+
+#endif // TEXTURE_H
@@ -0,0 +1,128 @@
+#include "Trace.h"
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+    struct Event {
+        const char* name;
+        int64_t start;     // Nanoseconds since enable()
+        int64_t duration;
+        char detail[Trace::DETAIL_SIZE];
+    };
+
+    // Written only by its thread; count is published after each event so the
+    // exporter never sees a half-written one at the end of the ring
+    struct ThreadBuffer {
+        std::vector<Event> events = std::vector<Event>(Trace::RING_SIZE);
+        std::atomic<uint64_t> count{0};
+        uint32_t id = 0;
+        std::string name;
+    };
+
+    std::atomic<bool> enabled{false};
+    std::chrono::steady_clock::time_point epoch;
+
+    // Registration only happens once per thread, so a plain mutex is enough.
+    // Buffers outlive their threads so short-lived workers still show up.
+    std::mutex registryMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+    ThreadBuffer& localBuffer() {
+        thread_local std::shared_ptr<ThreadBuffer> buffer;
+        if (!buffer) {
+            buffer = std::make_shared<ThreadBuffer>();
+            std::lock_guard<std::mutex> lock(registryMutex);
+            buffer->id = static_cast<uint32_t>(buffers.size()) + 1;
+            buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    int64_t toNanoseconds(std::chrono::steady_clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch).count();
+    }
+
+    void writeString(std::ostream& out, const std::string& text) {
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\') out << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20) out << ' ';
+            else out << c;
+        }
+        out << '"';
+    }
+}
+
+namespace Trace {
+    void enable() {
+        if (enabled.load()) return;
+        epoch = std::chrono::steady_clock::now();
+        enabled.store(true);
+    }
+
+    bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    void setThreadName(const char* name) {
+        if (isEnabled()) localBuffer().name = name;
+    }
+
+    void record(const char* name, const char* detail,
+                std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+        ThreadBuffer& buffer = localBuffer();
+        uint64_t count = buffer.count.load(std::memory_order_relaxed);
+        Event& event = buffer.events[count % RING_SIZE];
+        event.name = name;
+        event.start = toNanoseconds(start);
+        event.duration = toNanoseconds(end) - event.start;
+        std::strncpy(event.detail, detail, DETAIL_SIZE - 1);
+        event.detail[DETAIL_SIZE - 1] = '\0';
+        buffer.count.store(count + 1, std::memory_order_release);
+    }
+
+    bool writeJson(const std::string& filename, std::string& error) {
+        std::ofstream out(filename);
+        if (!out) {
+            error = "cannot write " + filename;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        uint64_t dropped = 0;
+        const char* separator = "\n";
+        out << std::fixed << std::setprecision(3) << "{\"traceEvents\": [";
+        for (const auto& buffer : buffers) {
+            out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id
+                << ", \"args\": {\"name\": ";
+            writeString(out, buffer->name.empty() ? "thread " + std::to_string(buffer->id) : buffer->name);
+            out << "}}";
+            separator = ",\n";
+
+            uint64_t count = buffer->count.load(std::memory_order_acquire);
+            uint64_t first = count > RING_SIZE ? count - RING_SIZE : 0;
+            dropped += first;
+            for (uint64_t i = first; i < count; ++i) {
+                const Event& event = buffer->events[i % RING_SIZE];
+                out << separator << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+                    << buffer->id << ", \"ts\": " << event.start / 1000.0 << ", \"dur\": " << event.duration / 1000.0;
+                if (event.detail[0]) {
+                    out << ", \"args\": {\"detail\": ";
+                    writeString(out, event.detail);
+                    out << "}";
+                }
+                out << "}";
+            }
+        }
+        out << "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {\"droppedEvents\": \"" << dropped << "\"}}\n";
+
+        if (!out) {
+            error = "cannot write " + filename;
+            return false;
+        }
+        return true;
+    }
+}
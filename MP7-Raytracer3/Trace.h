@@ -0,0 +1,55 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+// Timeline of scoped spans, exported in Chrome trace format for
+// chrome://tracing or Perfetto. Recording is off until enable(); after that
+// each thread appends to its own fixed-size ring buffer without locking, so
+// only the most recent RING_SIZE spans per thread are kept.
+namespace Trace {
+    constexpr size_t RING_SIZE = 1 << 15;
+    constexpr size_t DETAIL_SIZE = 48;
+
+    void enable();
+    bool isEnabled();
+
+    // Names the calling thread in the timeline
+    void setThreadName(const char* name);
+
+    // Writes every thread's spans; call once the traced work has finished
+    bool writeJson(const std::string& filename, std::string& error);
+
+    void record(const char* name, const char* detail,
+                std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+    // Records name (a string literal) from construction to destruction, with
+    // an optional printf-style detail that is only formatted while enabled
+    class Scope {
+    public:
+        explicit Scope(const char* name) : name_(isEnabled() ? name : nullptr) {
+            if (name_) start_ = std::chrono::steady_clock::now();
+        }
+
+        template <typename... Args>
+        Scope(const char* name, const char* format, Args... args) : Scope(name) {
+            if (name_) std::snprintf(detail_, sizeof(detail_), format, args...);
+        }
+
+        ~Scope() {
+            if (name_) record(name_, detail_, start_, std::chrono::steady_clock::now());
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* name_;
+        char detail_[DETAIL_SIZE] = "";
+        std::chrono::steady_clock::time_point start_;
+    };
+}
+
+#endif // TRACE_H
@@ -0,0 +1,417 @@
+// Scene-suite benchmark: renders every test/ray-*.txt scene (plus scaled
+// variants) several times through the ray tracer executable, checks the
+// output against the reference PNGs and compares throughput with a baseline.
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uselibpng.h"
+
+struct BenchOptions {
+    std::string programPath = "./program";
+    std::string sceneDirectory = "test";
+    std::string workDirectory = "bench-work";
+    std::string outputPath = "bench.json";
+    std::string baselinePath;
+    std::vector<int> scales = {1, 2};
+    int iterations = 3;
+    float regressionPercent = 10.0f;
+    float mismatchPercent = 1.0f;  // Share of pixels allowed to differ from the reference
+    int timeBudget = 0;            // Milliseconds passed to --time-budget; 0 renders in full
+    float budgetSlack = 10.0f;     // Milliseconds past the budget allowed for process startup
+    int pixelTolerance = 5;  // Per-channel difference allowed, ~2% like compare-sh
+};
+
+struct BenchResult {
+    std::string name;
+    bool rendered = false;
+    double medianSeconds = 0.0;
+    double minSeconds = 0.0;
+    double maxSeconds = 0.0;
+    double raysPerSecond = 0.0;
+    long peakRssKilobytes = 0;
+    bool hasReference = false;
+    double mismatchedPixelFraction = 0.0;
+};
+
+struct ImageDifference {
+    bool comparable;
+    double mismatchedPixelFraction;
+};
+
+static std::string joinPath(const std::string& directory, const std::string& name) {
+    if (directory.empty() || name.empty() || name[0] == '/') return name;
+    return directory + "/" + name;
+}
+
+static std::string getAbsolutePath(const std::string& path) {
+    char* resolved = realpath(path.c_str(), nullptr);
+    if (!resolved) return path;
+    std::string result(resolved);
+    free(resolved);
+    return result;
+}
+
+static std::vector<std::string> findScenes(const std::string& directory) {
+    std::vector<std::string> scenes;
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return scenes;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 8 && name.compare(0, 4, "ray-") == 0 &&
+            name.compare(name.size() - 4, 4, ".txt") == 0) {
+            scenes.push_back(name.substr(0, name.size() - 4));
+        }
+    }
+    closedir(dir);
+    std::sort(scenes.begin(), scenes.end());
+    return scenes;
+}
+
+// Copies a scene with its output redirected into the work directory, the
+// resolution multiplied by scale and file references made absolute.
+static bool writeScaledScene(const std::string& scenePath, const std::string& sceneDirectory,
+                             int scale, const std::string& outputImage, const std::string& destination) {
+    std::ifstream input(scenePath);
+    std::ofstream output(destination);
+    if (!input || !output) return false;
+
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream iss(line);
+        std::string keyword;
+        iss >> keyword;
+        if (keyword == "png") {
+            int width, height;
+            iss >> width >> height;
+            output << "png " << width * scale << " " << height * scale << " " << outputImage << "\n";
+        } else if (keyword == "texture" || keyword == "obj" || keyword == "clusters") {
+            // Arguments after the file, such as obj's subdivision levels, are kept as written
+            std::string file, rest;
+            iss >> file;
+            std::getline(iss, rest);
+            if (file != "none") file = getAbsolutePath(joinPath(sceneDirectory, file));
+            output << keyword << " " << file << rest << "\n";
+        } else {
+            output << line << "\n";
+        }
+    }
+    return true;
+}
+
+// Runs the renderer once; returns wall seconds or a negative value on failure
+static double runRenderer(const BenchOptions& options, const std::string& sceneFile,
+                          const std::string& statsFile, long& peakRssKilobytes) {
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) return -1.0;
+    if (pid == 0) {
+        if (chdir(options.workDirectory.c_str()) != 0) _exit(127);
+        std::string statsArg = "--stats=" + statsFile;
+        std::string budget = std::to_string(options.timeBudget);
+        if (options.timeBudget > 0) {
+            execl(options.programPath.c_str(), options.programPath.c_str(), statsArg.c_str(),
+                  "--time-budget", budget.c_str(), sceneFile.c_str(), static_cast<char*>(nullptr));
+        } else {
+            execl(options.programPath.c_str(), options.programPath.c_str(),
+                  statsArg.c_str(), sceneFile.c_str(), static_cast<char*>(nullptr));
+        }
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) return -1.0;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // ru_maxrss is in kilobytes on Linux and bytes on macOS
+#ifdef __APPLE__
+    peakRssKilobytes = std::max(peakRssKilobytes, static_cast<long>(usage.ru_maxrss / 1024));
+#else
+    peakRssKilobytes = std::max(peakRssKilobytes, static_cast<long>(usage.ru_maxrss));
+#endif
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1.0;
+    return elapsed.count();
+}
+
+// Pulls a numeric field out of a flat JSON document written by us
+static bool findJsonNumber(const std::string& json, const std::string& key, size_t from,
+                           double& value, size_t* position = nullptr) {
+    size_t at = json.find("\"" + key + "\"", from);
+    if (at == std::string::npos) return false;
+    size_t colon = json.find(':', at);
+    if (colon == std::string::npos) return false;
+    value = std::strtod(json.c_str() + colon + 1, nullptr);
+    if (position) *position = colon;
+    return true;
+}
+
+// Pulls the number at a key path such as {"rays", "total"} out of a JSON document; each key
+// must be a member of the object the previous one names, not just appear somewhere after it
+static bool findJsonPath(const std::string& json, const std::vector<std::string>& path, double& value) {
+    size_t at = json.find('{');
+    for (size_t step = 0; step < path.size(); ++step) {
+        if (at == std::string::npos || json[at] != '{') return false;
+        int depth = 0;
+        bool found = false;
+        for (++at; at < json.size() && !found; ++at) {
+            char c = json[at];
+            if (c == '{' || c == '[') {
+                ++depth;
+            } else if (c == '}' || c == ']') {
+                if (--depth < 0) return false;
+            } else if (c == '"') {
+                size_t end = json.find('"', at + 1);
+                if (end == std::string::npos) return false;
+                size_t next = json.find_first_not_of(" \t\r\n", end + 1);
+                if (depth == 0 && next != std::string::npos && json[next] == ':' &&
+                    json.compare(at + 1, end - at - 1, path[step]) == 0) {
+                    at = json.find_first_not_of(" \t\r\n", next + 1);
+                    found = true;
+                    break;
+                }
+                at = end;
+            }
+        }
+        if (!found) return false;
+    }
+    if (at == std::string::npos) return false;
+    char* end = nullptr;
+    value = std::strtod(json.c_str() + at, &end);
+    return end != json.c_str() + at;
+}
+
+static std::string readFile(const std::string& path) {
+    std::ifstream input(path);
+    std::stringstream buffer;
+    buffer << input.rdbuf();
+    return buffer.str();
+}
+
+static ImageDifference compareImages(const std::string& rendered, const std::string& reference,
+                                     int tolerance) {
+    ImageDifference difference = {false, 1.0};
+    image_t* a = load_image(rendered.c_str());
+    image_t* b = load_image(reference.c_str());
+    if (a && b && a->width == b->width && a->height == b->height) {
+        size_t count = static_cast<size_t>(a->width) * a->height;
+        size_t mismatched = 0;
+        for (size_t i = 0; i < count; ++i) {
+            for (int c = 0; c < 4; ++c) {
+                if (std::abs(a->rgba[i].p[c] - b->rgba[i].p[c]) > tolerance) {
+                    ++mismatched;
+                    break;
+                }
+            }
+        }
+        difference.comparable = true;
+        difference.mismatchedPixelFraction = count ? static_cast<double>(mismatched) / count : 0.0;
+    }
+    if (a) free_image(a);
+    if (b) free_image(b);
+    return difference;
+}
+
+static BenchResult benchmarkScene(const BenchOptions& options, const std::string& scene, int scale) {
+    BenchResult result;
+    result.name = scale == 1 ? scene : scene + "@x" + std::to_string(scale);
+
+    std::string scenePath = joinPath(options.sceneDirectory, scene + ".txt");
+    std::string outputImage = result.name + ".png";
+    std::string sceneCopy = result.name + ".txt";
+    std::string statsFile = result.name + ".stats.json";
+    if (!writeScaledScene(scenePath, options.sceneDirectory, scale, outputImage,
+                          joinPath(options.workDirectory, sceneCopy))) {
+        return result;
+    }
+
+    std::vector<double> times;
+    for (int i = 0; i < options.iterations; ++i) {
+        double seconds = runRenderer(options, sceneCopy, statsFile, result.peakRssKilobytes);
+        if (seconds < 0) return result;
+        times.push_back(seconds);
+    }
+    std::sort(times.begin(), times.end());
+    result.rendered = true;
+    result.minSeconds = times.front();
+    result.medianSeconds = times[times.size() / 2];
+    result.maxSeconds = times.back();
+
+    double rays = 0.0;
+    findJsonPath(readFile(joinPath(options.workDirectory, statsFile)), {"rays", "total"}, rays);
+    result.raysPerSecond = result.medianSeconds > 0 ? rays / result.medianSeconds : 0.0;
+
+    // Budgeted renders are partial or supersampled, so only full ones match their reference
+    if (scale == 1 && options.timeBudget == 0) {
+        ImageDifference difference = compareImages(
+            joinPath(options.workDirectory, outputImage),
+            joinPath(options.sceneDirectory, scene + ".png"),
+            options.pixelTolerance);
+        result.hasReference = difference.comparable;
+        result.mismatchedPixelFraction = difference.mismatchedPixelFraction;
+    }
+    return result;
+}
+
+static void writeResults(std::ostream& out, const std::vector<BenchResult>& results) {
+    out << "{\n  \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\""
+            << ", \"rendered\": " << (r.rendered ? "true" : "false")
+            << ", \"medianSeconds\": " << r.medianSeconds
+            << ", \"minSeconds\": " << r.minSeconds
+            << ", \"maxSeconds\": " << r.maxSeconds
+            << ", \"raysPerSecond\": " << r.raysPerSecond
+            << ", \"peakRssKilobytes\": " << r.peakRssKilobytes;
+        if (r.hasReference) {
+            out << ", \"mismatchedPixelFraction\": " << r.mismatchedPixelFraction;
+        }
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// Returns the number of scenes whose throughput fell more than the allowed percentage
+static int checkRegressions(const BenchOptions& options, const std::vector<BenchResult>& results) {
+    std::string baseline = readFile(options.baselinePath);
+    if (baseline.empty()) {
+        std::cerr << "Could not read baseline " << options.baselinePath << std::endl;
+        return 1;
+    }
+
+    int regressions = 0;
+    for (const BenchResult& r : results) {
+        if (!r.rendered) continue;
+        size_t at = baseline.find("\"name\": \"" + r.name + "\"");
+        double baselineRate = 0.0;
+        if (at == std::string::npos || !findJsonNumber(baseline, "raysPerSecond", at, baselineRate) ||
+            baselineRate <= 0.0) {
+            continue;
+        }
+        double change = 100.0 * (r.raysPerSecond - baselineRate) / baselineRate;
+        if (change < -options.regressionPercent) {
+            std::cerr << "REGRESSION " << r.name << ": " << r.raysPerSecond << " rays/s vs baseline "
+                      << baselineRate << " (" << change << "%)" << std::endl;
+            ++regressions;
+        }
+    }
+    return regressions;
+}
+
+// Returns the number of scenes that failed to render, strayed too far from their
+// reference or, with a time budget, took longer than it allows
+static int checkFailures(const BenchOptions& options, const std::vector<BenchResult>& results) {
+    int failures = 0;
+    for (const BenchResult& r : results) {
+        if (!r.rendered) {
+            std::cerr << "FAILED " << r.name << ": did not render" << std::endl;
+            ++failures;
+        } else if (r.hasReference && 100.0 * r.mismatchedPixelFraction > options.mismatchPercent) {
+            std::cerr << "MISMATCH " << r.name << ": " << 100.0 * r.mismatchedPixelFraction
+                      << "% of pixels differ from the reference" << std::endl;
+            ++failures;
+        } else if (options.timeBudget > 0 && 1000.0 * r.maxSeconds > options.timeBudget + options.budgetSlack) {
+            std::cerr << "OVERRUN " << r.name << ": " << 1000.0 * r.maxSeconds << " ms against a budget of "
+                      << options.timeBudget << " ms" << std::endl;
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+static std::vector<int> parseScales(const std::string& list) {
+    std::vector<int> scales;
+    std::istringstream iss(list);
+    std::string token;
+    while (std::getline(iss, token, ',')) {
+        int scale = std::atoi(token.c_str());
+        if (scale > 0) scales.push_back(scale);
+    }
+    return scales;
+}
+
+static void printUsage(const char* name) {
+    std::cerr << "Usage: " << name << " [--program <path>] [--scenes <dir>] [--work <dir>]\n"
+              << "       [--iterations N] [--scales 1,2] [--out bench.json]\n"
+              << "       [--baseline <json>] [--threshold <percent>] [--max-mismatch <percent>]\n"
+              << "       [--time-budget <ms> [--budget-slack <ms>]] [scene names...]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    std::vector<std::string> scenes;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--program" && hasValue) options.programPath = argv[++i];
+        else if (arg == "--scenes" && hasValue) options.sceneDirectory = argv[++i];
+        else if (arg == "--work" && hasValue) options.workDirectory = argv[++i];
+        else if (arg == "--iterations" && hasValue) options.iterations = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--scales" && hasValue) options.scales = parseScales(argv[++i]);
+        else if (arg == "--out" && hasValue) options.outputPath = argv[++i];
+        else if (arg == "--baseline" && hasValue) options.baselinePath = argv[++i];
+        else if (arg == "--threshold" && hasValue) options.regressionPercent = std::strtof(argv[++i], nullptr);
+        else if (arg == "--time-budget" && hasValue) options.timeBudget = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--budget-slack" && hasValue) options.budgetSlack = std::strtof(argv[++i], nullptr);
+        else if (arg == "--max-mismatch" && hasValue) options.mismatchPercent = std::strtof(argv[++i], nullptr);
+        else if (arg.compare(0, 2, "--") == 0) {
+            printUsage(argv[0]);
+            return -1;
+        } else {
+            scenes.push_back(arg);
+        }
+    }
+
+    mkdir(options.workDirectory.c_str(), 0755);
+    options.programPath = getAbsolutePath(options.programPath);
+    if (scenes.empty()) {
+        scenes = findScenes(options.sceneDirectory);
+    }
+
+    std::vector<BenchResult> results;
+    for (const std::string& scene : scenes) {
+        for (int scale : options.scales) {
+            BenchResult result = benchmarkScene(options, scene, scale);
+            std::cout << result.name;
+            if (result.rendered) {
+                std::cout << "  median " << result.medianSeconds << "s  min " << result.minSeconds
+                          << "s  max " << result.maxSeconds << "s  " << result.raysPerSecond << " rays/s  rss "
+                          << result.peakRssKilobytes << " KB";
+                if (result.hasReference) {
+                    std::cout << "  mismatch " << 100.0 * result.mismatchedPixelFraction << "%";
+                }
+            } else {
+                std::cout << "  FAILED to render";
+            }
+            std::cout << std::endl;
+            results.push_back(result);
+        }
+    }
+
+    std::ofstream output(options.outputPath);
+    if (!output) {
+        std::cerr << "Failed to write " << options.outputPath << std::endl;
+        return -1;
+    }
+    writeResults(output, results);
+
+    int failures = checkFailures(options, results);
+    if (!options.baselinePath.empty()) {
+        failures += checkRegressions(options, results);
+    }
+    return failures > 0 ? 1 : 0;
+}
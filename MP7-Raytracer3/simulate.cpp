@@ -0,0 +1,136 @@
+// Many-sphere simulation driver: steps a SphereSimulation and writes every
+// frame as a compiled scene, reusing a compiled template for the camera,
+// lights and any static geometry, so `program frame-0000.rtb` renders it.
+// Without a template it only reports step timings.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "SceneBinary.h"
+#include "SphereSimulation.h"
+
+struct SimulateOptions {
+    uint32_t sphereCount = 50;
+    uint32_t frameCount = 60;
+    float framesPerSecond = 30.0f;
+    uint32_t stepsPerFrame = 1;
+    uint32_t seed = 1;
+    uint32_t threadCount = 0;  // Every hardware thread
+    std::string templatePath;
+    std::string outputPrefix;
+};
+
+static void printUsage(const char* name) {
+    std::cerr << "Usage: " << name << " [--spheres N] [--frames N] [--fps R] [--substeps N]\n"
+              << "       [--seed N] [--threads N] [<template.rtb> <output prefix>]" << std::endl;
+}
+
+static std::string getFrameName(const std::string& prefix, uint32_t frame, const char* extension) {
+    char number[16];
+    std::snprintf(number, sizeof(number), "-%04u.", frame);
+    return prefix + number + extension;
+}
+
+// Copies the template's sections, points the output at this frame's PNG and
+// appends one material per palette entry plus the spheres, all in group 0
+static bool writeFrame(const SceneBinary::Reader& scene, const SphereSimulation& simulation,
+                       const std::string& prefix, uint32_t frame) {
+    SceneBinary::Writer writer;
+    for (uint32_t section = 0; section < SceneBinary::SECTION_COUNT; ++section) {
+        if (section == SceneBinary::SETTINGS) continue;
+        SceneBinary::Section id = static_cast<SceneBinary::Section>(section);
+        writer.add(id, scene.getRecords<char>(id), scene.getCount<char>(id));
+    }
+
+    SceneBinary::Settings settings = *scene.getRecords<SceneBinary::Settings>(SceneBinary::SETTINGS);
+    settings.outputFilename = writer.addString(getFrameName(prefix, frame, "png"));
+    writer.add(SceneBinary::SETTINGS, settings);
+
+    const std::vector<float>& palette = simulation.getPalette();
+    uint32_t firstMaterial = writer.getCount<SceneBinary::Material>(SceneBinary::MATERIALS);
+    for (uint32_t i = 0; i < SphereSimulation::PALETTE_SIZE; ++i) {
+        SceneBinary::Material material = {};
+        std::copy(&palette[3 * i], &palette[3 * i] + 3, material.diffuseColor);
+        material.textureFilename = SceneBinary::NO_INDEX;
+        material.refractiveIndex = 1.458f;
+        writer.add(SceneBinary::MATERIALS, material);
+    }
+
+    // Loaded as one more sphere set after the template's own
+    const SphereSimulation::Spheres& spheres = simulation.getSpheres();
+    std::vector<SceneBinary::Sphere> records(simulation.getSphereCount());
+    for (size_t i = 0; i < records.size(); ++i) {
+        records[i] = {{spheres.x[i], spheres.y[i], spheres.z[i]}, spheres.radius[i],
+                      firstMaterial + spheres.color[i], 0};
+    }
+    writer.add(SceneBinary::SPHERES, records.data(), records.size());
+
+    std::string error;
+    std::string filename = getFrameName(prefix, frame, "rtb");
+    if (!writer.writeToFile(filename, error)) {
+        std::cerr << "Failed to write " << filename << ": " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    SimulateOptions options;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--spheres" && hasValue) options.sphereCount = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--frames" && hasValue) options.frameCount = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--fps" && hasValue) options.framesPerSecond = std::max(1.0f, std::strtof(argv[++i], nullptr));
+        else if (arg == "--substeps" && hasValue) options.stepsPerFrame = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--seed" && hasValue) options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--threads" && hasValue) options.threadCount = std::max(0, std::atoi(argv[++i]));
+        else if (arg.compare(0, 2, "--") == 0) {
+            printUsage(argv[0]);
+            return -1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() != 0 && paths.size() != 2) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    SceneBinary::Reader scene;
+    if (!paths.empty()) {
+        options.templatePath = paths[0];
+        options.outputPrefix = paths[1];
+        std::string error;
+        if (!scene.open(options.templatePath, error)) {
+            std::cerr << "Failed to load " << options.templatePath << ": " << error << std::endl;
+            return -1;
+        }
+    }
+
+    SphereSimulation simulation(options.sphereCount, options.seed, options.threadCount);
+    float deltaSeconds = 1.0f / (options.framesPerSecond * static_cast<float>(options.stepsPerFrame));
+    double stepSeconds = 0.0;
+    for (uint32_t frame = 0; frame < options.frameCount; ++frame) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t step = 0; step < options.stepsPerFrame; ++step) {
+            simulation.step(deltaSeconds);
+        }
+        stepSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (!options.outputPrefix.empty() && !writeFrame(scene, simulation, options.outputPrefix, frame)) {
+            return -1;
+        }
+    }
+
+    uint64_t stepCount = static_cast<uint64_t>(options.frameCount) * options.stepsPerFrame;
+    std::cout << options.sphereCount << " spheres on " << simulation.getThreadCount() << " threads: "
+              << 1000.0 * stepSeconds / static_cast<double>(stepCount) << " ms per step, "
+              << static_cast<double>(stepCount) / stepSeconds << " steps/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Catmull-Clark subdivision driver: subdivides an OBJ model, reports the time
+// per level and writes the result as an OBJ for the ray tracer's `obj` command
+// and/or as MP1-Rasterizer `position`/`color`/`elements` commands.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ObjLoader.h"
+#include "Subdivision.h"
+
+struct SubdivideOptions {
+    std::string inputPath;
+    int levels = -1;
+    std::string objPath;
+    std::string rasterPath;
+    unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+};
+
+static void printUsage(const char* name) {
+    std::cerr << "Usage: " << name << " <model.obj> <levels> [--obj <out.obj>] [--raster <out.txt>] [--threads N]"
+              << std::endl;
+}
+
+// Buffered writer; the outputs run to hundreds of megabytes at level 5
+class OutputFile {
+public:
+    bool open(const std::string& filename) {
+        file_.reset(std::fopen(filename.c_str(), "wb"));
+        return file_ != nullptr;
+    }
+
+    template <typename... Args>
+    void print(const char* format, Args... args) {
+        if (buffer_.size() - used_ < 256) flush();
+        used_ += std::snprintf(&buffer_[used_], buffer_.size() - used_, format, args...);
+    }
+
+    bool close() {
+        flush();
+        return std::fclose(file_.release()) == 0 && !failed_;
+    }
+
+private:
+    struct Closer {
+        void operator()(std::FILE* file) const { if (file) std::fclose(file); }
+    };
+    std::unique_ptr<std::FILE, Closer> file_;
+    std::vector<char> buffer_ = std::vector<char>(1 << 20);
+    size_t used_ = 0;
+    bool failed_ = false;
+
+    void flush() {
+        failed_ = failed_ || std::fwrite(buffer_.data(), 1, used_, file_.get()) != used_;
+        used_ = 0;
+    }
+};
+
+// Faces are written as the subdivided quads, sharing one smooth normal per vertex
+static bool writeObj(const std::string& filename, const PolygonMesh& mesh, const ObjMesh& triangles) {
+    OutputFile file;
+    if (!file.open(filename)) return false;
+    for (const Vector3& position : mesh.positions) {
+        file.print("v %.9g %.9g %.9g\n", position.x, position.y, position.z);
+    }
+    for (const Vector3& normal : triangles.normals) {
+        file.print("vn %.6g %.6g %.6g\n", normal.x, normal.y, normal.z);
+    }
+    for (size_t f = 0; f < mesh.getFaceCount(); ++f) {
+        file.print("f");
+        for (uint32_t h = mesh.faceStarts[f]; h < mesh.faceStarts[f + 1]; ++h) {
+            file.print(" %u//%u", mesh.corners[h] + 1, mesh.corners[h] + 1);
+        }
+        file.print("\n");
+    }
+    return file.close();
+}
+
+// Colors each vertex by its normal, since the rasterizer has no lighting;
+// add `png` and `uniformMatrix` lines in front to render it
+static bool writeRaster(const std::string& filename, const ObjMesh& triangles) {
+    OutputFile file;
+    if (!file.open(filename)) return false;
+    file.print("position 3");
+    for (const Vector3& position : triangles.positions) {
+        file.print(" %.7g %.7g %.7g", position.x, position.y, position.z);
+    }
+    file.print("\ncolor 3");
+    for (const Vector3& normal : triangles.normals) {
+        file.print(" %.4f %.4f %.4f", 0.5f + 0.5f * normal.x, 0.5f + 0.5f * normal.y, 0.5f + 0.5f * normal.z);
+    }
+    file.print("\nelements");
+    for (uint32_t index : triangles.positionIndices) {
+        file.print(" %u", index);
+    }
+    file.print("\ndrawElementsTriangles %zu 0\n", triangles.positionIndices.size());
+    return file.close();
+}
+
+int main(int argc, char* argv[]) {
+    SubdivideOptions options;
+    std::vector<std::string> arguments;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--obj" && hasValue) options.objPath = argv[++i];
+        else if (arg == "--raster" && hasValue) options.rasterPath = argv[++i];
+        else if (arg == "--threads" && hasValue) options.threadCount = std::max(1, std::atoi(argv[++i]));
+        else if (arg.compare(0, 2, "--") == 0) {
+            printUsage(argv[0]);
+            return -1;
+        } else {
+            arguments.push_back(arg);
+        }
+    }
+    if (arguments.size() == 2) {
+        options.inputPath = arguments[0];
+        options.levels = std::atoi(arguments[1].c_str());
+    }
+    if (options.levels < 0) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    ObjMesh input;
+    std::string error;
+    if (!ObjLoader::loadFromFile(options.inputPath, options.threadCount, input, error)) {
+        std::cerr << "Failed to load OBJ: " << error << std::endl;
+        return -1;
+    }
+
+    PolygonMesh mesh = PolygonMesh::fromObj(input);
+    std::cout << "level 0: " << mesh.getFaceCount() << " faces, " << mesh.positions.size() << " vertices" << std::endl;
+    std::vector<double> levelSeconds;
+    if (!Subdivision::subdivide(mesh, options.levels, options.threadCount, error, &levelSeconds)) {
+        std::cerr << error << std::endl;
+        return -1;
+    }
+    // Every level after the first turns each quad into four
+    size_t faceCount = mesh.getFaceCount() >> (2 * std::max(0, options.levels - 1));
+    for (size_t level = 0; level < levelSeconds.size(); ++level, faceCount *= 4) {
+        std::cout << "level " << level + 1 << ": " << faceCount << " faces, "
+                  << 1000.0 * levelSeconds[level] << " ms" << std::endl;
+    }
+
+    if (options.objPath.empty() && options.rasterPath.empty()) return 0;
+    auto start = std::chrono::steady_clock::now();
+    ObjMesh triangles = mesh.toTriangles(options.threadCount);
+    std::cout << "triangulated " << triangles.getTriangleCount() << " triangles, "
+              << 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+              << " ms" << std::endl;
+    if (!options.objPath.empty() && !writeObj(options.objPath, mesh, triangles)) {
+        std::cerr << "Failed to write " << options.objPath << std::endl;
+        return -1;
+    }
+    if (!options.rasterPath.empty() && !writeRaster(options.rasterPath, triangles)) {
+        std::cerr << "Failed to write " << options.rasterPath << std::endl;
+        return -1;
+    }
+    return 0;
+}